@@ -226,6 +226,8 @@ View::save_view (void)
     if (this->path.empty())
         throw std::runtime_error("View not initialized");
 
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
+
     /* Save meta data. */
     int saved = 0;
     if (this->meta_data.is_dirty)
@@ -303,6 +305,7 @@ View::is_dirty (void) const
 int
 View::cache_cleanup (void)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     int released = 0;
     for (std::size_t i = 0; i < this->images.size(); ++i)
     {
@@ -330,6 +333,7 @@ View::cache_cleanup (void)
 std::size_t
 View::get_byte_size (void) const
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     std::size_t ret = 0;
     for (std::size_t i = 0; i < this->images.size(); ++i)
         if (this->images[i].image != nullptr)
@@ -396,6 +400,7 @@ View::set_camera (CameraInfo const& camera)
 ImageBase::Ptr
 View::get_image (std::string const& name, ImageType type)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     View::ImageProxy* proxy = this->find_image_intern(name);
     if (proxy != nullptr)
     {
@@ -411,6 +416,7 @@ View::get_image (std::string const& name, ImageType type)
 View::ImageProxy const*
 View::get_image_proxy (std::string const& name, ImageType type)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     View::ImageProxy* proxy = this->find_image_intern(name);
     if (proxy != nullptr)
     {
@@ -424,6 +430,7 @@ View::get_image_proxy (std::string const& name, ImageType type)
 bool
 View::has_image (std::string const& name, ImageType type)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     View::ImageProxy* proxy = this->find_image_intern(name);
     if (proxy == nullptr)
         return false;
@@ -449,6 +456,7 @@ View::set_image (ImageBase::Ptr image, std::string const& name)
     proxy.type = image->get_type();
     proxy.image = image;
 
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     for (std::size_t i = 0; i < this->images.size(); ++i)
         if (this->images[i].name == name)
         {
@@ -470,6 +478,7 @@ View::set_image_ref (std::string const& filename, std::string name)
     proxy.filename = util::fs::abspath(filename);
     proxy.is_initialized = false;
 
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     for (std::size_t i = 0; i < this->images.size(); ++i)
         if (this->images[i].name == name)
         {
@@ -482,6 +491,7 @@ View::set_image_ref (std::string const& filename, std::string name)
 bool
 View::remove_image (std::string const& name)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     for (ImageProxies::iterator iter = this->images.begin();
         iter != this->images.end(); ++iter)
     {
@@ -500,6 +510,7 @@ View::remove_image (std::string const& name)
 ByteImage::Ptr
 View::get_blob (std::string const& name)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     BlobProxy* proxy = this->find_blob_intern(name);
     if (proxy != nullptr)
         return this->load_blob(proxy, false);
@@ -509,6 +520,7 @@ View::get_blob (std::string const& name)
 View::BlobProxy const*
 View::get_blob_proxy (std::string const& name)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     BlobProxy* proxy = this->find_blob_intern(name);
     if (proxy != nullptr)
         this->initialize_blob(proxy, false);
@@ -518,6 +530,7 @@ View::get_blob_proxy (std::string const& name)
 bool
 View::has_blob (std::string const& name)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     return this->find_blob_intern(name) != nullptr;
 }
 
@@ -534,6 +547,7 @@ View::set_blob (ByteImage::Ptr blob, std::string const& name)
     proxy.size = blob->get_byte_size();
     proxy.blob = blob;
 
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     for (std::size_t i = 0; i < this->blobs.size(); ++i)
         if (this->blobs[i].name == name)
         {
@@ -546,6 +560,7 @@ View::set_blob (ByteImage::Ptr blob, std::string const& name)
 bool
 View::remove_blob (std::string const& name)
 {
+    std::lock_guard<std::mutex> lock(this->proxy_mutex);
     for (BlobProxies::iterator iter = this->blobs.begin();
         iter != this->blobs.end(); ++iter)
     {
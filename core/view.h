@@ -45,6 +45,7 @@
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -61,6 +62,12 @@ CORE_NAMESPACE_BEGIN
  * An MVE view is represented in a directory. This class manages the file
  * system layout, meta information in form of (key,value) pairs, and
  * dynamically loads images and blob.
+ *
+ * Loading, setting and removing images and BLOBs as well as cache cleanup
+ * are synchronized, i.e. different threads can request embeddings from the
+ * same view concurrently. save_view() is synchronized as well, so a view
+ * can be written while other threads read from it. save_view_as() and
+ * reloading a view are not synchronized.
  */
 class View
 {
@@ -309,6 +316,7 @@ protected:
     ImageProxies images;
     BlobProxies blobs;
     FilenameList to_delete;
+    mutable std::mutex proxy_mutex;
 };
 
 /* ---------------------------------------------------------------- */
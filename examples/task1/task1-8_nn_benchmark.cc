@@ -0,0 +1,160 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ *
+ * Microbenchmark for the nearest neighbor kernels. Matches random
+ * normalized descriptors with every backend supported by the CPU and
+ * reports the number of matches (queries) per second.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "util/aligned_memory.h"
+#include "util/timer.h"
+#include "math/functions.h"
+#include "math/vector.h"
+#include "features/nearest_neighbor.h"
+
+namespace
+{
+    /* Random non-negative (SIFT) or signed (SURF) unit vectors. */
+    template <int N>
+    std::vector<math::Vector<float, N>>
+    random_descriptors (int num, bool is_signed, std::mt19937* rng)
+    {
+        std::uniform_real_distribution<float> dist(is_signed ? -1.0f : 0.0f,
+            1.0f);
+        std::vector<math::Vector<float, N>> result(num);
+        for (int i = 0; i < num; ++i)
+        {
+            for (int j = 0; j < N; ++j)
+                result[i][j] = dist(*rng);
+            result[i].normalize();
+        }
+        return result;
+    }
+
+    /* Converts to the element type, integers are rounded after scaling. */
+    template <typename T, int N>
+    util::AlignedMemory<math::Vector<T, N>, 16>
+    convert (std::vector<math::Vector<float, N>> const& descr, float scale)
+    {
+        util::AlignedMemory<math::Vector<T, N>, 16> result(descr.size());
+        for (std::size_t i = 0; i < descr.size(); ++i)
+            for (int j = 0; j < N; ++j)
+                result[i][j] = std::is_integral<T>::value
+                    ? static_cast<T>(math::round(descr[i][j] * scale))
+                    : static_cast<T>(descr[i][j] * scale);
+        return result;
+    }
+
+    template <typename T, int N>
+    void
+    benchmark (char const* name,
+        util::AlignedMemory<math::Vector<T, N>, 16> const& queries,
+        util::AlignedMemory<math::Vector<T, N>, 16> const& elements)
+    {
+        typedef typename features::NearestNeighbor<T>::Result Result;
+        features::NearestNeighbor<T> nn;
+        nn.set_elements(elements.data()->begin());
+        nn.set_num_elements(elements.size());
+        nn.set_element_dimensions(N);
+
+        std::vector<int> reference;
+        for (int b = features::NN_BACKEND_SCALAR;
+            b <= features::NN_BACKEND_AVX512; ++b)
+        {
+            features::NearestNeighborBackend backend
+                = static_cast<features::NearestNeighborBackend>(b);
+            if (!features::nearest_neighbor_backend_supported(backend))
+                continue;
+            nn.set_backend(backend);
+
+            /* Per query search. */
+            std::vector<int> matches(queries.size());
+            util::WallTimer timer;
+            for (std::size_t i = 0; i < queries.size(); ++i)
+            {
+                Result result;
+                nn.find(queries[i].begin(), &result);
+                matches[i] = result.index_1st_best;
+            }
+            float const seconds = std::max(1e-6f, timer.get_elapsed_sec());
+
+            /* Search in blocks of queries as done by Matching. */
+            int const block_size = 64;
+            std::vector<Result> results(queries.size());
+            timer.reset();
+            for (std::size_t i = 0; i < queries.size(); i += block_size)
+                nn.find_block(queries[i].begin(), std::min<int>(block_size,
+                    queries.size() - i), &results[i]);
+            float const block_seconds
+                = std::max(1e-6f, timer.get_elapsed_sec());
+
+            /* Compare nearest neighbors to the scalar backend. */
+            if (reference.empty())
+                reference = matches;
+            std::size_t num_different = 0;
+            for (std::size_t i = 0; i < matches.size(); ++i)
+                num_different += matches[i] != reference[i]
+                    || results[i].index_1st_best != matches[i];
+
+            std::cout << std::setw(12) << name << std::setw(9)
+                << features::nearest_neighbor_backend_name(backend)
+                << std::fixed << std::setprecision(0)
+                << std::setw(10) << queries.size() / seconds
+                << " matches/s," << std::setw(10)
+                << queries.size() / block_seconds << " blocked, "
+                << num_different << " differ from scalar" << std::endl;
+        }
+    }
+}
+
+int
+main (int argc, char** argv)
+{
+    int const num_queries = argc > 1 ? std::atoi(argv[1]) : 1000;
+    int const num_elements = argc > 2 ? std::atoi(argv[2]) : 10000;
+    if (num_queries <= 0 || num_elements <= 0)
+    {
+        std::cerr << "Syntax: " << argv[0]
+            << " [num_queries] [num_elements]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Matching " << num_queries << " queries against "
+        << num_elements << " elements, best backend: "
+        << features::nearest_neighbor_backend_name(
+        features::nearest_neighbor_best_backend()) << std::endl;
+
+    std::mt19937 rng(1);
+    std::vector<math::Vec128f> sift_queries
+        = random_descriptors<128>(num_queries, false, &rng);
+    std::vector<math::Vec128f> sift_elements
+        = random_descriptors<128>(num_elements, false, &rng);
+    std::vector<math::Vec64f> surf_queries
+        = random_descriptors<64>(num_queries, true, &rng);
+    std::vector<math::Vec64f> surf_elements
+        = random_descriptors<64>(num_elements, true, &rng);
+
+    benchmark<unsigned char, 128>("SIFT uint8",
+        convert<unsigned char>(sift_queries, 255.0f),
+        convert<unsigned char>(sift_elements, 255.0f));
+    benchmark<unsigned short, 128>("SIFT uint16",
+        convert<unsigned short>(sift_queries, 255.0f),
+        convert<unsigned short>(sift_elements, 255.0f));
+    benchmark<float, 128>("SIFT float",
+        convert<float>(sift_queries, 1.0f),
+        convert<float>(sift_elements, 1.0f));
+    benchmark<short, 64>("SURF int16",
+        convert<short>(surf_queries, 127.0f),
+        convert<short>(surf_elements, 127.0f));
+
+    return 0;
+}
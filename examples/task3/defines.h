@@ -17,6 +17,9 @@
 // 用于重建新的Ttrakc
 #define NEW_TRACK_ERROR_THRES 0.01f
 
+// 每次并行注册的最多视角个数
+#define MAX_VIEWS_PER_BATCH 8
+
 static const std::string undistorted_name = "undistorted";
 static const std::string original_name = "original";
 static const std::string exif_name = "exif";
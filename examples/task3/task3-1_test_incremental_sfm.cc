@@ -1,6 +1,7 @@
 //
 // Created by caoqi on 2018/8/28.
 //
+#include <algorithm>
 #include <cassert>
 #include "defines.h"
 #include "functions.h"
@@ -273,30 +274,50 @@ int main(int argc, char *argv[])
 
     /* Reconstruct remaining views. */
     int num_cameras_reconstructed = 2;
-    int full_ba_num_skipped = 0;
     while (true)
     {
         /* Find suitable next views for reconstruction. */
         std::vector<int> next_views;
         incremental.find_next_views(&next_views);
 
-        /* Reconstruct the next view. */
-        int next_view_id = -1;
-        for (std::size_t i = 0; i < next_views.size(); ++i)
+        /*
+         * Reconstruct a batch of the best next views in parallel. The batch
+         * grows with the reconstruction, small reconstructions add one view
+         * at a time.
+         */
+        std::size_t const batch_size = std::max(1, std::min(
+            MAX_VIEWS_PER_BATCH, num_cameras_reconstructed / 4));
+        if (next_views.size() > batch_size)
+            next_views.resize(batch_size);
+
+        std::vector<int> new_views;
+        if (!next_views.empty())
         {
             std::cout << std::endl;
-            std::cout << "Adding next view ID " << next_views[i]
-                      << " (" << (num_cameras_reconstructed + 1) << " of "
+            std::cout << "Adding " << next_views.size() << " next views ("
+                      << (num_cameras_reconstructed + 1) << " of "
                       << viewports.size() << ")..." << std::endl;
-            if (incremental.reconstruct_next_view(next_views[i]))
+            incremental.reconstruct_next_views(next_views, &new_views);
+        }
+
+        /* Fall back to the remaining candidates one at a time. */
+        if (new_views.empty())
+        {
+            incremental.find_next_views(&next_views);
+            for (std::size_t i = batch_size; i < next_views.size(); ++i)
             {
-                next_view_id = next_views[i];
-                break;
+                std::cout << "Adding next view ID " << next_views[i]
+                          << "..." << std::endl;
+                if (incremental.reconstruct_next_view(next_views[i]))
+                {
+                    new_views.push_back(next_views[i]);
+                    break;
+                }
             }
         }
 
-        if (next_view_id < 0) {
-            if (full_ba_num_skipped == 0) {
+        if (new_views.empty()) {
+            if (incremental.num_registrations_since_full_ba() == 0) {
                 std::cout << "No valid next view." << std::endl;
                 std::cout << "SfM reconstruction finished." << std::endl;
                 break;
@@ -306,23 +327,25 @@ int main(int argc, char *argv[])
                 std::cout << "Running full bundle adjustment..." << std::endl;
                 incremental.invalidate_large_error_tracks();
                 incremental.bundle_adjustment_full();
-                full_ba_num_skipped = 0;
                 continue;
             }
         }
 
         /* Run single-camera bundle adjustment. */
         std::cout << "Running single camera bundle adjustment..." << std::endl;
-        incremental.bundle_adjustment_single_cam(next_view_id);
-        num_cameras_reconstructed += 1;
-
-        /* Run full bundle adjustment only after a couple of views. */
-        int const full_ba_skip_views =  std::min(100, num_cameras_reconstructed / 10);
-        if (full_ba_num_skipped < full_ba_skip_views)
+        for (std::size_t i = 0; i < new_views.size(); ++i)
+            incremental.bundle_adjustment_single_cam(new_views[i]);
+        num_cameras_reconstructed += new_views.size();
+
+        /*
+         * Run full bundle adjustment only after a couple of views or once
+         * the reconstruction grew enough, otherwise only optimize the new
+         * view together with its strongest co-visible views.
+         */
+        if (!incremental.is_full_ba_due())
         {
-            std::cout << "Skipping full bundle adjustment (skipping "
-                      << full_ba_skip_views << " views)." << std::endl;
-            full_ba_num_skipped += 1;
+            incremental.triangulate_new_tracks(MIN_VIEWS_PER_TRACK);
+            incremental.bundle_adjustment_local(new_views);
         }
         else{
             incremental.triangulate_new_tracks(MIN_VIEWS_PER_TRACK);
@@ -333,14 +356,13 @@ int main(int argc, char *argv[])
 
             /*全局的BA*/
             incremental.bundle_adjustment_full();
-            full_ba_num_skipped = 0;
         }
     }
 
-    sfm::bundler::TrackList valid_tracks;
+    std::vector<int> valid_tracks;
     for(int i=0; i<tracks.size(); i++){
-        if(tracks[i].is_valid()){
-            valid_tracks.push_back(tracks[i]);
+        if(tracks.is_valid(i)){
+            valid_tracks.push_back(i);
         }
     }
 
@@ -364,8 +386,10 @@ int main(int argc, char *argv[])
     out_file<<"end_header"<<std::endl;
 
     for(int i=0; i< valid_tracks.size(); i++){
-        out_file<<valid_tracks[i].pos[0]<<" "<< valid_tracks[i].pos[1]<<" "<<valid_tracks[i].pos[2]<<" "
-                <<(int)valid_tracks[i].color[0]<<" "<<(int)valid_tracks[i].color[1]<<" "<<(int)valid_tracks[i].color[2]<<std::endl;
+        math::Vec3f const& pos = tracks.position(valid_tracks[i]);
+        math::Vec3uc const& color = tracks.color(valid_tracks[i]);
+        out_file<<pos[0]<<" "<< pos[1]<<" "<<pos[2]<<" "
+                <<(int)color[0]<<" "<<(int)color[1]<<" "<<(int)color[2]<<std::endl;
     }
     out_file.close();
 
@@ -12,7 +12,7 @@
 #include <cstdlib>
 
 #include "mvs/settings.h"
-#include "mvs/dmrecon.h"
+#include "mvs/recon_scheduler.h"
 #include "core/scene.h"
 #include "core/view.h"
 #include "util/timer.h"
@@ -31,6 +31,8 @@ struct AppSettings{
     int max_pixels = 1500000;
     bool force_recon = false;
     bool write_ply = false;
+    unsigned int num_parallel_views = 0;
+    std::size_t memory_limit_mb = 4096;
     mvs::Settings mvs;
 };
 
@@ -40,7 +42,7 @@ int
 main (int argc, char** argv)
 {
     if(argc<3){
-        std::cout<<"usage: scendir scale"<<std::endl;
+        std::cout<<"usage: scendir scale [memory_limit_mb] [num_parallel_views]"<<std::endl;
         return -1;
     }
 
@@ -51,6 +53,11 @@ main (int argc, char** argv)
     // 获取图像尺度
     std::stringstream stream1(argv[2]);
     stream1>>conf.mvs.scale;
+    // 内存上限(MB)与同时重建的视角个数
+    if (argc > 3)
+        conf.memory_limit_mb = std::strtoul(argv[3], nullptr, 10);
+    if (argc > 4)
+        conf.num_parallel_views = std::strtoul(argv[4], nullptr, 10);
 
     /* Load MVE scene. */
     core::Scene::Ptr scene;
@@ -69,52 +76,22 @@ main (int argc, char** argv)
     conf.mvs.writePlyFile = conf.write_ply;
     conf.mvs.plyPath = util::fs::join_path(conf.scene_path, conf.ply_dest);
 
-     core::Scene::ViewList& views(scene->get_views());
      if (conf.view_ids.empty())
-     {
         std::cout << "Reconstructing all views..." << std::endl;
-        for(std::size_t i = 0; i < views.size(); ++i)
-             conf.view_ids.push_back(i);
-     }
      else
-     {
-         std::cout << "Reconstructing views from list..." << std::endl;
-     }
+        std::cout << "Reconstructing views from list..." << std::endl;
 
-     // 对于每一个视角单独进行重建
-     util::WallTimer timer;
-     for (std::size_t i = 0; i < conf.view_ids.size(); ++i)
-     {
-            std::size_t id = conf.view_ids[i];
-            if (id >= views.size())
-            {
-                std::cout << "Invalid ID " << id << ", skipping!" << std::endl;
-                continue;
-            }
-
-            if (views[id] == nullptr || !views[id]->is_camera_valid())
-                continue;
-
-            /* Setup MVS. */
-            mvs::Settings settings(conf.mvs);
-            settings.refViewNr = id;
-
-            std::string embedding_name = "depth-L" + util::string::get(settings.scale);
-            if (!conf.force_recon && views[id]->has_image(embedding_name))
-                continue;
-
-            try {
-                // 重建场景
-                mvs::DMRecon recon(scene, settings);
-                recon.start();
-                views[id]->save_view();
-            }
-            catch (std::exception &err)
-            {
-                std::cerr << err.what() << std::endl;
-            }
-     }
+     // 多个参考视角并行重建，邻域视角的图像金字塔在视角之间共享
+     mvs::ReconScheduler::Options options;
+     options.settings = conf.mvs;
+     options.settings.quiet = conf.num_parallel_views != 1;
+     options.numParallelViews = conf.num_parallel_views;
+     options.memoryLimit = conf.memory_limit_mb << 20;
+     options.forceRecon = conf.force_recon;
 
+     util::WallTimer timer;
+     mvs::ReconScheduler scheduler(scene, options);
+     scheduler.reconstruct(conf.view_ids);
 
     std::cout << "Reconstruction took "<< timer.get_elapsed() << "ms." << std::endl;
 
@@ -0,0 +1,92 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_DESCRIPTOR_QUANTIZATION_HEADER
+#define SFM_DESCRIPTOR_QUANTIZATION_HEADER
+
+#include "math/functions.h"
+#include "math/vector.h"
+#include "util/aligned_memory.h"
+#include "features/defines.h"
+#include "features/sift.h"
+#include "features/surf.h"
+
+FEATURES_NAMESPACE_BEGIN
+
+/**
+ * Compact descriptor storage used for matching. SIFT descriptors are
+ * non-negative and quantized to 8 bit, values in [0, 255], normalized to 255.
+ * SURF descriptors are signed and quantized to [-127, 127], normalized to
+ * 127, stored as 16 bit to match the SSE2 inner product. The memory is
+ * 16 byte aligned as required by NearestNeighbor.
+ */
+typedef util::AlignedMemory<math::Vec128uc, 16> QuantizedSiftDescriptors;
+typedef util::AlignedMemory<math::Vec64s, 16> QuantizedSurfDescriptors;
+
+/** Quantizes a single SIFT descriptor to 128 values in [0, 255]. */
+void
+quantize_descriptor (Sift::Descriptor const& descr, unsigned char* data);
+
+/** Quantizes a single SURF descriptor to 64 values in [-127, 127]. */
+void
+quantize_descriptor (Surf::Descriptor const& descr, short* data);
+
+/** Quantizes a list of SIFT descriptors. */
+void
+quantize_descriptors (Sift::Descriptors const& src,
+    QuantizedSiftDescriptors* dst);
+
+/** Quantizes a list of SURF descriptors. */
+void
+quantize_descriptors (Surf::Descriptors const& src,
+    QuantizedSurfDescriptors* dst);
+
+/* ------------------------ Implementation ------------------------ */
+
+inline void
+quantize_descriptor (Sift::Descriptor const& descr, unsigned char* data)
+{
+    for (int i = 0; i < 128; ++i)
+    {
+        float value = descr.data[i];
+        value = math::clamp(value, 0.0f, 1.0f);
+        value = math::round(value * 255.0f);
+        data[i] = static_cast<unsigned char>(value);
+    }
+}
+
+inline void
+quantize_descriptor (Surf::Descriptor const& descr, short* data)
+{
+    for (int i = 0; i < 64; ++i)
+    {
+        float value = descr.data[i];
+        value = math::clamp(value, -1.0f, 1.0f);
+        value = math::round(value * 127.0f);
+        data[i] = static_cast<signed char>(value);
+    }
+}
+
+inline void
+quantize_descriptors (Sift::Descriptors const& src,
+    QuantizedSiftDescriptors* dst)
+{
+    dst->resize(src.size());
+    for (std::size_t i = 0; i < src.size(); ++i)
+        quantize_descriptor(src[i], (*dst)[i].begin());
+}
+
+inline void
+quantize_descriptors (Surf::Descriptors const& src,
+    QuantizedSurfDescriptors* dst)
+{
+    dst->resize(src.size());
+    for (std::size_t i = 0; i < src.size(); ++i)
+        quantize_descriptor(src[i], (*dst)[i].begin());
+}
+
+FEATURES_NAMESPACE_END
+
+#endif /* SFM_DESCRIPTOR_QUANTIZATION_HEADER */
@@ -11,46 +11,41 @@
 
 FEATURES_NAMESPACE_BEGIN
 using namespace sfm;
+
+#if !DISCRETIZE_DESCRIPTORS
 namespace
 {
-#if DISCRETIZE_DESCRIPTORS
     void
-    convert_descriptor (Sift::Descriptor const& descr, unsigned short* data)
+    convert_descriptors (Sift::Descriptors const& src,
+        util::AlignedMemory<math::Vec128f, 16>* dst)
     {
-        for (int i = 0; i < 128; ++i)
-        {
-            float value = descr.data[i];
-            value = math::clamp(value, 0.0f, 1.0f);
-            value = math::round(value * 255.0f);
-            data[i] = static_cast<unsigned char>(value);
-        }
+        dst->resize(src.size());
+        for (std::size_t i = 0; i < src.size(); ++i)
+            (*dst)[i] = src[i].data;
     }
 
     void
-    convert_descriptor (Surf::Descriptor const& descr, signed short* data)
+    convert_descriptors (Surf::Descriptors const& src,
+        util::AlignedMemory<math::Vec64f, 16>* dst)
     {
-        for (int i = 0; i < 64; ++i)
-        {
-            float value = descr.data[i];
-            value = math::clamp(value, -1.0f, 1.0f);
-            value = math::round(value * 127.0f);
-            data[i] = static_cast<signed char>(value);
-        }
-    }
-#else // DISCRETIZE_DESCRIPTORS
-    void
-    convert_descriptor (Sift::Descriptor const& descr, float* data)
-    {
-        std::copy(descr.data.begin(), descr.data.end(), data);
+        dst->resize(src.size());
+        for (std::size_t i = 0; i < src.size(); ++i)
+            (*dst)[i] = src[i].data;
     }
 
+    /* Expands quantized descriptors back to float. */
+    template <typename Q, typename V>
     void
-    convert_descriptor (Surf::Descriptor const& descr, float* data)
+    convert_descriptors (util::AlignedMemory<Q, 16> const& src,
+        float normalizer, util::AlignedMemory<V, 16>* dst)
     {
-        std::copy(descr.data.begin(), descr.data.end(), data);
+        dst->resize(src.size());
+        for (std::size_t i = 0; i < src.size(); ++i)
+            for (int j = 0; j < V::dim; ++j)
+                (*dst)[i][j] = static_cast<float>(src[i][j]) / normalizer;
     }
-#endif // DISCRETIZE_DESCRIPTORS
 }
+#endif // DISCRETIZE_DESCRIPTORS
 
 void
 ExhaustiveMatching::init (bundler::ViewportList* viewports)
@@ -64,47 +59,41 @@ ExhaustiveMatching::init (bundler::ViewportList* viewports)
         FeatureSet const& fs = (*viewports)[i].features;
         ProcessedFeatureSet& pfs = this->processed_feature_sets[i];
 
-        this->init_sift(&pfs.sift_descr, fs.sift_descriptors);
-        this->init_surf(&pfs.surf_descr, fs.surf_descriptors);
+        this->init_sift(&pfs.sift_descr, fs);
+        this->init_surf(&pfs.surf_descr, fs);
     }
 }
 
 void
-ExhaustiveMatching::init_sift (SiftDescriptors* dst,
-    Sift::Descriptors const& src)
+ExhaustiveMatching::init_sift (SiftDescriptors* dst, FeatureSet const& fs)
 {
-    /* Prepare and copy to data structures. */
-    dst->resize(src.size());
-
 #if DISCRETIZE_DESCRIPTORS
-    uint16_t* ptr = dst->data()->begin();
+    if (!fs.sift_quantized.empty())
+        *dst = fs.sift_quantized;
+    else
+        quantize_descriptors(fs.sift_descriptors, dst);
 #else
-    float* ptr = dst->data()->begin();
+    if (!fs.sift_quantized.empty())
+        convert_descriptors(fs.sift_quantized, 255.0f, dst);
+    else
+        convert_descriptors(fs.sift_descriptors, dst);
 #endif
-    for (std::size_t i = 0; i < src.size(); ++i, ptr += 128)
-    {
-        Sift::Descriptor const& d = src[i];
-        convert_descriptor(d, ptr);
-    }
 }
 
 void
-ExhaustiveMatching::init_surf (SurfDescriptors* dst,
-    Surf::Descriptors const& src)
+ExhaustiveMatching::init_surf (SurfDescriptors* dst, FeatureSet const& fs)
 {
-    /* Prepare and copy to data structures. */
-    dst->resize(src.size());
-
 #if DISCRETIZE_DESCRIPTORS
-    int16_t* ptr = dst->data()->begin();
+    if (!fs.surf_quantized.empty())
+        *dst = fs.surf_quantized;
+    else
+        quantize_descriptors(fs.surf_descriptors, dst);
 #else
-    float* ptr = dst->data()->begin();
+    if (!fs.surf_quantized.empty())
+        convert_descriptors(fs.surf_quantized, 127.0f, dst);
+    else
+        convert_descriptors(fs.surf_descriptors, dst);
 #endif
-    for (std::size_t i = 0; i < src.size(); ++i, ptr += 64)
-    {
-        Surf::Descriptor const& d = src[i];
-        convert_descriptor(d, ptr);
-    }
 }
 
 void
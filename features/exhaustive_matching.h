@@ -12,12 +12,13 @@
 
 //#include "sfm/bundler_common.h"
 #include "features/defines.h"
+#include "features/descriptor_quantization.h"
 #include "features/matching_base.h"
 #include "features/nearest_neighbor.h"
 #include "features/sift.h"
 #include "features/surf.h"
 
-/* Whether to use floating point or 8-bit descriptors for matching. */
+/* Whether to use floating point or quantized descriptors for matching. */
 #define DISCRETIZE_DESCRIPTORS 1
 
 FEATURES_NAMESPACE_BEGIN
@@ -44,16 +45,20 @@ public:
 
 protected:
 #if DISCRETIZE_DESCRIPTORS
-    typedef util::AlignedMemory<math::Vec128us, 16> SiftDescriptors;
-    typedef util::AlignedMemory<math::Vec64s, 16> SurfDescriptors;
+    typedef QuantizedSiftDescriptors SiftDescriptors;
+    typedef QuantizedSurfDescriptors SurfDescriptors;
 #else
     typedef util::AlignedMemory<math::Vec128f, 16> SiftDescriptors;
     typedef util::AlignedMemory<math::Vec64f, 16> SurfDescriptors;
 #endif
 
-    /** Internal initialization methods for SIFT/SURF features. */
-    void init_sift (SiftDescriptors* dst, Sift::Descriptors const& src);
-    void init_surf (SurfDescriptors* dst, Surf::Descriptors const& src);
+    /**
+     * Internal initialization methods for SIFT/SURF features. The quantized
+     * descriptors are used if the feature set has been computed with
+     * compact descriptors, otherwise the float descriptors are converted.
+     */
+    void init_sift (SiftDescriptors* dst, sfm::FeatureSet const& fs);
+    void init_surf (SurfDescriptors* dst, sfm::FeatureSet const& fs);
 
     struct ProcessedFeatureSet
     {
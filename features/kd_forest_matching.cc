@@ -0,0 +1,283 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+#include "math/defines.h"
+#include "util/timer.h"
+#include "features/kd_forest_matching.h"
+
+FEATURES_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Number of descriptors used to estimate the split dimension. */
+    int const NUM_SPLIT_SAMPLES = 128;
+
+    /* Unexplored branch, ordered by distance for use in a min-heap. */
+    struct Branch
+    {
+        float dist;
+        int tree;
+        int node;
+
+        bool operator< (Branch const& other) const
+        {
+            return this->dist > other.dist;
+        }
+    };
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+KdForestMatching::init (sfm::bundler::ViewportList* viewports)
+{
+    ExhaustiveMatching::init(viewports);
+
+    util::WallTimer timer;
+    this->forests.clear();
+    this->forests.resize(viewports->size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < viewports->size(); i++)
+    {
+        this->build_forest(this->processed_feature_sets[i].sift_descr,
+            this->forest_opts.seed + i, &this->forests[i]);
+    }
+    std::cout << "Building KD-forests took " << timer.get_elapsed()
+        << " ms" << std::endl;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+KdForestMatching::pairwise_match (int view_1_id, int view_2_id,
+    Matching::Result* result) const
+{
+    ProcessedFeatureSet const& pfs_1 = this->processed_feature_sets[view_1_id];
+    ProcessedFeatureSet const& pfs_2 = this->processed_feature_sets[view_2_id];
+
+    /* SIFT matching. */
+    Matching::Result sift_result;
+    if (pfs_1.sift_descr.size() > 0)
+    {
+        this->oneway_match(this->opts.sift_matching_opts, pfs_1.sift_descr,
+            pfs_2.sift_descr, this->forests[view_2_id],
+            &sift_result.matches_1_2, &sift_result.ratios_1_2);
+        this->oneway_match(this->opts.sift_matching_opts, pfs_2.sift_descr,
+            pfs_1.sift_descr, this->forests[view_1_id],
+            &sift_result.matches_2_1);
+        Matching::remove_inconsistent_matches(&sift_result);
+    }
+
+    /* SURF matching. */
+    Matching::Result surf_result;
+    if (pfs_1.surf_descr.size() > 0)
+    {
+        Matching::twoway_match(this->opts.surf_matching_opts,
+            pfs_1.surf_descr.data()->begin(), pfs_1.surf_descr.size(),
+            pfs_2.surf_descr.data()->begin(), pfs_2.surf_descr.size(),
+            &surf_result);
+        Matching::remove_inconsistent_matches(&surf_result);
+    }
+
+    Matching::combine_results(sift_result, surf_result, result);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+KdForestMatching::build_forest (SiftDescriptors const& descrs,
+    unsigned int seed, KdForest* forest) const
+{
+    forest->clear();
+    if (descrs.empty())
+        return;
+
+    std::mt19937 rng(seed);
+    forest->resize(this->forest_opts.num_trees);
+    for (std::size_t i = 0; i < forest->size(); ++i)
+    {
+        KdTree& tree = forest->at(i);
+        tree.ids.resize(descrs.size());
+        std::iota(tree.ids.begin(), tree.ids.end(), 0);
+        this->build_node(descrs, 0, descrs.size(), &rng, &tree);
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+template <typename RNG>
+void
+KdForestMatching::build_node (SiftDescriptors const& descrs,
+    int begin, int end, RNG* rng, KdTree* tree) const
+{
+    typedef SiftDescriptors::value_type Descriptor;
+    int const dim = Descriptor::dim;
+
+    int const node_id = tree->nodes.size();
+    tree->nodes.push_back(KdTree::Node());
+    tree->nodes[node_id].dimension = -1;
+    tree->nodes[node_id].value = 0.0f;
+    tree->nodes[node_id].right = -1;
+    tree->nodes[node_id].begin = begin;
+    tree->nodes[node_id].end = end;
+    if (end - begin <= this->forest_opts.max_leaf_size)
+        return;
+
+    /* Estimate mean and variance per dimension from a few samples. */
+    int const num_samples = std::min(end - begin, NUM_SPLIT_SAMPLES);
+    int const stride = (end - begin) / num_samples;
+    std::vector<float> mean(dim, 0.0f);
+    std::vector<float> var(dim, 0.0f);
+    for (int i = 0; i < num_samples; ++i)
+    {
+        Descriptor const& d = descrs[tree->ids[begin + i * stride]];
+        for (int j = 0; j < dim; ++j)
+        {
+            mean[j] += static_cast<float>(d[j]);
+            var[j] += MATH_POW2(static_cast<float>(d[j]));
+        }
+    }
+    for (int j = 0; j < dim; ++j)
+    {
+        mean[j] /= static_cast<float>(num_samples);
+        var[j] = var[j] / static_cast<float>(num_samples) - MATH_POW2(mean[j]);
+    }
+
+    /* Choose a random dimension among the highest variance dimensions. */
+    int const num_candidates = std::max(1,
+        std::min(dim, this->forest_opts.num_split_candidates));
+    std::vector<int> dims(dim);
+    std::iota(dims.begin(), dims.end(), 0);
+    std::partial_sort(dims.begin(), dims.begin() + num_candidates, dims.end(),
+        [&var] (int a, int b) { return var[a] > var[b]; });
+    std::uniform_int_distribution<int> dist(0, num_candidates - 1);
+    int const split_dim = dims[dist(*rng)];
+    float const split_value = mean[split_dim];
+
+    /* Partition the IDs, degenerate splits result in a leaf. */
+    std::vector<int>::iterator middle = std::partition(
+        tree->ids.begin() + begin, tree->ids.begin() + end,
+        [&descrs, split_dim, split_value] (int id)
+        { return static_cast<float>(descrs[id][split_dim]) < split_value; });
+    int const split = middle - tree->ids.begin();
+    if (split == begin || split == end)
+        return;
+
+    tree->nodes[node_id].dimension = split_dim;
+    tree->nodes[node_id].value = split_value;
+    this->build_node(descrs, begin, split, rng, tree);
+    tree->nodes[node_id].right = tree->nodes.size();
+    this->build_node(descrs, split, end, rng, tree);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+KdForestMatching::oneway_match (Matching::Options const& matching_opts,
+    SiftDescriptors const& set_1, SiftDescriptors const& set_2,
+    KdForest const& forest_2, std::vector<int>* result,
+    std::vector<float>* ratios) const
+{
+    typedef SiftDescriptors::value_type Descriptor;
+    typedef Descriptor::ValueType T;
+
+    result->clear();
+    result->resize(set_1.size(), -1);
+    if (ratios != nullptr)
+        ratios->assign(set_1.size(), 1.0f);
+    if (set_1.empty() || set_2.empty())
+        return;
+
+    float const square_dist_thres = MATH_POW2(matching_opts.distance_threshold);
+    float const square_lowe_thres = MATH_POW2(matching_opts.lowe_ratio_threshold);
+    std::size_t const max_checks = std::max(2, this->forest_opts.max_checks);
+
+    /* Candidates are gathered and compared with the exact kernels. */
+    std::vector<Branch> branches;
+    std::vector<int> candidates;
+    std::vector<int> visited(set_2.size(), -1);
+    SiftDescriptors candidate_descrs;
+    NearestNeighbor<T> nn;
+    nn.set_element_dimensions(Descriptor::dim);
+
+    for (std::size_t i = 0; i < set_1.size(); ++i)
+    {
+        T const* query = set_1[i].begin();
+        branches.clear();
+        candidates.clear();
+
+        /* Descends to a leaf and remembers the branches not taken. */
+        auto descend = [&] (int tree_id, int node_id, float dist)
+        {
+            KdTree const& tree = forest_2[tree_id];
+            KdTree::Node const* node = &tree.nodes[node_id];
+            while (node->dimension >= 0)
+            {
+                float const diff = static_cast<float>(query[node->dimension])
+                    - node->value;
+                int const near_id = diff < 0.0f ? node_id + 1 : node->right;
+                int const far_id = diff < 0.0f ? node->right : node_id + 1;
+                branches.push_back({ dist + diff * diff, tree_id, far_id });
+                std::push_heap(branches.begin(), branches.end());
+                node_id = near_id;
+                node = &tree.nodes[node_id];
+            }
+            for (int k = node->begin; k < node->end; ++k)
+            {
+                int const id = tree.ids[k];
+                if (visited[id] == static_cast<int>(i))
+                    continue;
+                visited[id] = i;
+                candidates.push_back(id);
+            }
+        };
+
+        /* Best bin first search over all trees. */
+        for (std::size_t t = 0; t < forest_2.size(); ++t)
+            descend(t, 0, 0.0f);
+        while (candidates.size() < max_checks && !branches.empty())
+        {
+            std::pop_heap(branches.begin(), branches.end());
+            Branch const branch = branches.back();
+            branches.pop_back();
+            descend(branch.tree, branch.node, branch.dist);
+        }
+
+        /* Exact comparison with the candidates. */
+        candidate_descrs.resize(candidates.size());
+        for (std::size_t j = 0; j < candidates.size(); ++j)
+            candidate_descrs[j] = set_2[candidates[j]];
+        nn.set_elements(candidate_descrs.data()->begin());
+        nn.set_num_elements(candidates.size());
+
+        typename NearestNeighbor<T>::Result nn_result;
+        nn.find(query, &nn_result);
+
+        if (nn_result.dist_1st_best > square_dist_thres)
+            continue;
+
+        /* Identical first and second neighbors are ambiguous. */
+        if (nn_result.dist_2nd_best == 0)
+            continue;
+
+        float const square_ratio
+            = static_cast<float>(nn_result.dist_1st_best)
+            / static_cast<float>(nn_result.dist_2nd_best);
+        if (square_ratio > square_lowe_thres)
+            continue;
+
+        result->at(i) = candidates[nn_result.index_1st_best];
+        if (ratios != nullptr)
+            ratios->at(i) = square_ratio;
+    }
+}
+
+FEATURES_NAMESPACE_END
@@ -0,0 +1,132 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_KD_FOREST_MATCHING_HEADER
+#define SFM_KD_FOREST_MATCHING_HEADER
+
+#include <vector>
+
+#include "features/defines.h"
+#include "features/exhaustive_matching.h"
+#include "features/matching.h"
+
+FEATURES_NAMESPACE_BEGIN
+
+/**
+ * Approximate SIFT matching using a randomized KD-forest per view.
+ *
+ * During init() a forest of randomized KD-trees is built over the SIFT
+ * descriptors of every view. The split dimension of a node is chosen
+ * randomly among the dimensions with the highest variance, the split value
+ * is the mean. The forest of a view is reused for all pairs the view takes
+ * part in.
+ *
+ * A query descends all trees and then continues with the most promising
+ * unexplored branches (best bin first) until 'max_checks' descriptors have
+ * been collected. The candidates are compared with the exact inner product
+ * and the usual distance and Lowe ratio thresholds are applied. Increasing
+ * 'num_trees' and 'max_checks' increases recall at the cost of speed.
+ *
+ * SURF descriptors and low-resolution matching use the exhaustive matcher.
+ */
+class KdForestMatching : public ExhaustiveMatching
+{
+public:
+    struct Options
+    {
+        Options (void);
+
+        /** Number of randomized trees per view. */
+        int num_trees;
+
+        /** Maximum number of candidates compared per query. */
+        int max_checks;
+
+        /** Maximum number of descriptors in a leaf. */
+        int max_leaf_size;
+
+        /** Number of highest variance dimensions to choose splits from. */
+        int num_split_candidates;
+
+        /** Seed for the random split dimensions. */
+        unsigned int seed;
+    };
+
+public:
+    explicit KdForestMatching (Options const& options = Options());
+
+    /** Initialize matcher by building a KD-forest for every view. */
+    void init (sfm::bundler::ViewportList* viewports) override;
+
+    /** Matches all feature types yielding a single matching result. */
+    void pairwise_match (int view_1_id, int view_2_id,
+        Matching::Result* result) const override;
+
+private:
+    /**
+     * A KD-tree over the descriptors of a view. Inner nodes store the split
+     * dimension and value and the index of the second child, the first child
+     * directly follows its parent. Leaves reference a range of descriptor IDs.
+     */
+    struct KdTree
+    {
+        struct Node
+        {
+            /* Split dimension, or -1 for leaves. */
+            int dimension;
+            float value;
+            /* Second child for inner nodes, ID range for leaves. */
+            int right;
+            int begin;
+            int end;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<int> ids;
+    };
+
+    typedef std::vector<KdTree> KdForest;
+
+    /** Builds the forest for the given descriptors. */
+    void build_forest (SiftDescriptors const& descrs, unsigned int seed,
+        KdForest* forest) const;
+
+    /** Recursively builds the subtree for the given range of IDs. */
+    template <typename RNG>
+    void build_node (SiftDescriptors const& descrs, int begin, int end,
+        RNG* rng, KdTree* tree) const;
+
+    /** Matches the SIFT descriptors of set 1 using the forest of set 2. */
+    void oneway_match (Matching::Options const& matching_opts,
+        SiftDescriptors const& set_1, SiftDescriptors const& set_2,
+        KdForest const& forest_2, std::vector<int>* result,
+        std::vector<float>* ratios = nullptr) const;
+
+private:
+    Options forest_opts;
+    std::vector<KdForest> forests;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+KdForestMatching::Options::Options (void)
+    : num_trees(4)
+    , max_checks(128)
+    , max_leaf_size(8)
+    , num_split_candidates(5)
+    , seed(0)
+{
+}
+
+inline
+KdForestMatching::KdForestMatching (Options const& options)
+    : forest_opts(options)
+{
+}
+
+FEATURES_NAMESPACE_END
+
+#endif /* SFM_KD_FOREST_MATCHING_HEADER */
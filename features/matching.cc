@@ -72,6 +72,23 @@ Matching::combine_results(Matching::Result const& sift_result,
     result->matches_2_1.insert(result->matches_2_1.end(),
         surf_result.matches_2_1.begin(), surf_result.matches_2_1.end());
 
+    /* Combine ratios if known for any of the results. */
+    result->ratios_1_2.clear();
+    if (!sift_result.ratios_1_2.empty() || !surf_result.ratios_1_2.empty())
+    {
+        result->ratios_1_2.reserve(num_matches_1);
+        if (sift_result.ratios_1_2.size() == sift_result.matches_1_2.size())
+            result->ratios_1_2.insert(result->ratios_1_2.end(),
+                sift_result.ratios_1_2.begin(), sift_result.ratios_1_2.end());
+        else
+            result->ratios_1_2.resize(sift_result.matches_1_2.size(), 1.0f);
+        if (surf_result.ratios_1_2.size() == surf_result.matches_1_2.size())
+            result->ratios_1_2.insert(result->ratios_1_2.end(),
+                surf_result.ratios_1_2.begin(), surf_result.ratios_1_2.end());
+        else
+            result->ratios_1_2.resize(num_matches_1, 1.0f);
+    }
+
     /* Fix offsets. */
     std::size_t surf_offset_1 = sift_result.matches_1_2.size();
     std::size_t surf_offset_2 = sift_result.matches_2_1.size();
@@ -10,6 +10,7 @@
 #ifndef SFM_MATCHING_HEADER
 #define SFM_MATCHING_HEADER
 
+#include <algorithm>
 #include <vector>
 #include <limits>
 
@@ -59,6 +60,8 @@ public:
         std::vector<int> matches_1_2;
         /* Matches from set 2 in set 1. */
         std::vector<int> matches_2_1;
+        /* Squared Lowe ratios of matches_1_2, 1 if unknown. May be empty. */
+        std::vector<float> ratios_1_2;
     };
 
 public:
@@ -67,13 +70,16 @@ public:
      * It reports as result for each element of set 1 to which element
      * in set 2 it maches. An unsuccessful match which did not pass
      * one of the thresholds is indicated with a negative index.
+     * Optionally reports the squared Lowe ratio of every match, which can
+     * be used to order matches by quality.
      */
     template <typename T>
     static void
     oneway_match (Options const& options,
         T const* set_1, int set_1_size,
         T const* set_2, int set_2_size,
-        std::vector<int>* result);
+        std::vector<int>* result,
+        std::vector<float>* ratios = nullptr);
 
     /**
      * Matches all elements in set 1 to all elements in set 2 and vice versa.
@@ -116,15 +122,19 @@ void
 Matching::oneway_match (Options const& options,
     T const* set_1, int set_1_size,
     T const* set_2, int set_2_size,
-    std::vector<int>* result)
+    std::vector<int>* result,
+    std::vector<float>* ratios)
 {
     result->clear();
     result->resize(set_1_size, -1);
+    if (ratios != nullptr)
+        ratios->assign(set_1_size, 1.0f);
     if (set_1_size == 0 || set_2_size == 0)
         return;
 
-    // 与最近邻距离的阈值
+    // 与最近邻距离的阈值, 以及最近邻与次近邻距离比的阈值
     float const square_dist_thres = MATH_POW2(options.distance_threshold);
+    float const square_lowe_thres = MATH_POW2(options.lowe_ratio_threshold);
 
     // 以描述子为特征，计算每个特征点的最近邻和次近邻
     NearestNeighbor<T> nn;
@@ -134,36 +144,43 @@ Matching::oneway_match (Options const& options,
     // 设置特征描述子的维度 sift 128, surf 64
     nn.set_element_dimensions(options.descriptor_length);
 
-    for (int i = 0; i < set_1_size; ++i)
+    // 按块处理查询特征点, 使 feature set 2 的描述子在缓存中被多个查询复用
+    int const block_size = 64;
+    std::vector<typename NearestNeighbor<T>::Result> nn_results(block_size);
+    for (int block_begin = 0; block_begin < set_1_size;
+        block_begin += block_size)
     {
-        // 每个特征点最近邻搜索的结果
-        typename NearestNeighbor<T>::Result nn_result;
-
-        // feature sets 1 中第i个特征点的特征描述子
-        T const* query_pointer = set_1 + i * options.descriptor_length;
-
+        int const num_queries = std::min(block_size, set_1_size - block_begin);
         // 计算最近邻
-        nn.find(query_pointer, &nn_result);
-
-        // 标准1： 与最近邻的距离必须小于特定阈值
-        if (nn_result.dist_1st_best > square_dist_thres)
-            continue;
-
-
-
-
-        /***********************task2*************************************/
-        // 标准2： 与最近邻和次紧邻的距离比必须小于特定阈值
-        /*
-         * 参考标准1的形式给出lowe-ratio约束
-         */
-
-               /*                  */
-               /*    此处添加代码    */
-               /*                  */
-        /*******************************10696_10015b911522757f6?bizid=10696&txSecret=63384d4bd569e29729b6995dd8a9eefb&txTime=5B93EFB6**********************************/
-        // 匹配成功，feature set1 中第i个特征值对应feature set2中的第index_1st_best个特征点
-        result->at(i) = nn_result.index_1st_best;
+        nn.find_block(set_1 + block_begin * options.descriptor_length,
+            num_queries, &nn_results[0]);
+
+        for (int j = 0; j < num_queries; ++j)
+        {
+            // 每个特征点最近邻搜索的结果
+            typename NearestNeighbor<T>::Result const& nn_result
+                = nn_results[j];
+
+            // 标准1： 与最近邻的距离必须小于特定阈值
+            if (nn_result.dist_1st_best > square_dist_thres)
+                continue;
+
+            // 次近邻距离为0时最近邻与次近邻相同, 匹配有歧义
+            if (nn_result.dist_2nd_best == 0)
+                continue;
+
+            // 标准2： 与最近邻和次紧邻的距离比必须小于特定阈值
+            float const square_ratio
+                = static_cast<float>(nn_result.dist_1st_best)
+                / static_cast<float>(nn_result.dist_2nd_best);
+            if (square_ratio > square_lowe_thres)
+                continue;
+
+            // 匹配成功，feature set1 中第i个特征值对应feature set2中的第index_1st_best个特征点
+            result->at(block_begin + j) = nn_result.index_1st_best;
+            if (ratios != nullptr)
+                ratios->at(block_begin + j) = square_ratio;
+        }
     }
 }
 
@@ -176,7 +193,7 @@ Matching::twoway_match (Options const& options,
 {
     // 从feature set 2 中计算feature sets 1中每个特征点的最近邻居
     Matching::oneway_match(options, set_1, set_1_size,
-        set_2, set_2_size, &matches->matches_1_2);
+        set_2, set_2_size, &matches->matches_1_2, &matches->ratios_1_2);
 
     // 从feature set 1 中计算feature sets 2中每个特征点的最近邻
     Matching::oneway_match(options, set_2, set_2_size,
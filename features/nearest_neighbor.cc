@@ -39,253 +39,808 @@
 
 #include <algorithm>
 #include <iostream>
-#include <emmintrin.h> // SSE2
-#include <pmmintrin.h> // SSE3
+#include <vector>
 
+/*
+ * The SSE, AVX2 and AVX-512 kernels are compiled with function level target
+ * attributes and selected at runtime, independent of the compiler flags.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define NN_RUNTIME_DISPATCH 1
+#   define NN_TARGET(isa) __attribute__((target(isa)))
+#   include <immintrin.h> // SSE2, SSE3, AVX2, AVX-512
+#else
+#   define NN_RUNTIME_DISPATCH 0
+#endif
+
+#define NN_SSE2_KERNELS (NN_RUNTIME_DISPATCH && ENABLE_SSE2_NN_SEARCH)
+#define NN_SSE3_KERNELS (NN_RUNTIME_DISPATCH && ENABLE_SSE3_NN_SEARCH)
+#define NN_AVX2_KERNELS (NN_RUNTIME_DISPATCH && ENABLE_AVX2_NN_SEARCH)
+#define NN_AVX512_KERNELS (NN_RUNTIME_DISPATCH && ENABLE_AVX512_NN_SEARCH)
+#define NN_AVX512_TARGET "avx512f,avx512bw,avx512vnni"
+
+#include "util/system.h"
 #include "features/nearest_neighbor.h"
 
 FEATURES_NAMESPACE_BEGIN
 
 namespace
 {
+    /* Number of candidates processed at once by the kernels. */
+    int const BLOCK_SIZE = 4;
+    /* Maximum number of queries processed at once by the kernels. */
+    int const QUERY_BLOCK_SIZE = 2;
+    /* Size of a tile of candidates which is kept in the L1 cache. */
+    int const TILE_BYTES = 16 * 1024;
+
+    /* Largest and second largest inner product and their candidates. */
+    template <typename V>
+    struct BestInnerProducts
+    {
+        BestInnerProducts (void);
+
+        V value_1st_best;
+        V value_2nd_best;
+        int index_1st_best;
+        int index_2nd_best;
+    };
+
+    /* Initialized as in the original search, i.e. zero inner products. */
+    template <typename V>
+    inline
+    BestInnerProducts<V>::BestInnerProducts (void)
+        : value_1st_best(V(0))
+        , value_2nd_best(V(0))
+        , index_1st_best(0)
+        , index_2nd_best(0)
+    {
+    }
+
     /*
-     * Signed and unsigned short inner product implementation. Stores the
-     * largest and second largest inner product of query with elements.
-     *
-     * For SSE query and result should be 16 byte aligned.
-     * Otherwise loading and storing values into/from registers is slow.
-     * The dimension size must be divisible by 8, each __m128i register
-     * can load 8 shorts = 16 bytes = 128 bit.
+     * Updates the best inner products with the inner products of a block of
+     * candidates. Candidates are visited in order, ties are resolved in favor
+     * of later candidates. Most blocks are rejected with a single comparison.
      */
-    template <typename T>
-    void
-    short_inner_prod (T const* query,
-        typename NearestNeighbor<T>::Result* result,
-        T const* elements, int num_elements, int dimensions)
-    {
-#if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
-        /* Using a constant number reduces computation time by about 1/3. */
-        int const dim_8 = dimensions / 8;
-        __m128i const* descr_ptr = reinterpret_cast<__m128i const*>(elements);
-        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+    template <typename V>
+    inline void
+    update_best (V const* inner_products, int block_size, int first_index,
+        BestInnerProducts<V>* best)
+    {
+        V block_max = inner_products[0];
+        for (int k = 1; k < block_size; ++k)
+            block_max = std::max(block_max, inner_products[k]);
+        if (block_max < best->value_2nd_best)
+            return;
+
+        for (int k = 0; k < block_size; ++k)
         {
-            /* Compute dot product between query and candidate. */
-            __m128i const* query_ptr = reinterpret_cast<__m128i const*>(query);
-            __m128i reg_result = _mm_set1_epi16(0);
-            for (int i = 0; i < dim_8; ++i, ++query_ptr, ++descr_ptr)
+            V const inner_product = inner_products[k];
+            if (inner_product < best->value_2nd_best)
+                continue;
+            if (inner_product >= best->value_1st_best)
             {
-                __m128i reg_query = _mm_load_si128(query_ptr);
-                __m128i reg_subject = _mm_load_si128(descr_ptr);
-                reg_result = _mm_add_epi16(reg_result,
-                    _mm_mullo_epi16(reg_query, reg_subject));
+                best->index_2nd_best = best->index_1st_best;
+                best->value_2nd_best = best->value_1st_best;
+                best->index_1st_best = first_index + k;
+                best->value_1st_best = inner_product;
             }
-            T const* tmp = reinterpret_cast<T const*>(&reg_result);
-            int inner_product = tmp[0] + tmp[1] + tmp[2] + tmp[3]
-                + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+            else
+            {
+                best->index_2nd_best = first_index + k;
+                best->value_2nd_best = inner_product;
+            }
+        }
+    }
+
+    /*
+     * A kernel computes the inner products of NQ queries with a block of
+     * candidates, i.e. a small NQ x BLOCK_SIZE matrix product. Inner products
+     * are stored row by row for each query. The 16 bit and 8 bit kernels
+     * take 16 bit queries, unsigned short values must be below 2^15.
+     * All kernels read queries and candidates with unaligned loads.
+     */
+    template <typename Q, typename E, typename V>
+    struct Kernels
+    {
+        typedef void (*Func) (Q const* const* queries,
+            E const* const* candidates, int dimensions, V* inner_products);
+
+        /* Kernels for a single query and for QUERY_BLOCK_SIZE queries. */
+        Func single;
+        Func pair;
+    };
+
+    typedef Kernels<short, short, int> ShortKernels;
+    typedef Kernels<short, unsigned char, int> ByteKernels;
+    typedef Kernels<float, float, float> FloatKernels;
+
+    /*
+     * Linear scan over all elements for a block of queries. The elements are
+     * processed in tiles which stay in cache while all queries are matched
+     * against the tile. Within a tile, pairs of queries are matched against
+     * blocks of candidates. Candidates are visited in order for each query,
+     * the result is identical to matching the queries one by one.
+     */
+    template <typename Q, typename E, typename V>
+    void
+    inner_prod_scan (Kernels<Q, E, V> const& kernels, Q const* queries,
+        int num_queries, E const* elements, int num_elements, int dimensions,
+        BestInnerProducts<V>* best)
+    {
+        int const tile_size = std::max(BLOCK_SIZE, TILE_BYTES
+            / (dimensions * (int)sizeof(E)) / BLOCK_SIZE * BLOCK_SIZE);
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product >= result->dist_2nd_best)
+        for (int tile_begin = 0; tile_begin < num_elements;
+            tile_begin += tile_size)
+        {
+            int const tile_end = std::min(num_elements, tile_begin + tile_size);
+            for (int q = 0; q < num_queries; q += QUERY_BLOCK_SIZE)
             {
-                if (inner_product >= result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = descr_iter;
-                    result->dist_1st_best = inner_product;
-                }
-                else
+                int const query_block_size
+                    = std::min(QUERY_BLOCK_SIZE, num_queries - q);
+                Q const* query_ptrs[QUERY_BLOCK_SIZE];
+                for (int j = 0; j < QUERY_BLOCK_SIZE; ++j)
+                    query_ptrs[j] = queries + (q + std::min(j,
+                        query_block_size - 1)) * dimensions;
+                typename Kernels<Q, E, V>::Func kernel
+                    = query_block_size == QUERY_BLOCK_SIZE
+                    ? kernels.pair : kernels.single;
+
+                for (int i = tile_begin; i < tile_end; i += BLOCK_SIZE)
                 {
-                    result->index_2nd_best = descr_iter;
-                    result->dist_2nd_best = inner_product;
+                    /* The last block is padded with the last candidate. */
+                    int const block_size = std::min(BLOCK_SIZE, tile_end - i);
+                    E const* candidates[BLOCK_SIZE];
+                    for (int k = 0; k < BLOCK_SIZE; ++k)
+                        candidates[k] = elements
+                            + (i + std::min(k, block_size - 1)) * dimensions;
+
+                    V inner_products[QUERY_BLOCK_SIZE * BLOCK_SIZE];
+                    kernel(query_ptrs, candidates, dimensions, inner_products);
+                    for (int j = 0; j < query_block_size; ++j)
+                        update_best(inner_products + j * BLOCK_SIZE,
+                            block_size, i, best + q + j);
                 }
             }
         }
-#else
-        T const* descr_ptr = elements;
-        for (int i = 0; i < num_elements; ++i)
+    }
+
+    /* ------------------------- Scalar kernels ------------------------- */
+
+    template <int NQ, typename Q, typename E, typename V>
+    void
+    inner_prod_scalar (Q const* const* queries, E const* const* candidates,
+        int dimensions, V* inner_products)
+    {
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                V sum = V(0);
+                for (int i = 0; i < dimensions; ++i)
+                    sum += queries[j][i] * candidates[k][i];
+                inner_products[j * BLOCK_SIZE + k] = sum;
+            }
+    }
+
+    /* --------------------------- SSE kernels -------------------------- */
+
+#if NN_SSE2_KERNELS
+    /* Sums each of the four registers, result is (sum0, .., sum3). */
+    NN_TARGET("sse2")
+    inline __m128i
+    horizontal_sum (__m128i a0, __m128i a1, __m128i a2, __m128i a3)
+    {
+        __m128i const s01 = _mm_add_epi32(_mm_unpacklo_epi32(a0, a1),
+            _mm_unpackhi_epi32(a0, a1));
+        __m128i const s23 = _mm_add_epi32(_mm_unpacklo_epi32(a2, a3),
+            _mm_unpackhi_epi32(a2, a3));
+        return _mm_add_epi32(_mm_unpacklo_epi64(s01, s23),
+            _mm_unpackhi_epi64(s01, s23));
+    }
+
+    template <int NQ>
+    NN_TARGET("sse2")
+    void
+    inner_prod_short_sse2 (short const* const* queries,
+        short const* const* candidates, int dimensions, int* inner_products)
+    {
+        __m128i sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm_setzero_si128();
+        for (int i = 0; i < dimensions; i += 8)
         {
-            int inner_product = 0;
-            for (int i = 0; i < dimensions; ++i, ++descr_ptr)
-                inner_product += query[i] * *descr_ptr;
+            __m128i reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(queries[j] + i));
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m128i const reg_subject = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(candidates[k] + i));
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm_add_epi32(sum[j][k],
+                        _mm_madd_epi16(reg_query[j], reg_subject));
+            }
+        }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(inner_products
+                + j * BLOCK_SIZE), horizontal_sum(sum[j][0], sum[j][1],
+                sum[j][2], sum[j][3]));
+    }
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product >= result->dist_2nd_best)
+    template <int NQ>
+    NN_TARGET("sse2")
+    void
+    inner_prod_byte_sse2 (short const* const* queries,
+        unsigned char const* const* candidates, int dimensions,
+        int* inner_products)
+    {
+        __m128i const zero = _mm_setzero_si128();
+        __m128i sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm_setzero_si128();
+        for (int i = 0; i < dimensions; i += 16)
+        {
+            __m128i query_lo[NQ], query_hi[NQ];
+            for (int j = 0; j < NQ; ++j)
             {
-                if (inner_product >= result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = i;
-                    result->dist_1st_best = inner_product;
-                }
-                else
+                query_lo[j] = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(queries[j] + i));
+                query_hi[j] = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(queries[j] + i + 8));
+            }
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m128i const reg_subject = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(candidates[k] + i));
+                __m128i const subject_lo = _mm_unpacklo_epi8(reg_subject, zero);
+                __m128i const subject_hi = _mm_unpackhi_epi8(reg_subject, zero);
+                for (int j = 0; j < NQ; ++j)
                 {
-                    result->index_2nd_best = i;
-                    result->dist_2nd_best = inner_product;
+                    sum[j][k] = _mm_add_epi32(sum[j][k],
+                        _mm_madd_epi16(query_lo[j], subject_lo));
+                    sum[j][k] = _mm_add_epi32(sum[j][k],
+                        _mm_madd_epi16(query_hi[j], subject_hi));
                 }
             }
         }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(inner_products
+                + j * BLOCK_SIZE), horizontal_sum(sum[j][0], sum[j][1],
+                sum[j][2], sum[j][3]));
+    }
 #endif
+
+#if NN_SSE3_KERNELS
+    /* Sums each of the four registers, result is (sum0, .., sum3). */
+    NN_TARGET("sse3")
+    inline __m128
+    horizontal_sum (__m128 a0, __m128 a1, __m128 a2, __m128 a3)
+    {
+        return _mm_hadd_ps(_mm_hadd_ps(a0, a1), _mm_hadd_ps(a2, a3));
     }
 
-    /*
-     * Float inner product implementation. Stores the largest and
-     * second largest inner product of query with elements.
-     *
-     * For SSE query and result should be 16 byte aligned.
-     * Otherwise loading and storing values into/from registers is slow.
-     * The dimension size must be divisible by 4, each __m128i register
-     * can load 4 shorts = 16 bytes = 128 bit.
-     */
+    template <int NQ>
+    NN_TARGET("sse3")
     void
-    float_inner_prod (float const* query,
-        NearestNeighbor<float>::Result* result,
-        float const* elements, int num_elements, int dimensions)
+    inner_prod_float_sse3 (float const* const* queries,
+        float const* const* candidates, int dimensions, float* inner_products)
     {
-#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
-    /*
-         * SSE inner product implementation.
-         * Note that query and result should be 16 byte aligned.
-         * Otherwise loading and storing values into/from registers is slow.
-         * The dimension size must be divisible by 4, each __m128 register
-         * can load 4 floats = 16 bytes = 128 bit.
-         */
-
-        __m128 const* descr_ptr = reinterpret_cast<__m128 const*>(elements);
-        int const dim_4 = dimensions / 4;
-        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        __m128 sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm_setzero_ps();
+        for (int i = 0; i < dimensions; i += 4)
         {
-            /* Compute dot product between query and candidate. */
-            __m128 const* query_ptr = reinterpret_cast<__m128 const*>(query);
-            __m128 sum = _mm_setzero_ps();
-            for (int i = 0; i < dim_4; ++i, ++query_ptr, ++descr_ptr)
-                sum = _mm_add_ps(sum, _mm_mul_ps(*query_ptr, *descr_ptr));
-            sum = _mm_hadd_ps(sum, sum);
-            sum = _mm_hadd_ps(sum, sum);
-
-            /* Check if new largest inner product has been found. */
-            float inner_product = _mm_cvtss_f32(sum);
-            if (inner_product >= result->dist_2nd_best)
+            __m128 reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm_loadu_ps(queries[j] + i);
+            for (int k = 0; k < BLOCK_SIZE; ++k)
             {
-                if (inner_product >= result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = descr_iter;
-                    result->dist_1st_best = inner_product;
-                }
-                else
-                {
-                    result->index_2nd_best = descr_iter;
-                    result->dist_2nd_best = inner_product;
-                }
+                __m128 const reg_subject = _mm_loadu_ps(candidates[k] + i);
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm_add_ps(sum[j][k],
+                        _mm_mul_ps(reg_query[j], reg_subject));
             }
         }
-#else
-        float const* descr_ptr = elements;
-        for (int i = 0; i < num_elements; ++i)
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_ps(inner_products + j * BLOCK_SIZE, horizontal_sum(
+                sum[j][0], sum[j][1], sum[j][2], sum[j][3]));
+    }
+#endif
+
+    /* -------------------------- AVX2 kernels -------------------------- */
+
+#if NN_AVX2_KERNELS
+    NN_TARGET("avx2")
+    inline __m128i
+    fold (__m256i a)
+    {
+        return _mm_add_epi32(_mm256_castsi256_si128(a),
+            _mm256_extracti128_si256(a, 1));
+    }
+
+    NN_TARGET("avx2")
+    inline __m128
+    fold (__m256 a)
+    {
+        return _mm_add_ps(_mm256_castps256_ps128(a),
+            _mm256_extractf128_ps(a, 1));
+    }
+
+    template <int NQ>
+    NN_TARGET("avx2")
+    void
+    inner_prod_short_avx2 (short const* const* queries,
+        short const* const* candidates, int dimensions, int* inner_products)
+    {
+        __m256i sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm256_setzero_si256();
+        for (int i = 0; i < dimensions; i += 16)
         {
-            float inner_product = 0.0f;
-            for (int j = 0; j < dimensions; ++j, ++descr_ptr)
-                inner_product += query[j] * *descr_ptr;
+            __m256i reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(queries[j] + i));
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m256i const reg_subject = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(candidates[k] + i));
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm256_add_epi32(sum[j][k],
+                        _mm256_madd_epi16(reg_query[j], reg_subject));
+            }
+        }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(inner_products
+                + j * BLOCK_SIZE), horizontal_sum(fold(sum[j][0]),
+                fold(sum[j][1]), fold(sum[j][2]), fold(sum[j][3])));
+    }
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product >= result->dist_2nd_best)
+    template <int NQ>
+    NN_TARGET("avx2")
+    void
+    inner_prod_byte_avx2 (short const* const* queries,
+        unsigned char const* const* candidates, int dimensions,
+        int* inner_products)
+    {
+        __m256i sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm256_setzero_si256();
+        for (int i = 0; i < dimensions; i += 16)
+        {
+            __m256i reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(queries[j] + i));
+            for (int k = 0; k < BLOCK_SIZE; ++k)
             {
-                if (inner_product >= result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = i;
-                    result->dist_1st_best = inner_product;
-                }
-                else
-                {
-                    result->index_2nd_best = i;
-                    result->dist_2nd_best = inner_product;
-                }
+                __m256i const reg_subject = _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128(reinterpret_cast<__m128i const*>(
+                    candidates[k] + i)));
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm256_add_epi32(sum[j][k],
+                        _mm256_madd_epi16(reg_query[j], reg_subject));
             }
         }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(inner_products
+                + j * BLOCK_SIZE), horizontal_sum(fold(sum[j][0]),
+                fold(sum[j][1]), fold(sum[j][2]), fold(sum[j][3])));
+    }
+
+    template <int NQ>
+    NN_TARGET("avx2")
+    void
+    inner_prod_float_avx2 (float const* const* queries,
+        float const* const* candidates, int dimensions, float* inner_products)
+    {
+        __m256 sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm256_setzero_ps();
+        for (int i = 0; i < dimensions; i += 8)
+        {
+            __m256 reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm256_loadu_ps(queries[j] + i);
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m256 const reg_subject = _mm256_loadu_ps(candidates[k] + i);
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm256_add_ps(sum[j][k],
+                        _mm256_mul_ps(reg_query[j], reg_subject));
+            }
+        }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_ps(inner_products + j * BLOCK_SIZE, horizontal_sum(
+                fold(sum[j][0]), fold(sum[j][1]), fold(sum[j][2]),
+                fold(sum[j][3])));
+    }
 #endif
+
+    /* ------------------------- AVX-512 kernels ------------------------ */
+
+#if NN_AVX512_KERNELS
+    NN_TARGET(NN_AVX512_TARGET)
+    inline __m128i
+    fold (__m512i a)
+    {
+        return fold(_mm256_add_epi32(_mm512_castsi512_si256(a),
+            _mm512_extracti64x4_epi64(a, 1)));
     }
 
-}
+    NN_TARGET(NN_AVX512_TARGET)
+    inline __m128
+    fold (__m512 a)
+    {
+        return fold(_mm256_add_ps(_mm512_castps512_ps256(a),
+            _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1))));
+    }
 
-template <>
-void
-NearestNeighbor<short>::find (short const* query,
-    NearestNeighbor<short>::Result* result) const
-{
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = 0;
-    result->dist_2nd_best = 0;
-    result->index_1st_best = 0;
-    result->index_2nd_best = 0;
+    template <int NQ>
+    NN_TARGET(NN_AVX512_TARGET)
+    void
+    inner_prod_short_avx512 (short const* const* queries,
+        short const* const* candidates, int dimensions, int* inner_products)
+    {
+        __m512i sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm512_setzero_si512();
+        for (int i = 0; i < dimensions; i += 32)
+        {
+            __m512i reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm512_loadu_si512(queries[j] + i);
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m512i const reg_subject
+                    = _mm512_loadu_si512(candidates[k] + i);
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm512_dpwssd_epi32(sum[j][k],
+                        reg_query[j], reg_subject);
+            }
+        }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(inner_products
+                + j * BLOCK_SIZE), horizontal_sum(fold(sum[j][0]),
+                fold(sum[j][1]), fold(sum[j][2]), fold(sum[j][3])));
+    }
+
+    template <int NQ>
+    NN_TARGET(NN_AVX512_TARGET)
+    void
+    inner_prod_byte_avx512 (short const* const* queries,
+        unsigned char const* const* candidates, int dimensions,
+        int* inner_products)
+    {
+        __m512i sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm512_setzero_si512();
+        for (int i = 0; i < dimensions; i += 32)
+        {
+            __m512i reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm512_loadu_si512(queries[j] + i);
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m512i const reg_subject = _mm512_cvtepu8_epi16(
+                    _mm256_loadu_si256(reinterpret_cast<__m256i const*>(
+                    candidates[k] + i)));
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm512_dpwssd_epi32(sum[j][k],
+                        reg_query[j], reg_subject);
+            }
+        }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(inner_products
+                + j * BLOCK_SIZE), horizontal_sum(fold(sum[j][0]),
+                fold(sum[j][1]), fold(sum[j][2]), fold(sum[j][3])));
+    }
+
+    template <int NQ>
+    NN_TARGET(NN_AVX512_TARGET)
+    void
+    inner_prod_float_avx512 (float const* const* queries,
+        float const* const* candidates, int dimensions, float* inner_products)
+    {
+        __m512 sum[NQ][BLOCK_SIZE];
+        for (int j = 0; j < NQ; ++j)
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+                sum[j][k] = _mm512_setzero_ps();
+        for (int i = 0; i < dimensions; i += 16)
+        {
+            __m512 reg_query[NQ];
+            for (int j = 0; j < NQ; ++j)
+                reg_query[j] = _mm512_loadu_ps(queries[j] + i);
+            for (int k = 0; k < BLOCK_SIZE; ++k)
+            {
+                __m512 const reg_subject = _mm512_loadu_ps(candidates[k] + i);
+                for (int j = 0; j < NQ; ++j)
+                    sum[j][k] = _mm512_add_ps(sum[j][k],
+                        _mm512_mul_ps(reg_query[j], reg_subject));
+            }
+        }
+        for (int j = 0; j < NQ; ++j)
+            _mm_storeu_ps(inner_products + j * BLOCK_SIZE, horizontal_sum(
+                fold(sum[j][0]), fold(sum[j][1]), fold(sum[j][2]),
+                fold(sum[j][3])));
+    }
+#endif
 
-    short_inner_prod<short>(query, result, this->elements,
-        this->num_elements, this->dimensions);
+    /* ------------------------ Kernel selection ------------------------ */
+
+    /* Maps AUTO and unsupported backends to the best supported backend. */
+    NearestNeighborBackend
+    resolve_backend (NearestNeighborBackend backend)
+    {
+        if (backend == NN_BACKEND_AUTO)
+            return nearest_neighbor_best_backend();
+        while (!nearest_neighbor_backend_supported(backend))
+            backend = static_cast<NearestNeighborBackend>(backend - 1);
+        return backend;
+    }
+
+    ShortKernels
+    select_kernels (NearestNeighborBackend backend, int dimensions,
+        short const* /*tag*/)
+    {
+        backend = resolve_backend(backend);
+#if NN_AVX512_KERNELS
+        if (backend >= NN_BACKEND_AVX512 && dimensions % 32 == 0)
+            return { inner_prod_short_avx512<1>,
+                inner_prod_short_avx512<QUERY_BLOCK_SIZE> };
+#endif
+#if NN_AVX2_KERNELS
+        if (backend >= NN_BACKEND_AVX2 && dimensions % 16 == 0)
+            return { inner_prod_short_avx2<1>,
+                inner_prod_short_avx2<QUERY_BLOCK_SIZE> };
+#endif
+#if NN_SSE2_KERNELS
+        if (backend >= NN_BACKEND_SSE && dimensions % 8 == 0)
+            return { inner_prod_short_sse2<1>,
+                inner_prod_short_sse2<QUERY_BLOCK_SIZE> };
+#endif
+        return { inner_prod_scalar<1, short, short, int>,
+            inner_prod_scalar<QUERY_BLOCK_SIZE, short, short, int> };
+    }
+
+    ByteKernels
+    select_kernels (NearestNeighborBackend backend, int dimensions,
+        unsigned char const* /*tag*/)
+    {
+        backend = resolve_backend(backend);
+#if NN_AVX512_KERNELS
+        if (backend >= NN_BACKEND_AVX512 && dimensions % 32 == 0)
+            return { inner_prod_byte_avx512<1>,
+                inner_prod_byte_avx512<QUERY_BLOCK_SIZE> };
+#endif
+#if NN_AVX2_KERNELS
+        if (backend >= NN_BACKEND_AVX2 && dimensions % 16 == 0)
+            return { inner_prod_byte_avx2<1>,
+                inner_prod_byte_avx2<QUERY_BLOCK_SIZE> };
+#endif
+#if NN_SSE2_KERNELS
+        if (backend >= NN_BACKEND_SSE && dimensions % 16 == 0)
+            return { inner_prod_byte_sse2<1>,
+                inner_prod_byte_sse2<QUERY_BLOCK_SIZE> };
+#endif
+        return { inner_prod_scalar<1, short, unsigned char, int>,
+            inner_prod_scalar<QUERY_BLOCK_SIZE, short, unsigned char, int> };
+    }
+
+    FloatKernels
+    select_kernels (NearestNeighborBackend backend, int dimensions,
+        float const* /*tag*/)
+    {
+        backend = resolve_backend(backend);
+#if NN_AVX512_KERNELS
+        if (backend >= NN_BACKEND_AVX512 && dimensions % 16 == 0)
+            return { inner_prod_float_avx512<1>,
+                inner_prod_float_avx512<QUERY_BLOCK_SIZE> };
+#endif
+#if NN_AVX2_KERNELS
+        if (backend >= NN_BACKEND_AVX2 && dimensions % 8 == 0)
+            return { inner_prod_float_avx2<1>,
+                inner_prod_float_avx2<QUERY_BLOCK_SIZE> };
+#endif
+#if NN_SSE3_KERNELS
+        if (backend >= NN_BACKEND_SSE && dimensions % 4 == 0)
+            return { inner_prod_float_sse3<1>,
+                inner_prod_float_sse3<QUERY_BLOCK_SIZE> };
+#endif
+        return { inner_prod_scalar<1, float, float, float>,
+            inner_prod_scalar<QUERY_BLOCK_SIZE, float, float, float> };
+    }
+
+    /* -------------------- Inner products to distances ----------------- */
 
     /*
-     * Compute actual square distances.
      * The distance with 'signed char' vectors is: 2 * 127^2 - 2 * <Q, Ci>.
      * The maximum distance is (2*127)^2, which unfortunately does not fit
      * in a signed short. Therefore, the distance is clapmed at 127^2.
      */
-    result->dist_1st_best = std::min(16129, std::max(0, (int)result->dist_1st_best));
-    result->dist_2nd_best = std::min(16129, std::max(0, (int)result->dist_2nd_best));
-    result->dist_1st_best = 32258 - 2 * result->dist_1st_best;
-    result->dist_2nd_best = 32258 - 2 * result->dist_2nd_best;
-}
-
-template <>
-void
-NearestNeighbor<unsigned short>::find (unsigned short const* query,
-    NearestNeighbor<unsigned short>::Result* result) const
-{
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = 0;
-    result->dist_2nd_best = 0;
-    result->index_1st_best = 0;
-    result->index_2nd_best = 0;
-
-    short_inner_prod<unsigned short>(query, result, this->elements,
-        this->num_elements, this->dimensions);
+    void
+    convert_result (BestInnerProducts<int> const& best,
+        NearestNeighbor<short>::Result* result)
+    {
+        result->dist_1st_best = 32258 - 2 * std::min(16129, best.value_1st_best);
+        result->dist_2nd_best = 32258 - 2 * std::min(16129, best.value_2nd_best);
+        result->index_1st_best = best.index_1st_best;
+        result->index_2nd_best = best.index_2nd_best;
+    }
 
     /*
-     * Compute actual square distances.
      * The distance with 'unsigned char' vectors is: 2 * 255^2 - 2 * <Q, Ci>.
      * The maximum distance is (2*255)^2, which unfortunately does not fit
      * in a unsigned short. Therefore, the result distance is clapmed:
      * 2 * 255^2 - 2 * <Q, Ci> = 2 * (255^2 - <Q, Ci>) and (255^2 - <Q, Ci>)
-     * is clamped to 32767 and then multiplied by 2.
+     * is clamped to 32767 and then multiplied by 2. This is used for both
+     * unsigned short and unsigned char elements.
+     */
+    template <typename RESULT>
+    void
+    convert_result (BestInnerProducts<int> const& best, RESULT* result)
+    {
+        int const dist_1st_best = 65025 - std::min(65025, best.value_1st_best);
+        int const dist_2nd_best = 65025 - std::min(65025, best.value_2nd_best);
+        result->dist_1st_best = std::min(32767, dist_1st_best) * 2;
+        result->dist_2nd_best = std::min(32767, dist_2nd_best) * 2;
+        result->index_1st_best = best.index_1st_best;
+        result->index_2nd_best = best.index_2nd_best;
+    }
+
+    void
+    convert_result (BestInnerProducts<float> const& best,
+        NearestNeighbor<float>::Result* result)
+    {
+        result->dist_1st_best = std::max(0.0f, 2.0f - 2.0f * best.value_1st_best);
+        result->dist_2nd_best = std::max(0.0f, 2.0f - 2.0f * best.value_2nd_best);
+        result->index_1st_best = best.index_1st_best;
+        result->index_2nd_best = best.index_2nd_best;
+    }
+
+    /* Element types are mapped to the kernel query type. */
+    template <typename T>
+    T const*
+    kernel_values (T const* values)
+    {
+        return values;
+    }
+
+    short const*
+    kernel_values (unsigned short const* values)
+    {
+        return reinterpret_cast<short const*>(values);
+    }
+
+    /*
+     * Runs the search for a block of queries with the given kernels.
+     * Queries are processed in chunks to keep the state on the stack.
      */
-    result->dist_1st_best = std::min(65025, (int)result->dist_1st_best);
-    result->dist_2nd_best = std::min(65025, (int)result->dist_2nd_best);
-    result->dist_1st_best = 65025 - result->dist_1st_best;
-    result->dist_2nd_best = 65025 - result->dist_2nd_best;
-    result->dist_1st_best = std::min(32767, (int)result->dist_1st_best) * 2;
-    result->dist_2nd_best = std::min(32767, (int)result->dist_2nd_best) * 2;
+    template <typename Q, typename E, typename V, typename RESULT>
+    void
+    find_nearest (Kernels<Q, E, V> const& kernels, Q const* queries,
+        int num_queries, E const* elements, int num_elements, int dimensions,
+        RESULT* results)
+    {
+        int const chunk_size = 64;
+        BestInnerProducts<V> best[chunk_size];
+        for (int q = 0; q < num_queries; q += chunk_size)
+        {
+            int const num_chunk = std::min(chunk_size, num_queries - q);
+            std::fill(best, best + num_chunk, BestInnerProducts<V>());
+            inner_prod_scan(kernels, queries + q * dimensions, num_chunk,
+                elements, num_elements, dimensions, best);
+            for (int i = 0; i < num_chunk; ++i)
+                convert_result(best[i], results + q + i);
+        }
+    }
 }
 
-template <>
+/* ---------------------------------------------------------------- */
+
+bool
+nearest_neighbor_backend_supported (NearestNeighborBackend backend)
+{
+    switch (backend)
+    {
+        case NN_BACKEND_AUTO:
+        case NN_BACKEND_SCALAR:
+            return true;
+        case NN_BACKEND_SSE:
+            return NN_SSE2_KERNELS && NN_SSE3_KERNELS
+                && util::system::cpu_has_sse3();
+        case NN_BACKEND_AVX2:
+            return NN_AVX2_KERNELS && util::system::cpu_has_avx2();
+        case NN_BACKEND_AVX512:
+            return NN_AVX512_KERNELS && util::system::cpu_has_avx512_vnni();
+        default:
+            return false;
+    }
+}
+
+NearestNeighborBackend
+nearest_neighbor_best_backend (void)
+{
+    static NearestNeighborBackend const best = []
+    {
+        NearestNeighborBackend backend = NN_BACKEND_AVX512;
+        while (!nearest_neighbor_backend_supported(backend))
+            backend = static_cast<NearestNeighborBackend>(backend - 1);
+        return backend;
+    }();
+    return best;
+}
+
+char const*
+nearest_neighbor_backend_name (NearestNeighborBackend backend)
+{
+    switch (backend)
+    {
+        case NN_BACKEND_AUTO: return "auto";
+        case NN_BACKEND_SCALAR: return "scalar";
+        case NN_BACKEND_SSE: return "SSE";
+        case NN_BACKEND_AVX2: return "AVX2";
+        case NN_BACKEND_AVX512: return "AVX-512";
+        default: return "unknown";
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+template <typename T>
 void
-NearestNeighbor<float>::find (float const* query,
-    NearestNeighbor<float>::Result* result) const
+NearestNeighbor<T>::find (T const* query, Result* result) const
 {
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = 0.0f;
-    result->dist_2nd_best = 0.0f;
-    result->index_1st_best = 0;
-    result->index_2nd_best = 0;
+    this->find_block(query, 1, result);
+}
 
-    float_inner_prod(query, result, this->elements,
-        this->num_elements, this->dimensions);
+template <typename T>
+void
+NearestNeighbor<T>::find_block (T const* queries, int num_queries,
+    Result* results) const
+{
+    /* Result distances are computed from the largest inner products. */
+    find_nearest(select_kernels(this->backend, this->dimensions,
+        kernel_values(this->elements)), kernel_values(queries), num_queries,
+        kernel_values(this->elements), this->num_elements,
+        this->dimensions, results);
+}
 
-    /*
-     * Compute actual (square) distances.
-     */
-    result->dist_1st_best = std::max(0.0f, 2.0f - 2.0f * result->dist_1st_best);
-    result->dist_2nd_best = std::max(0.0f, 2.0f - 2.0f * result->dist_2nd_best);
+template <>
+void
+NearestNeighbor<unsigned char>::find_block (unsigned char const* queries,
+    int num_queries, Result* results) const
+{
+    /* Widen the queries once, small blocks fit into the stack buffer. */
+    int const num_values = num_queries * this->dimensions;
+    int const stack_values = 512;
+    short stack_queries[stack_values];
+    std::vector<short> heap_queries;
+    short* wide_queries = stack_queries;
+    if (num_values > stack_values)
+    {
+        heap_queries.resize(num_values);
+        wide_queries = &heap_queries[0];
+    }
+    std::copy(queries, queries + num_values, wide_queries);
+
+    find_nearest(select_kernels(this->backend,
+        this->dimensions, this->elements), wide_queries, num_queries,
+        this->elements, this->num_elements, this->dimensions, results);
 }
 
+template class NearestNeighbor<short>;
+template class NearestNeighbor<unsigned short>;
+template class NearestNeighbor<unsigned char>;
+template class NearestNeighbor<float>;
+
 FEATURES_NAMESPACE_END
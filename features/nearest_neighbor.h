@@ -12,11 +12,50 @@
 
 #include "features/defines.h"
 
+/* Kernels selected at runtime depending on the host CPU (x86, GCC/Clang). */
 #define ENABLE_SSE2_NN_SEARCH 1
 #define ENABLE_SSE3_NN_SEARCH 1
+#define ENABLE_AVX2_NN_SEARCH 1
+#define ENABLE_AVX512_NN_SEARCH 1
 
 FEATURES_NAMESPACE_BEGIN
 
+/**
+ * Instruction sets for the nearest neighbor kernels, ordered by capability.
+ * SSE uses SSE2 for integer and SSE3 for float elements, AVX-512 requires
+ * the BW and VNNI extensions.
+ */
+enum NearestNeighborBackend
+{
+    NN_BACKEND_AUTO,
+    NN_BACKEND_SCALAR,
+    NN_BACKEND_SSE,
+    NN_BACKEND_AVX2,
+    NN_BACKEND_AVX512
+};
+
+/** Returns whether the backend is compiled in and supported by the CPU. */
+bool nearest_neighbor_backend_supported (NearestNeighborBackend backend);
+
+/** Returns the most capable backend supported by the CPU. */
+NearestNeighborBackend nearest_neighbor_best_backend (void);
+
+/** Returns a human readable name for the backend. */
+char const* nearest_neighbor_backend_name (NearestNeighborBackend backend);
+
+/** Maps the element type to the type of the reported distances. */
+template <typename T>
+struct NearestNeighborDistance
+{
+    typedef T Type;
+};
+
+template <>
+struct NearestNeighborDistance<unsigned char>
+{
+    typedef unsigned short Type;
+};
+
 /**
  * Nearest (and second nearest) neighbor search for normalized vectors.
  *
@@ -30,27 +69,41 @@ FEATURES_NAMESPACE_BEGIN
  * Thus, we want to quickly compute and find the largest inner product <Q, Ci>
  * corresponding to the smallest distance.
  *
- * Notes: For SSE accellerated dot products, vector dimension must be a factor
- * of 8 (i.e. 128 bit registers for SSE). Query and elements must be 16 byte
- * aligned for efficient memory access.
+ * The inner products are computed by vectorized kernels which are selected
+ * at runtime for the host CPU, see NearestNeighborBackend. Kernels compute
+ * small matrix products of up to two queries and four candidates, which
+ * shares the loads between queries and candidates.
+ * Integer kernels accumulate in 32 bit and yield identical results on all
+ * backends. Float results may differ in the last bits between backends due
+ * to the summation order. Query and elements need no particular alignment.
+ * Vectorized kernels require the dimension to be a multiple of 8 (SSE),
+ * 16 (AVX2) and 32 (AVX-512) for short, 16, 16 and 32 for unsigned char,
+ * and 4, 8 and 16 for float elements. Otherwise the next less capable
+ * backend is used.
  *
  * The following types are supported:
- *   - signed short using SSE2
+ *   - signed short
  *     value range -127 to 127, normalized to 127, max distance 32258
- *   - unsigend short using SSE2
+ *   - unsigend short
  *     value range 0 to 255, normalized to 255, max distance 65534
- *   - float using SSE3
+ *   - unsigned char
+ *     value range 0 to 255, normalized to 255, max distance 65534,
+ *     distances are reported as unsigned short.
+ *   - float
  *     any value range, normalized to 1, any distance possible
  */
 template <typename T>
 class NearestNeighbor
 {
 public:
+    /** The type of the distances, wider than T for 8 bit elements. */
+    typedef typename NearestNeighborDistance<T>::Type DistanceType;
+
     /** Unlike the naming suggests, these are square distances. */
     struct Result
     {
-        T dist_1st_best;
-        T dist_2nd_best;
+        DistanceType dist_1st_best;
+        DistanceType dist_2nd_best;
         int index_1st_best;
         int index_2nd_best;
     };
@@ -63,8 +116,18 @@ public:
     void set_element_dimensions (int element_dimensions);
     /** For SfM, this is the number of descriptors. */
     void set_num_elements (int num_elements);
+    /** Sets the kernel backend, defaults to the best supported backend. */
+    void set_backend (NearestNeighborBackend backend);
     /** Find the nearest neighbor of 'query'. */
     void find (T const* query, Result* result) const;
+    /**
+     * Finds the nearest neighbors of 'num_queries' consecutive queries and
+     * stores one result per query. The elements are processed in cache sized
+     * tiles shared by all queries, which is considerably faster than calling
+     * find() for each query if the elements do not fit into the cache.
+     * The results are identical to find().
+     */
+    void find_block (T const* queries, int num_queries, Result* results) const;
 
     int get_element_dimensions (void) const;
 
@@ -72,6 +135,7 @@ private:
     int dimensions;
     int num_elements;
     T const* elements;
+    NearestNeighborBackend backend;
 };
 
 /* ---------------------------------------------------------------- */
@@ -82,6 +146,7 @@ NearestNeighbor<T>::NearestNeighbor (void)
     : dimensions(64)
     , num_elements(0)
     , elements(nullptr)
+    , backend(NN_BACKEND_AUTO)
 {
 }
 
@@ -106,6 +171,13 @@ NearestNeighbor<T>::set_num_elements (int num_elements)
     this->num_elements = num_elements;
 }
 
+template <typename T>
+inline void
+NearestNeighbor<T>::set_backend (NearestNeighborBackend backend)
+{
+    this->backend = backend;
+}
+
 template <typename T>
 inline int
 NearestNeighbor<T>::get_element_dimensions (void) const
@@ -23,6 +23,7 @@ FEATURES_NAMESPACE_BEGIN
 
 Sift::Sift (Options const& options)
     : options(options)
+    , peak_memory(0)
 {
     if (this->options.min_octave < -1
         || this->options.min_octave > this->options.max_octave)
@@ -47,6 +48,8 @@ Sift::process (void)
      * Creates the scale space representation of the image by
      * sampling the scale space and computing the DoG images.
      * See Section 3, 3.2 and 3.3 in SIFT article.
+     * In streaming mode, keypoints and descriptors are extracted for
+     * each octave right after it has been created.
      */
     if (this->options.verbose_output)
     {
@@ -56,6 +59,9 @@ Sift::process (void)
             << this->options.max_octave << ")..." << std::endl;
     }
     timer.reset();
+    this->keypoints.clear();
+    this->descriptors.clear();
+    this->peak_memory = 0;
     this->create_octaves();
     if (this->options.debug_output)
     {
@@ -63,6 +69,19 @@ Sift::process (void)
             << timer.get_elapsed() << "ms." << std::endl;
     }
 
+    if (this->options.stream_octaves)
+    {
+        if (this->options.verbose_output)
+        {
+            std::cout << "SIFT: Generated " << this->descriptors.size()
+                << " descriptors from " << this->keypoints.size()
+                << " keypoints, took " << total_timer.get_elapsed() << "ms, "
+                << (this->peak_memory >> 20) << " MB peak." << std::endl;
+        }
+        this->octaves.clear();
+        return;
+    }
+
     /*
      * Detects local extrema in the DoG function as described in Section 3.1.
      */
@@ -122,7 +141,8 @@ Sift::process (void)
     {
         std::cout << "SIFT: Generated " << this->descriptors.size()
             << " descriptors from " << this->keypoints.size() << " keypoints,"
-            << " took " << total_timer.get_elapsed() << "ms." << std::endl;
+            << " took " << total_timer.get_elapsed() << "ms, "
+            << (this->peak_memory >> 20) << " MB peak." << std::endl;
     }
 
     /* Free memory. */
@@ -182,6 +202,8 @@ Sift::create_octaves (void)
             = core::image::rescale_double_size_supersample<float>(this->orig);
         this->add_octave(img, this->options.inherent_blur_sigma * 2.0f,
             this->options.base_blur_sigma);
+        img.reset();
+        this->finish_octave(0);
     }
 
     /*
@@ -203,8 +225,9 @@ Sift::create_octaves (void)
         //std::cout << "Creating octave " << i << "..." << std::endl;
         this->add_octave(img, img_sigma, this->options.base_blur_sigma);
 
-        core::FloatImage::ConstPtr pre_base = octaves[octaves.size()-1].img[0];
-        img = core::image::rescale_half_size_gaussian<float>(pre_base);
+        img = core::image::rescale_half_size_gaussian<float>
+            (this->octaves.back().img[0]);
+        this->finish_octave(img->get_byte_size());
 
         img_sigma = this->options.base_blur_sigma;
     }
@@ -225,7 +248,7 @@ Sift::add_octave (core::FloatImage::ConstPtr image,
     //std::cout << "Pre-blurring image to sigma " << target_sigma << " (has "
     //    << has_sigma << ", blur = " << sigma << ")..." << std::endl;
     core::FloatImage::Ptr base = (target_sigma > has_sigma
-        ? core::image::blur_gaussian<float>(image, sigma)
+        ? this->scale_space.blur(*image, sigma)
         : image->duplicate());
 
     /* Create the new octave and add initial image. */
@@ -233,6 +256,20 @@ Sift::add_octave (core::FloatImage::ConstPtr image,
     Octave& oct = this->octaves.back();
     oct.img.push_back(base);
 
+    /*
+     * Gradient and orientation images are created with the blurred images.
+     * In streaming mode, they are created after the DoG images have been
+     * released to reduce the peak memory, see finish_octave().
+     */
+    bool const with_gradients = !this->options.stream_octaves;
+    core::FloatImage::Ptr grad, ori;
+    if (with_gradients)
+    {
+        SiftScaleSpace::gradients(*base, &grad, &ori);
+        oct.grad.push_back(grad);
+        oct.ori.push_back(ori);
+    }
+
     /* 'k' is the constant factor between the scales in scale space. */
     float const k = std::pow(2.0f, 1.0f / this->options.num_samples_per_octave);
     sigma = target_sigma;
@@ -244,17 +281,24 @@ Sift::add_octave (core::FloatImage::ConstPtr image,
         float sigmak = sigma * k;
         float blur_sigma = std::sqrt(MATH_POW2(sigmak) - MATH_POW2(sigma));
 
-        /* Blur the image to create a new scale space sample. */
+        /*
+         * Blur the image incrementally to create a new scale space sample.
+         * The Difference of Gaussian image (DoG) and the gradient magnitude
+         * and orientation images are computed in the same pass.
+         */
         //std::cout << "Blurring image to sigma " << sigmak << " (has " << sigma
         //    << ", blur = " << blur_sigma << ")..." << std::endl;
-        core::FloatImage::Ptr img = core::image::blur_gaussian<float>
-            (base, blur_sigma);
+        core::FloatImage::Ptr dog;
+        core::FloatImage::Ptr img = this->scale_space.blur_dog(*base,
+            blur_sigma, &dog, with_gradients ? &grad : nullptr,
+            with_gradients ? &ori : nullptr);
         oct.img.push_back(img);
-
-        /* Create the Difference of Gaussian image (DoG). */
-        //计算差分拉普拉斯 // todo revised by sway
-        core::FloatImage::Ptr dog = core::image::subtract<float>(img, base);
         oct.dog.push_back(dog);
+        if (with_gradients)
+        {
+            oct.grad.push_back(grad);
+            oct.ori.push_back(ori);
+        }
 
         /* Update previous image and sigma for next round. */
         base = img;
@@ -264,45 +308,164 @@ Sift::add_octave (core::FloatImage::ConstPtr image,
 
 /* ---------------------------------------------------------------- */
 
+void
+Sift::finish_octave (std::size_t pending_bytes)
+{
+    /* Track memory of the octaves and the pending next octave base. */
+    this->peak_memory = std::max(this->peak_memory,
+        this->get_octaves_byte_size() + pending_bytes);
+
+    Octave& oct = this->octaves.back();
+    if (!this->options.stream_octaves)
+    {
+        /* The blurred images are not needed once the octave is complete. */
+        oct.img.clear();
+        return;
+    }
+
+    /*
+     * Extract keypoints and descriptors for the last octave only. The
+     * previous octaves have been released already and are skipped by all
+     * stages. The results are appended to the results of earlier octaves,
+     * which yields the same order as processing all octaves at once.
+     */
+    Keypoints octave_keypoints;
+    Descriptors octave_descriptors;
+    std::swap(octave_keypoints, this->keypoints);
+    std::swap(octave_descriptors, this->descriptors);
+
+    this->extrema_detection();
+    this->keypoint_localization();
+    oct.dog.clear();
+
+    /* Replace each blurred image by its gradient and orientation image. */
+    for (std::size_t i = 0; i < oct.img.size(); ++i)
+    {
+        core::FloatImage::Ptr grad, ori;
+        SiftScaleSpace::gradients(*oct.img[i], &grad, &ori);
+        oct.grad.push_back(grad);
+        oct.ori.push_back(ori);
+        this->peak_memory = std::max(this->peak_memory,
+            this->get_octaves_byte_size() + pending_bytes);
+        oct.img[i].reset();
+    }
+    oct.img.clear();
+
+    this->descriptor_generation();
+
+    /* Release the octave, but keep it in place to retain octave indices. */
+    this->octaves.back() = Octave();
+
+    std::swap(octave_keypoints, this->keypoints);
+    std::swap(octave_descriptors, this->descriptors);
+    this->keypoints.insert(this->keypoints.end(),
+        octave_keypoints.begin(), octave_keypoints.end());
+    this->descriptors.insert(this->descriptors.end(),
+        octave_descriptors.begin(), octave_descriptors.end());
+}
+
+/* ---------------------------------------------------------------- */
+
+std::size_t
+Sift::get_octaves_byte_size (void) const
+{
+    std::size_t ret = 0;
+    for (std::size_t i = 0; i < this->octaves.size(); ++i)
+    {
+        Octave const& oct = this->octaves[i];
+        Octave::ImageVector const* images[4]
+            = { &oct.img, &oct.dog, &oct.grad, &oct.ori };
+        for (int j = 0; j < 4; ++j)
+            for (std::size_t k = 0; k < images[j]->size(); ++k)
+                if (images[j]->at(k) != nullptr)
+                    ret += images[j]->at(k)->get_byte_size();
+    }
+    return ret;
+}
+
+/* ---------------------------------------------------------------- */
+
 void
 Sift::extrema_detection (void)
 {
     /* Delete previous keypoints. */
     this->keypoints.clear();
 
-    /* Detect keypoints in each octave... */
+    /*
+     * Split the detection into bands of rows for each octave and each
+     * three subsequent DoG images. Every band detects into its own buffer.
+     * The buffers are concatenated in band order, which yields the same
+     * keypoint order as a sequential scan.
+     */
+    struct ExtremaBand
+    {
+        int octave;
+        int sample;
+        int y_begin;
+        int y_end;
+    };
+
+    int const band_height = 32;
+    std::vector<ExtremaBand> bands;
     for (std::size_t i = 0; i < this->octaves.size(); ++i)
     {
         Octave const& oct(this->octaves[i]);
-        /* In each octave, take three subsequent DoG images and detect. */
         for (int s = 0; s < (int)oct.dog.size() - 2; ++s)
         {
-            core::FloatImage::ConstPtr samples[3] =
-            { oct.dog[s + 0], oct.dog[s + 1], oct.dog[s + 2] };
-            this->extrema_detection(samples, static_cast<int>(i)
-                + this->options.min_octave, s);
+            int const h = oct.dog[s + 1]->height();
+            for (int y = 1; y < h - 1; y += band_height)
+            {
+                ExtremaBand band;
+                band.octave = static_cast<int>(i);
+                band.sample = s;
+                band.y_begin = y;
+                band.y_end = std::min(y + band_height, h - 1);
+                bands.push_back(band);
+            }
         }
     }
+
+    std::vector<Keypoints> band_keypoints(bands.size());
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < bands.size(); ++i)
+    {
+        ExtremaBand const& band = bands[i];
+        Octave const& oct(this->octaves[band.octave]);
+        core::FloatImage::ConstPtr samples[3] =
+        { oct.dog[band.sample + 0], oct.dog[band.sample + 1],
+            oct.dog[band.sample + 2] };
+        this->extrema_detection(samples, band.octave
+            + this->options.min_octave, band.sample,
+            band.y_begin, band.y_end, &band_keypoints[i]);
+    }
+
+    std::size_t num_keypoints = 0;
+    for (std::size_t i = 0; i < band_keypoints.size(); ++i)
+        num_keypoints += band_keypoints[i].size();
+    this->keypoints.reserve(num_keypoints);
+    for (std::size_t i = 0; i < band_keypoints.size(); ++i)
+        this->keypoints.insert(this->keypoints.end(),
+            band_keypoints[i].begin(), band_keypoints[i].end());
 }
 
 /* ---------------------------------------------------------------- */
 
 std::size_t
-Sift::extrema_detection (core::FloatImage::ConstPtr s[3], int oi, int si)
+Sift::extrema_detection (core::FloatImage::ConstPtr s[3], int oi, int si,
+    int y_begin, int y_end, Keypoints* result)
 {
     int const w = s[1]->width();
-    int const h = s[1]->height();
 
     /* Offsets for the 9-neighborhood w.r.t. center pixel. */
     int noff[9] = { -1 - w, 0 - w, 1 - w, -1, 0, 1, -1 + w, 0 + w, 1 + w };
 
     /*
-     * Iterate over all pixels in s[1], and check if pixel is maximum
-     * (or minumum) in its 27-neighborhood.
+     * Iterate over all pixels in the rows [y_begin, y_end) of s[1], and
+     * check if pixel is maximum (or minumum) in its 27-neighborhood.
      */
     int detected = 0;
-    int off = w;
-    for (int y = 1; y < h - 1; ++y, off += w)
+    int off = y_begin * w;
+    for (int y = y_begin; y < y_end; ++y, off += w)
         for (int x = 1; x < w - 1; ++x)
         {
             int idx = off + x;
@@ -331,7 +494,7 @@ Sift::extrema_detection (core::FloatImage::ConstPtr s[3], int oi, int si)
             kp.x = static_cast<float>(x);
             kp.y = static_cast<float>(y);
             kp.sample = static_cast<float>(si);
-            this->keypoints.push_back(kp);
+            result->push_back(kp);
             detected += 1;
         }
 
@@ -346,11 +509,13 @@ Sift::keypoint_localization (void)
     /*
      * Iterate over all keypoints, accurately localize minima and maxima
      * in the DoG function by fitting a quadratic Taylor polynomial
-     * around the keypoint.
+     * around the keypoint. Keypoints are localized independently in
+     * parallel, accepted keypoints are compacted in order afterwards.
      */
 
     int num_singular = 0;
-    int num_keypoints = 0; // Write iterator
+    std::vector<char> accepted(this->keypoints.size(), 0);
+#pragma omp parallel for schedule(dynamic, 256) reduction(+:num_singular)
     for (std::size_t i = 0; i < this->keypoints.size(); ++i)
     {
         /* Copy keypoint. */
@@ -517,12 +682,16 @@ Sift::keypoint_localization (void)
             continue;
         }
 
-        /* Keypoint is accepted, copy to write iter and advance. */
-        this->keypoints[num_keypoints] = kp;
-        num_keypoints += 1;
+        /* Keypoint is accepted, update in place. */
+        this->keypoints[i] = kp;
+        accepted[i] = 1;
     }
 
-    /* Limit vector size to number of accepted keypoints. */
+    /* Compact accepted keypoints and limit the vector size. */
+    std::size_t num_keypoints = 0; // Write iterator
+    for (std::size_t i = 0; i < this->keypoints.size(); ++i)
+        if (accepted[i])
+            this->keypoints[num_keypoints++] = this->keypoints[i];
     this->keypoints.resize(num_keypoints);
 
     if (this->options.debug_output && num_singular > 0)
@@ -546,101 +715,79 @@ Sift::descriptor_generation (void)
     this->descriptors.reserve(this->keypoints.size() * 3 / 2);
 
     /*
-     * Keep a buffer of S+3 gradient and orientation images for the current
-     * octave. Once the octave is changed, these images are recomputed.
-     * To ensure efficiency, the octave index must always increase, never
-     * decrease, which is enforced during the algorithm.
+     * The S+3 gradient and orientation images of each octave have been
+     * created with the octave. Keypoints are processed octave by octave,
+     * and the images are released once the octave is done. The octave
+     * index must always increase, never decrease, which is enforced
+     * during the algorithm.
+     *
+     * Within an octave, keypoints are split into fixed ranges that are
+     * processed in parallel. Each range produces its own descriptors,
+     * which are concatenated in range order.
      */
-    int octave_index = this->keypoints[0].octave;
-    Octave* octave = &this->octaves[octave_index - this->options.min_octave];
-
-    // todo 计算每个octave中所有图像的梯度值和方向，具体得, octave::grad存储图像的梯度响应值，octave::ori存储梯度方向
-    this->generate_grad_ori_images(octave);
-
-    /* Walk over all keypoints and compute descriptors. */
-    for (std::size_t i = 0; i < this->keypoints.size(); ++i)
+    std::size_t const range_size = 64;
+    std::size_t begin = 0;
+    while (begin < this->keypoints.size())
     {
-        Keypoint const& kp(this->keypoints[i]);
+        int const octave_index = this->keypoints[begin].octave;
+        std::size_t end = begin + 1;
+        while (end < this->keypoints.size()
+            && this->keypoints[end].octave == octave_index)
+            end += 1;
+        if (end < this->keypoints.size()
+            && this->keypoints[end].octave < octave_index)
+            throw std::runtime_error("Decreasing octave index!");
 
-        /* Generate new gradient and orientation images if octave changed. */
-        if (kp.octave > octave_index)
+        Octave* octave = &this->octaves[octave_index - this->options.min_octave];
+        std::size_t const num_ranges = (end - begin + range_size - 1)
+            / range_size;
+        std::vector<Descriptors> range_descriptors(num_ranges);
+#pragma omp parallel for schedule(dynamic)
+        for (std::size_t r = 0; r < num_ranges; ++r)
         {
-            /* Clear old octave gradient and orientation images. */
-            if (octave)
-            {
-                octave->grad.clear();
-                octave->ori.clear();
-            }
-            /* Setup new octave gradient and orientation images. */
-            octave_index = kp.octave;
-            octave = &this->octaves[octave_index - this->options.min_octave];
-            this->generate_grad_ori_images(octave);
-        }
-        else if (kp.octave < octave_index)
-        {
-            throw std::runtime_error("Decreasing octave index!");
+            std::size_t const range_begin = begin + r * range_size;
+            std::size_t const range_end = std::min(end,
+                range_begin + range_size);
+            for (std::size_t i = range_begin; i < range_end; ++i)
+                this->descriptor_generation(this->keypoints[i], octave,
+                    &range_descriptors[r]);
         }
 
-        /* Orientation assignment. This returns multiple orientations. */
-        /* todo 统计直方图找到特征点主方向,找到几个主方向*/
-        std::vector<float> orientations;
-        orientations.reserve(8);
-        this->orientation_assignment(kp, octave, orientations);
+        for (std::size_t r = 0; r < num_ranges; ++r)
+            this->descriptors.insert(this->descriptors.end(),
+                range_descriptors[r].begin(), range_descriptors[r].end());
 
-        /* todo 生成特征向量,同一个特征点可能有多个描述子，为了提升匹配的稳定性*/
-        /* Feature vector extraction. */
-        for (std::size_t j = 0; j < orientations.size(); ++j)
-        {
-            Descriptor desc;
-            float const scale_factor = std::pow(2.0f, kp.octave);
-            desc.x = scale_factor * (kp.x + 0.5f) - 0.5f;
-            desc.y = scale_factor * (kp.y + 0.5f) - 0.5f;
-            desc.scale = this->keypoint_absolute_scale(kp);
-            desc.orientation = orientations[j];
-            if (this->descriptor_assignment(kp, desc, octave))
-                this->descriptors.push_back(desc);
-        }
+        /* Clear octave gradient and orientation images. */
+        octave->grad.clear();
+        octave->ori.clear();
+        begin = end;
     }
 }
 
 /* ---------------------------------------------------------------- */
 
 void
-Sift::generate_grad_ori_images (Octave* octave)
+Sift::descriptor_generation (Keypoint const& kp, Octave const* octave,
+    Descriptors* result)
 {
-    octave->grad.clear();
-    octave->grad.reserve(octave->img.size());
-    octave->ori.clear();
-    octave->ori.reserve(octave->img.size());
-
-    int const width = octave->img[0]->width();
-    int const height = octave->img[0]->height();
-
-    //std::cout << "Generating gradient and orientation images..." << std::endl;
-    for (std::size_t i = 0; i < octave->img.size(); ++i)
+    /* Orientation assignment. This returns multiple orientations. */
+    /* todo 统计直方图找到特征点主方向,找到几个主方向*/
+    std::vector<float> orientations;
+    orientations.reserve(8);
+    this->orientation_assignment(kp, octave, orientations);
+
+    /* todo 生成特征向量,同一个特征点可能有多个描述子，为了提升匹配的稳定性*/
+    /* Feature vector extraction. */
+    for (std::size_t j = 0; j < orientations.size(); ++j)
     {
-        core::FloatImage::ConstPtr img = octave->img[i];
-        core::FloatImage::Ptr grad = core::FloatImage::create(width, height, 1);
-        core::FloatImage::Ptr ori = core::FloatImage::create(width, height, 1);
-
-        int image_iter = width + 1;
-        for (int y = 1; y < height - 1; ++y, image_iter += 2)
-            for (int x = 1; x < width - 1; ++x, ++image_iter)
-            {
-                float m1x = img->at(image_iter - 1);
-                float p1x = img->at(image_iter + 1);
-                float m1y = img->at(image_iter - width);
-                float p1y = img->at(image_iter + width);
-                float dx = 0.5f * (p1x - m1x);
-                float dy = 0.5f * (p1y - m1y);
-
-                float atan2f = std::atan2(dy, dx);
-                grad->at(image_iter) = std::sqrt(dx * dx + dy * dy);
-                ori->at(image_iter) = atan2f < 0.0f
-                    ? atan2f + MATH_PI * 2.0f : atan2f;
-            }
-        octave->grad.push_back(grad);
-        octave->ori.push_back(ori);
+        Descriptor desc;
+        float const scale_factor = std::pow(2.0f, kp.octave);
+        desc.x = scale_factor * (kp.x + 0.5f) - 0.5f;
+        desc.y = scale_factor * (kp.y + 0.5f) - 0.5f;
+        desc.scale = this->keypoint_absolute_scale(kp);
+        desc.orientation = orientations[j];
+        if (this->descriptor_assignment(kp, desc, octave))
+            result->push_back(desc);
     }
 }
 
@@ -13,7 +13,7 @@
  *   Absolute coordinates are obtained by (TODO why? explain):
  *   (x + 0.5, y + 0.5) * 2^octave - (0.5, 0.5).
  * - Memory consumption is quite high, especially with large images.
- *   TODO: Find a more efficent code path to create octaves.
+ *   Enable Options::stream_octaves to keep only one octave in memory.
  */
 #ifndef SFM_SIFT_HEADER
 #define SFM_SIFT_HEADER
@@ -24,6 +24,7 @@
 #include "math/vector.h"
 #include "core/image.h"
 #include "features/defines.h"
+#include "features/sift_scale_space.h"
 
 FEATURES_NAMESPACE_BEGIN
 
@@ -102,6 +103,15 @@ public:
          */
         float inherent_blur_sigma;
 
+        /**
+         * Processes the octaves one at a time. Each octave is created,
+         * its keypoints and descriptors are extracted, and it is released
+         * before the next octave is created. This greatly reduces the peak
+         * memory consumption for large images, the result is identical.
+         * Defaults to false.
+         */
+        bool stream_octaves;
+
         /**
          * Produce status messages on the console.
          */
@@ -174,6 +184,12 @@ public:
     /** Returns the list of descriptors. */
     Descriptors const& get_descriptors (void) const;
 
+    /**
+     * Returns the peak memory in bytes used by the scale space
+     * representation (the octaves) during the last call to process().
+     */
+    std::size_t get_peak_memory_usage (void) const;
+
     /**
      * Helper function that creates SIFT descriptors from David Lowe's
      * SIFT descriptor files.
@@ -183,7 +199,9 @@ public:
 
 protected:
     /**
-     * Representation of a SIFT octave.
+     * Representation of a SIFT octave. The gradient and orientation images
+     * are created together with the blurred images. The blurred images are
+     * released once the octave (and the base of the next octave) is built.
      */
     struct Octave
     {
@@ -201,13 +219,16 @@ protected:
     void create_octaves (void);
     void add_octave (core::FloatImage::ConstPtr image,
         float has_sigma, float target_sigma);
+    void finish_octave (std::size_t pending_bytes);
+    std::size_t get_octaves_byte_size (void) const;
     void extrema_detection (void);
     std::size_t extrema_detection (core::FloatImage::ConstPtr s[3],
-        int oi, int si);
+        int oi, int si, int y_begin, int y_end, Keypoints* result);
     void keypoint_localization (void);
 
     void descriptor_generation (void);
-    void generate_grad_ori_images (Octave* octave);
+    void descriptor_generation (Keypoint const& kp, Octave const* octave,
+        Descriptors* result);
     void orientation_assignment (Keypoint const& kp,
         Octave const* octave, std::vector<float>& orientations);
     bool descriptor_assignment (Keypoint const& kp, Descriptor& desc,
@@ -219,9 +240,11 @@ protected:
 private:
     Options options;
     core::FloatImage::ConstPtr orig; // Original input image
+    SiftScaleSpace scale_space; // Blur with reused scratch buffers
     Octaves octaves; // The image pyramid (the octaves)
     Keypoints keypoints; // Detected keypoints
     Descriptors descriptors; // Final SIFT descriptors
+    std::size_t peak_memory; // Peak scale space memory in bytes
 };
 
 /* ---------------------------------------------------------------- */
@@ -235,6 +258,7 @@ Sift::Options::Options (void)
     , edge_ratio_threshold(10.0f)
     , base_blur_sigma(1.6f)
     , inherent_blur_sigma(0.5f)
+    , stream_octaves(false)
     , verbose_output(false)
     , debug_output(false)
 {
@@ -252,6 +276,12 @@ Sift::get_descriptors (void) const
     return this->descriptors;
 }
 
+inline std::size_t
+Sift::get_peak_memory_usage (void) const
+{
+    return this->peak_memory;
+}
+
 FEATURES_NAMESPACE_END
 
 #endif /* SFM_SIFT_HEADER */
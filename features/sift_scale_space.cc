@@ -0,0 +1,316 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#if defined(__AVX__)
+#   include <immintrin.h> // AVX
+#elif defined(__SSE2__)
+#   include <emmintrin.h> // SSE2
+#endif
+
+#include "math/defines.h"
+#include "math/functions.h"
+#include "features/sift_scale_space.h"
+
+FEATURES_NAMESPACE_BEGIN
+
+namespace
+{
+    /*
+     * Horizontal convolution of a row with replicated border. The taps
+     * are accumulated in the order -ks to ks and the sum is divided by the
+     * kernel weight, which matches math::Accum in blur_gaussian().
+     */
+    void
+    convolve_horizontal (float const* padded, float const* kernel,
+        int num_taps, float weight, int width, float* out)
+    {
+        int x = 0;
+#if defined(__AVX__)
+        __m256 const avx_weight = _mm256_set1_ps(weight);
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int t = 0; t < num_taps; ++t)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(
+                    _mm256_loadu_ps(padded + x + t),
+                    _mm256_set1_ps(kernel[t])));
+            _mm256_storeu_ps(out + x, _mm256_div_ps(sum, avx_weight));
+        }
+#endif
+#if defined(__SSE2__)
+        __m128 const sse_weight = _mm_set1_ps(weight);
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int t = 0; t < num_taps; ++t)
+                sum = _mm_add_ps(sum, _mm_mul_ps(
+                    _mm_loadu_ps(padded + x + t), _mm_set1_ps(kernel[t])));
+            _mm_storeu_ps(out + x, _mm_div_ps(sum, sse_weight));
+        }
+#endif
+        for (; x < width; ++x)
+        {
+            float sum = 0.0f;
+            for (int t = 0; t < num_taps; ++t)
+                sum += padded[x + t] * kernel[t];
+            out[x] = sum / weight;
+        }
+    }
+
+    /* Vertical convolution over the given rows, same semantics as above. */
+    void
+    convolve_vertical (float const* const* rows, float const* kernel,
+        int num_taps, float weight, int width, float* out)
+    {
+        int x = 0;
+#if defined(__AVX__)
+        __m256 const avx_weight = _mm256_set1_ps(weight);
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int t = 0; t < num_taps; ++t)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(
+                    _mm256_loadu_ps(rows[t] + x),
+                    _mm256_set1_ps(kernel[t])));
+            _mm256_storeu_ps(out + x, _mm256_div_ps(sum, avx_weight));
+        }
+#endif
+#if defined(__SSE2__)
+        __m128 const sse_weight = _mm_set1_ps(weight);
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int t = 0; t < num_taps; ++t)
+                sum = _mm_add_ps(sum, _mm_mul_ps(
+                    _mm_loadu_ps(rows[t] + x), _mm_set1_ps(kernel[t])));
+            _mm_storeu_ps(out + x, _mm_div_ps(sum, sse_weight));
+        }
+#endif
+        for (; x < width; ++x)
+        {
+            float sum = 0.0f;
+            for (int t = 0; t < num_taps; ++t)
+                sum += rows[t][x] * kernel[t];
+            out[x] = sum / weight;
+        }
+    }
+
+    /* Computes the difference 'a - b' of two rows. */
+    void
+    subtract_row (float const* a, float const* b, int width, float* out)
+    {
+        int x = 0;
+#if defined(__AVX__)
+        for (; x + 8 <= width; x += 8)
+            _mm256_storeu_ps(out + x, _mm256_sub_ps(
+                _mm256_loadu_ps(a + x), _mm256_loadu_ps(b + x)));
+#endif
+#if defined(__SSE2__)
+        for (; x + 4 <= width; x += 4)
+            _mm_storeu_ps(out + x, _mm_sub_ps(
+                _mm_loadu_ps(a + x), _mm_loadu_ps(b + x)));
+#endif
+        for (; x < width; ++x)
+            out[x] = a[x] - b[x];
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+SiftScaleSpace::SiftScaleSpace (void)
+    : kernel_weight(0.0f)
+    , kernel_size(0)
+{
+}
+
+/* ---------------------------------------------------------------- */
+
+core::FloatImage::Ptr
+SiftScaleSpace::blur (core::FloatImage const& in, float sigma)
+{
+    return this->blur_dog(in, sigma, nullptr);
+}
+
+/* ---------------------------------------------------------------- */
+
+core::FloatImage::Ptr
+SiftScaleSpace::blur_dog (core::FloatImage const& in, float sigma,
+    core::FloatImage::Ptr* dog, core::FloatImage::Ptr* grad,
+    core::FloatImage::Ptr* ori)
+{
+    if (in.channels() != 1)
+        throw std::invalid_argument("Single channel image expected");
+
+    int const width = in.width();
+    int const height = in.height();
+    bool const with_grad = grad != nullptr && ori != nullptr;
+
+    /* Small sigmas result in literally no change (see blur_gaussian). */
+    if (MATH_EPSILON_EQ(sigma, 0.0f, 0.1f))
+    {
+        core::FloatImage::Ptr out = in.duplicate();
+        if (dog != nullptr)
+            *dog = core::FloatImage::create(width, height, 1);
+        if (with_grad)
+            SiftScaleSpace::gradients(*out, grad, ori);
+        return out;
+    }
+
+    this->setup_kernel(sigma);
+    int const ks = this->kernel_size;
+    int const num_taps = 2 * ks + 1;
+
+    /* Prepare the ring buffer for horizontally blurred rows. */
+    this->ring.resize(num_taps * width);
+    this->ring_rows.assign(num_taps, -1);
+    this->padded_row.resize(width + 2 * ks);
+    this->taps.resize(num_taps);
+
+    core::FloatImage::Ptr out = core::FloatImage::create(width, height, 1);
+    if (dog != nullptr)
+        *dog = core::FloatImage::create(width, height, 1);
+    if (with_grad)
+    {
+        *grad = core::FloatImage::create(width, height, 1);
+        *ori = core::FloatImage::create(width, height, 1);
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        /* Vertical pass over the horizontally blurred rows. */
+        for (int t = 0; t < num_taps; ++t)
+        {
+            int const row = math::clamp(y - ks + t, 0, height - 1);
+            this->taps[t] = this->horizontal_row(in, row);
+        }
+        float* out_row = &out->at(y * width);
+        convolve_vertical(&this->taps[0], &this->kernel[0], num_taps,
+            this->kernel_weight, width, out_row);
+
+        /* Difference of Gaussian while the row is still in cache. */
+        if (dog != nullptr)
+            subtract_row(out_row, &in.at(y * width), width,
+                &(*dog)->at(y * width));
+
+        /* Gradients of the previous row once its neighbors are complete. */
+        if (with_grad && y >= 2)
+        {
+            float const* rows[3] = { out_row - 2 * width,
+                out_row - width, out_row };
+            SiftScaleSpace::gradient_row(rows, width,
+                &(*grad)->at((y - 1) * width), &(*ori)->at((y - 1) * width));
+        }
+    }
+
+    return out;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+SiftScaleSpace::gradients (core::FloatImage const& img,
+    core::FloatImage::Ptr* grad, core::FloatImage::Ptr* ori)
+{
+    int const width = img.width();
+    int const height = img.height();
+    *grad = core::FloatImage::create(width, height, 1);
+    *ori = core::FloatImage::create(width, height, 1);
+
+    for (int y = 1; y < height - 1; ++y)
+    {
+        float const* rows[3] = { &img.at((y - 1) * width),
+            &img.at(y * width), &img.at((y + 1) * width) };
+        SiftScaleSpace::gradient_row(rows, width,
+            &(*grad)->at(y * width), &(*ori)->at(y * width));
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+SiftScaleSpace::setup_kernel (float sigma)
+{
+    /* Same kernel size and weights as core::image::blur_gaussian(). */
+    int const ks = std::ceil(sigma * 2.884f); // Cap kernel at 1/128
+    this->kernel_size = ks;
+    this->kernel.resize(2 * ks + 1);
+    this->kernel_weight = 0.0f;
+    for (int i = -ks; i <= ks; ++i)
+    {
+        float const weight = math::gaussian((float)std::abs(i), sigma);
+        this->kernel[i + ks] = weight;
+        this->kernel_weight += weight;
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+float const*
+SiftScaleSpace::horizontal_row (core::FloatImage const& in, int y)
+{
+    int const width = in.width();
+    int const ks = this->kernel_size;
+    int const num_taps = 2 * ks + 1;
+
+    /* All rows in the kernel window map to distinct ring slots. */
+    int const slot = y % num_taps;
+    float* result = &this->ring[slot * width];
+    if (this->ring_rows[slot] == y)
+        return result;
+
+    /* Replicate the border pixels to avoid clamping in the inner loop. */
+    float const* row = &in.at(y * width);
+    float* padded = &this->padded_row[0];
+    std::fill(padded, padded + ks, row[0]);
+    std::copy(row, row + width, padded + ks);
+    std::fill(padded + ks + width, padded + 2 * ks + width, row[width - 1]);
+
+    convolve_horizontal(padded, &this->kernel[0], num_taps,
+        this->kernel_weight, width, result);
+    this->ring_rows[slot] = y;
+    return result;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+SiftScaleSpace::gradient_row (float const* rows[3], int width,
+    float* grad, float* ori)
+{
+    /* Gradient magnitude, border pixels are left untouched. */
+    int x = 1;
+#if defined(__SSE2__)
+    __m128 const half = _mm_set1_ps(0.5f);
+    for (; x + 4 <= width - 1; x += 4)
+    {
+        __m128 dx = _mm_mul_ps(half, _mm_sub_ps(
+            _mm_loadu_ps(rows[1] + x + 1), _mm_loadu_ps(rows[1] + x - 1)));
+        __m128 dy = _mm_mul_ps(half, _mm_sub_ps(
+            _mm_loadu_ps(rows[2] + x), _mm_loadu_ps(rows[0] + x)));
+        _mm_storeu_ps(grad + x, _mm_sqrt_ps(_mm_add_ps(
+            _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))));
+    }
+#endif
+    for (; x < width - 1; ++x)
+    {
+        float const dx = 0.5f * (rows[1][x + 1] - rows[1][x - 1]);
+        float const dy = 0.5f * (rows[2][x] - rows[0][x]);
+        grad[x] = std::sqrt(dx * dx + dy * dy);
+    }
+
+    /* Gradient orientation in [0, 2PI]. */
+    for (x = 1; x < width - 1; ++x)
+    {
+        float const dx = 0.5f * (rows[1][x + 1] - rows[1][x - 1]);
+        float const dy = 0.5f * (rows[2][x] - rows[0][x]);
+        float const angle = std::atan2(dy, dx);
+        ori[x] = angle < 0.0f ? angle + MATH_PI * 2.0f : angle;
+    }
+}
+
+FEATURES_NAMESPACE_END
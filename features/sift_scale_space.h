@@ -0,0 +1,78 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_SIFT_SCALE_SPACE_HEADER
+#define SFM_SIFT_SCALE_SPACE_HEADER
+
+#include <vector>
+
+#include "core/image.h"
+#include "features/defines.h"
+
+FEATURES_NAMESPACE_BEGIN
+
+/**
+ * Scale space construction for SIFT.
+ *
+ * The Gaussian blur is applied separately in x and y direction. Rows are
+ * blurred horizontally into a small ring buffer just before they are needed
+ * by the vertical pass, which keeps the working set in cache. Both passes are
+ * vectorized (AVX if available at compile time, SSE2 otherwise).
+ * The difference of Gaussian and the gradient magnitude and orientation
+ * images are computed in the same pass while the blurred rows are hot.
+ *
+ * The results are bit-identical to core::image::blur_gaussian(),
+ * core::image::subtract() and the scalar gradient computation, i.e. the
+ * accumulation order and normalization are the same. Scratch buffers are
+ * kept between calls, one instance should be used per thread.
+ */
+class SiftScaleSpace
+{
+public:
+    SiftScaleSpace (void);
+
+    /** Blurs the single-channel image 'in' with a Gaussian of 'sigma'. */
+    core::FloatImage::Ptr blur (core::FloatImage const& in, float sigma);
+
+    /**
+     * Blurs the single-channel image 'in' with a Gaussian of 'sigma' and
+     * returns the blurred image. The DoG image (blurred - in) is stored in
+     * 'dog'. If 'grad' and 'ori' are not null, gradient magnitude and
+     * orientation of the blurred image are computed in the same pass.
+     */
+    core::FloatImage::Ptr blur_dog (core::FloatImage const& in, float sigma,
+        core::FloatImage::Ptr* dog, core::FloatImage::Ptr* grad = nullptr,
+        core::FloatImage::Ptr* ori = nullptr);
+
+    /**
+     * Computes gradient magnitude and orientation in [0, 2PI] using central
+     * differences. The one pixel image border is set to zero.
+     */
+    static void gradients (core::FloatImage const& img,
+        core::FloatImage::Ptr* grad, core::FloatImage::Ptr* ori);
+
+private:
+    void setup_kernel (float sigma);
+    float const* horizontal_row (core::FloatImage const& in, int y);
+    static void gradient_row (float const* rows[3], int width,
+        float* grad, float* ori);
+
+private:
+    /* Kernel weights for taps -ks to ks and the accumulated weight. */
+    std::vector<float> kernel;
+    float kernel_weight;
+    int kernel_size;
+    /* Row with replicated border for the horizontal pass. */
+    std::vector<float> padded_row;
+    /* Ring buffer of horizontally blurred rows and their row indices. */
+    std::vector<float> ring;
+    std::vector<int> ring_rows;
+    /* Pointers to the kernel taps for the current row. */
+    std::vector<float const*> taps;
+};
+
+FEATURES_NAMESPACE_END
+
+#endif /* SFM_SIFT_SCALE_SPACE_HEADER */
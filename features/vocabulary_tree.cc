@@ -0,0 +1,426 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#include "util/exception.h"
+#include "features/vocabulary_tree.h"
+
+#define VOCTREE_SIGNATURE "MVE_VOCTREE\n"
+#define VOCTREE_SIGNATURE_LEN 12
+
+FEATURES_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Minimum number of descriptors to parallelize the assignment. */
+    std::size_t const PARALLEL_ASSIGNMENT_SIZE = 4096;
+
+    int
+    square_distance (unsigned char const* a, unsigned char const* b)
+    {
+        int dist = 0;
+        for (int i = 0; i < 128; ++i)
+        {
+            int const diff = static_cast<int>(a[i]) - static_cast<int>(b[i]);
+            dist += diff * diff;
+        }
+        return dist;
+    }
+
+    template <typename T>
+    void
+    write_value (std::ostream& out, T const& value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T
+    read_value (std::istream& in)
+    {
+        T value;
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyTree::train (QuantizedSiftDescriptors const& descrs)
+{
+    if (this->opts.branching_factor < 2 || this->opts.num_levels < 1)
+        throw std::invalid_argument("Invalid vocabulary tree options");
+
+    this->nodes.clear();
+    this->centers.clear();
+    this->num_leaves = 0;
+    if (descrs.empty())
+        return;
+
+    /* The root node has no center. */
+    this->nodes.push_back(Node());
+    this->centers.push_back(math::Vec128uc(static_cast<unsigned char>(0)));
+
+    std::vector<int> ids(descrs.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    this->train_node(descrs, &ids, 0, 0, this->opts.seed);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyTree::train_node (QuantizedSiftDescriptors const& descrs,
+    std::vector<int>* ids, int node_id, int level, unsigned int seed)
+{
+    int const k = this->opts.branching_factor;
+    this->nodes[node_id].first_child = -1;
+    this->nodes[node_id].num_children = 0;
+    this->nodes[node_id].word = -1;
+
+    /* Leaf if the maximum depth is reached or too few descriptors. */
+    if (level == this->opts.num_levels || ids->size() <= std::size_t(k))
+    {
+        this->nodes[node_id].word = this->num_leaves++;
+        return;
+    }
+
+    /* Initialize centers with distinct random descriptors. */
+    std::mt19937 rng(seed);
+    for (int i = 0; i < k; ++i)
+    {
+        std::uniform_int_distribution<int> dist(i, ids->size() - 1);
+        std::swap(ids->at(i), ids->at(dist(rng)));
+    }
+    QuantizedSiftDescriptors cluster_centers(k);
+    for (int i = 0; i < k; ++i)
+        cluster_centers[i] = descrs[ids->at(i)];
+
+    /* Lloyd iterations. */
+    std::vector<int> labels(ids->size(), -1);
+    std::vector<int> sums(k * 128);
+    std::vector<int> counts(k);
+    for (int iter = 0; iter < this->opts.max_iterations; ++iter)
+    {
+        int num_changed = 0;
+#pragma omp parallel for reduction(+:num_changed) \
+    if (ids->size() >= PARALLEL_ASSIGNMENT_SIZE)
+        for (std::size_t i = 0; i < ids->size(); ++i)
+        {
+            unsigned char const* descr = descrs[ids->at(i)].begin();
+            int best_label = 0;
+            int best_dist = std::numeric_limits<int>::max();
+            for (int j = 0; j < k; ++j)
+            {
+                int const dist = square_distance(descr,
+                    cluster_centers[j].begin());
+                if (dist < best_dist)
+                {
+                    best_dist = dist;
+                    best_label = j;
+                }
+            }
+            if (labels[i] != best_label)
+                num_changed += 1;
+            labels[i] = best_label;
+        }
+
+        if (num_changed == 0)
+            break;
+
+        /* Update centers, empty clusters keep their center. */
+        std::fill(sums.begin(), sums.end(), 0);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (std::size_t i = 0; i < ids->size(); ++i)
+        {
+            unsigned char const* descr = descrs[ids->at(i)].begin();
+            int* sum = &sums[labels[i] * 128];
+            for (int j = 0; j < 128; ++j)
+                sum[j] += descr[j];
+            counts[labels[i]] += 1;
+        }
+        for (int i = 0; i < k; ++i)
+        {
+            if (counts[i] == 0)
+                continue;
+            for (int j = 0; j < 128; ++j)
+                cluster_centers[i][j] = static_cast<unsigned char>(
+                    (sums[i * 128 + j] + counts[i] / 2) / counts[i]);
+        }
+    }
+
+    /* Distribute descriptor IDs to the clusters. */
+    std::vector<std::vector<int>> cluster_ids(k);
+    for (std::size_t i = 0; i < ids->size(); ++i)
+        cluster_ids[labels[i]].push_back(ids->at(i));
+    ids->clear();
+    ids->shrink_to_fit();
+
+    /* Create children consecutively, then recurse. */
+    int const first_child = this->nodes.size();
+    this->nodes[node_id].first_child = first_child;
+    this->nodes[node_id].num_children = k;
+    this->nodes.resize(first_child + k);
+    this->centers.resize(first_child + k);
+    for (int i = 0; i < k; ++i)
+        this->centers[first_child + i] = cluster_centers[i];
+    for (int i = 0; i < k; ++i)
+        this->train_node(descrs, &cluster_ids[i], first_child + i,
+            level + 1, seed * 31u + first_child + i);
+}
+
+/* ---------------------------------------------------------------- */
+
+int
+VocabularyTree::lookup (unsigned char const* descr) const
+{
+    if (this->nodes.empty())
+        throw std::runtime_error("Vocabulary tree is empty");
+
+    int node_id = 0;
+    while (this->nodes[node_id].num_children > 0)
+    {
+        Node const& node = this->nodes[node_id];
+        int best_child = node.first_child;
+        int best_dist = std::numeric_limits<int>::max();
+        for (int i = 0; i < node.num_children; ++i)
+        {
+            int const child = node.first_child + i;
+            int const dist = square_distance(descr,
+                this->centers[child].begin());
+            if (dist < best_dist)
+            {
+                best_dist = dist;
+                best_child = child;
+            }
+        }
+        node_id = best_child;
+    }
+    return this->nodes[node_id].word;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyTree::save_to_file (std::string const& filename) const
+{
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    out.write(VOCTREE_SIGNATURE, VOCTREE_SIGNATURE_LEN);
+    write_value<int32_t>(out, this->opts.branching_factor);
+    write_value<int32_t>(out, this->opts.num_levels);
+    write_value<int32_t>(out, this->nodes.size());
+    for (std::size_t i = 0; i < this->nodes.size(); ++i)
+    {
+        write_value<int32_t>(out, this->nodes[i].first_child);
+        write_value<int32_t>(out, this->nodes[i].num_children);
+        write_value<int32_t>(out, this->nodes[i].word);
+        out.write(reinterpret_cast<char const*>(this->centers[i].begin()),
+            128);
+    }
+    out.close();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyTree::load_from_file (std::string const& filename)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    char signature[VOCTREE_SIGNATURE_LEN + 1];
+    in.read(signature, VOCTREE_SIGNATURE_LEN);
+    signature[VOCTREE_SIGNATURE_LEN] = '\0';
+    if (std::string(VOCTREE_SIGNATURE) != signature)
+        throw std::invalid_argument("Invalid vocabulary file signature");
+
+    this->opts.branching_factor = read_value<int32_t>(in);
+    this->opts.num_levels = read_value<int32_t>(in);
+    int32_t const num_nodes = read_value<int32_t>(in);
+    if (in.fail() || num_nodes < 0)
+        throw util::Exception("Invalid vocabulary file header");
+
+    /* Every node takes three integers and a center, check the file size. */
+    std::streamoff const node_size = 3 * sizeof(int32_t) + 128;
+    std::streampos const data_begin = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streamoff const data_size = in.tellg() - data_begin;
+    in.seekg(data_begin);
+    if (in.fail() || data_size / node_size < num_nodes)
+        throw util::Exception("Premature EOF");
+
+    this->nodes.resize(num_nodes);
+    this->centers.resize(num_nodes);
+    this->num_leaves = 0;
+    for (int32_t i = 0; i < num_nodes; ++i)
+    {
+        this->nodes[i].first_child = read_value<int32_t>(in);
+        this->nodes[i].num_children = read_value<int32_t>(in);
+        this->nodes[i].word = read_value<int32_t>(in);
+        in.read(reinterpret_cast<char*>(this->centers[i].begin()), 128);
+        if (this->nodes[i].num_children == 0)
+            this->num_leaves += 1;
+    }
+
+    if (in.fail())
+    {
+        this->nodes.clear();
+        this->centers.clear();
+        this->num_leaves = 0;
+        throw util::Exception("Premature EOF");
+    }
+
+    /*
+     * Children must follow their parent inside the node list, so lookup()
+     * stays in bounds and always terminates. Leaves need a valid word.
+     */
+    for (int32_t i = 0; i < num_nodes; ++i)
+    {
+        Node const& node = this->nodes[i];
+        bool valid;
+        if (node.num_children == 0)
+            valid = node.word >= 0 && node.word < this->num_leaves;
+        else
+            valid = node.num_children > 0 && node.first_child > i
+                && static_cast<int64_t>(node.first_child)
+                + node.num_children <= num_nodes;
+        if (!valid)
+        {
+            this->nodes.clear();
+            this->centers.clear();
+            this->num_leaves = 0;
+            throw util::Exception("Invalid vocabulary tree node");
+        }
+    }
+    in.close();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyIndex::reset (std::size_t num_images)
+{
+    this->images.clear();
+    this->images.resize(num_images);
+    this->inverted_files.clear();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyIndex::set_image (std::size_t image_id,
+    QuantizedSiftDescriptors const& descrs)
+{
+    std::vector<int> words(descrs.size());
+    for (std::size_t i = 0; i < descrs.size(); ++i)
+        words[i] = this->tree->lookup(descrs[i].begin());
+    std::sort(words.begin(), words.end());
+
+    /* Store the term frequencies, weighted in finalize(). */
+    BagOfWords& bow = this->images[image_id];
+    bow.clear();
+    for (std::size_t i = 0; i < words.size(); ++i)
+    {
+        if (bow.empty() || bow.back().first != words[i])
+            bow.push_back(std::make_pair(words[i], 0.0f));
+        bow.back().second += 1.0f / static_cast<float>(words.size());
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyIndex::finalize (void)
+{
+    /* Inverse document frequency per word. */
+    std::vector<int> num_images(this->tree->num_words(), 0);
+    for (std::size_t i = 0; i < this->images.size(); ++i)
+        for (std::size_t j = 0; j < this->images[i].size(); ++j)
+            num_images[this->images[i][j].first] += 1;
+
+    std::vector<float> idf(num_images.size(), 0.0f);
+    for (std::size_t i = 0; i < idf.size(); ++i)
+        if (num_images[i] > 0)
+            idf[i] = std::log(static_cast<float>(this->images.size())
+                / static_cast<float>(num_images[i]));
+
+    /* Normalized TF-IDF weights and inverted files. */
+    this->inverted_files.clear();
+    this->inverted_files.resize(num_images.size());
+    for (std::size_t i = 0; i < num_images.size(); ++i)
+        this->inverted_files[i].reserve(num_images[i]);
+
+    for (std::size_t i = 0; i < this->images.size(); ++i)
+    {
+        BagOfWords& bow = this->images[i];
+        float square_norm = 0.0f;
+        for (std::size_t j = 0; j < bow.size(); ++j)
+        {
+            bow[j].second *= idf[bow[j].first];
+            square_norm += bow[j].second * bow[j].second;
+        }
+        if (square_norm <= 0.0f)
+            continue;
+
+        float const inv_norm = 1.0f / std::sqrt(square_norm);
+        for (std::size_t j = 0; j < bow.size(); ++j)
+        {
+            bow[j].second *= inv_norm;
+            Entry entry;
+            entry.image_id = i;
+            entry.weight = bow[j].second;
+            this->inverted_files[bow[j].first].push_back(entry);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+VocabularyIndex::query (std::size_t image_id, std::size_t num_results,
+    std::vector<int>* results) const
+{
+    results->clear();
+    if (this->inverted_files.empty())
+        throw std::runtime_error("Vocabulary index is not finalized");
+
+    /* Accumulate the cosine similarity using the inverted files. */
+    std::vector<float> scores(this->images.size(), 0.0f);
+    BagOfWords const& bow = this->images[image_id];
+    for (std::size_t i = 0; i < bow.size(); ++i)
+    {
+        std::vector<Entry> const& entries = this->inverted_files[bow[i].first];
+        for (std::size_t j = 0; j < entries.size(); ++j)
+            scores[entries[j].image_id] += bow[i].second * entries[j].weight;
+    }
+
+    std::vector<std::pair<float, int>> ranking;
+    for (std::size_t i = 0; i < scores.size(); ++i)
+        if (i != image_id && scores[i] > 0.0f)
+            ranking.push_back(std::make_pair(scores[i], i));
+
+    num_results = std::min(num_results, ranking.size());
+    std::partial_sort(ranking.begin(), ranking.begin() + num_results,
+        ranking.end(), std::greater<std::pair<float, int>>());
+    for (std::size_t i = 0; i < num_results; ++i)
+        results->push_back(ranking[i].second);
+}
+
+FEATURES_NAMESPACE_END
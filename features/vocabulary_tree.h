@@ -0,0 +1,171 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_VOCABULARY_TREE_HEADER
+#define SFM_VOCABULARY_TREE_HEADER
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "features/defines.h"
+#include "features/descriptor_quantization.h"
+
+FEATURES_NAMESPACE_BEGIN
+
+/**
+ * Hierarchical k-means vocabulary over quantized SIFT descriptors.
+ *
+ * The tree is trained by recursively clustering the training descriptors
+ * into 'branching_factor' clusters up to 'num_levels' levels. The leaves
+ * of the tree are the visual words. A descriptor is mapped to a word by
+ * descending the tree to the closest cluster center on every level.
+ *
+ * The vocabulary can be saved to and loaded from file in order to reuse
+ * it for several reconstructions. The file format is binary:
+ *
+ * <signature> <branching factor> <number of levels> <number of nodes>
+ *   <first child> <number of children> <word ID> <128 byte center>
+ *   ...
+ */
+class VocabularyTree
+{
+public:
+    struct Options
+    {
+        Options (void);
+
+        /** Number of clusters per node. */
+        int branching_factor;
+
+        /** Number of levels, the tree has up to b^L words. */
+        int num_levels;
+
+        /** Number of k-means iterations per node. */
+        int max_iterations;
+
+        /** Seed for the initial cluster centers. */
+        unsigned int seed;
+    };
+
+public:
+    explicit VocabularyTree (Options const& options = Options());
+
+    /** Trains the vocabulary from the given descriptors. */
+    void train (QuantizedSiftDescriptors const& descrs);
+
+    /** Returns the word ID of a 128 dimensional descriptor. */
+    int lookup (unsigned char const* descr) const;
+
+    /** Returns the number of words, zero if the tree is empty. */
+    int num_words (void) const;
+
+    /** Saves the vocabulary to file. */
+    void save_to_file (std::string const& filename) const;
+
+    /** Loads a vocabulary from file, replacing the options. */
+    void load_from_file (std::string const& filename);
+
+private:
+    struct Node
+    {
+        /* Index of the first child, children are consecutive. */
+        int first_child;
+        int num_children;
+        /* Word ID for leaves, -1 for inner nodes. */
+        int word;
+    };
+
+    void train_node (QuantizedSiftDescriptors const& descrs,
+        std::vector<int>* ids, int node_id, int level, unsigned int seed);
+
+private:
+    Options opts;
+    std::vector<Node> nodes;
+    QuantizedSiftDescriptors centers;
+    int num_leaves;
+};
+
+/* ---------------------------------------------------------------- */
+
+/**
+ * TF-IDF image database using the words of a vocabulary tree.
+ *
+ * Every image is represented by an L2-normalized TF-IDF weighted histogram
+ * of words. The database stores an inverted file per word and scores the
+ * images with the cosine similarity, which only visits images sharing at
+ * least one word with the query.
+ *
+ * Usage: reset() with the number of images, set_image() for every image
+ * (thread-safe for distinct image IDs), finalize(), then query().
+ */
+class VocabularyIndex
+{
+public:
+    explicit VocabularyIndex (VocabularyTree const* tree);
+
+    /** Clears the database and allocates the given number of images. */
+    void reset (std::size_t num_images);
+
+    /** Computes the words of an image. */
+    void set_image (std::size_t image_id,
+        QuantizedSiftDescriptors const& descrs);
+
+    /** Computes the TF-IDF weights and the inverted files. */
+    void finalize (void);
+
+    /** Returns up to 'num_results' most similar images, best first. */
+    void query (std::size_t image_id, std::size_t num_results,
+        std::vector<int>* results) const;
+
+private:
+    struct Entry
+    {
+        int image_id;
+        float weight;
+    };
+
+    /* Sorted pairs of word ID and weight. */
+    typedef std::vector<std::pair<int, float>> BagOfWords;
+
+private:
+    VocabularyTree const* tree;
+    std::vector<BagOfWords> images;
+    std::vector<std::vector<Entry>> inverted_files;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+VocabularyTree::Options::Options (void)
+    : branching_factor(10)
+    , num_levels(4)
+    , max_iterations(10)
+    , seed(0)
+{
+}
+
+inline
+VocabularyTree::VocabularyTree (Options const& options)
+    : opts(options)
+    , num_leaves(0)
+{
+}
+
+inline int
+VocabularyTree::num_words (void) const
+{
+    return this->num_leaves;
+}
+
+inline
+VocabularyIndex::VocabularyIndex (VocabularyTree const* tree)
+    : tree(tree)
+{
+}
+
+FEATURES_NAMESPACE_END
+
+#endif /* SFM_VOCABULARY_TREE_HEADER */
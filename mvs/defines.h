@@ -10,8 +10,10 @@
 #ifndef DMRECON_DEFINES_H
 #define DMRECON_DEFINES_H
 
-#include <vector>
+#include <array>
+#include <cstddef>
 #include <set>
+#include <vector>
 
 #include "math/vector.h"
 
@@ -29,6 +31,41 @@ typedef std::vector< math::Vec3f > Samples;
 // 三维采样点对应的图像坐标
 typedef std::vector< math::Vec2f > PixelCoords;
 
+/** Upper bounds of Settings::filterWidth and Settings::nrReconNeighbors. */
+std::size_t const MAX_FILTER_WIDTH = 9;
+std::size_t const MAX_PATCH_SAMPLES = MAX_FILTER_WIDTH * MAX_FILTER_WIDTH;
+std::size_t const MAX_LOCAL_NEIGHBORS = 8;
+
+// patch 上的样本，固定容量，不进行动态内存分配
+typedef std::array< math::Vec3f, MAX_PATCH_SAMPLES > PatchSamples;
+typedef std::array< math::Vec2f, MAX_PATCH_SAMPLES > PatchCoords;
+
+/**
+ * Sorted set of at most MAX_LOCAL_NEIGHBORS view IDs stored inline.
+ * Used for the local views that are copied into every queue entry.
+ */
+class LocalIndexSet
+{
+public:
+    typedef std::size_t const* const_iterator;
+
+    LocalIndexSet();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+    void clear();
+    bool contains(std::size_t id) const;
+    /** Inserts the ID, returns false if it is contained or the set is full. */
+    bool insert(std::size_t id);
+    void erase(std::size_t id);
+
+private:
+    std::size_t ids[MAX_LOCAL_NEIGHBORS];
+    std::size_t num;
+};
+
 const float pi = 3.141592653589793f;
 
 template<typename T>
@@ -37,6 +74,78 @@ inline const T sqr(const T& a)
     return (a)*(a);
 }
 
+/* ------------------------- Implementation ----------------------- */
+
+inline
+LocalIndexSet::LocalIndexSet()
+    : num(0)
+{
+}
+
+inline LocalIndexSet::const_iterator
+LocalIndexSet::begin() const
+{
+    return ids;
+}
+
+inline LocalIndexSet::const_iterator
+LocalIndexSet::end() const
+{
+    return ids + num;
+}
+
+inline std::size_t
+LocalIndexSet::size() const
+{
+    return num;
+}
+
+inline bool
+LocalIndexSet::empty() const
+{
+    return num == 0;
+}
+
+inline void
+LocalIndexSet::clear()
+{
+    num = 0;
+}
+
+inline bool
+LocalIndexSet::contains(std::size_t id) const
+{
+    for (std::size_t i = 0; i < num; ++i)
+        if (ids[i] == id)
+            return true;
+    return false;
+}
+
+inline bool
+LocalIndexSet::insert(std::size_t id)
+{
+    if (num == MAX_LOCAL_NEIGHBORS || contains(id))
+        return false;
+    std::size_t pos = num;
+    for (; pos > 0 && ids[pos - 1] > id; --pos)
+        ids[pos] = ids[pos - 1];
+    ids[pos] = id;
+    num += 1;
+    return true;
+}
+
+inline void
+LocalIndexSet::erase(std::size_t id)
+{
+    std::size_t pos = 0;
+    while (pos < num && ids[pos] != id)
+        ++pos;
+    if (pos == num)
+        return;
+    for (num -= 1; pos < num; ++pos)
+        ids[pos] = ids[pos + 1];
+}
+
 MVS_NAMESPACE_END
 
 #endif
@@ -0,0 +1,228 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+
+#include "math/octree_tools.h"
+#include "util/strings.h"
+#include "mvs/depth_recon.h"
+#include "mvs/global_view_selection.h"
+
+MVS_NAMESPACE_BEGIN
+
+DepthRecon::DepthRecon(core::Scene::Ptr _scene, Settings const& _settings)
+    : scene(_scene)
+    , settings(_settings)
+{
+    core::Scene::ViewList const& mve_views(scene->get_views());
+
+    /* Check if master image exists */
+    if (settings.refViewNr >= mve_views.size())
+        throw std::invalid_argument("Master view index out of bounds");
+
+    /* Check for meaningful scale factor */
+    if (settings.scale < 0.f)
+        throw std::invalid_argument("Invalid scale factor");
+
+    /* Check if image embedding is set. */
+    if (settings.imageEmbedding.empty())
+        throw std::invalid_argument("Invalid image embedding");
+
+    /* Check if the patch fits into the fixed size buffers. */
+    if (settings.filterWidth > MAX_FILTER_WIDTH)
+        throw std::invalid_argument("Filter width too large");
+    if (settings.nrReconNeighbors > MAX_LOCAL_NEIGHBORS)
+        throw std::invalid_argument("Too many reconstruction neighbors");
+    /* Fetch bundle file. */
+    try {
+        this->bundle = this->scene->get_bundle();
+    }
+    catch (std::exception& e) {
+        throw std::runtime_error(std::string("Error reading bundle file: ")
+              + e.what());
+    }
+
+    //为场景中的每一幅图像创建一个Single view
+    /* Create list of SingleView pointers from MVE views. */
+    views.resize(mve_views.size());
+    for (std::size_t i = 0; i < mve_views.size(); ++i) {
+        if (mve_views[i] == nullptr || !mve_views[i]->is_camera_valid() ||
+            !mve_views[i]->has_image(this->settings.imageEmbedding,
+            core::IMAGE_TYPE_UINT8))
+            continue;
+        views[i] = mvs::SingleView::create(scene, mve_views[i],
+            this->settings.imageEmbedding);
+    }
+
+    // 提取refrence view 并创建图像金字塔
+    SingleView::Ptr refV = views[settings.refViewNr];
+    if (refV == nullptr)
+        throw std::invalid_argument("Invalid master view");
+
+    /* Prepare reconstruction */
+    // 加载图像，并且构建图像金字塔
+    refV->loadColorImage(this->settings.scale);
+    // 创建相关的depth image, normal image, dz image, conf image深度图像，法向量图像等等
+    refV->prepareMasterView(settings.scale);
+    core::ByteImage::ConstPtr scaled_img = refV->getScaledImg();
+    // 需要重建的尺度的图像的尺寸
+    this->width = scaled_img->width();
+    this->height = scaled_img->height();
+
+    if (!settings.quiet)
+        std::cout << "scaled image size: " << this->width << " x "
+                  << this->height << std::endl;
+}
+
+DepthRecon::~DepthRecon()
+{
+}
+
+/*
+ * Attach features that are visible in the reference view (according to
+ * the bundle) to all other views if inside the frustum.
+ */
+void
+DepthRecon::analyzeFeatures()
+{
+    progress.status = RECON_FEATURES;
+
+    // 获取参考视角
+    SingleView::ConstPtr refV = views[settings.refViewNr];
+    // 读取所有重建的3D稀疏点
+    core::Bundle::Features const& features = bundle->get_features();
+
+    // 对每一个特征点
+    for (std::size_t i = 0; i < features.size() && !progress.cancelled; ++i){
+
+        // 三维点在该参考视角中可见
+        if (!features[i].contains_view_id(settings.refViewNr))
+            continue;
+
+        // 将特征点的三维坐标投影到原始尺度的图像中，判断：1) 相机坐标系中的Z坐标是否为正； 2) 投影到图像上的坐标是否超出了
+        // 图像的范围
+        math::Vec3f featurePos(features[i].pos);
+        if (!refV->pointInFrustum(featurePos))
+            continue;
+
+        // 重建的特征点需要在设定的空间范围内( aabbMin 和 aabbMax确定的包围盒内)
+        if (!math::geom::point_box_overlap(featurePos,
+            this->settings.aabbMin, this->settings.aabbMax))
+            continue;
+
+        // 如果该三维点是在参考视角中可见的，则将其添加到所有可见的视角中--每个视角包含哪些可见的特征点
+        for (std::size_t j = 0; j < features[i].refs.size(); ++j){
+
+            int view_id = features[i].refs[j].view_id;
+            if (view_id < 0 || view_id >= static_cast<int>(views.size())
+                || views[view_id] == nullptr)
+                continue;
+
+            // 判断视角是否在其它视角中可见
+            if (views[view_id]->pointInFrustum(featurePos))
+                views[view_id]->addFeature(i);
+        }
+    }
+}
+
+void
+DepthRecon::globalViewSelection(){
+
+    progress.status = RECON_GLOBALVS;
+    if (progress.cancelled)
+        return;
+
+    //执行全局的视角选择
+    /* Perform global view selection. */
+    GlobalViewSelection globalVS(views, bundle->get_features(), settings);
+    globalVS.performVS();
+    neighViews = globalVS.getSelectedIDs();
+
+    // 全局的视角选择失败
+    if (neighViews.empty())
+        throw std::runtime_error("Global View Selection failed");
+
+    /* Print result of global view selection. */
+    if (!settings.quiet){
+        std::cout << "Global View Selection:";
+        for (IndexSet::const_iterator iter = neighViews.begin();
+            iter != neighViews.end(); ++iter)
+            std::cout << " " << *iter;
+        std::cout << std::endl;
+    }
+
+    /* Load selected images. */
+    if (!settings.quiet)
+        std::cout << "Loading color images..." << std::endl;
+
+    // 对全局选择的邻域视角加载图像
+    for (IndexSet::const_iterator iter = neighViews.begin();
+        iter != neighViews.end() && !progress.cancelled; ++iter)
+        views[*iter]->loadColorImage(0);
+}
+
+void
+DepthRecon::saveResult()
+{
+    progress.status = RECON_SAVING;
+    SingleView::Ptr refV(views[settings.refViewNr]);
+    if (settings.writePlyFile){
+        if (!settings.quiet)
+            std::cout << "Saving ply file as "
+                << settings.plyPath << "/"
+                << refV->createFileName(settings.scale)
+                << ".ply" << std::endl;
+        refV->saveReconAsPly(settings.plyPath, settings.scale);
+    }
+
+    // Save images to view
+    core::View::Ptr view = refV->getMVEView();
+
+    std::string name("depth-L");
+    name += util::string::get(settings.scale);
+    view->set_image(refV->depthImg, name);
+
+    if (settings.keepDzMap){
+        name = "dz-L";
+        name += util::string::get(settings.scale);
+        view->set_image(refV->dzImg, name);
+    }
+
+    if (settings.keepConfidenceMap){
+        name = "conf-L";
+        name += util::string::get(settings.scale);
+        view->set_image(refV->confImg, name);
+    }
+
+    if (settings.scale != 0){
+        name = "undist-L";
+        name += util::string::get(settings.scale);
+        view->set_image(refV->getScaledImg()->duplicate(), name);
+    }
+
+    progress.status = RECON_IDLE;
+}
+
+void
+DepthRecon::printSummary() const
+{
+    if (settings.quiet)
+        return;
+
+    /* Output percentage of filled pixels */
+    int nrPix = this->width * this->height;
+    float percent = (float) progress.filled / (float) nrPix;
+    std::cout << "Filled " << progress.filled << " pixels, i.e. "
+              << util::string::get_fixed(percent * 100.f, 1)
+              << " %." << std::endl;
+
+    /* Output required time to process the image */
+    size_t mvs_time = std::time(nullptr) - progress.start_time;
+    std::cout << "MVS took " << mvs_time << " seconds." << std::endl;
+}
+
+MVS_NAMESPACE_END
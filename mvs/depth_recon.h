@@ -0,0 +1,80 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef DMRECON_DEPTH_RECON_H
+#define DMRECON_DEPTH_RECON_H
+
+#include <vector>
+
+#include "core/bundle.h"
+#include "core/scene.h"
+#include "mvs/defines.h"
+#include "mvs/progress.h"
+#include "mvs/settings.h"
+#include "mvs/single_view.h"
+
+MVS_NAMESPACE_BEGIN
+
+/**
+ * Steps shared by the depth map reconstructions of one reference view,
+ * DMRecon and PatchMatch. The constructor validates the settings and
+ * prepares the reference view, the derived classes fill its depth,
+ * normal, dz and confidence images.
+ */
+class DepthRecon
+{
+public:
+    std::size_t getRefViewNr() const;
+    Progress const& getProgress() const;
+    Progress& getProgress();
+
+protected:
+    DepthRecon(core::Scene::Ptr scene, Settings const& settings);
+    ~DepthRecon();
+
+    /** Attaches the features seen by the reference view to all views. */
+    void analyzeFeatures();
+    /** Selects and loads the global neighbor views. */
+    void globalViewSelection();
+    /** Writes the ply file and the depth map embeddings of the view. */
+    void saveResult();
+    /** Prints the filled pixels and the reconstruction time. */
+    void printSummary() const;
+
+protected:
+    core::Scene::Ptr scene;
+    core::Bundle::ConstPtr bundle;
+    std::vector<SingleView::Ptr> views;
+
+    Settings settings;
+    IndexSet neighViews;
+    int width;
+    int height;
+    Progress progress;
+};
+
+/* ------------------------- Implementation ----------------------- */
+
+inline const Progress&
+DepthRecon::getProgress() const
+{
+    return progress;
+}
+
+inline Progress&
+DepthRecon::getProgress()
+{
+    return progress;
+}
+
+inline std::size_t
+DepthRecon::getRefViewNr() const
+{
+    return settings.refViewNr;
+}
+
+MVS_NAMESPACE_END
+
+#endif
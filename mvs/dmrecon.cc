@@ -7,11 +7,18 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <set>
+#include <thread>
 #include <ctime>
 
 #include <core/scene.h>
@@ -22,71 +29,16 @@
 #include "core/image.h"
 #include "core/image_tools.h"
 #include "util/file_system.h"
-#include "util/strings.h"
 #include "mvs/settings.h"
 #include "mvs/dmrecon.h"
-#include "mvs/global_view_selection.h"
 #include "mvs/progress.h"
 #include "mvs/single_view.h"
 
 MVS_NAMESPACE_BEGIN
 
 DMRecon::DMRecon(core::Scene::Ptr _scene, Settings const& _settings)
-    : scene(_scene)
-    , settings(_settings)
+    : DepthRecon(_scene, _settings)
 {
-    core::Scene::ViewList const& mve_views(scene->get_views());
-
-    /* Check if master image exists */
-    if (settings.refViewNr >= mve_views.size())
-        throw std::invalid_argument("Master view index out of bounds");
-
-    /* Check for meaningful scale factor */
-    if (settings.scale < 0.f)
-        throw std::invalid_argument("Invalid scale factor");
-
-    /* Check if image embedding is set. */
-    if (settings.imageEmbedding.empty())
-        throw std::invalid_argument("Invalid image embedding");
-    /* Fetch bundle file. */
-    try {
-        this->bundle = this->scene->get_bundle();
-    }
-    catch (std::exception& e) {
-        throw std::runtime_error(std::string("Error reading bundle file: ")
-              + e.what());
-    }
-
-    //为场景中的每一幅图像创建一个Single view
-    /* Create list of SingleView pointers from MVE views. */
-    views.resize(mve_views.size());
-    for (std::size_t i = 0; i < mve_views.size(); ++i) {
-        if (mve_views[i] == nullptr || !mve_views[i]->is_camera_valid() ||
-            !mve_views[i]->has_image(this->settings.imageEmbedding,
-            core::IMAGE_TYPE_UINT8))
-            continue;
-        views[i] = mvs::SingleView::create(scene, mve_views[i],
-            this->settings.imageEmbedding);
-    }
-
-    // 提取refrence view 并创建图像金字塔
-    SingleView::Ptr refV = views[settings.refViewNr];
-    if (refV == nullptr)
-        throw std::invalid_argument("Invalid master view");
-
-    /* Prepare reconstruction */
-    // 加载图像，并且构建图像金字塔
-    refV->loadColorImage(this->settings.scale);
-    // 创建相关的depth image, normal image, dz image, conf image深度图像，法向量图像等等
-    refV->prepareMasterView(settings.scale);
-    core::ByteImage::ConstPtr scaled_img = refV->getScaledImg();
-    // 需要重建的尺度的图像的尺寸
-    this->width = scaled_img->width();
-    this->height = scaled_img->height();
-
-    if (!settings.quiet)
-        std::cout << "scaled image size: " << this->width << " x "
-                  << this->height << std::endl;
 }
 
 void
@@ -116,58 +68,8 @@ DMRecon::start()
             return;
         }
 
-        progress.status = RECON_SAVING;
-        SingleView::Ptr refV(views[settings.refViewNr]);
-        if (settings.writePlyFile){
-            if (!settings.quiet)
-                std::cout << "Saving ply file as "
-                    << settings.plyPath << "/"
-                    << refV->createFileName(settings.scale)
-                    << ".ply" << std::endl;
-            refV->saveReconAsPly(settings.plyPath, settings.scale);
-        }
-
-        // Save images to view
-        core::View::Ptr view = refV->getMVEView();
-
-        std::string name("depth-L");
-        name += util::string::get(settings.scale);
-        view->set_image(refV->depthImg, name);
-
-        if (settings.keepDzMap){
-            name = "dz-L";
-            name += util::string::get(settings.scale);
-            view->set_image(refV->dzImg, name);
-        }
-
-        if (settings.keepConfidenceMap){
-            name = "conf-L";
-            name += util::string::get(settings.scale);
-            view->set_image(refV->confImg, name);
-        }
-
-        if (settings.scale != 0){
-            name = "undist-L";
-            name += util::string::get(settings.scale);
-            view->set_image(refV->getScaledImg()->duplicate(), name);
-        }
-
-        progress.status = RECON_IDLE;
-
-        /* Output percentage of filled pixels */
-        {
-            int nrPix = this->width * this->height;
-            float percent = (float) progress.filled / (float) nrPix;
-            if (!settings.quiet)
-                std::cout << "Filled " << progress.filled << " pixels, i.e. "
-                          << util::string::get_fixed(percent * 100.f, 1)
-                          << " %." << std::endl;
-        }
-
-        /* Output required time to process the image */
-        size_t mvs_time = std::time(nullptr) - progress.start_time;
-        if (!settings.quiet)
-            std::cout << "MVS took " << mvs_time << " seconds." << std::endl;
+        saveResult();
+        printSummary();
     }
     catch (util::Exception e)
     {
@@ -179,89 +81,6 @@ DMRecon::start()
     }
 }
 
-/*
- * Attach features that are visible in the reference view (according to
- * the bundle) to all other views if inside the frustum.
- */
-void
-DMRecon::analyzeFeatures()
-{
-    progress.status = RECON_FEATURES;
-
-    // 获取参考视角
-    SingleView::ConstPtr refV = views[settings.refViewNr];
-    // 读取所有重建的3D稀疏点
-    core::Bundle::Features const& features = bundle->get_features();
-
-    // 对每一个特征点
-    for (std::size_t i = 0; i < features.size() && !progress.cancelled; ++i){
-
-        // 三维点在该参考视角中可见
-        if (!features[i].contains_view_id(settings.refViewNr))
-            continue;
-
-        // 将特征点的三维坐标投影到原始尺度的图像中，判断：1) 相机坐标系中的Z坐标是否为正； 2) 投影到图像上的坐标是否超出了
-        // 图像的范围
-        math::Vec3f featurePos(features[i].pos);
-        if (!refV->pointInFrustum(featurePos))
-            continue;
-
-        // 重建的特征点需要在设定的空间范围内( aabbMin 和 aabbMax确定的包围盒内)
-        if (!math::geom::point_box_overlap(featurePos,
-            this->settings.aabbMin, this->settings.aabbMax))
-            continue;
-
-        // 如果该三维点是在参考视角中可见的，则将其添加到所有可见的视角中--每个视角包含哪些可见的特征点
-        for (std::size_t j = 0; j < features[i].refs.size(); ++j){
-
-            int view_id = features[i].refs[j].view_id;
-            if (view_id < 0 || view_id >= static_cast<int>(views.size())
-                || views[view_id] == nullptr)
-                continue;
-
-            // 判断视角是否在其它视角中可见
-            if (views[view_id]->pointInFrustum(featurePos))
-                views[view_id]->addFeature(i);
-        }
-    }
-}
-
-void
-DMRecon::globalViewSelection(){
-
-    progress.status = RECON_GLOBALVS;
-    if (progress.cancelled)
-        return;
-
-    //执行全局的视角选择
-    /* Perform global view selection. */
-    GlobalViewSelection globalVS(views, bundle->get_features(), settings);
-    globalVS.performVS();
-    neighViews = globalVS.getSelectedIDs();
-
-    // 全局的视角选择失败
-    if (neighViews.empty())
-        throw std::runtime_error("Global View Selection failed");
-
-    /* Print result of global view selection. */
-    if (!settings.quiet){
-        std::cout << "Global View Selection:";
-        for (IndexSet::const_iterator iter = neighViews.begin();
-            iter != neighViews.end(); ++iter)
-            std::cout << " " << *iter;
-        std::cout << std::endl;
-    }
-
-    /* Load selected images. */
-    if (!settings.quiet)
-        std::cout << "Loading color images..." << std::endl;
-
-    // 对全局选择的邻域视角加载图像
-    for (IndexSet::const_iterator iter = neighViews.begin();
-        iter != neighViews.end() && !progress.cancelled; ++iter)
-        views[*iter]->loadColorImage(0);
-}
-
 void
 DMRecon::processFeatures(){
 
@@ -281,6 +100,7 @@ DMRecon::processFeatures(){
 
     std::size_t success = 0;
     std::size_t processed = 0;
+    PatchOptimization patch(views, settings, neighViews);
     for (std::size_t i = 0; i < features.size() && !progress.cancelled; ++i) {
         /*
          * Use feature if visible in reference view or
@@ -326,8 +146,7 @@ DMRecon::processFeatures(){
         float initDepth = (featPos - refV->camPos).norm();
 
         // 对三维点的深度进行优化，同时得到法向量，深度图，以及优化的可信度
-        PatchOptimization patch(views, settings, x, y, initDepth,
-            0.f, 0.f, neighViews, IndexSet());
+        patch.init(x, y, initDepth, 0.f, 0.f, LocalIndexSet());
         patch.doAutoOptimization();
         float conf = patch.computeConfidence();
         if (conf <= 0.0f)
@@ -372,125 +191,397 @@ DMRecon::processFeatures(){
                   << success << " succeeded optimization." << std::endl;
 }
 
-void
-DMRecon::processQueue()
+namespace
 {
-    progress.status = RECON_QUEUE;
-    if (progress.cancelled)  return;
+    /* Confidence of tiles without seeds. */
+    float const NO_SEED = -std::numeric_limits<float>::max();
 
-    // 当前的参考视角
-    SingleView::Ptr refV = this->views[settings.refViewNr];
+    /* Maximum number of seeds a thread grows before picking a tile again. */
+    int const SEEDS_PER_CLAIM = 64;
 
-    if (!settings.quiet)
-        std::cout << "Process queue ..." << std::endl;
+    /* Raises the value to x, returns false if the value was not smaller. */
+    bool
+    atomicUpdateMax(std::atomic<float>* value, float x)
+    {
+        float current = value->load();
+        while (current < x)
+            if (value->compare_exchange_weak(current, x))
+                return true;
+        return false;
+    }
 
-    size_t count = 0, lastStatus = 1;
-    progress.queueSize = prQueue.size();
+    /*
+     * Lock-free multi-producer, single-consumer stack for seeds crossing
+     * a tile boundary. Any thread pushes, the thread owning the tile takes
+     * all seeds at once.
+     */
+    class SeedInbox
+    {
+    public:
+        struct Node
+        {
+            QueueData data;
+            Node* next;
+        };
 
-    // 初始状态
-    if (!settings.quiet)
-        std::cout << "Count: " << std::setw(8) << count
-                  << "  filled: " << std::setw(8) << progress.filled  // 填充深度值的像素个数
-                  << "  Queue: " << std::setw(8) << progress.queueSize  // 队列中的种子点个数
-                  << std::endl;
-    lastStatus = progress.filled;
-
-    // 队列不为空
-    while (!prQueue.empty() && !progress.cancelled){
-
-        progress.queueSize = prQueue.size();
-
-        // 每填充1000个像素并且填充像素在增加，则打印输出填充结果
-        if ((progress.filled % 1000 == 0) && (progress.filled != lastStatus)) {
-            if (!settings.quiet)
-                std::cout << "Count: " << std::setw(8) << count
-                          << "  filled: " << std::setw(8) << progress.filled
-                          << "  Queue: " << std::setw(8) << progress.queueSize
-                          << std::endl;
-            lastStatus = progress.filled;
+        SeedInbox();
+        ~SeedInbox();
+
+        void push(QueueData const& data);
+        Node* takeAll();
+
+    private:
+        std::atomic<Node*> head;
+    };
+
+    SeedInbox::SeedInbox()
+        : head(nullptr)
+    {
+    }
+
+    SeedInbox::~SeedInbox()
+    {
+        Node* node = this->takeAll();
+        while (node != nullptr) {
+            Node* next = node->next;
+            delete node;
+            node = next;
         }
+    }
+
+    void
+    SeedInbox::push(QueueData const& data)
+    {
+        Node* node = new Node;
+        node->data = data;
+        node->next = this->head.load(std::memory_order_relaxed);
+        while (!this->head.compare_exchange_weak(node->next, node,
+            std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    SeedInbox::Node*
+    SeedInbox::takeAll()
+    {
+        return this->head.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    /*
+     * Every tile owns the pixels inside its rectangle. Only the thread
+     * holding the tile grows its queue, so pixels are written by a single
+     * thread at a time.
+     */
+    struct Tile
+    {
+        std::priority_queue<QueueData> queue;
+        SeedInbox inbox;
+        std::atomic<bool> busy;
+        /* Best confidence in the queue, written by the owner only. */
+        std::atomic<float> queueBest;
+        /* Upper bound of the best confidence in the inbox. */
+        std::atomic<float> inboxBest;
+
+        Tile() : busy(false), queueBest(NO_SEED), inboxBest(NO_SEED) {}
+    };
+
+    /*
+     * Parallel best-first region growing. The image is partitioned into
+     * tiles with one priority queue each. Threads repeatedly claim the
+     * free tile with the best seed and grow a batch of seeds from it.
+     * Seeds for pixels of another tile are handed over through its inbox.
+     */
+    class RegionGrowing
+    {
+    public:
+        RegionGrowing(std::vector<SingleView::Ptr> const& views,
+            Settings const& settings, IndexSet const& neighViews,
+            Progress* progress);
+
+        void run(std::priority_queue<QueueData>* seeds);
+
+    private:
+        void worker();
+        Tile* claimTile();
+        void growTile(Tile* tile, PatchOptimization* patch);
+        void growSeed(Tile* tile, QueueData seed, PatchOptimization* patch);
+        void pushSeed(Tile* tile, QueueData const& seed);
+        void printStatus(std::size_t filled);
+
+    private:
+        std::vector<SingleView::Ptr> const& views;
+        Settings const& settings;
+        IndexSet const& neighViews;
+        Progress* progress;
+        SingleView::Ptr refV;
+        int width;
+        int height;
+        int tileSize;
+        int tilesX;
+        int numTiles;
+
+        std::unique_ptr<Tile[]> tiles;
+        /* Per-pixel confidence, only ever raised by compare-and-update. */
+        std::unique_ptr<std::atomic<float>[]> confidence;
+
+        /* Seeds in all queues and inboxes, including seeds in process. */
+        std::atomic<std::size_t> pending;
+        std::atomic<std::size_t> filled;
+        std::atomic<std::size_t> count;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+        std::mutex statusMutex;
+    };
+
+    RegionGrowing::RegionGrowing(std::vector<SingleView::Ptr> const& views,
+        Settings const& settings, IndexSet const& neighViews,
+        Progress* progress)
+        : views(views)
+        , settings(settings)
+        , neighViews(neighViews)
+        , progress(progress)
+        , refV(views[settings.refViewNr])
+        , width(refV->confImg->width())
+        , height(refV->confImg->height())
+        , tileSize(std::max(1, static_cast<int>(settings.tileSize)))
+        , tilesX((width + tileSize - 1) / tileSize)
+        , numTiles(tilesX * ((height + tileSize - 1) / tileSize))
+        , tiles(new Tile[numTiles])
+        , confidence(new std::atomic<float>[width * height])
+        , pending(0)
+        , filled(progress->filled)
+        , count(0)
+        , failed(false)
+    {
+        for (int i = 0; i < width * height; ++i)
+            confidence[i].store(refV->confImg->at(i),
+                std::memory_order_relaxed);
+    }
+
+    void
+    RegionGrowing::run(std::priority_queue<QueueData>* seeds)
+    {
+        /* Distribute the seeds to the tiles. */
+        for (; !seeds->empty(); seeds->pop()) {
+            QueueData const& seed = seeds->top();
+            if (seed.x < 0 || seed.x >= this->width
+                || seed.y < 0 || seed.y >= this->height)
+                continue;
+            this->pending += 1;
+            Tile& tile = this->tiles[(seed.y / this->tileSize) * this->tilesX
+                + seed.x / this->tileSize];
+            tile.queue.push(seed);
+        }
+        for (int i = 0; i < this->numTiles; ++i)
+            if (!this->tiles[i].queue.empty())
+                this->tiles[i].queueBest
+                    = this->tiles[i].queue.top().confidence;
+
+        if (!settings.quiet)
+            std::cout << "Count: " << std::setw(8) << 0
+                      << "  filled: " << std::setw(8) << this->filled
+                      << "  Queue: " << std::setw(8) << this->pending
+                      << std::endl;
+
+        unsigned int const numThreads = settings.numThreads > 0
+            ? settings.numThreads
+            : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < numThreads; ++i)
+            threads.emplace_back(&RegionGrowing::worker, this);
+        this->worker();
+        for (std::size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+
+        if (this->error)
+            std::rethrow_exception(this->error);
+
+        /* Copy back the confidences. */
+        for (int i = 0; i < width * height; ++i)
+            refV->confImg->at(i) = confidence[i].load();
+        this->progress->filled = this->filled;
+        this->progress->queueSize = 0;
+    }
 
-        // 取出第一个种子点
-        QueueData tmpData = prQueue.top();
-        // 去除种子点
-        prQueue.pop();
-        ++count;
-        float x = tmpData.x;
-        float y = tmpData.y;
-        int index = y * this->width + x;
-
-        //此处应该是相等的
-        if (refV->confImg->at(index) > tmpData.confidence) {
-            continue ;
+    void
+    RegionGrowing::worker()
+    {
+        try {
+            /* Every thread reuses one optimizer for all its seeds. */
+            PatchOptimization patch(this->views, this->settings,
+                this->neighViews);
+            while (this->pending.load() > 0 && !this->failed
+                && !this->progress->cancelled) {
+                Tile* tile = this->claimTile();
+                if (tile == nullptr) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                this->growTile(tile, &patch);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(this->statusMutex);
+            if (!this->error)
+                this->error = std::current_exception();
+            this->failed = true;
+        }
+    }
+
+    Tile*
+    RegionGrowing::claimTile()
+    {
+        /* Claim the free tile with the best seed. */
+        while (true) {
+            int bestTile = -1;
+            float bestConf = NO_SEED;
+            for (int i = 0; i < this->numTiles; ++i) {
+                Tile const& tile = this->tiles[i];
+                if (tile.busy.load(std::memory_order_relaxed))
+                    continue;
+                float const conf = std::max(tile.queueBest.load(),
+                    tile.inboxBest.load());
+                if (conf > bestConf) {
+                    bestConf = conf;
+                    bestTile = i;
+                }
+            }
+            if (bestTile < 0)
+                return nullptr;
+
+            bool expected = false;
+            if (this->tiles[bestTile].busy.compare_exchange_strong(expected,
+                true, std::memory_order_acquire))
+                return &this->tiles[bestTile];
         }
+    }
+
+    void
+    RegionGrowing::growTile(Tile* tile, PatchOptimization* patch)
+    {
+        /* Take the seeds handed over by other tiles. */
+        tile->inboxBest.store(NO_SEED);
+        SeedInbox::Node* node = tile->inbox.takeAll();
+        while (node != nullptr) {
+            SeedInbox::Node* next = node->next;
+            tile->queue.push(node->data);
+            delete node;
+            node = next;
+        }
+
+        for (int i = 0; i < SEEDS_PER_CLAIM && !tile->queue.empty()
+            && !this->progress->cancelled; ++i) {
+            QueueData seed = tile->queue.top();
+            tile->queue.pop();
+            this->growSeed(tile, seed, patch);
+            this->pending -= 1;
+        }
+
+        tile->queueBest.store(tile->queue.empty()
+            ? NO_SEED : tile->queue.top().confidence);
+        tile->busy.store(false, std::memory_order_release);
+    }
+
+    void
+    RegionGrowing::growSeed(Tile* tile, QueueData seed,
+        PatchOptimization* patch)
+    {
+        this->count += 1;
+        int const x = seed.x;
+        int const y = seed.y;
+        int const index = y * this->width + x;
+        if (this->confidence[index].load() > seed.confidence)
+            return;
 
         /**进行patch 优化**/
-        PatchOptimization patch(views, settings, x, y, tmpData.depth,
-            tmpData.dz_i, tmpData.dz_j, neighViews, tmpData.localViewIDs);
-        patch.doAutoOptimization();
-        tmpData.confidence = patch.computeConfidence();
+        patch->init(x, y, seed.depth, seed.dz_i, seed.dz_j,
+            seed.localViewIDs);
+        patch->doAutoOptimization();
+        seed.confidence = patch->computeConfidence();
 
         /*优化后的confidence<0 则抛除*/
-        if (tmpData.confidence == 0) {
-            continue;
+        if (seed.confidence == 0)
+            return;
+
+        // 之前没有被优化过的点
+        if (this->confidence[index].load() <= 0) {
+            std::size_t const numFilled = ++this->filled;
+            if (numFilled % 1000 == 0)
+                this->printStatus(numFilled);
         }
 
-        float new_depth = patch.getDepth();
-        tmpData.depth = new_depth;
-        tmpData.dz_i = patch.getDzI();
-        tmpData.dz_j = patch.getDzJ();
-        math::Vec3f normal = patch.getNormal();
-        tmpData.localViewIDs = patch.getLocalViewIDs();
+        // 优化后性能有了提升的点，像素只属于当前tile，只有本线程写深度等
+        if (!atomicUpdateMax(&this->confidence[index], seed.confidence))
+            return;
 
-        // 之前没有被优化过的点
-        if (refV->confImg->at(index) <= 0) {
-            ++progress.filled;
+        seed.depth = patch->getDepth();
+        seed.dz_i = patch->getDzI();
+        seed.dz_j = patch->getDzJ();
+        seed.localViewIDs = patch->getLocalViewIDs();
+        math::Vec3f normal = patch->getNormal();
+        refV->depthImg->at(index) = seed.depth;
+        refV->normalImg->at(index, 0) = normal[0];
+        refV->normalImg->at(index, 1) = normal[1];
+        refV->normalImg->at(index, 2) = normal[2];
+        refV->dzImg->at(index, 0) = seed.dz_i;
+        refV->dzImg->at(index, 1) = seed.dz_j;
+
+        /***
+         * 如果优化后的pixel confidence比neighboring pixel 的confidence好0.05以上， 那么将该pixel的初始化变量赋给
+         * neighboring 像素继续进行优化，交替进行指导neigboring pixels的confidence小于一定的值
+         */
+        int const offsets[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+        for (int i = 0; i < 4; ++i) {
+            seed.x = x + offsets[i][0];
+            seed.y = y + offsets[i][1];
+            if (seed.x < 0 || seed.x >= this->width
+                || seed.y < 0 || seed.y >= this->height)
+                continue;
+            float const conf = this->confidence[seed.y * this->width
+                + seed.x].load();
+            if (conf < seed.confidence - 0.05f || conf == 0.f)
+                this->pushSeed(tile, seed);
         }
-        // 优化后性能有了提升的点
-        if (refV->confImg->at(index) < tmpData.confidence) {
-            refV->depthImg->at(index) = tmpData.depth;
-            refV->normalImg->at(index, 0) = normal[0];
-            refV->normalImg->at(index, 1) = normal[1];
-            refV->normalImg->at(index, 2) = normal[2];
-            refV->dzImg->at(index, 0) = tmpData.dz_i;
-            refV->dzImg->at(index, 1) = tmpData.dz_j;
-            refV->confImg->at(index) = tmpData.confidence;
-
-            // left
-            tmpData.x = x - 1; tmpData.y = y;
-            index = tmpData.y * this->width + tmpData.x;
-
-            /***
-             * 如果优化后的pixel confidence比neighboring pixel 的confidence好0.05以上， 那么将该pixel的初始化变量赋给
-             * neighboring 像素继续进行优化，交替进行指导neigboring pixels的confidence小于一定的值
-             */
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f){
-                prQueue.push(tmpData);
-            }
-            // right
-            tmpData.x = x + 1; tmpData.y = y;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f){
-                prQueue.push(tmpData);
-            }
-            // top
-            tmpData.x = x; tmpData.y = y - 1;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f){
-                prQueue.push(tmpData);
-            }
-            // bottom
-            tmpData.x = x; tmpData.y = y + 1;
-            index = tmpData.y * this->width + tmpData.x;
-            if (refV->confImg->at(index) < tmpData.confidence - 0.05f ||
-                refV->confImg->at(index) == 0.f){
-                prQueue.push(tmpData);
-            }
+    }
+
+    void
+    RegionGrowing::pushSeed(Tile* tile, QueueData const& seed)
+    {
+        this->pending += 1;
+        Tile* owner = &this->tiles[(seed.y / this->tileSize) * this->tilesX
+            + seed.x / this->tileSize];
+        if (owner == tile) {
+            tile->queue.push(seed);
+            return;
         }
+        owner->inbox.push(seed);
+        atomicUpdateMax(&owner->inboxBest, seed.confidence);
+    }
+
+    void
+    RegionGrowing::printStatus(std::size_t filled)
+    {
+        std::lock_guard<std::mutex> lock(this->statusMutex);
+        this->progress->filled = filled;
+        this->progress->queueSize = this->pending;
+        if (!settings.quiet)
+            std::cout << "Count: " << std::setw(8) << this->count
+                      << "  filled: " << std::setw(8) << filled
+                      << "  Queue: " << std::setw(8) << this->pending
+                      << std::endl;
     }
 }
 
+void
+DMRecon::processQueue()
+{
+    progress.status = RECON_QUEUE;
+    if (progress.cancelled)  return;
+
+    if (!settings.quiet)
+        std::cout << "Process queue ..." << std::endl;
+
+    RegionGrowing growing(this->views, this->settings, this->neighViews,
+        &this->progress);
+    growing.run(&this->prQueue);
+}
+
 MVS_NAMESPACE_END
@@ -19,6 +19,7 @@
 #include "core/image.h"
 #include "core/scene.h"
 #include "mvs/defines.h"
+#include "mvs/depth_recon.h"
 #include "mvs/patch_optimization.h"
 #include "mvs/single_view.h"
 #include "mvs/progress.h"
@@ -39,36 +40,22 @@ struct QueueData{
     float dz_i, dz_j;
 
     // 局部视角，用于进行depeth, dz_i, dz_j的优化
-    IndexSet localViewIDs;
+    LocalIndexSet localViewIDs;
 
     bool operator< (const QueueData& rhs) const;
 };
 
-class DMRecon
+class DMRecon : public DepthRecon
 {
 public:
     DMRecon(core::Scene::Ptr scene, Settings const& settings);
 
-    std::size_t getRefViewNr() const;
-    Progress const& getProgress() const;
-    Progress& getProgress();
     void start();
 
 private:
-    core::Scene::Ptr scene;
-    core::Bundle::ConstPtr bundle;
-    std::vector<SingleView::Ptr> views;
-
-    Settings settings;
     std::priority_queue<QueueData> prQueue;
-    IndexSet neighViews;
     std::vector<SingleView::Ptr> imgNeighbors;
-    int width;
-    int height;
-    Progress progress;
 
-    void analyzeFeatures();
-    void globalViewSelection();
     void processFeatures();
     void processQueue();
     void refillQueueFromLowRes();
@@ -81,23 +68,6 @@ QueueData::operator< (const QueueData& rhs) const{
     return (confidence < rhs.confidence);
 }
 
-inline const Progress&
-DMRecon::getProgress() const{
-    return progress;
-}
-
-inline Progress&
-DMRecon::getProgress()
-{
-    return progress;
-}
-
-inline std::size_t
-DMRecon::getRefViewNr() const
-{
-    return settings.refViewNr;
-}
-
 MVS_NAMESPACE_END
 
 #endif
@@ -10,6 +10,7 @@
 #include "mvs/image_pyramid.h"
 
 #include "core/image_tools.h"
+#include "mvs/mvs_tools.h"
 #include <cassert>
 
 MVS_NAMESPACE_BEGIN
@@ -87,46 +88,88 @@ namespace
                 curr_height = img->height();
             }
 
-            if (minLevel <= i)
+            if (minLevel <= i) {
                 levels[i].image = img;
+                levels[i].planar = toLinearPlanar(*img);
+            }
         }
 
         view->cache_cleanup();
     }
+
+    std::size_t
+    pyramidByteSize(ImagePyramid const& levels)
+    {
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < levels.size(); ++i)
+        {
+            if (levels[i].image != nullptr)
+                bytes += levels[i].image->get_byte_size();
+            if (levels[i].planar != nullptr)
+                bytes += levels[i].planar->getByteSize();
+        }
+        return bytes;
+    }
 }
 
 ImagePyramid::ConstPtr
 ImagePyramidCache::get(core::Scene::Ptr scene, core::View::Ptr view,
     std::string embeddingName, int minLevel)
 {
-    std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
 
-    /* Initialize on first access. */
-    if (ImagePyramidCache::cachedScene == nullptr) {
-        ImagePyramidCache::cachedScene = scene;
-        ImagePyramidCache::cachedEmbedding = embeddingName;
-    }
+        /* Initialize on first access. */
+        if (ImagePyramidCache::cachedScene == nullptr) {
+            ImagePyramidCache::cachedScene = scene;
+            ImagePyramidCache::cachedEmbedding = embeddingName;
+        }
 
-    ImagePyramid::Ptr pyramid;
+        if (scene == ImagePyramidCache::cachedScene
+            && embeddingName == ImagePyramidCache::cachedEmbedding)
+        {
+            /* Use cached entry and mark it as most recently used. */
+            std::shared_ptr<Entry>& cached
+                = ImagePyramidCache::entries[view->get_id()];
+            if (cached == nullptr) {
+                cached = std::make_shared<Entry>();
+                ImagePyramidCache::lruList.push_front(view->get_id());
+                cached->lruPos = ImagePyramidCache::lruList.begin();
+            }
+            else
+                ImagePyramidCache::lruList.splice(
+                    ImagePyramidCache::lruList.begin(),
+                    ImagePyramidCache::lruList, cached->lruPos);
+            entry = cached;
+        }
+    }
 
-    if (scene != ImagePyramidCache::cachedScene
-        || embeddingName != ImagePyramidCache::cachedEmbedding)
+    if (entry == nullptr)
     {
         /* create own pyramid because shared pyramid is incompatible. */
-        pyramid = buildPyramid(view, embeddingName);
+        ImagePyramid::Ptr pyramid = buildPyramid(view, embeddingName);
+        ensureImages(*pyramid, view, embeddingName, minLevel);
+        return pyramid;
     }
-    else
+
+    /* Either re-recreate or use cached entry. */
+    ImagePyramid::Ptr pyramid;
+    std::size_t byteSize;
     {
-        /* Either re-recreate or use cached entry. */
-        pyramid = ImagePyramidCache::entries[view->get_id()];
-        if (pyramid == nullptr)
-        {
-            pyramid = buildPyramid(view, embeddingName);
-            ImagePyramidCache::entries[view->get_id()] = pyramid;
-        }
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if (entry->pyramid == nullptr)
+            entry->pyramid = buildPyramid(view, embeddingName);
+        pyramid = entry->pyramid;
+        // 根据设定的尺度添加图像，从minLevel开始
+        ensureImages(*pyramid, view, embeddingName, minLevel);
+        byteSize = pyramidByteSize(*pyramid);
     }
-    // 根据设定的尺度添加图像，从minLevel开始
-    ensureImages(*pyramid, view, embeddingName, minLevel);
+
+    std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
+    ImagePyramidCache::memoryUsage += byteSize - entry->byteSize;
+    entry->byteSize = byteSize;
+    ImagePyramidCache::evictUnused();
     return pyramid;
 }
 
@@ -134,21 +177,49 @@ void
 ImagePyramidCache::cleanup()
 {
     std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
+    ImagePyramidCache::evictUnused();
+}
+
+void
+ImagePyramidCache::setMemoryLimit(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
+    ImagePyramidCache::memoryLimit = bytes;
+    ImagePyramidCache::evictUnused();
+}
+
+std::size_t
+ImagePyramidCache::getMemoryUsage()
+{
+    std::lock_guard<std::mutex> lock(ImagePyramidCache::metadataMutex);
+    return ImagePyramidCache::memoryUsage;
+}
 
+void
+ImagePyramidCache::evictUnused()
+{
     if (ImagePyramidCache::cachedScene == nullptr)
         return;
 
-    for (std::map<int, ImagePyramid::Ptr>::iterator it = ImagePyramidCache::entries.begin();
-         it != ImagePyramidCache::entries.end(); ++it)
+    /*
+     * Release least recently used pyramids that are only referenced by
+     * the cache. Entries being loaded are skipped.
+     */
+    std::list<int>::reverse_iterator it = ImagePyramidCache::lruList.rbegin();
+    for (; it != ImagePyramidCache::lruList.rend()
+        && ImagePyramidCache::memoryUsage > ImagePyramidCache::memoryLimit;
+        ++it)
     {
-        if (it->second == nullptr)
+        Entry& entry = *ImagePyramidCache::entries[*it];
+        std::unique_lock<std::mutex> lock(entry.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || entry.pyramid == nullptr
+            || entry.pyramid.use_count() != 1)
             continue;
 
-        if (it->second.use_count() == 1)
-        {
-            it->second.reset();
-            ImagePyramidCache::cachedScene->get_view_by_id(it->first)->cache_cleanup();
-        }
+        entry.pyramid.reset();
+        ImagePyramidCache::memoryUsage -= entry.byteSize;
+        entry.byteSize = 0;
+        ImagePyramidCache::cachedScene->get_view_by_id(*it)->cache_cleanup();
     }
 }
 
@@ -156,6 +227,10 @@ ImagePyramidCache::cleanup()
 std::mutex ImagePyramidCache::metadataMutex;
 core::Scene::Ptr ImagePyramidCache::cachedScene;
 std::string ImagePyramidCache::cachedEmbedding = "";
-std::map<int, ImagePyramid::Ptr> ImagePyramidCache::entries;
+std::map<int, std::shared_ptr<ImagePyramidCache::Entry> >
+    ImagePyramidCache::entries;
+std::list<int> ImagePyramidCache::lruList;
+std::size_t ImagePyramidCache::memoryLimit = 0;
+std::size_t ImagePyramidCache::memoryUsage = 0;
 
 MVS_NAMESPACE_END
@@ -10,6 +10,7 @@
 #ifndef DMRECON_IMAGE_PYRAMID_H
 #define DMRECON_IMAGE_PYRAMID_H
 
+#include <list>
 #include <vector>
 #include <memory>
 #include <map>
@@ -25,12 +26,44 @@
 
 MVS_NAMESPACE_BEGIN
 
+/**
+ * Linear RGB image with one float plane per channel. The patch sampling
+ * kernels read it directly without converting from sRGB bytes.
+ */
+struct PlanarImage{
+
+    typedef std::shared_ptr<PlanarImage> Ptr;
+    typedef std::shared_ptr<PlanarImage const> ConstPtr;
+
+    // 图像宽和高
+    int width, height;
+    // 红、绿、蓝三个通道依次存放，每个通道width * height个值
+    std::vector<float> data;
+
+    float const* plane(int channel) const;
+    std::size_t getByteSize() const;
+};
+
+inline float const*
+PlanarImage::plane(int channel) const
+{
+    return data.data() + channel * width * height;
+}
+
+inline std::size_t
+PlanarImage::getByteSize() const
+{
+    return data.size() * sizeof(float);
+}
+
 struct ImagePyramidLevel{
 
     // 图像宽和高
     int width, height;
     // 图像数据
     core::ByteImage::ConstPtr image;
+    // 线性RGB浮点图像，用于patch采样
+    PlanarImage::ConstPtr planar;
     // 投影矩阵
     math::Matrix3f proj;
     // 逆投影矩阵
@@ -69,6 +102,12 @@ public:
     typedef std::shared_ptr<ImagePyramid const> ConstPtr;
 };
 
+/**
+  * Process-wide cache of image pyramids, shared by all reconstructions of
+  * a scene. Pyramids that are not in use are kept in least-recently-used
+  * order until the memory limit is exceeded. Loading locks only the entry
+  * of the requested view, so different views load concurrently.
+  */
 class ImagePyramidCache
 {
 public:
@@ -76,12 +115,32 @@ public:
         core::View::Ptr view, std::string embeddingName, int minLevel);
     static void cleanup();
 
+    /** Sets the byte budget for cached pyramids, 0 keeps no unused pyramid. */
+    static void setMemoryLimit(std::size_t bytes);
+    /** Returns the bytes of all cached pyramids, including those in use. */
+    static std::size_t getMemoryUsage();
+
 private:
+    struct Entry
+    {
+        std::mutex mutex;
+        ImagePyramid::Ptr pyramid;
+        std::size_t byteSize = 0;
+        std::list<int>::iterator lruPos;
+    };
+
+    /** Releases unused pyramids, requires the metadata lock. */
+    static void evictUnused();
+
     static std::mutex metadataMutex;
     static core::Scene::Ptr cachedScene;
     static std::string cachedEmbedding;
 
-    static std::map<int, ImagePyramid::Ptr> entries;
+    static std::map<int, std::shared_ptr<Entry> > entries;
+    /** View IDs of the entries, most recently used first. */
+    static std::list<int> lruList;
+    static std::size_t memoryLimit;
+    static std::size_t memoryUsage;
 };
 
 MVS_NAMESPACE_END
@@ -7,6 +7,9 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <stdexcept>
+
 #include "math/defines.h"
 #include "math/functions.h"
 #include "mvs/local_view_selection.h"
@@ -19,19 +22,31 @@ MVS_NAMESPACE_BEGIN
 LocalViewSelection::LocalViewSelection(
     std::vector<SingleView::Ptr> const& views,
     Settings const& settings,
-    IndexSet const& globalViewIDs,
-    IndexSet const& propagated,
-    PatchSampler::Ptr sampler):
-    ViewSelection(settings),
+    IndexSet const& globalViews,
+    PatchSampler& sampler):
     success(false),
     views(views),
-    sampler(sampler){
+    settings(settings),
+    sampler(sampler),
+    globalViewIDs(globalViews.begin(), globalViews.end()),
+    available(views.size(), false),
+    viewDir(views.size()),
+    epipolarPlane(views.size()),
+    ncc(views.size(), 0.f){
+
+    if (settings.nrReconNeighbors > MAX_LOCAL_NEIGHBORS)
+        throw std::invalid_argument("Too many local neighbors requested");
+}
+
+void LocalViewSelection::init(LocalIndexSet const& propagated){
+
+    success = false;
 
     // inherited attribute
     this->selected = propagated;
 
     /*patch采样在参考视角中失败*/
-    if (!sampler->success[settings.refViewNr]) {
+    if (!sampler.succeeded(settings.refViewNr)) {
         return;
     }
 
@@ -47,17 +62,15 @@ LocalViewSelection::LocalViewSelection(
     }
 
     /**将所有视角的flag设置成false**/
-    available.clear();
-    available.resize(views.size(), false);
+    std::fill(available.begin(), available.end(), false);
 
     /**将所有global的视角设置成true**/
-    IndexSet::const_iterator id;
-    for (id = globalViewIDs.begin(); id != globalViewIDs.end(); ++id) {
-        available[*id] = true;
+    for (std::size_t i = 0; i < globalViewIDs.size(); ++i) {
+        available[globalViewIDs[i]] = true;
     }
 
     /**将所有的已经选择的视角设置成false**/
-    IndexSet::const_iterator sel;
+    LocalIndexSet::const_iterator sel;
     for (sel = selected.begin(); sel != selected.end(); ++sel) {
         available[*sel] = false;
     }
@@ -74,24 +87,22 @@ void LocalViewSelection::performVS(){
     }
 
     /*获取参考视角*/
-    SingleView::Ptr refV = views[settings.refViewNr];
+    SingleView* refV = views[settings.refViewNr].get();
 
     /*获取patch的中心点*/
-    math::Vec3f p(sampler->getMidWorldPoint());
+    math::Vec3f p(sampler.getMidWorldPoint());
 
     // pixel print in reference view
     float mfp = refV->footPrintScaled(p);
     math::Vec3f refDir = (p - refV->camPos).normalized();
 
     /*计算patch在参考视角和其他所有视角的的ncc, 极平面的法向量*/
-    std::map<std::size_t, math::Vec3f> viewDir;
-    std::map<std::size_t, math::Vec3f> epipolarPlane; // plane normal
-    std::map<std::size_t, float> ncc;
-    for (std::size_t i = 0; i < views.size(); ++i) {
+    for (std::size_t k = 0; k < globalViewIDs.size(); ++k) {
+        std::size_t const i = globalViewIDs[k];
         if (!available[i])
             continue;
         /*计算patch在第i个视角和参考视角的NCC值*/
-        float tmpNCC = sampler->getFastNCC(i);
+        float tmpNCC = sampler.getFastNCC(i);
 
         /*如果NCC的值小于设定的阈值*/
         assert(!MATH_ISNAN(tmpNCC));
@@ -108,7 +119,7 @@ void LocalViewSelection::performVS(){
     }
 
     /*对于所有的已经选择的视角，计算极平面的法向量*/
-    IndexSet::const_iterator sel;
+    LocalIndexSet::const_iterator sel;
     for (sel = selected.begin(); sel != selected.end(); ++sel) {
         viewDir[*sel] = (p - views[*sel]->camPos).normalized();
         epipolarPlane[*sel] = (viewDir[*sel].cross(refDir)).normalized();
@@ -120,7 +131,8 @@ void LocalViewSelection::performVS(){
         foundOne = false;
         std::size_t maxView = 0;
         float maxScore = 0.f;
-        for (std::size_t i = 0; i < views.size(); ++i) {
+        for (std::size_t k = 0; k < globalViewIDs.size(); ++k) {
+            std::size_t const i = globalViewIDs[k];
             if (!available[i])
                 continue;
             float score = ncc[i];
@@ -180,9 +192,9 @@ void LocalViewSelection::performVS(){
 }
 
 void
-LocalViewSelection::replaceViews(IndexSet const & toBeReplaced){
+LocalViewSelection::replaceViews(LocalIndexSet const & toBeReplaced){
 
-    IndexSet::const_iterator tbr = toBeReplaced.begin();
+    LocalIndexSet::const_iterator tbr = toBeReplaced.begin();
     while (tbr != toBeReplaced.end()) {
         available[*tbr] = false;
         selected.erase(*tbr);
@@ -13,7 +13,6 @@
 
 #include "mvs/defines.h"
 #include "mvs/settings.h"
-#include "mvs/view_selection.h"
 #include "mvs/patch_sampler.h"
 #include "mvs/single_view.h"
 
@@ -23,15 +22,20 @@ MVS_NAMESPACE_BEGIN
 /**
  * 局部视角选择是从全局视角中选取一些视角(最多4个)，局部视角是针对每个patch的
  * 因此更加灵活，也就是每个patch的局部视角可以是不同的，但是全局视角都是相同的。
+ *
+ * The per-view buffers are allocated once, init() restarts the selection
+ * for the next patch of the sampler.
  */
-class LocalViewSelection : public ViewSelection{
+class LocalViewSelection{
 public:
     LocalViewSelection(
         std::vector<SingleView::Ptr> const& views,
         Settings const& settings,
         IndexSet const& globalViews,
-        IndexSet const& propagated,
-        PatchSampler::Ptr sampler);
+        PatchSampler& sampler);
+
+    /**从propagated开始新的视角选择**/
+    void init(LocalIndexSet const& propagated);
 
     /**进行视角选怎**/
     void performVS();
@@ -40,16 +44,35 @@ public:
      * 从local view中去除toBeReplaced的视角，并重新进行local view selection
      * @param toBeReplaced
      */
-    void replaceViews(IndexSet const& toBeReplaced);
+    void replaceViews(LocalIndexSet const& toBeReplaced);
+
+    /**获取已经选择的视角**/
+    LocalIndexSet const& getSelectedIDs() const;
 
     /**是否成功**/
     bool success;
 
 private:
     std::vector<SingleView::Ptr> const& views;
-    PatchSampler::Ptr sampler;
+    Settings const& settings;
+    PatchSampler& sampler;
+
+    std::vector<std::size_t> globalViewIDs;   // 全局视角
+    std::vector<bool> available;  // flag--用于指示视角是否可用
+    LocalIndexSet selected;       // 选择的视角的索引
+
+    /** per-view buffers of performVS() */
+    std::vector<math::Vec3f> viewDir;
+    std::vector<math::Vec3f> epipolarPlane; // plane normal
+    std::vector<float> ncc;
 };
 
+inline LocalIndexSet const&
+LocalViewSelection::getSelectedIDs() const
+{
+    return selected;
+}
+
 MVS_NAMESPACE_END
 
 #endif
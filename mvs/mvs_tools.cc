@@ -8,10 +8,26 @@
  */
 
 #include <cassert>
+#include <cmath>
+#include <stdexcept>
 #include <string>
 
+/*
+ * The AVX2 sampling kernels are compiled with function level target
+ * attributes and selected at runtime. FMA is not enabled, which keeps the
+ * samples identical to the scalar kernels.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define MVS_AVX2_KERNELS 1
+#   define MVS_TARGET(isa) __attribute__((target(isa)))
+#   include <immintrin.h>
+#else
+#   define MVS_AVX2_KERNELS 0
+#endif
+
 #include "core/image_tools.h"
 #include "core/image_io.h"
+#include "util/system.h"
 #include "mvs/mvs_tools.h"
 
 MVS_NAMESPACE_BEGIN
@@ -96,12 +112,13 @@ namespace
 
 
 void
-colAndExactDeriv(core::ByteImage const& img, PixelCoords const& imgPos,
-    PixelCoords const& gradDir, Samples& color, Samples& deriv)
+colAndExactDeriv(core::ByteImage const& img, math::Vec2f const* imgPos,
+    math::Vec2f const* gradDir, std::size_t num,
+    math::Vec3f* color, math::Vec3f* deriv)
 {
     int const width = img.width();
     int const height = img.height();
-    for (std::size_t i = 0; i < imgPos.size(); ++i) {
+    for (std::size_t i = 0; i < num; ++i) {
 
         int const left = std::floor(imgPos[i][0]);
         int const top = std::floor(imgPos[i][1]);
@@ -149,13 +166,13 @@ colAndExactDeriv(core::ByteImage const& img, PixelCoords const& imgPos,
 
 void
 getXYZColorAtPix(core::ByteImage const& img,
-    std::vector<math::Vec2i> const& imgPos, Samples* color){
+    math::Vec2i const* imgPos, std::size_t num, math::Vec3f* color){
 
     // 图像的宽度
     int width = img.width();
-    Samples::iterator itCol = color->begin();
+    math::Vec3f* itCol = color;
 
-    for (std::size_t i = 0; i < imgPos.size(); ++i) {
+    for (std::size_t i = 0; i < num; ++i) {
 
         // 全局索引
         int const idx = imgPos[i][1] * width + imgPos[i][0];
@@ -171,17 +188,17 @@ getXYZColorAtPix(core::ByteImage const& img,
 /* ------------------------------------------------------------------ */
 
 void
-getXYZColorAtPos(core::ByteImage const& img, PixelCoords const& imgPos,
-    Samples* color){
+getXYZColorAtPos(core::ByteImage const& img, math::Vec2f const* imgPos,
+    std::size_t num, math::Vec3f* color){
 
     // 图像尺寸
     int width = img.width();
     int height = img.height();
-    PixelCoords::const_iterator citPos;
-    Samples::iterator itCol = color->begin();
+    math::Vec2f const* citPos = imgPos;
+    math::Vec3f* itCol = color;
 
     /**对图像的每个位置**/
-    for (citPos = imgPos.begin(); citPos != imgPos.end(); ++citPos, ++itCol){
+    for (; citPos != imgPos + num; ++citPos, ++itCol){
         int const i = floor((*citPos)[0]);
         int const j = floor((*citPos)[1]);
         assert(i < width-1 && j < height-1);
@@ -205,4 +222,228 @@ getXYZColorAtPos(core::ByteImage const& img, PixelCoords const& imgPos,
     }
 }
 
+/* ------------------------------------------------------------------ */
+
+PlanarImage::Ptr
+toLinearPlanar(core::ByteImage const& img)
+{
+    if (img.channels() != 3)
+        throw std::invalid_argument("Expected 3-channel image");
+
+    PlanarImage::Ptr planar(new PlanarImage());
+    planar->width = img.width();
+    planar->height = img.height();
+    int const numPixels = img.get_pixel_amount();
+    planar->data.resize(3 * numPixels);
+    for (int c = 0; c < 3; ++c) {
+        float* plane = planar->data.data() + c * numPixels;
+        for (int i = 0; i < numPixels; ++i)
+            plane[i] = srgb2lin[img.at(i, c)];
+    }
+    return planar;
+}
+
+namespace
+{
+    /*
+     * Bilinear color and derivative in direction dir at one position,
+     * with the same operations as the byte image version. The derivative
+     * is skipped if deriv is null.
+     */
+    inline void
+    sampleBilinear(PlanarImage const& img, math::Vec2f const& pos,
+        math::Vec2f const* dir, math::Vec3f* color, math::Vec3f* deriv)
+    {
+        int const left = std::floor(pos[0]);
+        int const top = std::floor(pos[1]);
+        float const x = pos[0] - left;
+        float const y = pos[1] - top;
+
+        if (left < 0 || left > img.width - 2
+            || top < 0 || top > img.height - 2)
+            throw std::runtime_error("Image position out of bounds");
+
+        int const p0 = top * img.width + left;
+        int const p1 = p0 + img.width;
+        for (int c = 0; c < 3; ++c) {
+            float const* plane = img.plane(c);
+            float const a = plane[p0];
+            float const b = plane[p0 + 1];
+            float const d = plane[p1];
+            float const e = plane[p1 + 1];
+            float const x0 = (1.f - x) * a + x * b;
+            float const x3 = (1.f - x) * d + x * e;
+            (*color)[c] = (1.f - y) * x0 + y * x3;
+            if (deriv == nullptr)
+                continue;
+            float const u = (*dir)[0];
+            float const v = (*dir)[1];
+            (*deriv)[c] = u * (b - a) + v * (d - a)
+                + (v * x + u * y) * (a - b - d + e);
+        }
+    }
+
+#if MVS_AVX2_KERNELS
+    /* Loads eight interleaved 2D vectors as one register per component. */
+    MVS_TARGET("avx2")
+    inline void
+    loadDeinterleaved(math::Vec2f const* vec, __m256* x, __m256* y)
+    {
+        static_assert(sizeof(math::Vec2f) == 2 * sizeof(float),
+            "Vectors must be tightly packed");
+        float const* ptr = vec->begin();
+        __m256 const lo = _mm256_loadu_ps(ptr);
+        __m256 const hi = _mm256_loadu_ps(ptr + 8);
+        /* Per 128 bit lane: x0 x1 x4 x5 | x2 x3 x6 x7. */
+        __m256 const xs = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 const ys = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        *x = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(xs),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+        *y = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(ys),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    /* Samples eight positions per iteration with gathers. */
+    MVS_TARGET("avx2")
+    void
+    sampleBilinearAVX2(PlanarImage const& img, math::Vec2f const* imgPos,
+        math::Vec2f const* gradDir, std::size_t num,
+        math::Vec3f* color, math::Vec3f* deriv)
+    {
+        __m256 const one = _mm256_set1_ps(1.f);
+        __m256i const zero = _mm256_setzero_si256();
+        __m256i const width = _mm256_set1_epi32(img.width);
+        __m256i const maxLeft = _mm256_set1_epi32(img.width - 2);
+        __m256i const maxTop = _mm256_set1_epi32(img.height - 2);
+
+        std::size_t i = 0;
+        for (; i + 8 <= num; i += 8) {
+            __m256 px, py;
+            loadDeinterleaved(imgPos + i, &px, &py);
+            __m256 const fx = _mm256_floor_ps(px);
+            __m256 const fy = _mm256_floor_ps(py);
+            __m256i const left = _mm256_cvttps_epi32(fx);
+            __m256i const top = _mm256_cvttps_epi32(fy);
+
+            __m256i const outside = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpgt_epi32(zero, left),
+                    _mm256_cmpgt_epi32(left, maxLeft)),
+                _mm256_or_si256(_mm256_cmpgt_epi32(zero, top),
+                    _mm256_cmpgt_epi32(top, maxTop)));
+            if (!_mm256_testz_si256(outside, outside))
+                throw std::runtime_error("Image position out of bounds");
+
+            __m256 const x = _mm256_sub_ps(px, fx);
+            __m256 const y = _mm256_sub_ps(py, fy);
+            __m256 const wx = _mm256_sub_ps(one, x);
+            __m256 const wy = _mm256_sub_ps(one, y);
+            __m256i const p0 = _mm256_add_epi32(
+                _mm256_mullo_epi32(top, width), left);
+            __m256i const p1 = _mm256_add_epi32(p0, width);
+
+            __m256 u = _mm256_setzero_ps();
+            __m256 v = _mm256_setzero_ps();
+            __m256 vxuy = _mm256_setzero_ps();
+            if (deriv != nullptr) {
+                loadDeinterleaved(gradDir + i, &u, &v);
+                vxuy = _mm256_add_ps(_mm256_mul_ps(v, x), _mm256_mul_ps(u, y));
+            }
+
+            float col[3][8];
+            float der[3][8];
+            for (int c = 0; c < 3; ++c) {
+                float const* plane = img.plane(c);
+                __m256 const a = _mm256_i32gather_ps(plane, p0, 4);
+                __m256 const b = _mm256_i32gather_ps(plane + 1, p0, 4);
+                __m256 const d = _mm256_i32gather_ps(plane, p1, 4);
+                __m256 const e = _mm256_i32gather_ps(plane + 1, p1, 4);
+                __m256 const x0 = _mm256_add_ps(_mm256_mul_ps(wx, a),
+                    _mm256_mul_ps(x, b));
+                __m256 const x3 = _mm256_add_ps(_mm256_mul_ps(wx, d),
+                    _mm256_mul_ps(x, e));
+                _mm256_storeu_ps(col[c], _mm256_add_ps(
+                    _mm256_mul_ps(wy, x0), _mm256_mul_ps(y, x3)));
+                if (deriv == nullptr)
+                    continue;
+                __m256 const diag = _mm256_add_ps(_mm256_sub_ps(
+                    _mm256_sub_ps(a, b), d), e);
+                _mm256_storeu_ps(der[c], _mm256_add_ps(_mm256_add_ps(
+                    _mm256_mul_ps(u, _mm256_sub_ps(b, a)),
+                    _mm256_mul_ps(v, _mm256_sub_ps(d, a))),
+                    _mm256_mul_ps(vxuy, diag)));
+            }
+
+            for (int k = 0; k < 8; ++k) {
+                color[i + k] = math::Vec3f(col[0][k], col[1][k], col[2][k]);
+                if (deriv != nullptr)
+                    deriv[i + k] = math::Vec3f(der[0][k], der[1][k],
+                        der[2][k]);
+            }
+        }
+
+        for (; i < num; ++i)
+            sampleBilinear(img, imgPos[i],
+                deriv != nullptr ? gradDir + i : nullptr,
+                color + i, deriv != nullptr ? deriv + i : nullptr);
+    }
+#endif
+
+    bool
+    useAVX2Kernels()
+    {
+#if MVS_AVX2_KERNELS
+        static bool const hasAVX2 = util::system::cpu_has_avx2();
+        return hasAVX2;
+#else
+        return false;
+#endif
+    }
+
+    void
+    sampleBilinearPatch(PlanarImage const& img, math::Vec2f const* imgPos,
+        math::Vec2f const* gradDir, std::size_t num,
+        math::Vec3f* color, math::Vec3f* deriv)
+    {
+#if MVS_AVX2_KERNELS
+        if (useAVX2Kernels()) {
+            sampleBilinearAVX2(img, imgPos, gradDir, num, color, deriv);
+            return;
+        }
+#endif
+        for (std::size_t i = 0; i < num; ++i)
+            sampleBilinear(img, imgPos[i],
+                deriv != nullptr ? gradDir + i : nullptr,
+                color + i, deriv != nullptr ? deriv + i : nullptr);
+    }
+}
+
+void
+colAndExactDeriv(PlanarImage const& img, math::Vec2f const* imgPos,
+    math::Vec2f const* gradDir, std::size_t num,
+    math::Vec3f* color, math::Vec3f* deriv)
+{
+    sampleBilinearPatch(img, imgPos, gradDir, num, color, deriv);
+}
+
+void
+getXYZColorAtPos(PlanarImage const& img, math::Vec2f const* imgPos,
+    std::size_t num, math::Vec3f* color)
+{
+    sampleBilinearPatch(img, imgPos, nullptr, num, color, nullptr);
+}
+
+void
+getXYZColorAtPix(PlanarImage const& img, math::Vec2i const* imgPos,
+    std::size_t num, math::Vec3f* color)
+{
+    int const numPixels = img.width * img.height;
+    float const* red = img.plane(0);
+    for (std::size_t i = 0; i < num; ++i) {
+        int const idx = imgPos[i][1] * img.width + imgPos[i][0];
+        color[i][0] = red[idx];
+        color[i][1] = red[idx + numPixels];
+        color[i][2] = red[idx + 2 * numPixels];
+    }
+}
+
 MVS_NAMESPACE_END
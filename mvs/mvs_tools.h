@@ -16,22 +16,42 @@
 #include "math/vector.h"
 #include "core/image.h"
 #include "mvs/defines.h"
+#include "mvs/image_pyramid.h"
 #include "mvs/single_view.h"
 
 MVS_NAMESPACE_BEGIN
 
-/** interpolate color and derivative at given sample positions */
+/** interpolate color and derivative at num given sample positions */
 void colAndExactDeriv(core::ByteImage const& img,
-    PixelCoords const& imgPos, PixelCoords const& gradDir,
-    Samples& color, Samples& deriv);
+    math::Vec2f const* imgPos, math::Vec2f const* gradDir, std::size_t num,
+    math::Vec3f* color, math::Vec3f* deriv);
 
-/** get color at given pixel positions (no interpolation) */
+/** get color at num given pixel positions (no interpolation) */
 void getXYZColorAtPix(core::ByteImage const& img,
-    std::vector<math::Vec2i> const& imgPos, Samples* color);
+    math::Vec2i const* imgPos, std::size_t num, math::Vec3f* color);
 
-/** interpolate only color at given sample positions */
+/** interpolate only color at num given sample positions */
 void getXYZColorAtPos(core::ByteImage const& img,
-    PixelCoords const& imgPos, Samples* color);
+    math::Vec2f const* imgPos, std::size_t num, math::Vec3f* color);
+
+/** converts an sRGB byte image to linear RGB planes */
+PlanarImage::Ptr toLinearPlanar(core::ByteImage const& img);
+
+/**
+ * interpolate color and derivative at num positions of a planar image,
+ * whole patches are sampled with AVX2 if the CPU supports it
+ */
+void colAndExactDeriv(PlanarImage const& img,
+    math::Vec2f const* imgPos, math::Vec2f const* gradDir, std::size_t num,
+    math::Vec3f* color, math::Vec3f* deriv);
+
+/** interpolate only color at num positions of a planar image */
+void getXYZColorAtPos(PlanarImage const& img,
+    math::Vec2f const* imgPos, std::size_t num, math::Vec3f* color);
+
+/** get color at num pixel positions of a planar image */
+void getXYZColorAtPix(PlanarImage const& img,
+    math::Vec2i const* imgPos, std::size_t num, math::Vec3f* color);
 
 /** Computes the parallax between two views with respect to some 3D point p */
 float parallax(math::Vec3f p, mvs::SingleView::Ptr v1, mvs::SingleView::Ptr v2);
@@ -0,0 +1,405 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "math/functions.h"
+#include "util/exception.h"
+#include "mvs/patch_match.h"
+#include "mvs/patch_optimization.h"
+#include "mvs/patch_sampler.h"
+
+MVS_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Slope of the steepest random patch, tan(60 deg). */
+    float const MAX_TILT = 1.73f;
+
+    /* Margin added to the depth range of the features. */
+    float const NEAR_FACTOR = 0.75f;
+    float const FAR_FACTOR = 1.5f;
+
+    /* Red-black propagation: Every offset points to the other color. */
+    int const NUM_OFFSETS = 8;
+    int const OFFSETS[NUM_OFFSETS][2] = {
+        {-1, 0}, {1, 0}, {0, -1}, {0, 1},
+        {-3, 0}, {3, 0}, {0, -3}, {0, 3}
+    };
+
+    /*
+     * Xorshift generator. It is seeded per row and pass, so the result
+     * does not depend on the number of threads.
+     */
+    class Random
+    {
+    public:
+        void seed(std::uint32_t pass, std::uint32_t row)
+        {
+            this->state = (pass * 0x9e3779b1u) ^ (row * 0x85ebca6bu)
+                ^ 0x27d4eb2fu;
+            if (this->state == 0)
+                this->state = 1;
+            this->next();
+        }
+
+        std::uint32_t next()
+        {
+            this->state ^= this->state << 13;
+            this->state ^= this->state >> 17;
+            this->state ^= this->state << 5;
+            return this->state;
+        }
+
+        /* Uniform in [0, 1). */
+        float uniform()
+        {
+            return static_cast<float>(this->next() >> 8) / 16777216.f;
+        }
+
+        /* Uniform in [-1, 1). */
+        float symmetric()
+        {
+            return 2.f * this->uniform() - 1.f;
+        }
+
+    private:
+        std::uint32_t state = 1;
+    };
+}
+
+/* Buffers of one thread, reused for all pixels. */
+struct PatchMatch::Worker
+{
+    PatchSampler sampler;
+    PatchOptimization optimizer;
+    std::vector<float> ncc;
+    Random random;
+
+    Worker(std::vector<SingleView::Ptr> const& views,
+        Settings const& settings, IndexSet const& neighViews)
+        : sampler(views, settings, neighViews)
+        , optimizer(views, settings, neighViews)
+        , ncc(neighViews.size())
+    {
+    }
+};
+
+PatchMatch::PatchMatch(core::Scene::Ptr _scene, Settings const& _settings)
+    : DepthRecon(_scene, _settings)
+    , minDepth(0.f)
+    , maxDepth(0.f)
+    , pixelAngle(0.f)
+{
+}
+
+PatchMatch::~PatchMatch()
+{
+}
+
+void
+PatchMatch::start()
+{
+    try
+    {
+        progress.start_time = std::time(nullptr);
+
+        analyzeFeatures();
+        globalViewSelection();
+        computeDepthRange();
+
+        unsigned int const numThreads = settings.numThreads > 0
+            ? settings.numThreads
+            : std::max(1u, std::thread::hardware_concurrency());
+        this->workers.clear();
+        for (unsigned int i = 0; i < numThreads; ++i)
+            this->workers.emplace_back(new Worker(this->views,
+                this->settings, this->neighViews));
+
+        progress.status = RECON_QUEUE;
+        initHypotheses();
+        for (unsigned int i = 0; i < settings.patchMatchIterations
+            && !progress.cancelled; ++i) {
+            propagate(i, 0);
+            propagate(i, 1);
+            if (!settings.quiet) {
+                std::size_t valid = 0;
+                for (std::size_t j = 0; j < scores.size(); ++j)
+                    if (scores[j] >= settings.minNCC)
+                        valid += 1;
+                std::cout << "PatchMatch iteration " << i << ": "
+                          << valid << " pixels above NCC threshold."
+                          << std::endl;
+            }
+        }
+        refineHypotheses();
+        this->workers.clear();
+
+        if (progress.cancelled){
+            progress.status = RECON_CANCELLED;
+            return;
+        }
+
+        saveResult();
+        printSummary();
+    }
+    catch (util::Exception const& e)
+    {
+        if (!settings.quiet)
+            std::cout << "Reconstruction failed: " << e << std::endl;
+
+        progress.status = RECON_CANCELLED;
+        return;
+    }
+}
+
+/*
+ * Random hypotheses are drawn between the nearest and farthest feature
+ * seen by the reference view. The depth of a feature is measured along
+ * viewRayScaled() of its pixel, the ray PatchSampler scales by the depth.
+ */
+void
+PatchMatch::computeDepthRange()
+{
+    SingleView::Ptr refV = views[settings.refViewNr];
+    core::Bundle::Features const& features = bundle->get_features();
+    std::vector<std::size_t> const& indices = refV->getFeatureIndices();
+
+    this->minDepth = std::numeric_limits<float>::max();
+    this->maxDepth = 0.f;
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+        math::Vec3f featPos(features[indices[i]].pos);
+        math::Vec2f pixPos = refV->worldToScreenScaled(featPos);
+        math::Vec3f ray = refV->viewRayScaled(math::round(pixPos[0]),
+            math::round(pixPos[1]));
+        float const depth = (featPos - refV->camPos).dot(ray)
+            / ray.square_norm();
+        if (depth <= 0.f)
+            continue;
+        this->minDepth = std::min(this->minDepth, depth);
+        this->maxDepth = std::max(this->maxDepth, depth);
+    }
+    if (this->maxDepth <= 0.f)
+        throw std::runtime_error("No features to estimate the depth range");
+    this->minDepth *= NEAR_FACTOR;
+    this->maxDepth *= FAR_FACTOR;
+
+    /* Angle between the rays of neighboring pixels at the image center. */
+    int const cx = this->width / 2;
+    int const cy = this->height / 2;
+    this->pixelAngle = (refV->viewRayScaled(cx + 1, cy)
+        - refV->viewRayScaled(cx, cy)).norm();
+
+    if (!settings.quiet)
+        std::cout << "PatchMatch depth range: " << this->minDepth
+                  << " - " << this->maxDepth << std::endl;
+}
+
+void
+PatchMatch::initHypotheses()
+{
+    this->hypotheses.resize(this->width * this->height);
+    this->scores.resize(this->width * this->height);
+    this->forEachRow([this](int y, Worker* worker) {
+        worker->random.seed(0, y);
+        for (int x = 0; x < this->width; ++x) {
+            int const index = y * this->width + x;
+            this->hypotheses[index] = this->randomHypothesis(worker);
+            this->scores[index] = this->score(worker, x, y,
+                this->hypotheses[index]);
+        }
+    });
+}
+
+/*
+ * Updates all pixels of one color. A pixel tests the hypotheses of its
+ * neighbors of the other color, two random refinements of its own
+ * hypothesis whose range shrinks every iteration, and a new random one.
+ */
+void
+PatchMatch::propagate(int iteration, int color)
+{
+    float const step = std::pow(0.5f, static_cast<float>(iteration + 1));
+    float const depthRange = this->maxDepth - this->minDepth;
+    this->forEachRow([&](int y, Worker* worker) {
+        worker->random.seed(2 * iteration + color + 1, y);
+        for (int x = (y + color) % 2; x < this->width; x += 2) {
+            int const index = y * this->width + x;
+            Hypothesis best = this->hypotheses[index];
+            float bestScore = this->scores[index];
+
+            auto test = [&](Hypothesis const& hyp) {
+                if (hyp.depth <= 0.f)
+                    return;
+                float const s = this->score(worker, x, y, hyp);
+                if (s > bestScore) {
+                    best = hyp;
+                    bestScore = s;
+                }
+            };
+
+            /* Continue the slanted patch of the neighbor to this pixel. */
+            for (int i = 0; i < NUM_OFFSETS; ++i) {
+                int const nx = x + OFFSETS[i][0];
+                int const ny = y + OFFSETS[i][1];
+                if (nx < 0 || nx >= this->width || ny < 0 || ny >= this->height)
+                    continue;
+                int const nIndex = ny * this->width + nx;
+                if (this->scores[nIndex] <= bestScore)
+                    continue;
+                Hypothesis hyp = this->hypotheses[nIndex];
+                hyp.depth += (x - nx) * hyp.dzI + (y - ny) * hyp.dzJ;
+                test(hyp);
+            }
+
+            Hypothesis hyp = best;
+            hyp.depth += depthRange * step * worker->random.symmetric();
+            test(hyp);
+
+            hyp = best;
+            float const slope = this->maxSlope(best.depth) * step;
+            hyp.dzI += slope * worker->random.symmetric();
+            hyp.dzJ += slope * worker->random.symmetric();
+            test(hyp);
+
+            test(this->randomHypothesis(worker));
+
+            this->hypotheses[index] = best;
+            this->scores[index] = bestScore;
+        }
+    });
+}
+
+/*
+ * Runs the DMRecon patch optimization on every plausible hypothesis. This
+ * selects the local views and yields the same confidence as region
+ * growing, so unreliable pixels are dropped the same way.
+ */
+void
+PatchMatch::refineHypotheses()
+{
+    if (progress.cancelled)
+        return;
+
+    SingleView::Ptr refV = views[settings.refViewNr];
+    std::atomic<std::size_t> filled(0);
+    this->forEachRow([&](int y, Worker* worker) {
+        PatchOptimization& patch = worker->optimizer;
+        for (int x = 0; x < this->width; ++x) {
+            int const index = y * this->width + x;
+            if (this->scores[index] < settings.minNCC)
+                continue;
+
+            Hypothesis const& hyp = this->hypotheses[index];
+            patch.init(x, y, hyp.depth, hyp.dzI, hyp.dzJ, LocalIndexSet());
+            patch.doAutoOptimization();
+            float const conf = patch.computeConfidence();
+            if (conf <= 0.f)
+                continue;
+
+            filled += 1;
+            math::Vec3f normal = patch.getNormal();
+            refV->depthImg->at(index) = patch.getDepth();
+            refV->normalImg->at(index, 0) = normal[0];
+            refV->normalImg->at(index, 1) = normal[1];
+            refV->normalImg->at(index, 2) = normal[2];
+            refV->dzImg->at(index, 0) = patch.getDzI();
+            refV->dzImg->at(index, 1) = patch.getDzJ();
+            refV->confImg->at(index) = conf;
+        }
+    });
+    progress.filled = filled;
+}
+
+void
+PatchMatch::forEachRow(RowFunction const& func)
+{
+    std::atomic<int> nextRow(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto run = [&](Worker* worker) {
+        try {
+            while (!failed && !this->progress.cancelled) {
+                int const y = nextRow++;
+                if (y >= this->height)
+                    break;
+                func(y, worker);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < this->workers.size(); ++i)
+        threads.emplace_back(run, this->workers[i].get());
+    run(this->workers[0].get());
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/* Mean NCC of the best nrReconNeighbors global views, -1 on failure. */
+float
+PatchMatch::score(Worker* worker, int x, int y, Hypothesis const& hyp)
+{
+    PatchSampler& sampler = worker->sampler;
+    sampler.init(x, y, hyp.depth, hyp.dzI, hyp.dzJ);
+    if (!sampler.succeeded(settings.refViewNr))
+        return -1.f;
+
+    std::size_t num = 0;
+    for (IndexSet::const_iterator id = neighViews.begin();
+        id != neighViews.end(); ++id)
+        worker->ncc[num++] = sampler.getFastNCC(*id);
+
+    std::size_t const k = std::min<std::size_t>(
+        std::max(1u, settings.nrReconNeighbors), num);
+    std::partial_sort(worker->ncc.begin(), worker->ncc.begin() + k,
+        worker->ncc.begin() + num, std::greater<float>());
+    float sum = 0.f;
+    for (std::size_t i = 0; i < k; ++i)
+        sum += worker->ncc[i];
+    return sum / static_cast<float>(k);
+}
+
+PatchMatch::Hypothesis
+PatchMatch::randomHypothesis(Worker* worker) const
+{
+    Hypothesis hyp;
+    hyp.depth = this->minDepth + (this->maxDepth - this->minDepth)
+        * worker->random.uniform();
+    float const slope = this->maxSlope(hyp.depth);
+    hyp.dzI = slope * worker->random.symmetric();
+    hyp.dzJ = slope * worker->random.symmetric();
+    return hyp;
+}
+
+float
+PatchMatch::maxSlope(float depth) const
+{
+    return depth * this->pixelAngle * MAX_TILT;
+}
+
+MVS_NAMESPACE_END
@@ -0,0 +1,75 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef DMRECON_PATCH_MATCH_H
+#define DMRECON_PATCH_MATCH_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "core/scene.h"
+#include "mvs/defines.h"
+#include "mvs/depth_recon.h"
+#include "mvs/settings.h"
+
+MVS_NAMESPACE_BEGIN
+
+/**
+ * PatchMatch depth estimation for one reference view, an alternative to
+ * the seed based region growing of DMRecon.
+ *
+ * Every pixel starts with a random depth and patch orientation. The
+ * hypotheses are improved by red-black checkerboard propagation from
+ * neighboring pixels and random refinement, scored by the mean of the
+ * best NCC values of the global views. Pixels of one color only read
+ * pixels of the other color, so all pixels of a color are processed in
+ * parallel. Finally every pixel is refined with PatchOptimization, which
+ * selects local views and computes the same confidence as DMRecon.
+ */
+class PatchMatch : public DepthRecon
+{
+public:
+    PatchMatch(core::Scene::Ptr scene, Settings const& settings);
+    ~PatchMatch();
+
+    void start();
+
+private:
+    /** Depth and patch orientation as used by PatchSampler. */
+    struct Hypothesis
+    {
+        float depth;
+        float dzI;
+        float dzJ;
+    };
+
+    struct Worker;
+    typedef std::function<void(int, Worker*)> RowFunction;
+
+    void computeDepthRange();
+    void initHypotheses();
+    void propagate(int iteration, int color);
+    void refineHypotheses();
+
+    /** Runs func for all rows, distributed over the worker threads. */
+    void forEachRow(RowFunction const& func);
+    float score(Worker* worker, int x, int y, Hypothesis const& hyp);
+    Hypothesis randomHypothesis(Worker* worker) const;
+    /** Largest depth change per pixel of a plausibly slanted patch. */
+    float maxSlope(float depth) const;
+
+private:
+    float minDepth;
+    float maxDepth;
+    float pixelAngle;
+    std::vector<Hypothesis> hypotheses;
+    std::vector<float> scores;
+    std::vector<std::unique_ptr<Worker> > workers;
+};
+
+MVS_NAMESPACE_END
+
+#endif
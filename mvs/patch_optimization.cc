@@ -21,44 +21,28 @@ MVS_NAMESPACE_BEGIN
 PatchOptimization::PatchOptimization(
     std::vector<SingleView::Ptr> const& _views,
     Settings const& _settings,
-    int _x,          // Pixel position
-    int _y,
-    float _depth,
-    float _dzI,
-    float _dzJ,
-    IndexSet const & _globalViewIDs,
-    IndexSet const & _localViewIDs) :
+    IndexSet const & _globalViewIDs) :
     views(_views),
     settings(_settings),
-    midx(_x),
-    midy(_y),
-    depth(_depth),
-    dzI(_dzI),
-    dzJ(_dzJ),
-    sampler(PatchSampler::create(views, settings, midx, midy, depth, dzI, dzJ)),
-    ii(sqr(settings.filterWidth)),
-    jj(sqr(settings.filterWidth)),
-    localVS(views, settings, _globalViewIDs, _localViewIDs, sampler)
+    midx(0),
+    midy(0),
+    depth(0.f),
+    dzI(0.f),
+    dzJ(0.f),
+    colorScale(views.size()),
+    globalViewIDs(_globalViewIDs.begin(), _globalViewIDs.end()),
+    sampler(views, settings, _globalViewIDs),
+    localVS(views, settings, _globalViewIDs, sampler)
 {
     status.iterationCount = 0;
-    status.optiSuccess = true;
+    status.optiSuccess = false;
     status.converged = false;
 
-    // 初始化成功，计算出参考视角中的
-    if (!sampler->success[settings.refViewNr]) {
-        // Sampler could not be initialized properly
-        status.optiSuccess = false;
-        return;
-    }
-
     std::size_t count = 0;
 
     // patch 宽度的一半
     int halfFW = (int) settings.filterWidth / 2;
 
-    // 像素权重
-    pixel_weight.resize(sampler->getNrSamples());
-
     // 像素权重初始化，初始时每个值设定为1
     for (int j = -halfFW; j <= halfFW; ++j)
         for (int i = -halfFW; i <= halfFW; ++i) {
@@ -67,6 +51,44 @@ PatchOptimization::PatchOptimization(
             pixel_weight[count] = 1.f;
             ++count;
         }
+}
+
+PatchOptimization::PatchOptimization(
+    std::vector<SingleView::Ptr> const& _views,
+    Settings const& _settings,
+    int _x,          // Pixel position
+    int _y,
+    float _depth,
+    float _dzI,
+    float _dzJ,
+    IndexSet const & _globalViewIDs,
+    LocalIndexSet const & _localViewIDs) :
+    PatchOptimization(_views, _settings, _globalViewIDs)
+{
+    init(_x, _y, _depth, _dzI, _dzJ, _localViewIDs);
+}
+
+void PatchOptimization::init(int _x, int _y, float _depth, float _dzI,
+    float _dzJ, LocalIndexSet const& _localViewIDs){
+
+    midx = _x;
+    midy = _y;
+    depth = _depth;
+    dzI = _dzI;
+    dzJ = _dzJ;
+    status.iterationCount = 0;
+    status.optiSuccess = true;
+    status.converged = false;
+
+    sampler.init(midx, midy, depth, dzI, dzJ);
+    localVS.init(_localViewIDs);
+
+    // 初始化成功，计算出参考视角中的
+    if (!sampler.succeeded(settings.refViewNr)) {
+        // Sampler could not be initialized properly
+        status.optiSuccess = false;
+        return;
+    }
 
     /**进行局部视角选择**/
     localVS.performVS();
@@ -76,9 +98,9 @@ PatchOptimization::PatchOptimization(
     }
 
     // brute force initialize all colorScale entries
-    float masterMeanCol = sampler->getMasterMeanColor();
-    for (std::size_t idx = 0; idx < views.size(); ++idx) {
-        colorScale[idx] = math::Vec3f(1.f / masterMeanCol);
+    float masterMeanCol = sampler.getMasterMeanColor();
+    for (std::size_t i = 0; i < globalViewIDs.size(); ++i) {
+        colorScale[globalViewIDs[i]] = math::Vec3f(1.f / masterMeanCol);
     }
 
     /**计算每个视角的颜色尺度**/
@@ -91,24 +113,24 @@ void PatchOptimization::computeColorScale(){
         return;
 
     // refView 中的样本点的颜色
-    Samples const & mCol = sampler->getMasterColorSamples();
+    PatchSamples const & mCol = sampler.getMasterColorSamples();
 
     // 获取已经被选择的视角的索引
-    IndexSet const & neighIDs = localVS.getSelectedIDs();
-    IndexSet::const_iterator id;
+    LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
+    LocalIndexSet::const_iterator id;
 
     /**遍历每一个邻域的每一个视角**/
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id) {
         // just copied from old mvs:
         /**获取样本点的颜色值**/
-        Samples const & nCol = sampler->getNeighColorSamples(*id);
-        if (!sampler->success[*id])
+        PatchSamples const & nCol = sampler.getNeighColorSamples(*id);
+        if (!sampler.succeeded(*id))
             return;
         /**对于每一个颜色通道**/
         for (int c = 0; c < 3; ++c) {
             float ab = 0.f;
             float aa = 0.f;
-            for (std::size_t i = 0; i < mCol.size(); ++i) {
+            for (std::size_t i = 0; i < sampler.getNrSamples(); ++i) {
                 // todo 每个样本点 s = sum[（cm -cn* s) * cn]/ sum[cn*cn] 是否有问题??
                 ab += (mCol[i][c] - nCol[i][c] * colorScale[*id][c]) * nCol[i][c];
                 aa += sqr(nCol[i][c]);
@@ -126,7 +148,7 @@ void PatchOptimization::computeColorScale(){
 
 float PatchOptimization::computeConfidence(){
 
-    SingleView::Ptr refV = views[settings.refViewNr];
+    SingleView* refV = views[settings.refViewNr].get();
     if (!status.converged)
         return 0.f;
 
@@ -134,10 +156,10 @@ float PatchOptimization::computeConfidence(){
     /* Compute mean NCC between reference view and local neighbors,
        where each NCC has to be higher than acceptance NCC */
     float meanNCC = 0.f;
-    IndexSet const & neighIDs = localVS.getSelectedIDs();
-    IndexSet::const_iterator id;
+    LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
+    LocalIndexSet::const_iterator id;
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id) {
-        meanNCC += sampler->getFastNCC(*id);
+        meanNCC += sampler.getFastNCC(*id);
     }
     meanNCC /= neighIDs.size();
     float score = (meanNCC - settings.acceptNCC) / (1.f - settings.acceptNCC);
@@ -146,7 +168,7 @@ float PatchOptimization::computeConfidence(){
     /* Compute angle between estimated surface normal and view direction
        and weight current score with dot product */
     math::Vec3f viewDir(refV->viewRayScaled(midx, midy));
-    math::Vec3f normal(sampler->getPatchNormal());
+    math::Vec3f normal(sampler.getPatchNormal());
     float dotP = - normal.dot(viewDir);
     if (dotP < 0.2f) {
         return 0.f;
@@ -157,16 +179,16 @@ float PatchOptimization::computeConfidence(){
 float
 PatchOptimization::derivNorm()
 {
-    IndexSet const & neighIDs = localVS.getSelectedIDs();
-    IndexSet::const_iterator id;
-    std::size_t nrSamples = sampler->getNrSamples();
+    LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
+    LocalIndexSet::const_iterator id;
+    std::size_t nrSamples = sampler.getNrSamples();
 
     float norm(0);
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id)
     {
-        Samples nCol, nDeriv;
-        sampler->fastColAndDeriv(*id, nCol, nDeriv);
-        if (!sampler->success[*id]) {
+        PatchSamples nCol, nDeriv;
+        sampler.fastColAndDeriv(*id, nCol, nDeriv);
+        if (!sampler.succeeded(*id)) {
             status.optiSuccess = false;
             return -1.f;
         }
@@ -198,14 +220,15 @@ void PatchOptimization::doAutoOptimization(){
         localVS.success && status.optiSuccess){
 
         // 邻域视角
-        IndexSet const & neighIDs = localVS.getSelectedIDs();
-        IndexSet::const_iterator id;
+        LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
+        LocalIndexSet::const_iterator id;
 
         // 保存当前每个邻域视角的NCC值
-        std::vector<float> oldNCC;
-        for (id = neighIDs.begin(); id != neighIDs.end(); ++id) {
+        std::array<float, MAX_LOCAL_NEIGHBORS> oldNCC;
+        std::size_t count = 0;
+        for (id = neighIDs.begin(); id != neighIDs.end(); ++id, ++count) {
             // 快速的计算参考视角和当前视角的NCC值
-            oldNCC.push_back(sampler->getFastNCC(*id));
+            oldNCC[count] = sampler.getFastNCC(*id);
         }
 
         // 当有视角移除或者优化一定次数之后，重新进行深度和法向量的优化，以及颜色尺度的计算
@@ -225,11 +248,11 @@ void PatchOptimization::doAutoOptimization(){
 
         // 检查每个视角
         converged = true;
-        std::size_t count = 0;
-        IndexSet toBeReplaced;
+        count = 0;
+        LocalIndexSet toBeReplaced;
         for (id = neighIDs.begin(); id != neighIDs.end(); ++id, ++count) {
             // 快速计算NCC
-            float ncc = sampler->getFastNCC(*id);
+            float ncc = sampler.getFastNCC(*id);
 
             // 有一个视角当前ncc的值比前一次迭代ncc的值大于一定的阈值，则未收敛
             if (std::abs(ncc - oldNCC[count]) > settings.minRefineDiff)
@@ -266,14 +289,14 @@ void PatchOptimization::doAutoOptimization(){
 
 float PatchOptimization::objFunValue()
 {
-    Samples const & mCol = sampler->getMasterColorSamples();
-    std::size_t nrSamples = sampler->getNrSamples();
-    IndexSet const & neighIDs = localVS.getSelectedIDs();
-    IndexSet::const_iterator id;
+    PatchSamples const & mCol = sampler.getMasterColorSamples();
+    std::size_t nrSamples = sampler.getNrSamples();
+    LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
+    LocalIndexSet::const_iterator id;
     float obj = 0.f;
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id) {
-        Samples const & nCol = sampler->getNeighColorSamples(*id);
-        if (!sampler->success[*id])
+        PatchSamples const & nCol = sampler.getNeighColorSamples(*id);
+        if (!sampler.succeeded(*id))
             return -1.f;
         math::Vec3f cs(colorScale[*id]);
         for (std::size_t i = 0; i < nrSamples; ++i) {
@@ -288,20 +311,20 @@ void PatchOptimization::optimizeDepthOnly(){
     float numerator = 0.f;
     float denom = 0.f;
     // 参考视角的样本颜色值
-    Samples const & mCol = sampler->getMasterColorSamples();
+    PatchSamples const & mCol = sampler.getMasterColorSamples();
     // 所有的局部视角
-    IndexSet const & neighIDs = localVS.getSelectedIDs();
+    LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
     // patch三维点的个数
-    IndexSet::const_iterator id;
-    std::size_t nrSamples = sampler->getNrSamples();
+    LocalIndexSet::const_iterator id;
+    std::size_t nrSamples = sampler.getNrSamples();
 
     // 对于每一个邻域视角
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id){
 
         // 计算邻域视角采样点的颜色和梯度
-        Samples nCol, nDeriv;
-        sampler->fastColAndDeriv(*id, nCol, nDeriv);
-        if (!sampler->success[*id]) {
+        PatchSamples nCol, nDeriv;
+        sampler.fastColAndDeriv(*id, nCol, nDeriv);
+        if (!sampler.succeeded(*id)) {
             status.optiSuccess = false;
             return;
         }
@@ -319,8 +342,8 @@ void PatchOptimization::optimizeDepthOnly(){
 
     if (denom > 0) {
         depth += numerator / denom;
-        sampler->update(depth, dzI, dzJ);
-        if (sampler->success[settings.refViewNr])
+        sampler.update(depth, dzI, dzJ);
+        if (sampler.succeeded(settings.refViewNr))
             status.optiSuccess = true;
         else
             status.optiSuccess = false;
@@ -332,20 +355,20 @@ void PatchOptimization::optimizeDepthAndNormal(){
     if (!localVS.success) {
         return;
     }
-    IndexSet const & neighIDs = localVS.getSelectedIDs();
-    std::size_t nrSamples = sampler->getNrSamples();
+    LocalIndexSet const & neighIDs = localVS.getSelectedIDs();
+    std::size_t nrSamples = sampler.getNrSamples();
 
     // Solve linear system A*x = b using Moore-Penrose pseudoinverse
     // Fill matrix ATA and vector ATb:
     math::Matrix3d ATA(0.f);
     math::Vec3d ATb(0.f);
-    Samples const & mCol = sampler->getMasterColorSamples();
-    IndexSet::const_iterator id;
+    PatchSamples const & mCol = sampler.getMasterColorSamples();
+    LocalIndexSet::const_iterator id;
     std::size_t row = 0;
     for (id = neighIDs.begin(); id != neighIDs.end(); ++id){
-        Samples nCol, nDeriv;
-        sampler->fastColAndDeriv(*id, nCol, nDeriv);
-        if (!sampler->success[*id]) {
+        PatchSamples nCol, nDeriv;
+        sampler.fastColAndDeriv(*id, nCol, nDeriv);
+        if (!sampler.succeeded(*id)) {
             status.optiSuccess = false;
             return;
         }
@@ -385,8 +408,8 @@ void PatchOptimization::optimizeDepthAndNormal(){
     dzI += X[1];
     dzJ += X[2];
     depth += X[0];
-    sampler->update(depth, dzI, dzJ);
-    if (sampler->success[settings.refViewNr])
+    sampler.update(depth, dzI, dzJ);
+    if (sampler.succeeded(settings.refViewNr))
         status.optiSuccess = true;
     else
         status.optiSuccess = false;
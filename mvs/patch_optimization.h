@@ -10,7 +10,9 @@
 #ifndef DMRECON_PATCH_OPTIMIZATION_H
 #define DMRECON_PATCH_OPTIMIZATION_H
 
+#include <array>
 #include <iostream>
+#include <vector>
 
 #include "math/vector.h"
 #include "mvs/defines.h"
@@ -29,13 +31,28 @@ struct Status{
 
 /**
  * \description 对patch的深度进行优化
+ *
+ * The optimizer owns its sampler and view selection. Construct it once
+ * per thread with the global views and call init() for every patch, the
+ * hot loop then runs without heap allocations.
  */
 class PatchOptimization{
 
 public:
 
     /**
-     * Constructor
+     * Constructor for reuse, call init() before optimizing
+     * @param _views
+     * @param _settings
+     * @param _globalViewIDs
+     */
+    PatchOptimization(
+        std::vector<SingleView::Ptr> const& _views,
+        Settings const& _settings,
+        IndexSet const& _globalViewIDs);  // 全局的视角
+
+    /**
+     * Constructor for a single patch
      * @param _views
      * @param _settings
      * @param _x
@@ -55,7 +72,19 @@ public:
         float _dzI,      // hs(s,t)
         float _dzJ,      // ht(s.t)
         IndexSet const& _globalViewIDs,   // 全局的视角
-        IndexSet const& _localViewIDs);   // 局部视角
+        LocalIndexSet const& _localViewIDs);   // 局部视角
+
+    /**
+     * 初始化一个新的patch
+     * @param _x
+     * @param _y
+     * @param _depth
+     * @param _dzI
+     * @param _dzJ
+     * @param _localViewIDs
+     */
+    void init(int _x, int _y, float _depth, float _dzI, float _dzJ,
+        LocalIndexSet const& _localViewIDs);
 
 
     /**
@@ -98,7 +127,7 @@ public:
      * 获取局部视角的索引
      * @return
      */
-    IndexSet const& getLocalViewIDs() const;
+    LocalIndexSet const& getLocalViewIDs() const;
 
     /**
      * 通过path 3D点的坐标，计算patch的法向量
@@ -117,32 +146,38 @@ public:
      */
     void optimizeDepthAndNormal();
 
+private:
+    /* The view selection refers to the sampler member. */
+    PatchOptimization(PatchOptimization const&) = delete;
+    PatchOptimization& operator=(PatchOptimization const&) = delete;
+
 private:
     std::vector<SingleView::Ptr> const& views;
     Settings const& settings;
 
     // initial values and settings
-    const int midx;
-    const int midy;
+    int midx;
+    int midy;
 
     float depth;     // depth 值
     float dzI, dzJ;  // represents patch normal
-    std::map<std::size_t, math::Vec3f, std::less<std::size_t> > colorScale;  // 每个视角的颜色尺度
+    std::vector<math::Vec3f> colorScale;  // 每个视角的颜色尺度
+    std::vector<std::size_t> globalViewIDs;
 
     Status status;
 
     /**
      * patch sampler
      */
-    PatchSampler::Ptr sampler;
+    PatchSampler sampler;
 
     // patch点的x 和 y 坐标
-    std::vector<int> ii, jj;  // ii, jj坐标
+    std::array<int, MAX_PATCH_SAMPLES> ii, jj;  // ii, jj坐标
 
     /**
      * 像素的权重值
      */
-    std::vector<float> pixel_weight;
+    std::array<float, MAX_PATCH_SAMPLES> pixel_weight;
 
     /**
      * 局部视角选取
@@ -166,14 +201,14 @@ PatchOptimization::getDzJ() const
     return dzJ;
 }
 
-inline IndexSet const&
+inline LocalIndexSet const&
 PatchOptimization::getLocalViewIDs() const{
     return localVS.getSelectedIDs();
 }
 
 inline math::Vec3f
 PatchOptimization::getNormal() const{
-    return sampler->getPatchNormal();
+    return sampler.getPatchNormal();
 }
 
 MVS_NAMESPACE_END
@@ -7,6 +7,9 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <stdexcept>
+
 #include "math/defines.h"
 #include "math/matrix.h"
 #include "math/vector.h"
@@ -17,22 +20,19 @@
 MVS_NAMESPACE_BEGIN
 
 PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
-    Settings const& _settings,
-    int _x, int _y, float _depth, float _dzI, float _dzJ)
+    Settings const& _settings, IndexSet const& _neighViews)
     : views(_views)
     , settings(_settings)
-    , midPix(_x,_y)
+    , refV(views[settings.refViewNr].get())
     , masterMeanCol(0.f)
-    , depth(_depth)
-    , dzI(_dzI)
-    , dzJ(_dzJ)
-    , success(views.size(), false){
-
-    // 获取参考视角
-    SingleView::Ptr refV(views[settings.refViewNr]);
+    , depth(0.f)
+    , dzI(0.f)
+    , dzJ(0.f)
+    , masterSuccess(false)
+    , slots(views.size(), -1){
 
-    // 获取设定尺度的参考图像
-    core::ByteImage::ConstPtr masterImg(refV->getScaledImg());
+    if (settings.filterWidth > MAX_FILTER_WIDTH)
+        throw std::invalid_argument("Filter width exceeds MAX_FILTER_WIDTH");
 
     // patch的大小是5x5
     offset = settings.filterWidth / 2;
@@ -40,10 +40,32 @@ PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
     // 需要采样的点的个数是5x5
     nrSamples = sqr(settings.filterWidth);
 
-    /* initialize arrays */
-    patchPoints.resize(nrSamples);  // patch 对应的三维空间点
-    masterColorSamples.resize(nrSamples); // patch 的三维点在参考图像中的颜色
-    masterViewDirs.resize(nrSamples); // 每个点对应的视角方向
+    /* one buffer slot per neighbor view */
+    IndexSet::const_iterator id;
+    for (id = _neighViews.begin(); id != _neighViews.end(); ++id) {
+        if (*id == settings.refViewNr || *id >= views.size())
+            continue;
+        slots[*id] = neighColorSamples.size();
+        neighColorSamples.push_back(PatchSamples());
+    }
+    neighColorValid.resize(neighColorSamples.size(), 0);
+    neighSuccess.resize(neighColorSamples.size(), 0);
+}
+
+void PatchSampler::init(int _x, int _y, float _depth, float _dzI, float _dzJ){
+
+    midPix[0] = _x;
+    midPix[1] = _y;
+    masterMeanCol = 0.f;
+    depth = _depth;
+    dzI = _dzI;
+    dzJ = _dzJ;
+    masterSuccess = false;
+    std::fill(neighColorValid.begin(), neighColorValid.end(), 0);
+    std::fill(neighSuccess.begin(), neighSuccess.end(), 0);
+
+    // 获取设定尺度的参考图像
+    PlanarImage const& masterImg = refV->getScaledPlanar();
 
     /* compute patch position and check if it's valid */
     // 在图像上确定一个5x5的patch，并判断其是否位于图像范围内
@@ -52,8 +74,8 @@ PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
     topLeft = midPix - h;       // 在参考图像上的的BBox左上角
     bottomRight = midPix + h;   // 在参考图像上的BBox的右下角
     if (topLeft[0] < 0 || topLeft[1] < 0
-        || bottomRight[0] > masterImg->width()-1
-        || bottomRight[1] > masterImg->height()-1)
+        || bottomRight[0] > masterImg.width-1
+        || bottomRight[1] > masterImg.height-1)
         return;
 
     /* initialize viewing rays from master view */
@@ -64,7 +86,7 @@ PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
             masterViewDirs[count++] = refV->viewRayScaled(i, j);
 
     /* initialize master color samples and 3d patch points */
-    success[settings.refViewNr] = true;
+    masterSuccess = true;
 
     /**计算在参考视角中的每个patch点的颜色值，颜色均值以及协方差矩阵**/
     computeMasterSamples();
@@ -79,14 +101,11 @@ PatchSampler::PatchSampler(std::vector<SingleView::Ptr> const& _views,
  * @param color
  * @param deriv
  */
-void PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv){
-
-    success[v] = false;
-    SingleView::Ptr refV = views[settings.refViewNr];
+void PatchSampler::fastColAndDeriv(std::size_t v, PatchSamples& color,
+    PatchSamples& deriv){
 
-    /*第i个视角的图像位置*/
-    PixelCoords& imgPos = neighPosSamples[v];
-    imgPos.resize(nrSamples);
+    char& success = neighSuccess[slotOf(v)];
+    success = false;
 
     // patch的3D中心点
     math::Vec3f const& p0 = patchPoints[nrSamples/2];
@@ -113,23 +132,24 @@ void PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv
 
     /* compute step size for derivative */
     math::Vec3f p1(p0 + masterViewDirs[nrSamples/2]);
-    float d = (views[v]->worldToScreen(p1, mmLevel) - views[v]->worldToScreen(patchPoints[12], mmLevel)).norm();
+    float d = (views[v]->worldToScreen(p1, mmLevel) - views[v]->worldToScreen(p0, mmLevel)).norm();
     if (!(d > 0.f)) {
         return;
     }
-    stepSize[v] = 1.f / d;
+    float const stepSize = 1.f / d;
 
     /* request according undistorted color image */
-    core::ByteImage::ConstPtr img(views[v]->getPyramidImg(mmLevel));
-    int const w = img->width();
-    int const h = img->height();
+    PlanarImage const& img = views[v]->getPyramidPlanar(mmLevel);
+    int const w = img.width;
+    int const h = img.height;
 
     /* compute image position and gradient direction for each sample
        point in neighbor image v */
-    std::vector<math::Vec2f> gradDir(nrSamples);
+    PatchCoords imgPos;
+    PatchCoords gradDir;
     for (std::size_t i = 0; i < nrSamples; ++i){
         math::Vec3f p0(patchPoints[i]);
-        math::Vec3f p1(patchPoints[i] + masterViewDirs[i] * stepSize[v]);
+        math::Vec3f p1(patchPoints[i] + masterViewDirs[i] * stepSize);
         imgPos[i] = views[v]->worldToScreen(p0, mmLevel);
         // imgPos should be away from image border
         if (!(imgPos[i][0] > 0 && imgPos[i][0] < w-1 &&
@@ -140,15 +160,14 @@ void PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv
     }
 
     /* draw the samples in the image */
-    color.resize(nrSamples, math::Vec3f(0.f));
-    deriv.resize(nrSamples, math::Vec3f(0.f));
-    colAndExactDeriv(*img, imgPos, gradDir, color, deriv);
+    colAndExactDeriv(img, imgPos.data(), gradDir.data(), nrSamples,
+        color.data(), deriv.data());
 
     /* normalize the gradient */  //fixme?? 为什么要进行归一化
     for (std::size_t i = 0; i < nrSamples; ++i)
-        deriv[i] /= stepSize[v];
+        deriv[i] /= stepSize;
 
-    success[v] = true;
+    success = true;
 }
 
 /**
@@ -159,27 +178,26 @@ void PatchSampler::fastColAndDeriv(std::size_t v, Samples& color, Samples& deriv
 float PatchSampler::getFastNCC(std::size_t v){
 
     /**计算第v个视角上patch点的颜色向量**/
-    if (neighColorSamples[v].empty())
-        computeNeighColorSamples(v);
+    PatchSamples const& nCol = getNeighColorSamples(v);
 
-    if (!success[v])
+    if (!succeeded(v))
         return -1.f;
 
-    assert(success[settings.refViewNr]);
+    assert(masterSuccess);
 
     /**计算颜色均值**/
     math::Vec3f meanY(0.f);
     for (std::size_t i = 0; i < nrSamples; ++i)
-        meanY += neighColorSamples[v][i];
+        meanY += nCol[i];
     meanY /= (float) nrSamples;
 
     /**计算NCC的颜色值**/
     float sqrDevY = 0.f;
     float devXY = 0.f;
     for (std::size_t i = 0; i < nrSamples; ++i){
-        sqrDevY += (neighColorSamples[v][i] - meanY).square_norm();
+        sqrDevY += (nCol[i] - meanY).square_norm();
         // Note: master color samples are normalized!
-        devXY += (masterColorSamples[i] - meanX).dot(neighColorSamples[v][i] - meanY);
+        devXY += (masterColorSamples[i] - meanX).dot(nCol[i] - meanY);
     }
     float tmp = sqrt(sqrDevX * sqrDevY);
     assert(!MATH_ISNAN(tmp) && !MATH_ISNAN(devXY));
@@ -191,18 +209,16 @@ float PatchSampler::getFastNCC(std::size_t v){
 
 float PatchSampler::getNCC(std::size_t u, std::size_t v){
 
-    if (neighColorSamples[u].empty())
-        computeNeighColorSamples(u);
-    if (neighColorSamples[v].empty())
-        computeNeighColorSamples(v);
-    if (!success[u] || !success[v])
+    PatchSamples const& uCol = getNeighColorSamples(u);
+    PatchSamples const& vCol = getNeighColorSamples(v);
+    if (!succeeded(u) || !succeeded(v))
             return -1.f;
 
     math::Vec3f meanX(0.f);
     math::Vec3f meanY(0.f);
     for (std::size_t i = 0; i < nrSamples; ++i) {
-        meanX += neighColorSamples[u][i];
-        meanY += neighColorSamples[v][i];
+        meanX += uCol[i];
+        meanY += vCol[i];
     }
     meanX /= nrSamples;
     meanY /= nrSamples;
@@ -211,10 +227,9 @@ float PatchSampler::getNCC(std::size_t u, std::size_t v){
     float sqrDevY = 0.f;
     float devXY = 0.f;
     for (std::size_t i = 0; i < nrSamples; ++i) {
-        sqrDevX += (neighColorSamples[u][i] - meanX).square_norm();
-        sqrDevY += (neighColorSamples[v][i] - meanY).square_norm();
-        devXY += (neighColorSamples[u][i] - meanX)
-            .dot(neighColorSamples[v][i] - meanY);
+        sqrDevX += (uCol[i] - meanX).square_norm();
+        sqrDevY += (vCol[i] - meanY).square_norm();
+        devXY += (uCol[i] - meanX).dot(vCol[i] - meanY);
     }
 
     float tmp = sqrt(sqrDevX * sqrDevY);
@@ -226,15 +241,14 @@ float PatchSampler::getNCC(std::size_t u, std::size_t v){
 
 float PatchSampler::getSAD(std::size_t v, math::Vec3f const& cs){
 
-    if (neighColorSamples[v].empty())
-        computeNeighColorSamples(v);
-    if (!success[v])
+    PatchSamples const& nCol = getNeighColorSamples(v);
+    if (!succeeded(v))
         return -1.f;
 
     float sum = 0.f;
     for (std::size_t i = 0; i < nrSamples; ++i) {
         for (int c = 0; c < 3; ++c) {
-            sum += std::abs(cs[c] * neighColorSamples[v][i][c] -
+            sum += std::abs(cs[c] * nCol[i][c] -
                 masterColorSamples[i][c]);
         }
     }
@@ -243,15 +257,14 @@ float PatchSampler::getSAD(std::size_t v, math::Vec3f const& cs){
 
 float PatchSampler::getSSD(std::size_t v, math::Vec3f const& cs){
 
-    if (neighColorSamples[v].empty())
-        computeNeighColorSamples(v);
-    if (!success[v])
+    PatchSamples const& nCol = getNeighColorSamples(v);
+    if (!succeeded(v))
         return -1.f;
 
     float sum = 0.f;
     for (std::size_t i = 0; i < nrSamples; ++i) {
         for (int c = 0; c < 3; ++c) {
-            float diff = cs[c] * neighColorSamples[v][i][c] -
+            float diff = cs[c] * nCol[i][c] -
                 masterColorSamples[i][c];
             sum += diff * diff;
         }
@@ -277,23 +290,17 @@ math::Vec3f PatchSampler::getPatchNormal() const{
 void PatchSampler::update(float newDepth, float newDzI, float newDzJ){
 
     // 更新depth, dzI, dzJ,并重新计算patch的三维点
-    success.clear();
-    success.resize(views.size(), false);
+    std::fill(neighColorValid.begin(), neighColorValid.end(), 0);
+    std::fill(neighSuccess.begin(), neighSuccess.end(), 0);
     depth = newDepth;
     dzI = newDzI;
     dzJ = newDzJ;
-    success[settings.refViewNr] = true;
+    masterSuccess = true;
     computePatchPoints();
-    neighColorSamples.clear();
-    neighDerivSamples.clear();
-    neighPosSamples.clear();
 }
 
 void PatchSampler::computePatchPoints(){
 
-    /**获取参考视角**/
-    SingleView::Ptr refV = views[settings.refViewNr];
-
     unsigned int count = 0;
     for (int j = topLeft[1]; j <= bottomRight[1]; ++j) {
         for (int i = topLeft[0]; i <= bottomRight[0]; ++i) {
@@ -301,7 +308,7 @@ void PatchSampler::computePatchPoints(){
             /**公式中的d(i,j) = d + i * hs(s,t) + j* ht(s,t) **/
             float tmpDepth = depth + (i - midPix[0]) * dzI + (j - midPix[1]) * dzJ;
             if (tmpDepth <= 0.f) {
-                success[settings.refViewNr] = false;
+                masterSuccess = false;
                 return;
             }
             /**计算每个patch点的坐标**/
@@ -313,15 +320,12 @@ void PatchSampler::computePatchPoints(){
 
 void PatchSampler::computeMasterSamples(){
 
-    // 获取参考视角
-    SingleView::Ptr refV = views[settings.refViewNr];
-
     // 获取参考视角的的图像（根据目标尺度空间进行了缩放）
-    core::ByteImage::ConstPtr img(refV->getScaledImg());
+    PlanarImage const& img = refV->getScaledPlanar();
 
     /* draw color samples from image and compute mean color */
     std::size_t count = 0;
-    std::vector<math::Vec2i> imgPos(nrSamples);
+    std::array<math::Vec2i, MAX_PATCH_SAMPLES> imgPos;
     for (int j = topLeft[1]; j <= bottomRight[1]; ++j) {
         for (int i = topLeft[0]; i <= bottomRight[0]; ++i) {
             imgPos[count][0] = i;
@@ -331,7 +335,8 @@ void PatchSampler::computeMasterSamples(){
     }
 
     /**在参考图像位置处的颜色值**/
-    getXYZColorAtPix(*img, imgPos, &masterColorSamples);
+    getXYZColorAtPix(img, imgPos.data(), nrSamples,
+        masterColorSamples.data());
 
     /**将每个位置处的rgb三个通道的颜色值相加**/
     masterMeanCol = 0.f;
@@ -345,7 +350,7 @@ void PatchSampler::computeMasterSamples(){
     /**计算颜色均值**/
     masterMeanCol /= 3.f * nrSamples;
     if (masterMeanCol < 0.01f || masterMeanCol > 0.99f) {
-        success[settings.refViewNr] = false;
+        masterSuccess = false;
         return;
     }
 
@@ -368,14 +373,14 @@ void PatchSampler::computeMasterSamples(){
 
 void PatchSampler::computeNeighColorSamples(std::size_t v){
 
-    /**参考视角**/
-    SingleView::Ptr refV = views[settings.refViewNr];
+    std::size_t const slot = slotOf(v);
 
     // patch points在第v个视角上的颜色值
-    Samples & color = neighColorSamples[v];
+    PatchSamples & color = neighColorSamples[slot];
     // patch points在第v个视角上的像素坐标
-    PixelCoords & imgPos = neighPosSamples[v];
-    success[v] = false;
+    PatchCoords imgPos;
+    neighColorValid[slot] = true;
+    neighSuccess[slot] = false;
 
     /* compute pixel prints and decide on which MipMap-Level to draw the samples */
     /**利用中心点，计算在参考帧和当前帧图像上的分辨率，从而确定相邻视角的最佳尺度**/
@@ -399,12 +404,9 @@ void PatchSampler::computeNeighColorSamples(std::size_t v){
 
     /**读取对应尺度的图像**/
     mmLevel = views[v]->clampLevel(mmLevel);
-    core::ByteImage::ConstPtr img(views[v]->getPyramidImg(mmLevel));
-    int const w = img->width();
-    int const h = img->height();
-    color.resize(nrSamples);
-    imgPos.resize(nrSamples);
-
+    PlanarImage const& img = views[v]->getPyramidPlanar(mmLevel);
+    int const w = img.width;
+    int const h = img.height;
 
     /**将patch的3D点投影到视角v中，求得投影坐标，并获取投影点的像素**/
     for (std::size_t i = 0; i < nrSamples; ++i) {
@@ -417,10 +419,10 @@ void PatchSampler::computeNeighColorSamples(std::size_t v){
     }
 
     /**获取图像坐标处的颜色值**/
-    getXYZColorAtPos(*img, imgPos, &color);
+    getXYZColorAtPos(img, imgPos.data(), nrSamples, color.data());
 
     /**操作成功**/
-    success[v] = true;
+    neighSuccess[slot] = true;
 }
 
 
@@ -10,8 +10,9 @@
 #ifndef DMRECON_PATCH_SAMPLER_H
 #define DMRECON_PATCH_SAMPLER_H
 
-#include <map>
+#include <cassert>
 #include <memory>
+#include <vector>
 
 #include "math/vector.h"
 #include "mvs/defines.h"
@@ -22,6 +23,9 @@ MVS_NAMESPACE_BEGIN
 
 /**
 * PatchSampler 是采样给定的三维点以及对应的patch，采样patch上的点
+*
+* All sample buffers have a fixed capacity or are allocated once in the
+* constructor, so one sampler is reused for all patches via init().
 */
 class PatchSampler{
 
@@ -29,32 +33,33 @@ public:
     typedef std::shared_ptr<PatchSampler> Ptr;
 
 public:
-    /** Default constructor */
-    PatchSampler();
-
-    /** Constructor */
+    /** Constructor, allocates the buffers for the neighbor views */
     PatchSampler(
         std::vector<SingleView::Ptr> const& _views,
         Settings const& _settings,
+        IndexSet const& _neighViews);   // 可以进行采样的邻域视角
+
+    /** Smart pointer PatchSampler constructor. */
+    static PatchSampler::Ptr create(std::vector<SingleView::Ptr> const& views,
+        Settings const& settings, IndexSet const& neighViews);
+
+    /** Places the patch at a pixel of the reference view */
+    void init(
         int _x,          // pixel 在图像中的
         int _y,
         float _depth,    // 中心点处的depth
         float _dzI,      // hs(s,t)
         float _dzJ);     // ht(s,t)
 
-    /** Smart pointer PatchSampler constructor. */
-    static PatchSampler::Ptr create(std::vector<SingleView::Ptr> const& views,
-        Settings const& settings, int x, int _y,
-        float _depth, float _dzI, float _dzJ);
-
     /** Draw color samples and derivatives in neighbor view v */
-    void fastColAndDeriv(std::size_t v, Samples & color, Samples& deriv);
+    void fastColAndDeriv(std::size_t v, PatchSamples& color,
+        PatchSamples& deriv);
 
     /** Compute NCC between reference view and a neighbor view */
     float getFastNCC(std::size_t v);
 
     /**获取参考视角中样本点的颜色值 */
-    Samples const& getMasterColorSamples() const;
+    PatchSamples const& getMasterColorSamples() const;
 
     /**获取参考视角的的平均颜色值*/
     float getMasterMeanColor() const;
@@ -74,7 +79,7 @@ public:
     float getSSD(std::size_t v, math::Vec3f const& cs);
 
     /**获取邻域视角的的样本点颜色*/
-    Samples const& getNeighColorSamples(std::size_t v);
+    PatchSamples const& getNeighColorSamples(std::size_t v);
 
     /**获取样本点的个数*/
     std::size_t getNrSamples() const;
@@ -101,6 +106,7 @@ private:
     // 所有的视角
     std::vector<SingleView::Ptr> const& views;
     Settings const& settings;
+    SingleView* refV;
 
     /** precomputed mean and variance for NCC */
     math::Vec3f meanX;
@@ -125,20 +131,25 @@ private:
     float dzI, dzJ;
 
     /** viewing rays according to patch in master view */
-    std::vector<math::Vec3f> masterViewDirs;
+    PatchSamples masterViewDirs;
 
     /** 3d position of patch points */
-    Samples patchPoints;  // patch上所有的点对应的3D点坐标
+    PatchSamples patchPoints;  // patch上所有的点对应的3D点坐标
 
     /** pixel colors of patch in master image */
-    Samples masterColorSamples;
+    PatchSamples masterColorSamples;
+    bool masterSuccess;
 
-    /** samples in neighbor images */
-    std::map<std::size_t, Samples> neighColorSamples;    // 所有局部视角中的颜色
-    std::map<std::size_t, Samples> neighDerivSamples;    // 所有局部视角的中的颜色梯度
-    std::map<std::size_t, PixelCoords> neighPosSamples;  // 所有局部视角中的像素坐标
+    /** slot of each view in the neighbor buffers, -1 if not a neighbor */
+    std::vector<int> slots;
 
-    std::map<std::size_t, float> stepSize;
+    /** samples in neighbor images, one slot per neighbor view */
+    std::vector<PatchSamples> neighColorSamples;    // 所有局部视角中的颜色
+    std::vector<char> neighColorValid;              // 颜色是否已经计算
+    std::vector<char> neighSuccess;                 // 在相邻视角上是否成功
+
+    /** Returns the slot of neighbor view v */
+    std::size_t slotOf(std::size_t v) const;
 
     /**
      * 计算patch中所有点的3D坐标
@@ -155,33 +166,32 @@ private:
      * @param v
      */
     void computeNeighColorSamples(std::size_t v);
-
-public:
-    std::vector<bool> success;   // 在相邻视角上是否成功
 };
 
 inline PatchSampler::Ptr
 PatchSampler::create(std::vector<SingleView::Ptr> const& views
         , Settings const& settings
-        , int x
-        , int y
-        , float depth
-        , float dzI
-        , float dzJ){
-    return PatchSampler::Ptr(new PatchSampler
-        (views, settings, x, y, depth, dzI, dzJ));
+        , IndexSet const& neighViews){
+    return PatchSampler::Ptr(new PatchSampler(views, settings, neighViews));
+}
+
+inline std::size_t
+PatchSampler::slotOf(std::size_t v) const{
+    assert(v < slots.size() && slots[v] >= 0);
+    return slots[v];
 }
 
-inline Samples const&
+inline PatchSamples const&
 PatchSampler::getMasterColorSamples() const{
     return masterColorSamples;
 }
 
-inline Samples const&
+inline PatchSamples const&
 PatchSampler::getNeighColorSamples(std::size_t v){
-    if (neighColorSamples[v].empty())
+    std::size_t const slot = slotOf(v);
+    if (!neighColorValid[slot])
         computeNeighColorSamples(v);
-    return neighColorSamples[v];
+    return neighColorSamples[slot];
 }
 
 inline float
@@ -199,6 +209,13 @@ PatchSampler::getNrSamples() const{
     return nrSamples;
 }
 
+inline bool
+PatchSampler::succeeded(std::size_t v) const{
+    if (v == settings.refViewNr)
+        return masterSuccess;
+    return neighSuccess[slotOf(v)] != 0;
+}
+
 inline float
 PatchSampler::varInMasterPatch(){
     return sqrDevX / (3.f * (float) nrSamples);
@@ -0,0 +1,272 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "util/strings.h"
+#include "util/timer.h"
+#include "mvs/dmrecon.h"
+#include "mvs/image_pyramid.h"
+#include "mvs/recon_scheduler.h"
+
+MVS_NAMESPACE_BEGIN
+
+ReconScheduler::ReconScheduler(core::Scene::Ptr _scene,
+    Options const& options)
+    : scene(_scene)
+    , opts(options)
+    , nextView(0)
+    , numRunning(0)
+    , runningMemory(0)
+    , numDone(0)
+    , reconDone(false)
+{
+    if (scene == nullptr)
+        throw std::invalid_argument("Null scene given");
+}
+
+void
+ReconScheduler::reconstruct(std::vector<int> const& viewIDs)
+{
+    /* Keep the bundle loaded, all reconstructions share it. */
+    core::Bundle::ConstPtr bundle = this->scene->get_bundle();
+    core::Scene::ViewList const& views = this->scene->get_views();
+
+    /* Collect views without depth map. */
+    std::string const depthName = "depth-L"
+        + util::string::get(this->opts.settings.scale);
+    std::vector<int> ids(viewIDs);
+    if (ids.empty())
+        for (std::size_t i = 0; i < views.size(); ++i)
+            ids.push_back(i);
+
+    std::vector<int> candidates;
+    for (std::size_t i = 0; i < ids.size(); ++i) {
+        int const id = ids[i];
+        if (id < 0 || id >= static_cast<int>(views.size())) {
+            std::cout << "Invalid ID " << id << ", skipping!" << std::endl;
+            continue;
+        }
+        if (views[id] == nullptr || !views[id]->is_camera_valid())
+            continue;
+        if (!this->opts.forceRecon && views[id]->has_image(depthName))
+            continue;
+        candidates.push_back(id);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+        candidates.end());
+
+    unsigned int const numCores
+        = std::max(1u, std::thread::hardware_concurrency());
+    unsigned int numParallel = this->opts.numParallelViews > 0
+        ? this->opts.numParallelViews : numCores;
+    numParallel = std::max(1u, std::min(numParallel,
+        static_cast<unsigned int>(candidates.size())));
+
+    /* Split the cores between the views running at once. */
+    if (this->opts.settings.numThreads == 0)
+        this->opts.settings.numThreads = std::max(1u, numCores / numParallel);
+
+    this->schedule = this->orderViews(candidates);
+    this->nextView = 0;
+    this->numRunning = 0;
+    this->runningMemory = 0;
+    this->numDone = 0;
+    this->reconDone = false;
+    ImagePyramidCache::setMemoryLimit(this->opts.memoryLimit > 0
+        ? this->opts.memoryLimit : std::numeric_limits<std::size_t>::max());
+
+    std::thread saver(&ReconScheduler::saveWorker, this);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < numParallel; ++i)
+        workers.emplace_back(&ReconScheduler::reconWorker, this);
+    for (std::size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->reconDone = true;
+    }
+    this->changed.notify_all();
+    saver.join();
+
+    /* Release all pyramids. */
+    ImagePyramidCache::setMemoryLimit(0);
+}
+
+std::vector<int>
+ReconScheduler::orderViews(std::vector<int> const& viewIDs) const
+{
+    std::size_t const numViews = viewIDs.size();
+    std::vector<int> positions(this->scene->get_views().size(), -1);
+    for (std::size_t i = 0; i < numViews; ++i)
+        positions[viewIDs[i]] = i;
+
+    /* Count the features shared by every pair of views. */
+    core::Bundle::Features const& features
+        = this->scene->get_bundle()->get_features();
+    std::vector<std::size_t> shared(numViews * numViews, 0);
+    std::vector<int> featureViews;
+    for (std::size_t i = 0; i < features.size(); ++i) {
+        featureViews.clear();
+        for (std::size_t j = 0; j < features[i].refs.size(); ++j) {
+            int const id = features[i].refs[j].view_id;
+            if (id >= 0 && id < static_cast<int>(positions.size())
+                && positions[id] >= 0)
+                featureViews.push_back(positions[id]);
+        }
+        for (std::size_t j = 0; j < featureViews.size(); ++j)
+            for (std::size_t k = 0; k < featureViews.size(); ++k)
+                shared[featureViews[j] * numViews + featureViews[k]] += 1;
+    }
+
+    /*
+     * Greedy chain: The next view shares most features with the previous
+     * one. A new chain starts at the remaining view with most features.
+     */
+    std::vector<int> order;
+    std::vector<bool> scheduled(numViews, false);
+    int current = -1;
+    while (order.size() < numViews) {
+        int best = -1;
+        std::size_t bestShared = 0;
+        for (std::size_t i = 0; i < numViews; ++i) {
+            if (scheduled[i])
+                continue;
+            std::size_t const score = current < 0
+                ? shared[i * numViews + i]
+                : shared[current * numViews + i];
+            if (best < 0 || score > bestShared) {
+                best = i;
+                bestShared = score;
+            }
+        }
+        if (current >= 0 && bestShared == 0) {
+            current = -1;
+            continue;
+        }
+        scheduled[best] = true;
+        order.push_back(viewIDs[best]);
+        current = best;
+    }
+    return order;
+}
+
+std::size_t
+ReconScheduler::estimateMemory(int viewID) const
+{
+    core::View::Ptr view = this->scene->get_view_by_id(viewID);
+    core::View::ImageProxy const* proxy
+        = view->get_image_proxy(this->opts.settings.imageEmbedding);
+    if (proxy == nullptr)
+        return 0;
+
+    /*
+     * Byte and float RGB pyramid and 7 float channels of depth, normal,
+     * dz and conf.
+     */
+    std::size_t const pixels = proxy->width * proxy->height;
+    std::size_t const scaledPixels = pixels
+        >> (2 * this->opts.settings.scale);
+    return pixels * 3 * (1 + sizeof(float)) * 4 / 3
+        + scaledPixels * 7 * sizeof(float);
+}
+
+void
+ReconScheduler::reconWorker()
+{
+    std::size_t const limit = this->opts.memoryLimit;
+    while (true) {
+        int viewID;
+        std::size_t memory;
+        {
+            /* Wait until the next view fits into the memory limit. */
+            std::unique_lock<std::mutex> lock(this->mutex);
+            while (true) {
+                if (this->nextView >= this->schedule.size())
+                    return;
+                memory = this->estimateMemory(this->schedule[this->nextView]);
+                if (this->numRunning == 0 || limit == 0)
+                    break;
+                std::size_t const required = this->runningMemory + memory;
+                ImagePyramidCache::setMemoryLimit(
+                    limit > required ? limit - required : 0);
+                if (ImagePyramidCache::getMemoryUsage() + required <= limit)
+                    break;
+                this->changed.wait(lock);
+            }
+            viewID = this->schedule[this->nextView];
+            this->nextView += 1;
+            this->numRunning += 1;
+            this->runningMemory += memory;
+        }
+
+        util::WallTimer timer;
+        try {
+            Settings settings(this->opts.settings);
+            settings.refViewNr = viewID;
+            {
+                DMRecon recon(this->scene, settings);
+                recon.start();
+            }
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->saveQueue.push_back(this->scene->get_view_by_id(viewID));
+        }
+        catch (std::exception& err) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            std::cerr << "View " << viewID << ": " << err.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->numRunning -= 1;
+            this->runningMemory -= memory;
+            this->numDone += 1;
+            if (limit > 0)
+                ImagePyramidCache::setMemoryLimit(
+                    limit > this->runningMemory
+                    ? limit - this->runningMemory : 0);
+            std::cout << "Reconstructed view " << viewID << " ("
+                << this->numDone << " of " << this->schedule.size()
+                << "), took " << timer.get_elapsed() << "ms." << std::endl;
+        }
+        this->changed.notify_all();
+    }
+}
+
+void
+ReconScheduler::saveWorker()
+{
+    while (true) {
+        core::View::Ptr view;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            while (this->saveQueue.empty() && !this->reconDone)
+                this->changed.wait(lock);
+            if (this->saveQueue.empty())
+                return;
+            view = this->saveQueue.front();
+            this->saveQueue.pop_front();
+        }
+
+        /* Write the depth maps and release them from memory. */
+        try {
+            view->save_view();
+            view->cache_cleanup();
+        }
+        catch (std::exception& err) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            std::cerr << "Error saving view " << view->get_id() << ": "
+                << err.what() << std::endl;
+        }
+    }
+}
+
+MVS_NAMESPACE_END
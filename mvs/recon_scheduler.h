@@ -0,0 +1,80 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef DMRECON_RECON_SCHEDULER_H
+#define DMRECON_RECON_SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "core/scene.h"
+#include "core/view.h"
+#include "mvs/defines.h"
+#include "mvs/settings.h"
+
+MVS_NAMESPACE_BEGIN
+
+/**
+ * Reconstructs depth maps for many reference views concurrently.
+ *
+ * The views are ordered such that consecutive views share many features,
+ * so neighbor pyramids are reused from the ImagePyramidCache. A new view
+ * is only started if the cached pyramids and the depth maps of the running
+ * views stay within the memory limit. Finished views are written to disc
+ * by a separate thread while the next views are reconstructed.
+ */
+class ReconScheduler
+{
+public:
+    struct Options
+    {
+        /** Settings for every view, the reference view is set per view. */
+        Settings settings;
+
+        /** Number of views reconstructed at once, 0 uses all cores. */
+        unsigned int numParallelViews = 0;
+
+        /** Memory limit in bytes for pyramids and depth maps, 0 is none. */
+        std::size_t memoryLimit = 0;
+
+        /** Reconstruct views that already have a depth map. */
+        bool forceRecon = false;
+    };
+
+public:
+    ReconScheduler(core::Scene::Ptr scene, Options const& options);
+
+    /** Reconstructs the given views, all views if the list is empty. */
+    void reconstruct(std::vector<int> const& viewIDs);
+
+private:
+    /** Greedily chains views with most shared features. */
+    std::vector<int> orderViews(std::vector<int> const& viewIDs) const;
+    /** Estimates the bytes for the pyramid and depth maps of a view. */
+    std::size_t estimateMemory(int viewID) const;
+
+    void reconWorker();
+    void saveWorker();
+
+private:
+    core::Scene::Ptr scene;
+    Options opts;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<int> schedule;
+    std::size_t nextView;
+    std::size_t numRunning;
+    std::size_t runningMemory;
+    std::size_t numDone;
+    std::deque<core::View::Ptr> saveQueue;
+    bool reconDone;
+};
+
+MVS_NAMESPACE_END
+
+#endif
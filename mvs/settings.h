@@ -50,6 +50,18 @@ struct Settings
     /**全局视角global view 最大设置为20个**/
     unsigned int globalVSMax = 20;
 
+    /**
+     * Threads per reference view for DMRecon region growing and PatchMatch,
+     * 0 uses all cores. ReconScheduler splits the cores between its views.
+     */
+    unsigned int numThreads = 0;
+
+    /** Width and height of the region growing tiles in pixels. */
+    unsigned int tileSize = 32;
+
+    /** Red-black propagation iterations of PatchMatch. */
+    unsigned int patchMatchIterations = 3;
+
     /**图像的尺度**/
     int scale = 0;
 
@@ -40,6 +40,8 @@ public:
     int clampLevel(int level) const;
     core::ByteImage::ConstPtr const& getScaledImg() const;
     core::ByteImage::ConstPtr const& getPyramidImg(int level) const;
+    PlanarImage const& getScaledPlanar() const;
+    PlanarImage const& getPyramidPlanar(int level) const;
     core::View::Ptr getMVEView() const;
 
     std::string createFileName(float scale) const;
@@ -144,6 +146,18 @@ SingleView::getScaledImg() const
     return this->target_level.image;
 }
 
+inline PlanarImage const&
+SingleView::getPyramidPlanar(int level) const
+{
+    return *this->img_pyramid->at(level).planar;
+}
+
+inline PlanarImage const&
+SingleView::getScaledPlanar() const
+{
+    return *this->target_level.planar;
+}
+
 inline std::string
 SingleView::createFileName(float scale) const
 {
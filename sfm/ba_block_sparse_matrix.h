@@ -0,0 +1,906 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_BA_BLOCK_SPARSE_MATRIX_HEADER
+#define SFM_BA_BLOCK_SPARSE_MATRIX_HEADER
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "sfm/ba_dense_vector.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+SFM_BA_NAMESPACE_BEGIN
+
+/*
+ * Kernels on dense row-major blocks with compile-time dimensions. The loops
+ * have constant trip counts and are fully unrolled and vectorized by the
+ * compiler.
+ */
+
+/** C (MxN) += alpha * A^T * B with A (KxM) and B (KxN). */
+template <typename T, int K, int M, int N>
+void
+block_gemm_tn (T const* A, T const* B, T const& alpha, T* C);
+
+/** C (MxN) += alpha * A * B^T with A (MxK) and B (NxK). */
+template <typename T, int M, int K, int N>
+void
+block_gemm_nt (T const* A, T const* B, T const& alpha, T* C);
+
+/** C (MxN) = A * B with A (MxK) and B (KxN). */
+template <typename T, int M, int K, int N>
+void
+block_gemm_nn (T const* A, T const* B, T* C);
+
+/** y (M) += A * x with A (MxN). */
+template <typename T, int M, int N>
+void
+block_gemv (T const* A, T const* x, T* y);
+
+/** y (N) += A^T * x with A (MxN). */
+template <typename T, int M, int N>
+void
+block_gemv_t (T const* A, T const* x, T* y);
+
+/**
+ * Inverts a symmetric, positive definite NxN block inplace using Cholesky
+ * decomposition. Non-finite entries of the inverse (singular blocks) are
+ * set to zero.
+ */
+template <typename T, int N>
+void
+block_cholesky_invert (T* A);
+
+/* ---------------------------------------------------------------- */
+
+/**
+ * Block diagonal matrix with NxN blocks, e.g. the camera or point blocks
+ * of the Hessian J^T J in bundle adjustment.
+ */
+template <typename T, int N>
+class BlockDiagonalMatrix
+{
+public:
+    static int const BLOCK_DIM = N;
+    static int const BLOCK_SIZE = N * N;
+
+public:
+    BlockDiagonalMatrix (void) = default;
+    explicit BlockDiagonalMatrix (std::size_t num_blocks);
+
+    /** Resizes the matrix to the given number of blocks, set to zero. */
+    void allocate (std::size_t num_blocks);
+
+    /** Multiplies the diagonal elements of all blocks with factor. */
+    void mult_diagonal (T const& factor);
+    /** Inverts all blocks inplace, see block_cholesky_invert(). */
+    void invert_blocks (void);
+
+    DenseVector<T> multiply (DenseVector<T> const& rhs) const;
+    DenseVector<T> diagonal (void) const;
+
+    std::size_t num_blocks (void) const;
+    std::size_t num_rows (void) const;
+    std::size_t num_cols (void) const;
+    T* block (std::size_t index);
+    T const* block (std::size_t index) const;
+
+private:
+    std::vector<T> values;
+};
+
+/* ---------------------------------------------------------------- */
+
+/**
+ * Sparse matrix in block compressed row (BSR) format with dense row-major
+ * RxC blocks. Block row i owns the blocks [row_begin(i), row_end(i)), the
+ * block column indices within a row are strictly increasing. In addition,
+ * a column index lists the blocks of every block column in row order,
+ * which allows transposed products without scattering.
+ */
+template <typename T, int R, int C>
+class BlockSparseMatrix
+{
+public:
+    static int const BLOCK_ROWS = R;
+    static int const BLOCK_COLS = C;
+    static int const BLOCK_SIZE = R * C;
+
+public:
+    BlockSparseMatrix (void);
+
+    /** Creates an empty matrix with the given number of blocks. */
+    void allocate (std::size_t block_rows, std::size_t block_cols);
+
+    /**
+     * Sets the block structure, 'row_offsets' has one entry per block row
+     * plus one, 'col_indices' has the block column of every block. All
+     * block values are set to zero.
+     */
+    void set_structure (std::size_t block_cols,
+        std::vector<std::size_t> const& row_offsets,
+        std::vector<std::size_t> const& col_indices);
+
+    /** Sets all block values to zero. */
+    void set_zero (void);
+
+    /** Adds the blocks of D to the diagonal blocks, requires R == C. */
+    void add_block_diagonal (BlockDiagonalMatrix<T, R> const& D);
+    /** Copies the diagonal blocks to D, requires R == C. */
+    void block_diagonal (BlockDiagonalMatrix<T, R>* D) const;
+
+    /** Returns A * x. */
+    DenseVector<T> multiply (DenseVector<T> const& rhs) const;
+    /** Returns A^T * x. */
+    DenseVector<T> transpose_multiply (DenseVector<T> const& rhs) const;
+
+    std::size_t num_block_rows (void) const;
+    std::size_t num_block_cols (void) const;
+    std::size_t num_blocks (void) const;
+    std::size_t num_rows (void) const;
+    std::size_t num_cols (void) const;
+
+    /** Block ranges of block rows, and row/column of blocks. */
+    std::size_t row_begin (std::size_t block_row) const;
+    std::size_t row_end (std::size_t block_row) const;
+    std::size_t block_row (std::size_t index) const;
+    std::size_t block_col (std::size_t index) const;
+
+    /** Block ranges of block columns in the column index. */
+    std::size_t col_begin (std::size_t block_col) const;
+    std::size_t col_end (std::size_t block_col) const;
+    std::size_t col_block (std::size_t position) const;
+
+    T* block (std::size_t index);
+    T const* block (std::size_t index) const;
+
+private:
+    /** Returns the index of block (i, i) or num_blocks() if missing. */
+    std::size_t find_diagonal_block (std::size_t block_row) const;
+
+private:
+    std::size_t block_rows;
+    std::size_t block_cols;
+    std::vector<std::size_t> row_offsets;
+    std::vector<std::size_t> col_indices;
+    std::vector<std::size_t> row_indices;
+    std::vector<std::size_t> col_offsets;
+    std::vector<std::size_t> col_blocks;
+    std::vector<T> values;
+};
+
+/* ---------------------------------------------------------------- */
+
+/** Computes the diagonal blocks of A^T * A. */
+template <typename T, int R, int C>
+void
+block_gram_diagonal (BlockSparseMatrix<T, R, C> const& A,
+    BlockDiagonalMatrix<T, C>* result);
+
+/** Computes A^T * B for matrices with the same block rows. */
+template <typename T, int R, int C1, int C2>
+void
+block_transpose_multiply (BlockSparseMatrix<T, R, C1> const& A,
+    BlockSparseMatrix<T, R, C2> const& B,
+    BlockSparseMatrix<T, C1, C2>* result);
+
+/**
+ * Computes alpha * A * B^T for matrices with the same block columns.
+ * If the result is square, the diagonal blocks are always part of its
+ * structure.
+ */
+template <typename T, int R1, int R2, int C>
+void
+block_multiply_transpose (BlockSparseMatrix<T, R1, C> const& A,
+    BlockSparseMatrix<T, R2, C> const& B, T const& alpha,
+    BlockSparseMatrix<T, R1, R2>* result);
+
+/** Computes A * D for a block diagonal matrix D. */
+template <typename T, int R, int C>
+void
+block_multiply_diagonal (BlockSparseMatrix<T, R, C> const& A,
+    BlockDiagonalMatrix<T, C> const& D,
+    BlockSparseMatrix<T, R, C>* result);
+
+SFM_BA_NAMESPACE_END
+SFM_NAMESPACE_END
+
+/* ------------------------ Implementation ------------------------ */
+
+SFM_NAMESPACE_BEGIN
+SFM_BA_NAMESPACE_BEGIN
+
+template <typename T, int K, int M, int N>
+inline void
+block_gemm_tn (T const* A, T const* B, T const& alpha, T* C)
+{
+    for (int k = 0; k < K; ++k)
+        for (int i = 0; i < M; ++i)
+        {
+            T const a = alpha * A[k * M + i];
+            for (int j = 0; j < N; ++j)
+                C[i * N + j] += a * B[k * N + j];
+        }
+}
+
+template <typename T, int M, int K, int N>
+inline void
+block_gemm_nt (T const* A, T const* B, T const& alpha, T* C)
+{
+    for (int i = 0; i < M; ++i)
+        for (int j = 0; j < N; ++j)
+        {
+            T dot = T(0);
+            for (int k = 0; k < K; ++k)
+                dot += A[i * K + k] * B[j * K + k];
+            C[i * N + j] += alpha * dot;
+        }
+}
+
+template <typename T, int M, int K, int N>
+inline void
+block_gemm_nn (T const* A, T const* B, T* C)
+{
+    for (int i = 0; i < M; ++i)
+    {
+        for (int j = 0; j < N; ++j)
+            C[i * N + j] = T(0);
+        for (int k = 0; k < K; ++k)
+        {
+            T const a = A[i * K + k];
+            for (int j = 0; j < N; ++j)
+                C[i * N + j] += a * B[k * N + j];
+        }
+    }
+}
+
+template <typename T, int M, int N>
+inline void
+block_gemv (T const* A, T const* x, T* y)
+{
+    for (int i = 0; i < M; ++i)
+    {
+        T dot = T(0);
+        for (int j = 0; j < N; ++j)
+            dot += A[i * N + j] * x[j];
+        y[i] += dot;
+    }
+}
+
+template <typename T, int M, int N>
+inline void
+block_gemv_t (T const* A, T const* x, T* y)
+{
+    for (int i = 0; i < M; ++i)
+        for (int j = 0; j < N; ++j)
+            y[j] += A[i * N + j] * x[i];
+}
+
+template <typename T, int N>
+void
+block_cholesky_invert (T* A)
+{
+    /* Decomposition A = L * L^T, see cholesky_decomposition(). */
+    T L[N * N];
+    for (int r = 0; r < N; ++r)
+    {
+        for (int c = 0; c < r; ++c)
+        {
+            T result = A[r * N + c];
+            for (int ci = 0; ci < c; ++ci)
+                result -= L[r * N + ci] * L[c * N + ci];
+            L[r * N + c] = result / L[c * N + c];
+        }
+        T result = A[r * N + r];
+        for (int c = 0; c < r; ++c)
+            result -= L[r * N + c] * L[r * N + c];
+        L[r * N + r] = std::sqrt(std::max(T(0), result));
+        for (int c = r + 1; c < N; ++c)
+            L[r * N + c] = T(0);
+    }
+
+    /* Inverse of the lower-triangular matrix L. */
+    T L_inv[N * N];
+    for (int r = 0; r < N; ++r)
+    {
+        for (int c = 0; c < r; ++c)
+        {
+            T result = T(0);
+            for (int ci = c; ci < r; ++ci)
+                result -= L[r * N + ci] * L_inv[ci * N + c];
+            L_inv[r * N + c] = result / L[r * N + r];
+        }
+        L_inv[r * N + r] = T(1) / L[r * N + r];
+        for (int c = r + 1; c < N; ++c)
+            L_inv[r * N + c] = T(0);
+    }
+
+    /* A^-1 = L^-T * L^-1. */
+    for (int i = 0; i < N; ++i)
+        for (int j = 0; j < N; ++j)
+        {
+            T dot = T(0);
+            for (int k = std::max(i, j); k < N; ++k)
+                dot += L_inv[k * N + i] * L_inv[k * N + j];
+            A[i * N + j] = std::isfinite(dot) ? dot : T(0);
+        }
+}
+
+/* ---------------------------------------------------------------- */
+
+template <typename T, int N>
+inline
+BlockDiagonalMatrix<T, N>::BlockDiagonalMatrix (std::size_t num_blocks)
+{
+    this->allocate(num_blocks);
+}
+
+template <typename T, int N>
+inline void
+BlockDiagonalMatrix<T, N>::allocate (std::size_t num_blocks)
+{
+    this->values.clear();
+    this->values.resize(num_blocks * BLOCK_SIZE, T(0));
+}
+
+template <typename T, int N>
+void
+BlockDiagonalMatrix<T, N>::mult_diagonal (T const& factor)
+{
+    for (std::size_t i = 0; i < this->values.size(); i += BLOCK_SIZE)
+        for (int j = 0; j < N; ++j)
+            this->values[i + j * N + j] *= factor;
+}
+
+template <typename T, int N>
+void
+BlockDiagonalMatrix<T, N>::invert_blocks (void)
+{
+    std::size_t const num_blocks = this->num_blocks();
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < num_blocks; ++i)
+        block_cholesky_invert<T, N>(this->block(i));
+}
+
+template <typename T, int N>
+DenseVector<T>
+BlockDiagonalMatrix<T, N>::multiply (DenseVector<T> const& rhs) const
+{
+    if (rhs.size() != this->num_cols())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    DenseVector<T> ret(this->num_rows(), T(0));
+    std::size_t const num_blocks = this->num_blocks();
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < num_blocks; ++i)
+        block_gemv<T, N, N>(this->block(i), rhs.data() + i * N,
+            ret.data() + i * N);
+    return ret;
+}
+
+template <typename T, int N>
+DenseVector<T>
+BlockDiagonalMatrix<T, N>::diagonal (void) const
+{
+    DenseVector<T> ret(this->num_rows());
+    for (std::size_t i = 0; i < this->num_blocks(); ++i)
+        for (int j = 0; j < N; ++j)
+            ret[i * N + j] = this->block(i)[j * N + j];
+    return ret;
+}
+
+template <typename T, int N>
+inline std::size_t
+BlockDiagonalMatrix<T, N>::num_blocks (void) const
+{
+    return this->values.size() / BLOCK_SIZE;
+}
+
+template <typename T, int N>
+inline std::size_t
+BlockDiagonalMatrix<T, N>::num_rows (void) const
+{
+    return this->num_blocks() * N;
+}
+
+template <typename T, int N>
+inline std::size_t
+BlockDiagonalMatrix<T, N>::num_cols (void) const
+{
+    return this->num_blocks() * N;
+}
+
+template <typename T, int N>
+inline T*
+BlockDiagonalMatrix<T, N>::block (std::size_t index)
+{
+    return this->values.data() + index * BLOCK_SIZE;
+}
+
+template <typename T, int N>
+inline T const*
+BlockDiagonalMatrix<T, N>::block (std::size_t index) const
+{
+    return this->values.data() + index * BLOCK_SIZE;
+}
+
+/* ---------------------------------------------------------------- */
+
+template <typename T, int R, int C>
+inline
+BlockSparseMatrix<T, R, C>::BlockSparseMatrix (void)
+    : block_rows(0)
+    , block_cols(0)
+{
+}
+
+template <typename T, int R, int C>
+void
+BlockSparseMatrix<T, R, C>::allocate (std::size_t block_rows,
+    std::size_t block_cols)
+{
+    this->set_structure(block_cols,
+        std::vector<std::size_t>(block_rows + 1, 0),
+        std::vector<std::size_t>());
+}
+
+template <typename T, int R, int C>
+void
+BlockSparseMatrix<T, R, C>::set_structure (std::size_t block_cols,
+    std::vector<std::size_t> const& row_offsets,
+    std::vector<std::size_t> const& col_indices)
+{
+    if (row_offsets.empty() || row_offsets.back() != col_indices.size())
+        throw std::invalid_argument("Invalid block structure");
+    for (std::size_t i = 0; i < col_indices.size(); ++i)
+        if (col_indices[i] >= block_cols)
+            throw std::invalid_argument("Block column out of range");
+
+    this->row_offsets = row_offsets;
+    this->col_indices = col_indices;
+    this->block_rows = row_offsets.size() - 1;
+    this->block_cols = block_cols;
+
+    /* Build the row of every block and the column index. */
+    this->row_indices.resize(col_indices.size());
+    for (std::size_t i = 0; i < this->block_rows; ++i)
+        for (std::size_t j = row_offsets[i]; j < row_offsets[i + 1]; ++j)
+            this->row_indices[j] = i;
+
+    this->col_offsets.assign(this->block_cols + 1, 0);
+    for (std::size_t i = 0; i < col_indices.size(); ++i)
+        this->col_offsets[col_indices[i] + 1] += 1;
+    for (std::size_t i = 0; i < this->block_cols; ++i)
+        this->col_offsets[i + 1] += this->col_offsets[i];
+
+    std::vector<std::size_t> fill(this->col_offsets.begin(),
+        this->col_offsets.end() - 1);
+    this->col_blocks.resize(col_indices.size());
+    for (std::size_t i = 0; i < col_indices.size(); ++i)
+        this->col_blocks[fill[col_indices[i]]++] = i;
+
+    this->values.clear();
+    this->values.resize(col_indices.size() * BLOCK_SIZE, T(0));
+}
+
+template <typename T, int R, int C>
+inline void
+BlockSparseMatrix<T, R, C>::set_zero (void)
+{
+    std::fill(this->values.begin(), this->values.end(), T(0));
+}
+
+template <typename T, int R, int C>
+void
+BlockSparseMatrix<T, R, C>::add_block_diagonal (
+    BlockDiagonalMatrix<T, R> const& D)
+{
+    static_assert(R == C, "Block diagonal requires square blocks");
+    if (D.num_blocks() != this->block_rows)
+        throw std::invalid_argument("Incompatible dimensions");
+
+    for (std::size_t i = 0; i < this->block_rows; ++i)
+    {
+        std::size_t const index = this->find_diagonal_block(i);
+        if (index == this->num_blocks())
+            throw std::invalid_argument("Missing diagonal block");
+
+        T* block = this->block(index);
+        T const* diag = D.block(i);
+        for (int j = 0; j < BLOCK_SIZE; ++j)
+            block[j] += diag[j];
+    }
+}
+
+template <typename T, int R, int C>
+void
+BlockSparseMatrix<T, R, C>::block_diagonal (
+    BlockDiagonalMatrix<T, R>* D) const
+{
+    static_assert(R == C, "Block diagonal requires square blocks");
+    D->allocate(this->block_rows);
+    for (std::size_t i = 0; i < this->block_rows; ++i)
+    {
+        std::size_t const index = this->find_diagonal_block(i);
+        if (index != this->num_blocks())
+            std::copy(this->block(index), this->block(index) + BLOCK_SIZE,
+                D->block(i));
+    }
+}
+
+template <typename T, int R, int C>
+std::size_t
+BlockSparseMatrix<T, R, C>::find_diagonal_block (std::size_t block_row) const
+{
+    std::size_t const* begin = this->col_indices.data()
+        + this->row_offsets[block_row];
+    std::size_t const* end = this->col_indices.data()
+        + this->row_offsets[block_row + 1];
+    std::size_t const* iter = std::lower_bound(begin, end, block_row);
+    if (iter == end || *iter != block_row)
+        return this->num_blocks();
+    return iter - this->col_indices.data();
+}
+
+template <typename T, int R, int C>
+DenseVector<T>
+BlockSparseMatrix<T, R, C>::multiply (DenseVector<T> const& rhs) const
+{
+    if (rhs.size() != this->num_cols())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    DenseVector<T> ret(this->num_rows(), T(0));
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < this->block_rows; ++i)
+        for (std::size_t j = this->row_offsets[i];
+            j < this->row_offsets[i + 1]; ++j)
+            block_gemv<T, R, C>(this->block(j),
+                rhs.data() + this->col_indices[j] * C, ret.data() + i * R);
+    return ret;
+}
+
+template <typename T, int R, int C>
+DenseVector<T>
+BlockSparseMatrix<T, R, C>::transpose_multiply (
+    DenseVector<T> const& rhs) const
+{
+    if (rhs.size() != this->num_rows())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    DenseVector<T> ret(this->num_cols(), T(0));
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < this->block_cols; ++i)
+        for (std::size_t j = this->col_offsets[i];
+            j < this->col_offsets[i + 1]; ++j)
+        {
+            std::size_t const index = this->col_blocks[j];
+            block_gemv_t<T, R, C>(this->block(index),
+                rhs.data() + this->row_indices[index] * R,
+                ret.data() + i * C);
+        }
+    return ret;
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::num_block_rows (void) const
+{
+    return this->block_rows;
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::num_block_cols (void) const
+{
+    return this->block_cols;
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::num_blocks (void) const
+{
+    return this->col_indices.size();
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::num_rows (void) const
+{
+    return this->block_rows * R;
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::num_cols (void) const
+{
+    return this->block_cols * C;
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::row_begin (std::size_t block_row) const
+{
+    return this->row_offsets[block_row];
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::row_end (std::size_t block_row) const
+{
+    return this->row_offsets[block_row + 1];
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::block_row (std::size_t index) const
+{
+    return this->row_indices[index];
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::block_col (std::size_t index) const
+{
+    return this->col_indices[index];
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::col_begin (std::size_t block_col) const
+{
+    return this->col_offsets[block_col];
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::col_end (std::size_t block_col) const
+{
+    return this->col_offsets[block_col + 1];
+}
+
+template <typename T, int R, int C>
+inline std::size_t
+BlockSparseMatrix<T, R, C>::col_block (std::size_t position) const
+{
+    return this->col_blocks[position];
+}
+
+template <typename T, int R, int C>
+inline T*
+BlockSparseMatrix<T, R, C>::block (std::size_t index)
+{
+    return this->values.data() + index * BLOCK_SIZE;
+}
+
+template <typename T, int R, int C>
+inline T const*
+BlockSparseMatrix<T, R, C>::block (std::size_t index) const
+{
+    return this->values.data() + index * BLOCK_SIZE;
+}
+
+/* ---------------------------------------------------------------- */
+
+template <typename T, int R, int C>
+void
+block_gram_diagonal (BlockSparseMatrix<T, R, C> const& A,
+    BlockDiagonalMatrix<T, C>* result)
+{
+    result->allocate(A.num_block_cols());
+    std::size_t const num_block_cols = A.num_block_cols();
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::size_t i = 0; i < num_block_cols; ++i)
+        for (std::size_t j = A.col_begin(i); j < A.col_end(i); ++j)
+        {
+            T const* block = A.block(A.col_block(j));
+            block_gemm_tn<T, R, C, C>(block, block, T(1), result->block(i));
+        }
+}
+
+template <typename T, int R, int C1, int C2>
+void
+block_transpose_multiply (BlockSparseMatrix<T, R, C1> const& A,
+    BlockSparseMatrix<T, R, C2> const& B,
+    BlockSparseMatrix<T, C1, C2>* result)
+{
+    if (A.num_block_rows() != B.num_block_rows())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    /*
+     * Block row i of the result collects the blocks of B in all rows that
+     * have a block in column i of A. The structure is computed in two
+     * passes, the first counts the blocks per row, the second fills them.
+     */
+    std::size_t const rows = A.num_block_cols();
+    std::size_t const cols = B.num_block_cols();
+    std::vector<std::size_t> row_offsets(rows + 1, 0);
+    std::vector<std::size_t> col_indices;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1)
+        {
+            for (std::size_t i = 0; i < rows; ++i)
+                row_offsets[i + 1] += row_offsets[i];
+            col_indices.resize(row_offsets.back());
+        }
+#pragma omp parallel
+        {
+            std::vector<std::size_t> row_cols;
+            std::vector<char> marker(cols, 0);
+#pragma omp for schedule(dynamic, 64)
+            for (std::size_t i = 0; i < rows; ++i)
+            {
+                row_cols.clear();
+                for (std::size_t j = A.col_begin(i); j < A.col_end(i); ++j)
+                {
+                    std::size_t const row = A.block_row(A.col_block(j));
+                    for (std::size_t k = B.row_begin(row);
+                        k < B.row_end(row); ++k)
+                    {
+                        std::size_t const col = B.block_col(k);
+                        if (marker[col])
+                            continue;
+                        marker[col] = 1;
+                        row_cols.push_back(col);
+                    }
+                }
+                for (std::size_t j = 0; j < row_cols.size(); ++j)
+                    marker[row_cols[j]] = 0;
+
+                if (pass == 0)
+                {
+                    row_offsets[i + 1] = row_cols.size();
+                    continue;
+                }
+                std::sort(row_cols.begin(), row_cols.end());
+                std::copy(row_cols.begin(), row_cols.end(),
+                    col_indices.begin() + row_offsets[i]);
+            }
+        }
+    }
+    result->set_structure(cols, row_offsets, col_indices);
+
+    /* Numeric product using a dense column-to-block map per thread. */
+#pragma omp parallel
+    {
+        std::vector<std::size_t> positions(cols, 0);
+#pragma omp for schedule(dynamic, 64)
+        for (std::size_t i = 0; i < rows; ++i)
+        {
+            for (std::size_t j = result->row_begin(i);
+                j < result->row_end(i); ++j)
+                positions[result->block_col(j)] = j;
+
+            for (std::size_t j = A.col_begin(i); j < A.col_end(i); ++j)
+            {
+                std::size_t const a_index = A.col_block(j);
+                std::size_t const row = A.block_row(a_index);
+                for (std::size_t k = B.row_begin(row); k < B.row_end(row); ++k)
+                    block_gemm_tn<T, R, C1, C2>(A.block(a_index), B.block(k),
+                        T(1), result->block(positions[B.block_col(k)]));
+            }
+        }
+    }
+}
+
+template <typename T, int R1, int R2, int C>
+void
+block_multiply_transpose (BlockSparseMatrix<T, R1, C> const& A,
+    BlockSparseMatrix<T, R2, C> const& B, T const& alpha,
+    BlockSparseMatrix<T, R1, R2>* result)
+{
+    if (A.num_block_cols() != B.num_block_cols())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    /*
+     * Block row i of the result collects the rows of all blocks of B in
+     * the columns that have a block in row i of A. Same two-pass scheme
+     * as in block_transpose_multiply().
+     */
+    std::size_t const rows = A.num_block_rows();
+    std::size_t const cols = B.num_block_rows();
+    bool const square = rows == cols && R1 == R2;
+    std::vector<std::size_t> row_offsets(rows + 1, 0);
+    std::vector<std::size_t> col_indices;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1)
+        {
+            for (std::size_t i = 0; i < rows; ++i)
+                row_offsets[i + 1] += row_offsets[i];
+            col_indices.resize(row_offsets.back());
+        }
+#pragma omp parallel
+        {
+            std::vector<std::size_t> row_cols;
+            std::vector<char> marker(cols, 0);
+#pragma omp for schedule(dynamic, 64)
+            for (std::size_t i = 0; i < rows; ++i)
+            {
+                row_cols.clear();
+                if (square)
+                {
+                    marker[i] = 1;
+                    row_cols.push_back(i);
+                }
+                for (std::size_t j = A.row_begin(i); j < A.row_end(i); ++j)
+                {
+                    std::size_t const col = A.block_col(j);
+                    for (std::size_t k = B.col_begin(col);
+                        k < B.col_end(col); ++k)
+                    {
+                        std::size_t const row = B.block_row(B.col_block(k));
+                        if (marker[row])
+                            continue;
+                        marker[row] = 1;
+                        row_cols.push_back(row);
+                    }
+                }
+                for (std::size_t j = 0; j < row_cols.size(); ++j)
+                    marker[row_cols[j]] = 0;
+
+                if (pass == 0)
+                {
+                    row_offsets[i + 1] = row_cols.size();
+                    continue;
+                }
+                std::sort(row_cols.begin(), row_cols.end());
+                std::copy(row_cols.begin(), row_cols.end(),
+                    col_indices.begin() + row_offsets[i]);
+            }
+        }
+    }
+    result->set_structure(cols, row_offsets, col_indices);
+
+    /* Numeric product using a dense column-to-block map per thread. */
+#pragma omp parallel
+    {
+        std::vector<std::size_t> positions(cols, 0);
+#pragma omp for schedule(dynamic, 64)
+        for (std::size_t i = 0; i < rows; ++i)
+        {
+            for (std::size_t j = result->row_begin(i);
+                j < result->row_end(i); ++j)
+                positions[result->block_col(j)] = j;
+
+            for (std::size_t j = A.row_begin(i); j < A.row_end(i); ++j)
+            {
+                std::size_t const col = A.block_col(j);
+                for (std::size_t k = B.col_begin(col); k < B.col_end(col); ++k)
+                {
+                    std::size_t const b_index = B.col_block(k);
+                    block_gemm_nt<T, R1, C, R2>(A.block(j), B.block(b_index),
+                        alpha, result->block(positions[B.block_row(b_index)]));
+                }
+            }
+        }
+    }
+}
+
+template <typename T, int R, int C>
+void
+block_multiply_diagonal (BlockSparseMatrix<T, R, C> const& A,
+    BlockDiagonalMatrix<T, C> const& D,
+    BlockSparseMatrix<T, R, C>* result)
+{
+    if (A.num_block_cols() != D.num_blocks())
+        throw std::invalid_argument("Incompatible dimensions");
+
+    *result = A;
+    std::size_t const num_blocks = A.num_blocks();
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < num_blocks; ++i)
+        block_gemm_nn<T, R, C, C>(A.block(i), D.block(A.block_col(i)),
+            result->block(i));
+}
+
+SFM_BA_NAMESPACE_END
+SFM_NAMESPACE_END
+
+#endif /* SFM_BA_BLOCK_SPARSE_MATRIX_HEADER */
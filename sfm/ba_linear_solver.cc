@@ -10,11 +10,7 @@
 #include <stdexcept>
 #include <iostream>
 
-#include "util/timer.h"
-#include "math/matrix.h"
-#include "math/matrix_tools.h"
 #include "sfm/ba_linear_solver.h"
-#include "sfm/ba_cholesky.h"
 #include "sfm/ba_conjugate_gradient.h"
 
 SFM_NAMESPACE_BEGIN
@@ -22,124 +18,170 @@ SFM_BA_NAMESPACE_BEGIN
 
 namespace
 {
-    /*
-     * Inverts a symmetric, positive definite matrix with NxN bocks on its
-     * diagonal using Cholesky decomposition. All other entries must be zero.
-     */
-    void
-    invert_block_matrix_NxN_inplace (SparseMatrix<double>* A, int blocksize)
+    /* Conjugate gradient functor for block sparse and block diagonal. */
+    template <typename Matrix>
+    class CGBlockMatrixFunctor : public ConjugateGradient<double>::Functor
     {
-        if (A->num_rows() != A->num_cols())
-            throw std::invalid_argument("Block matrix must be square");
-        if (A->num_non_zero() != A->num_rows() * blocksize)
-            throw std::invalid_argument("Invalid number of non-zeros");
-
-        int const bs2 = blocksize * blocksize;
-        std::vector<double> matrix_block(bs2);
-        for (double* iter = A->begin(); iter != A->end(); )
+    public:
+        CGBlockMatrixFunctor (Matrix const& A) : A(&A) {}
+
+        DenseVector<double> multiply (DenseVector<double> const& x) const
         {
-            double* iter_backup = iter;
-            for (int i = 0; i < bs2; ++i)
-                matrix_block[i] = *(iter++);
-
-            cholesky_invert_inplace(matrix_block.data(), blocksize);
-
-            iter = iter_backup;
-            for (int i = 0; i < bs2; ++i)
-                if (std::isfinite(matrix_block[i]))
-                    *(iter++) = matrix_block[i];
-                else
-                    *(iter++) = 0.0;
+            return this->A->multiply(x);
+        }
+
+        std::size_t input_size (void) const
+        {
+            return this->A->num_cols();
+        }
+
+        std::size_t output_size (void) const
+        {
+            return this->A->num_rows();
         }
-    }
+
+    private:
+        Matrix const* A;
+    };
 
     /*
-     * Inverts a matrix with 3x3 bocks on its diagonal. All other entries
-     * must be zero. Reading blocks is thus very efficient.
+     * Implicit reduced camera matrix S = B - Jc^T Jp C^-1 Jp^T Jc, where
+     * B and C^-1 are block diagonal. S is applied to a vector through the
+     * Jacobian blocks and never formed.
      */
-    void
-    invert_block_matrix_3x3_inplace (SparseMatrix<double>* A)
+    template <int N>
+    class CGImplicitSchurFunctor : public ConjugateGradient<double>::Functor
     {
-        if (A->num_rows() != A->num_cols())
-            throw std::invalid_argument("Block matrix must be square");
-        if (A->num_non_zero() != A->num_rows() * 3)
-            throw std::invalid_argument("Invalid number of non-zeros");
+    public:
+        CGImplicitSchurFunctor (BlockSparseMatrix<double, 2, N> const& Jc,
+            BlockSparseMatrix<double, 2, 3> const& Jp,
+            BlockDiagonalMatrix<double, N> const& B,
+            BlockDiagonalMatrix<double, 3> const& C_inv)
+            : Jc(&Jc), Jp(&Jp), B(&B), C_inv(&C_inv) {}
+
+        DenseVector<double> multiply (DenseVector<double> const& x) const
+        {
+            DenseVector<double> ret = this->B->multiply(x);
+            DenseVector<double> const y = this->Jc->transpose_multiply(
+                this->Jp->multiply(this->C_inv->multiply(
+                this->Jp->transpose_multiply(this->Jc->multiply(x)))));
+            for (std::size_t i = 0; i < ret.size(); ++i)
+                ret[i] -= y[i];
+            return ret;
+        }
 
-        for (double* iter = A->begin(); iter != A->end(); )
+        std::size_t input_size (void) const
         {
-            double* iter_backup = iter;
-            math::Matrix<double, 3, 3> rot;
-            for (int i = 0; i < 9; ++i)
-                rot[i] = *(iter++);
-
-            double det = math::matrix_determinant(rot);
-            if (MATH_DOUBLE_EQ(det, 0.0))
-                continue;
-
-            rot = math::matrix_inverse(rot, det);
-            iter = iter_backup;
-            for (int i = 0; i < 9; ++i)
-                *(iter++) = rot[i];
+            return this->Jc->num_cols();
         }
-    }
+
+        std::size_t output_size (void) const
+        {
+            return this->Jc->num_cols();
+        }
+
+    private:
+        BlockSparseMatrix<double, 2, N> const* Jc;
+        BlockSparseMatrix<double, 2, 3> const* Jp;
+        BlockDiagonalMatrix<double, N> const* B;
+        BlockDiagonalMatrix<double, 3> const* C_inv;
+    };
 
     /*
-     * Computes for a given matrix A the square matrix A^T * A for the
-     * case that block columns of A only need to be multiplied with itself.
-     * Becase the resulting matrix is symmetric, only about half the work
-     * needs to be performed.
+     * Computes the camera blocks S_ii = B_ii - sum_p E_ip C_p^-1 E_ip^T of
+     * the reduced camera matrix without forming S, with E_ip the sum of
+     * Jc^T Jp over the observations of point p in camera i.
      */
+    template <int N>
     void
-    matrix_block_column_multiply (SparseMatrix<double> const& A,
-        std::size_t block_size, SparseMatrix<double>* B)
+    schur_block_diagonal (BlockSparseMatrix<double, 2, N> const& Jc,
+        BlockSparseMatrix<double, 2, 3> const& Jp,
+        BlockDiagonalMatrix<double, N> const& B,
+        BlockDiagonalMatrix<double, 3> const& C_inv,
+        BlockDiagonalMatrix<double, N>* result)
     {
-        SparseMatrix<double>::Triplets triplets;
-        triplets.reserve(A.num_cols() * block_size);
-        for (std::size_t block = 0; block < A.num_cols(); block += block_size)
+        *result = B;
+        std::size_t const num_cameras = Jc.num_block_cols();
+#pragma omp parallel
         {
-            std::vector<DenseVector<double>> columns(block_size);
-            for (std::size_t col = 0; col < block_size; ++col)
-                A.column_nonzeros(block + col, &columns[col]);
-            for (std::size_t col = 0; col < block_size; ++col)
+            /* Accumulators for E_ip of the points seen by one camera. */
+            std::vector<std::size_t> positions(Jp.num_block_cols(), 0);
+            std::vector<std::size_t> points;
+            std::vector<double> blocks;
+#pragma omp for schedule(dynamic, 4)
+            for (std::size_t i = 0; i < num_cameras; ++i)
             {
-                double dot = columns[col].dot(columns[col]);
-                triplets.emplace_back(block + col, block + col, dot);
-                for (std::size_t row = col + 1; row < block_size; ++row)
+                points.clear();
+                blocks.clear();
+                for (std::size_t j = Jc.col_begin(i); j < Jc.col_end(i); ++j)
+                {
+                    std::size_t const obs = Jc.col_block(j);
+                    std::size_t const point = Jp.block_col(obs);
+                    if (positions[point] >= points.size()
+                        || points[positions[point]] != point)
+                    {
+                        positions[point] = points.size();
+                        points.push_back(point);
+                        blocks.resize(blocks.size() + N * 3, 0.0);
+                    }
+                    block_gemm_tn<double, 2, N, 3>(Jc.block(obs),
+                        Jp.block(obs), 1.0,
+                        blocks.data() + positions[point] * N * 3);
+                }
+
+                double EC[N * 3];
+                for (std::size_t j = 0; j < points.size(); ++j)
                 {
-                    dot = columns[col].dot(columns[row]);
-                    triplets.emplace_back(block + row, block + col, dot);
-                    triplets.emplace_back(block + col, block + row, dot);
+                    double const* E = blocks.data() + j * N * 3;
+                    block_gemm_nn<double, N, 3, 3>(E,
+                        C_inv.block(points[j]), EC);
+                    block_gemm_nt<double, N, 3, N>(EC, E, -1.0,
+                        result->block(i));
                 }
             }
         }
-        B->allocate(A.num_cols(), A.num_cols());
-        B->set_from_triplets(triplets);
     }
 }
 
+template <>
+BlockSparseCholesky<double, 6>&
+LinearSolver::cholesky<6> (void)
+{
+    return this->cholesky_6;
+}
+
+template <>
+BlockSparseCholesky<double, 9>&
+LinearSolver::cholesky<9> (void)
+{
+    return this->cholesky_9;
+}
+
+template <int N>
 LinearSolver::Status
-LinearSolver::solve (SparseMatrixType const& jac_cams,
-    SparseMatrixType const& jac_points,
+LinearSolver::solve (BlockSparseMatrix<double, 2, N> const& jac_cams,
+    PointJacobian const& jac_points,
     DenseVectorType const& vector_f,
     DenseVectorType* delta_x)
 {
-    bool const has_jac_cams = jac_cams.num_rows() > 0;
-    bool const has_jac_points = jac_points.num_rows() > 0;
+    bool const has_jac_cams = jac_cams.num_cols() > 0;
+    bool const has_jac_points = jac_points.num_cols() > 0;
 
     /* Select solver based on bundle adjustment mode. */
     if (has_jac_cams && has_jac_points)
         return this->solve_schur(jac_cams, jac_points, vector_f, delta_x);
     else if (has_jac_cams && !has_jac_points)
-        return this->solve(jac_cams, vector_f, delta_x, 0);
+        return this->solve_blocks(jac_cams, vector_f, delta_x);
     else if (!has_jac_cams && has_jac_points)
-        return this->solve(jac_points, vector_f, delta_x, 3);
+        return this->solve_blocks(jac_points, vector_f, delta_x);
     else
         throw std::invalid_argument("No Jacobian given");
 }
 
+template <int N>
 LinearSolver::Status
-LinearSolver::solve_schur (SparseMatrixType const& jac_cams,
-    SparseMatrixType const& jac_points,
+LinearSolver::solve_schur (BlockSparseMatrix<double, 2, N> const& jac_cams,
+    PointJacobian const& jac_points,
     DenseVectorType const& values, DenseVectorType* delta_x)
 {
     /*
@@ -155,88 +197,142 @@ LinearSolver::solve_schur (SparseMatrixType const& jac_cams,
      *   B = Jcc, E = Jcp, C = Jpp
      *  其中 Jcc = Jc^T* Jc, Jcx = Jc^T*Jx, Jxc = Jx^TJc, Jxx = Jx^T*Jx
      *      v = Jc^T(F-x), w = Jx^T(F-x), deta_x = [delta_c; delta_p]
+     *
+     *   B和C是块对角矩阵 (NxN和3x3), E的每个块对应一个相机和三维点。
      */
 
     // 误差向量
     DenseVectorType const& F = values;
     // 关于相机的雅阁比矩阵
-    SparseMatrixType const& Jc = jac_cams;
+    BlockSparseMatrix<double, 2, N> const& Jc = jac_cams;
     // 关于三维点的雅阁比矩阵
-    SparseMatrixType const& Jp = jac_points;
-    SparseMatrixType JcT = Jc.transpose();
-    SparseMatrixType JpT = Jp.transpose();
+    PointJacobian const& Jp = jac_points;
 
     // 构造正规方程
-    SparseMatrixType B, C;
+    BlockDiagonalMatrix<double, N> B;
+    BlockDiagonalMatrix<double, 3> C;
     // B = Jc^T* Jc
-    matrix_block_column_multiply(Jc, this->opts.camera_block_dim, &B);
+    block_gram_diagonal(Jc, &B);
     // C = Jp^T*Jp
-    matrix_block_column_multiply(Jp, 3, &C);
-    // E = Jc^T*Jp
-    SparseMatrixType E = JcT.multiply(Jp);
+    block_gram_diagonal(Jp, &C);
 
     /* Assemble two values vectors. */
-    DenseVectorType v = JcT.multiply(F);
-    DenseVectorType w = JpT.multiply(F);
+    DenseVectorType v = Jc.transpose_multiply(F);
+    DenseVectorType w = Jp.transpose_multiply(F);
     v.negate_self();
     w.negate_self();
 
-    /* 以矩阵B和C的对角元素重新构建对角阵*/
-//    SparseMatrixType B_diag = B.diagonal_matrix();
-//    SparseMatrixType C_diag = C.diagonal_matrix();
-
     /* 添加信赖域 */
     C.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
     B.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
 
     /* 求解C矩阵的逆C = inv(Jx^T+Jx + lambda*Ixx)*/
-    invert_block_matrix_3x3_inplace(&C);
-
-    /* 计算S矩阵的Schur补用于高斯消元. */
-    SparseMatrixType ET = E.transpose();
-
-    // S = (Jcc+lambda*Icc) - Jc^T*Jx*inv(Jxx+ lambda*Ixx)*Jx^T*Jc
-    SparseMatrixType S = B.subtract(E.multiply(C).multiply(ET));
-    // rhs = v -  Jc^T*Jx*inv(Jxx+ lambda*Ixx)*w
-    DenseVectorType rhs = v.subtract(E.multiply(C.multiply(w)));
-
-    /* Compute pre-conditioner for linear system. */
-    //SparseMatrixType precond = S.diagonal_matrix();
-    //precond.cwise_invert();
-    SparseMatrixType precond = B;
-    invert_block_matrix_NxN_inplace(&precond, this->opts.camera_block_dim);
-
-    /* 用共轭梯度法求解相机参数. */
-    DenseVectorType delta_y(Jc.num_cols());
-    typedef sfm::ba::ConjugateGradient<double> CGSolver;
-    CGSolver::Options cg_opts;
-    cg_opts.max_iterations = this->opts.cg_max_iterations;
-    cg_opts.tolerance = 1e-20;
-    CGSolver solver(cg_opts);
-    CGSolver::Status cg_status;
-    cg_status = solver.solve(S, rhs, &delta_y, &precond);
+    C.invert_blocks();
 
-    Status status;
-    status.num_cg_iterations = cg_status.num_iterations;
-    switch (cg_status.info)
+    /*
+     * 计算S矩阵的Schur补用于高斯消元.
+     * S = (Jcc+lambda*Icc) - Jc^T*Jx*inv(Jxx+ lambda*Ixx)*Jx^T*Jc
+     * rhs = v -  Jc^T*Jx*inv(Jxx+ lambda*Ixx)*w
+     * 预条件子为S的对角块的逆 (block-Jacobi).
+     */
+    DenseVectorType rhs = v.subtract(
+        Jc.transpose_multiply(Jp.multiply(C.multiply(w))));
+
+    SchurSolver schur_solver = this->opts.schur_solver;
+    if (schur_solver == SCHUR_AUTO)
+        schur_solver = Jc.num_block_cols()
+            <= static_cast<std::size_t>(this->opts.cholesky_max_cameras)
+            ? SCHUR_SPARSE_CHOLESKY : SCHUR_IMPLICIT_CG;
+
+    BlockSparseMatrix<double, N, N> S;
+    switch (schur_solver)
     {
-        case CGSolver::CG_CONVERGENCE:
-            status.success = true;
+        case SCHUR_EXPLICIT_CG:
+        case SCHUR_SPARSE_CHOLESKY:
+        {
+            // E = Jc^T*Jp
+            BlockSparseMatrix<double, N, 3> E, EC;
+            block_transpose_multiply(Jc, Jp, &E);
+            block_multiply_diagonal(E, C, &EC);
+            block_multiply_transpose(EC, E, -1.0, &S);
+            S.add_block_diagonal(B);
             break;
-        case CGSolver::CG_MAX_ITERATIONS:
-            status.success = true;
+        }
+        case SCHUR_IMPLICIT_CG:
             break;
-        case CGSolver::CG_INVALID_INPUT:
-            std::cout << "BA: CG failed (invalid input)" << std::endl;
-            status.success = false;
-            return status;
         default:
-            break;
+            throw std::invalid_argument("Invalid Schur solver");
+    }
+
+    Status status;
+    DenseVectorType delta_y;
+    if (schur_solver == SCHUR_SPARSE_CHOLESKY)
+    {
+        /* 稀疏Cholesky分解直接求解, 符号分解只在结构变化时重新计算. */
+        BlockSparseCholesky<double, N>& cholesky = this->cholesky<N>();
+        if (!cholesky.is_analyzed_for(S))
+            cholesky.analyze(S);
+        if (cholesky.factorize(S))
+        {
+            delta_y = cholesky.solve(rhs);
+            status.success = true;
+        }
+        else
+        {
+            /* Not positive definite, fall back to CG on S. */
+            schur_solver = SCHUR_EXPLICIT_CG;
+        }
+    }
+
+    if (schur_solver != SCHUR_SPARSE_CHOLESKY)
+    {
+        BlockDiagonalMatrix<double, N> precond;
+        if (schur_solver == SCHUR_IMPLICIT_CG)
+            schur_block_diagonal(Jc, Jp, B, C, &precond);
+        else
+            S.block_diagonal(&precond);
+        precond.invert_blocks();
+
+        /* 用共轭梯度法求解相机参数. */
+        typedef sfm::ba::ConjugateGradient<double> CGSolver;
+        CGSolver::Options cg_opts;
+        cg_opts.max_iterations = this->opts.cg_max_iterations;
+        cg_opts.tolerance = 1e-20;
+        CGSolver solver(cg_opts);
+        CGSolver::Status cg_status;
+        CGBlockMatrixFunctor<BlockSparseMatrix<double, N, N> > S_functor(S);
+        CGImplicitSchurFunctor<N> S_implicit_functor(Jc, Jp, B, C);
+        CGBlockMatrixFunctor<BlockDiagonalMatrix<double, N> >
+            precond_functor(precond);
+        if (schur_solver == SCHUR_IMPLICIT_CG)
+            cg_status = solver.solve(S_implicit_functor, rhs, &delta_y,
+                &precond_functor);
+        else
+            cg_status = solver.solve(S_functor, rhs, &delta_y,
+                &precond_functor);
+
+        status.num_cg_iterations = cg_status.num_iterations;
+        switch (cg_status.info)
+        {
+            case CGSolver::CG_CONVERGENCE:
+                status.success = true;
+                break;
+            case CGSolver::CG_MAX_ITERATIONS:
+                status.success = true;
+                break;
+            case CGSolver::CG_INVALID_INPUT:
+                std::cout << "BA: CG failed (invalid input)" << std::endl;
+                status.success = false;
+                return status;
+            default:
+                break;
+        }
     }
 
     /* 将相机参数带入到第二个方程中，求解三维点的参数. */
     /*E= inv(Jp^T Jp) (JpT.multiply(F)-Jc^T * Jp * delta_y)*/
-    DenseVectorType delta_z = C.multiply(w.subtract(ET.multiply(delta_y)));
+    DenseVectorType delta_z = C.multiply(
+        w.subtract(Jp.transpose_multiply(Jc.multiply(delta_y))));
 
     /* Fill output vector. */
     std::size_t const jac_cam_cols = Jc.num_cols();
@@ -250,85 +346,51 @@ LinearSolver::solve_schur (SparseMatrixType const& jac_cams,
     for (std::size_t i = 0; i < jac_point_cols; ++i)
         delta_x->at(jac_cam_cols + i) = delta_z[i];
 
-    /* Compute predicted error decrease */
-//    status.predicted_error_decrease = 0.0;
-//    status.predicted_error_decrease += delta_y.dot(B_diag.multiply(
-//        delta_y).multiply(1.0 / this->opts.trust_region_radius).add(v));
-//    status.predicted_error_decrease += delta_z.dot(C_diag.multiply(
-//        delta_z).multiply(1.0 / this->opts.trust_region_radius).add(w));
-
     return status;
 }
 
+template <int N>
 LinearSolver::Status
-LinearSolver::solve (SparseMatrixType const& J,
+LinearSolver::solve_blocks (BlockSparseMatrix<double, 2, N> const& J,
     DenseVectorType const& vector_f,
-    DenseVectorType* delta_x,
-    std::size_t block_size)
+    DenseVectorType* delta_x)
 {
+    for (std::size_t i = 0; i < J.num_block_rows(); ++i)
+        if (J.row_end(i) - J.row_begin(i) > 1)
+            throw std::invalid_argument("Jacobian is not block diagonal");
+
     DenseVectorType const& F = vector_f;
-    SparseMatrixType Jt = J.transpose();
-    SparseMatrixType H = Jt.multiply(J);
-    SparseMatrixType H_diag = H.diagonal_matrix();
+    BlockDiagonalMatrix<double, N> H;
+    block_gram_diagonal(J, &H);
+    DenseVectorType H_diag = H.diagonal();
 
     /* Compute RHS. */
-    DenseVectorType g = Jt.multiply(F);
+    DenseVectorType g = J.transpose_multiply(F);
     g.negate_self();
 
-    /* Add regularization to H. */
+    /* Add regularization to H and invert blocks of H directly. */
     H.mult_diagonal(1.0 + 1.0 / this->opts.trust_region_radius);
+    H.invert_blocks();
+    *delta_x = H.multiply(g);
 
     Status status;
-    if (block_size == 0)
-    {
-        /* Use preconditioned CG using the diagonal of H. */
-        SparseMatrixType precond = H.diagonal_matrix();
-        precond.cwise_invert();
-
-        typedef sfm::ba::ConjugateGradient<double> CGSolver;
-        CGSolver::Options cg_opts;
-        cg_opts.max_iterations = this->opts.cg_max_iterations;
-        cg_opts.tolerance = 1e-20;
-        CGSolver solver(cg_opts);
-        CGSolver::Status cg_status;
-        cg_status = solver.solve(H, g, delta_x, &precond);
-        status.num_cg_iterations = cg_status.num_iterations;
-
-        switch (cg_status.info)
-        {
-            case CGSolver::CG_CONVERGENCE:
-                status.success = true;
-                break;
-            case CGSolver::CG_MAX_ITERATIONS:
-                status.success = true;
-                break;
-            case CGSolver::CG_INVALID_INPUT:
-                std::cout << "BA: CG failed (invalid input)" << std::endl;
-                status.success = false;
-                return status;
-            default:
-                break;
-        }
-    }
-    else if (block_size == 3)
-    {
-        /* Invert blocks of H directly */
-        invert_block_matrix_3x3_inplace(&H);
-        *delta_x = H.multiply(g);
-        status.success = true;
-        status.num_cg_iterations = 0;
-    }
-    else
-    {
-        status.success = false;
-        throw std::invalid_argument("Unsupported block_size in linear solver");
-    }
-
-    status.predicted_error_decrease = delta_x->dot(H_diag.multiply(
-        *delta_x).multiply(1.0 / this->opts.trust_region_radius).add(g));
+    status.success = true;
+    status.num_cg_iterations = 0;
+    status.predicted_error_decrease = 0.0;
+    for (std::size_t i = 0; i < delta_x->size(); ++i)
+        status.predicted_error_decrease += delta_x->at(i) * (H_diag[i]
+            * delta_x->at(i) / this->opts.trust_region_radius + g[i]);
 
     return status;
 }
 
+/* Instances for fixed intrinsics (6) and full camera parameters (9). */
+template LinearSolver::Status LinearSolver::solve<6> (
+    BlockSparseMatrix<double, 2, 6> const&, PointJacobian const&,
+    DenseVectorType const&, DenseVectorType*);
+template LinearSolver::Status LinearSolver::solve<9> (
+    BlockSparseMatrix<double, 2, 9> const&, PointJacobian const&,
+    DenseVectorType const&, DenseVectorType*);
+
 SFM_BA_NAMESPACE_END
 SFM_NAMESPACE_END
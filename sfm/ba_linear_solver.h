@@ -13,8 +13,9 @@
 #include <vector>
 
 #include "sfm/defines.h"
-#include "sfm/ba_sparse_matrix.h"
+#include "sfm/ba_block_sparse_matrix.h"
 #include "sfm/ba_dense_vector.h"
+#include "sfm/ba_sparse_cholesky.h"
 
 SFM_NAMESPACE_BEGIN
 SFM_BA_NAMESPACE_BEGIN
@@ -22,13 +23,33 @@ SFM_BA_NAMESPACE_BEGIN
 class LinearSolver
 {
 public:
+    /**
+     * Solver for the reduced camera system S of the Schur complement trick.
+     * The explicit solver forms S, the implicit solver only applies S to
+     * vectors using the Jacobian blocks, which requires less memory if
+     * many cameras see the same points. Both use a block-Jacobi
+     * preconditioner with the camera blocks of S. The sparse Cholesky
+     * solver forms and factorizes S, the analysis of the structure is
+     * reused as long as the solver is used for the same problem. The
+     * automatic mode uses sparse Cholesky for at most
+     * 'cholesky_max_cameras' cameras, otherwise the implicit solver.
+     */
+    enum SchurSolver
+    {
+        SCHUR_EXPLICIT_CG,
+        SCHUR_IMPLICIT_CG,
+        SCHUR_SPARSE_CHOLESKY,
+        SCHUR_AUTO
+    };
+
     struct Options
     {
         Options (void);
 
         double trust_region_radius;
         int cg_max_iterations;
-        int camera_block_dim;
+        SchurSolver schur_solver;
+        int cholesky_max_cameras;
     };
 
     struct Status
@@ -40,8 +61,8 @@ public:
         bool success;
     };
 
-    // 稀疏矩阵设置为double类型
-    typedef SparseMatrix<double> SparseMatrixType;
+    /** Jacobian with one 2x3 point block per observation. */
+    typedef BlockSparseMatrix<double, 2, 3> PointJacobian;
 
     // 向量设置为double类型
     typedef DenseVector<double> DenseVectorType;
@@ -49,6 +70,9 @@ public:
 public:
     LinearSolver (Options const& options);
 
+    /** Changes the options, keeps the analysis of the sparse Cholesky. */
+    void set_options (Options const& options);
+
 
     // 解正规方程J^TJ delta_x = -J^T f
     /**
@@ -57,9 +81,13 @@ public:
      * If the Jacobian for points is empty, only cameras are optimized.
      * If both, Jacobian for cams and points is given, the Schur complement
      * trick is used to solve the linear system.
+     *
+     * The camera Jacobian has one 2xN block per observation, N is the
+     * number of camera parameters (6 with fixed intrinsics, otherwise 9).
      */
-    Status solve (SparseMatrixType const& jac_cams,
-        SparseMatrixType const& jac_points,
+    template <int N>
+    Status solve (BlockSparseMatrix<double, 2, N> const& jac_cams,
+        PointJacobian const& jac_points,
         DenseVectorType const& vector_f,
         DenseVectorType* delta_x);
 
@@ -70,27 +98,30 @@ private:
      * Conjugate Gradient on Schur-complement by exploiting the block
      * structure of H = J^T * J.
      */
-    Status solve_schur (SparseMatrixType const& jac_cams,
-        SparseMatrixType const& jac_points,
+    template <int N>
+    Status solve_schur (BlockSparseMatrix<double, 2, N> const& jac_cams,
+        PointJacobian const& jac_points,
         DenseVectorType const& values,
         DenseVectorType* delta_x);
 
-
-    //block size = 0的时候
     /**
-     * J is the Jacobian of the problem. If H = J^T * J has a block diagonal
-     * structure (e.g. 'motion only' or 'structure only' problems in BA),
-     * block_size can be used to directly invert H. If block_size is 0
-     * the diagonal of H is used as a preconditioner and the linear system
-     * is solved via conjugate gradient.
+     * J is the Jacobian of a 'motion only' or 'structure only' problem.
+     * Every observation depends on a single camera or point, H = J^T * J
+     * is thus block diagonal with NxN blocks and is inverted directly.
      */
-    Status solve (SparseMatrixType const& J,
+    template <int N>
+    Status solve_blocks (BlockSparseMatrix<double, 2, N> const& J,
         DenseVectorType const& vector_f,
-        DenseVectorType* delta_x,
-        std::size_t block_size = 0);
+        DenseVectorType* delta_x);
+
+    /** Sparse Cholesky for N camera parameters. */
+    template <int N>
+    BlockSparseCholesky<double, N>& cholesky (void);
 
 private:
     Options opts;
+    BlockSparseCholesky<double, 6> cholesky_6;
+    BlockSparseCholesky<double, 9> cholesky_9;
 };
 
 /* ------------------------ Implementation ------------------------ */
@@ -99,6 +130,8 @@ inline
 LinearSolver::Options::Options (void)
     : trust_region_radius(1.0)
     , cg_max_iterations(1000)
+    , schur_solver(SCHUR_AUTO)
+    , cholesky_max_cameras(200)
 {
 }
 
@@ -116,6 +149,12 @@ LinearSolver::LinearSolver (Options const& options)
 {
 }
 
+inline void
+LinearSolver::set_options (Options const& options)
+{
+    this->opts = options;
+}
+
 SFM_BA_NAMESPACE_END
 SFM_NAMESPACE_END
 
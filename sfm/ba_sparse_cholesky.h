@@ -0,0 +1,508 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_BA_SPARSE_CHOLESKY_HEADER
+#define SFM_BA_SPARSE_CHOLESKY_HEADER
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "sfm/ba_block_sparse_matrix.h"
+#include "sfm/ba_dense_vector.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+SFM_BA_NAMESPACE_BEGIN
+
+/**
+ * Supernodal sparse Cholesky factorization P A P^T = L L^T of a symmetric,
+ * positive definite block sparse matrix with NxN blocks, e.g. the reduced
+ * camera matrix of bundle adjustment.
+ *
+ * The analysis computes a minimum degree ordering of the block graph, the
+ * block structure of L and its supernodes, i.e. consecutive block columns
+ * of L with the same structure below the diagonal, which are stored as
+ * dense panels. The analysis only depends on the block structure of A and
+ * is reused for all matrices with the same structure. The numeric
+ * factorization is right-looking and updates the panels of the ancestors
+ * with dense block kernels.
+ */
+template <typename T, int N>
+class BlockSparseCholesky
+{
+public:
+    typedef BlockSparseMatrix<T, N, N> Matrix;
+
+public:
+    BlockSparseCholesky (void) = default;
+
+    /** Computes ordering and structure of L for the structure of A. */
+    void analyze (Matrix const& A);
+
+    /** Returns true if the analysis is valid for the structure of A. */
+    bool is_analyzed_for (Matrix const& A) const;
+
+    /**
+     * Computes the numeric factorization of A, which must have the
+     * analyzed structure. Returns false if A is not positive definite.
+     */
+    bool factorize (Matrix const& A);
+
+    /** Solves A x = b using the factorization. */
+    DenseVector<T> solve (DenseVector<T> const& b) const;
+
+    std::size_t num_supernodes (void) const;
+    std::size_t num_factor_blocks (void) const;
+
+private:
+    void minimum_degree (Matrix const& A,
+        std::vector<std::vector<std::size_t>>* columns);
+    std::size_t find_row (std::size_t supernode, std::size_t row) const;
+    T* panel (std::size_t supernode);
+    T const* panel (std::size_t supernode) const;
+
+private:
+    /* Structure of the analyzed matrix. */
+    std::vector<std::size_t> row_offsets;
+    std::vector<std::size_t> col_indices;
+
+    /* Permutation, 'perm' maps new to old and 'inv_perm' old to new. */
+    std::vector<std::size_t> perm;
+    std::vector<std::size_t> inv_perm;
+
+    /*
+     * Supernode s owns the block columns [sn_begin[s], sn_begin[s + 1]).
+     * Its sorted block rows are [sn_row_offsets[s], sn_row_offsets[s + 1])
+     * in sn_rows, starting with its own columns. The panel of s is a dense
+     * row-major (rows * N) x (cols * N) matrix at sn_value_offsets[s].
+     */
+    std::vector<std::size_t> sn_begin;
+    std::vector<std::size_t> sn_of_col;
+    std::vector<std::size_t> sn_row_offsets;
+    std::vector<std::size_t> sn_rows;
+    std::vector<std::size_t> sn_value_offsets;
+    std::vector<T> values;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+template <typename T, int N>
+void
+BlockSparseCholesky<T, N>::analyze (Matrix const& A)
+{
+    if (A.num_block_rows() != A.num_block_cols())
+        throw std::invalid_argument("Matrix must be square");
+
+    std::size_t const n = A.num_block_rows();
+    this->row_offsets.resize(n + 1);
+    this->col_indices.resize(A.num_blocks());
+    for (std::size_t i = 0; i <= n; ++i)
+        this->row_offsets[i] = i < n ? A.row_begin(i) : A.num_blocks();
+    for (std::size_t i = 0; i < A.num_blocks(); ++i)
+        this->col_indices[i] = A.block_col(i);
+
+    /* Ordering and the structure of the columns of L below the diagonal. */
+    std::vector<std::vector<std::size_t>> columns;
+    this->minimum_degree(A, &columns);
+
+    /*
+     * Fundamental supernodes: column j + 1 joins the supernode of column j
+     * if it is the parent of j and the structure of j without j + 1 is the
+     * structure of j + 1.
+     */
+    this->sn_begin.assign(1, 0);
+    this->sn_of_col.resize(n);
+    for (std::size_t j = 0; j < n; ++j)
+    {
+        bool const merge = j > 0 && !columns[j - 1].empty()
+            && columns[j - 1].front() == j
+            && columns[j - 1].size() == columns[j].size() + 1;
+        if (j > 0 && !merge)
+            this->sn_begin.push_back(j);
+        this->sn_of_col[j] = this->sn_begin.size() - 1;
+    }
+    if (n > 0)
+        this->sn_begin.push_back(n);
+
+    std::size_t const num_supernodes = this->sn_begin.size() - 1;
+    this->sn_row_offsets.assign(1, 0);
+    this->sn_rows.clear();
+    this->sn_value_offsets.assign(1, 0);
+    for (std::size_t s = 0; s < num_supernodes; ++s)
+    {
+        std::size_t const first = this->sn_begin[s];
+        std::size_t const last = this->sn_begin[s + 1];
+        for (std::size_t j = first; j < last; ++j)
+            this->sn_rows.push_back(j);
+        std::vector<std::size_t> const& below = columns[last - 1];
+        this->sn_rows.insert(this->sn_rows.end(), below.begin(), below.end());
+        this->sn_row_offsets.push_back(this->sn_rows.size());
+
+        std::size_t const num_rows = this->sn_row_offsets[s + 1]
+            - this->sn_row_offsets[s];
+        this->sn_value_offsets.push_back(this->sn_value_offsets.back()
+            + num_rows * (last - first) * N * N);
+    }
+    this->values.clear();
+    this->values.resize(this->sn_value_offsets.back(), T(0));
+}
+
+template <typename T, int N>
+void
+BlockSparseCholesky<T, N>::minimum_degree (Matrix const& A,
+    std::vector<std::vector<std::size_t>>* columns)
+{
+    /*
+     * Minimum degree on the elimination graph: The node of smallest degree
+     * is eliminated and its neighbors become a clique. The neighbors at
+     * elimination time are the rows of the corresponding column of L.
+     */
+    std::size_t const n = A.num_block_rows();
+    std::vector<std::vector<std::size_t>> graph(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = A.row_begin(i); j < A.row_end(i); ++j)
+            if (A.block_col(j) != i)
+            {
+                graph[i].push_back(A.block_col(j));
+                graph[A.block_col(j)].push_back(i);
+            }
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        std::sort(graph[i].begin(), graph[i].end());
+        graph[i].erase(std::unique(graph[i].begin(), graph[i].end()),
+            graph[i].end());
+    }
+
+    this->perm.clear();
+    this->inv_perm.assign(n, 0);
+    std::vector<char> eliminated(n, 0);
+    std::vector<std::vector<std::size_t>> old_columns(n);
+    std::vector<std::size_t> merged;
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        std::size_t node = n;
+        for (std::size_t i = 0; i < n; ++i)
+            if (!eliminated[i]
+                && (node == n || graph[i].size() < graph[node].size()))
+                node = i;
+
+        eliminated[node] = 1;
+        this->inv_perm[node] = k;
+        this->perm.push_back(node);
+        std::vector<std::size_t>& clique = graph[node];
+        for (std::size_t i = 0; i < clique.size(); ++i)
+        {
+            std::vector<std::size_t>& adj = graph[clique[i]];
+            merged.clear();
+            std::set_union(adj.begin(), adj.end(),
+                clique.begin(), clique.end(), std::back_inserter(merged));
+            adj.clear();
+            for (std::size_t j = 0; j < merged.size(); ++j)
+                if (merged[j] != node && merged[j] != clique[i])
+                    adj.push_back(merged[j]);
+        }
+        old_columns[k].swap(clique);
+    }
+
+    /* Convert the columns of L to the new order. */
+    columns->resize(n);
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        std::vector<std::size_t>& column = columns->at(k);
+        column.clear();
+        for (std::size_t i = 0; i < old_columns[k].size(); ++i)
+            column.push_back(this->inv_perm[old_columns[k][i]]);
+        std::sort(column.begin(), column.end());
+    }
+}
+
+template <typename T, int N>
+bool
+BlockSparseCholesky<T, N>::is_analyzed_for (Matrix const& A) const
+{
+    if (this->perm.empty() && A.num_block_rows() > 0)
+        return false;
+    if (A.num_block_rows() + 1 != this->row_offsets.size()
+        || A.num_blocks() != this->col_indices.size())
+        return false;
+    for (std::size_t i = 0; i < A.num_block_rows(); ++i)
+        if (A.row_begin(i) != this->row_offsets[i])
+            return false;
+    for (std::size_t i = 0; i < A.num_blocks(); ++i)
+        if (A.block_col(i) != this->col_indices[i])
+            return false;
+    return true;
+}
+
+template <typename T, int N>
+bool
+BlockSparseCholesky<T, N>::factorize (Matrix const& A)
+{
+    if (!this->is_analyzed_for(A))
+        throw std::invalid_argument("Matrix structure not analyzed");
+
+    std::size_t const num_supernodes = this->num_supernodes();
+    std::fill(this->values.begin(), this->values.end(), T(0));
+
+    /* Scatter the lower blocks of P A P^T into the panels. */
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t s = 0; s < num_supernodes; ++s)
+    {
+        std::size_t const first = this->sn_begin[s];
+        std::size_t const width = (this->sn_begin[s + 1] - first) * N;
+        T* panel = this->panel(s);
+        for (std::size_t col = first; col < this->sn_begin[s + 1]; ++col)
+        {
+            std::size_t const old_col = this->perm[col];
+            for (std::size_t k = A.row_begin(old_col);
+                k < A.row_end(old_col); ++k)
+            {
+                std::size_t const row = this->inv_perm[A.block_col(k)];
+                if (row < col)
+                    continue;
+
+                /* Block (row, col) is the transpose of block (col, row). */
+                T const* block = A.block(k);
+                T* dest = panel + this->find_row(s, row) * N * width
+                    + (col - first) * N;
+                for (int r = 0; r < N; ++r)
+                    for (int c = 0; c < N; ++c)
+                        dest[r * width + c] = block[c * N + r];
+            }
+        }
+    }
+
+    bool success = true;
+    for (std::size_t s = 0; s < num_supernodes && success; ++s)
+    {
+        std::size_t const first = this->sn_begin[s];
+        std::size_t const width = (this->sn_begin[s + 1] - first) * N;
+        std::size_t const rows_begin = this->sn_row_offsets[s];
+        std::size_t const num_rows
+            = (this->sn_row_offsets[s + 1] - rows_begin) * N;
+        T* panel = this->panel(s);
+
+        /* Dense Cholesky of the diagonal part L_D. */
+        for (std::size_t c = 0; c < width && success; ++c)
+        {
+            T* row_c = panel + c * width;
+            T diag = row_c[c];
+            for (std::size_t k = 0; k < c; ++k)
+                diag -= row_c[k] * row_c[k];
+            if (!(diag > T(0)) || !std::isfinite(diag))
+            {
+                success = false;
+                break;
+            }
+            diag = std::sqrt(diag);
+            row_c[c] = diag;
+            for (std::size_t r = c + 1; r < width; ++r)
+            {
+                T* row_r = panel + r * width;
+                T sum = row_r[c];
+                for (std::size_t k = 0; k < c; ++k)
+                    sum -= row_r[k] * row_c[k];
+                row_r[c] = sum / diag;
+            }
+        }
+        if (!success)
+            break;
+
+        /* Rows below the diagonal part: L_B = A_B L_D^-T. */
+#pragma omp parallel for schedule(static)
+        for (std::size_t r = width; r < num_rows; ++r)
+        {
+            T* row_r = panel + r * width;
+            for (std::size_t c = 0; c < width; ++c)
+            {
+                T const* row_c = panel + c * width;
+                T sum = row_r[c];
+                for (std::size_t k = 0; k < c; ++k)
+                    sum -= row_r[k] * row_c[k];
+                row_r[c] = sum / row_c[c];
+            }
+        }
+
+        /*
+         * Update the ancestors with L_B L_B^T. The update of block column
+         * j only touches block column sn_rows[j] of the target supernode.
+         */
+        std::size_t const num_cols = width / N;
+        std::size_t const num_block_rows = num_rows / N;
+#pragma omp parallel for schedule(dynamic)
+        for (std::size_t j = num_cols; j < num_block_rows; ++j)
+        {
+            std::size_t const col = this->sn_rows[rows_begin + j];
+            std::size_t const target = this->sn_of_col[col];
+            std::size_t const target_first = this->sn_begin[target];
+            std::size_t const target_width
+                = (this->sn_begin[target + 1] - target_first) * N;
+            T* target_panel = this->panel(target);
+            T const* L_j = panel + j * N * width;
+
+            /* Rows of s below j are a subset of the target rows. */
+            std::size_t pos = this->find_row(target, col);
+            for (std::size_t i = j; i < num_block_rows; ++i)
+            {
+                std::size_t const row = this->sn_rows[rows_begin + i];
+                while (this->sn_rows[this->sn_row_offsets[target] + pos]
+                    != row)
+                    pos += 1;
+
+                T const* L_i = panel + i * N * width;
+                T* dest = target_panel + pos * N * target_width
+                    + (col - target_first) * N;
+                for (int r = 0; r < N; ++r)
+                    for (int c = 0; c < N; ++c)
+                    {
+                        T const* a = L_i + r * width;
+                        T const* b = L_j + c * width;
+                        T dot = T(0);
+                        for (std::size_t k = 0; k < width; ++k)
+                            dot += a[k] * b[k];
+                        dest[r * target_width + c] -= dot;
+                    }
+            }
+        }
+    }
+
+    if (!success)
+        std::fill(this->values.begin(), this->values.end(), T(0));
+    return success;
+}
+
+template <typename T, int N>
+DenseVector<T>
+BlockSparseCholesky<T, N>::solve (DenseVector<T> const& b) const
+{
+    std::size_t const n = this->perm.size();
+    if (b.size() != n * N)
+        throw std::invalid_argument("Incompatible dimensions");
+
+    DenseVector<T> y(n * N);
+    for (std::size_t i = 0; i < n; ++i)
+        for (int j = 0; j < N; ++j)
+            y[i * N + j] = b[this->perm[i] * N + j];
+
+    /* Forward substitution L z = P b. */
+    std::size_t const num_supernodes = this->num_supernodes();
+    for (std::size_t s = 0; s < num_supernodes; ++s)
+    {
+        std::size_t const offset = this->sn_begin[s] * N;
+        std::size_t const width = (this->sn_begin[s + 1]
+            - this->sn_begin[s]) * N;
+        std::size_t const rows_begin = this->sn_row_offsets[s];
+        std::size_t const num_block_rows
+            = this->sn_row_offsets[s + 1] - rows_begin;
+        T const* panel = this->panel(s);
+
+        T* z = y.data() + offset;
+        for (std::size_t r = 0; r < width; ++r)
+        {
+            T const* row_r = panel + r * width;
+            T sum = z[r];
+            for (std::size_t k = 0; k < r; ++k)
+                sum -= row_r[k] * z[k];
+            z[r] = sum / row_r[r];
+        }
+        for (std::size_t i = width / N; i < num_block_rows; ++i)
+        {
+            T* dest = y.data() + this->sn_rows[rows_begin + i] * N;
+            for (int r = 0; r < N; ++r)
+            {
+                T const* row_r = panel + (i * N + r) * width;
+                T dot = T(0);
+                for (std::size_t k = 0; k < width; ++k)
+                    dot += row_r[k] * z[k];
+                dest[r] -= dot;
+            }
+        }
+    }
+
+    /* Backward substitution L^T x = z. */
+    for (std::size_t s = num_supernodes; s-- > 0; )
+    {
+        std::size_t const offset = this->sn_begin[s] * N;
+        std::size_t const width = (this->sn_begin[s + 1]
+            - this->sn_begin[s]) * N;
+        std::size_t const rows_begin = this->sn_row_offsets[s];
+        std::size_t const num_block_rows
+            = this->sn_row_offsets[s + 1] - rows_begin;
+        T const* panel = this->panel(s);
+
+        T* x = y.data() + offset;
+        for (std::size_t i = width / N; i < num_block_rows; ++i)
+        {
+            T const* src = y.data() + this->sn_rows[rows_begin + i] * N;
+            for (int r = 0; r < N; ++r)
+            {
+                T const* row_r = panel + (i * N + r) * width;
+                for (std::size_t k = 0; k < width; ++k)
+                    x[k] -= row_r[k] * src[r];
+            }
+        }
+        for (std::size_t r = width; r-- > 0; )
+        {
+            T sum = x[r];
+            for (std::size_t k = r + 1; k < width; ++k)
+                sum -= panel[k * width + r] * x[k];
+            x[r] = sum / panel[r * width + r];
+        }
+    }
+
+    DenseVector<T> ret(n * N);
+    for (std::size_t i = 0; i < n; ++i)
+        for (int j = 0; j < N; ++j)
+            ret[this->perm[i] * N + j] = y[i * N + j];
+    return ret;
+}
+
+template <typename T, int N>
+inline std::size_t
+BlockSparseCholesky<T, N>::num_supernodes (void) const
+{
+    return this->sn_begin.empty() ? 0 : this->sn_begin.size() - 1;
+}
+
+template <typename T, int N>
+inline std::size_t
+BlockSparseCholesky<T, N>::num_factor_blocks (void) const
+{
+    return this->values.size() / (N * N);
+}
+
+template <typename T, int N>
+inline std::size_t
+BlockSparseCholesky<T, N>::find_row (std::size_t supernode,
+    std::size_t row) const
+{
+    std::size_t const* begin = this->sn_rows.data()
+        + this->sn_row_offsets[supernode];
+    std::size_t const* end = this->sn_rows.data()
+        + this->sn_row_offsets[supernode + 1];
+    return std::lower_bound(begin, end, row) - begin;
+}
+
+template <typename T, int N>
+inline T*
+BlockSparseCholesky<T, N>::panel (std::size_t supernode)
+{
+    return this->values.data() + this->sn_value_offsets[supernode];
+}
+
+template <typename T, int N>
+inline T const*
+BlockSparseCholesky<T, N>::panel (std::size_t supernode) const
+{
+    return this->values.data() + this->sn_value_offsets[supernode];
+}
+
+SFM_BA_NAMESPACE_END
+SFM_NAMESPACE_END
+
+#endif /* SFM_BA_SPARSE_CHOLESKY_HEADER */
@@ -13,7 +13,7 @@
 
 #include "math/matrix_tools.h"
 #include "util/timer.h"
-#include "sfm/ba_sparse_matrix.h"
+#include "sfm/ba_block_sparse_matrix.h"
 #include "sfm/ba_dense_vector.h"
 #include "sfm/bundle_adjustment.h"
 
@@ -35,6 +35,14 @@ BundleAdjustment::optimize (void)
     util::WallTimer timer;
     this->sanity_checks();
     this->status = Status();
+
+    /* Constant cameras are not part of the parameter vector. */
+    this->camera_blocks.resize(this->cameras->size());
+    this->num_camera_blocks = 0;
+    for (std::size_t i = 0; i < this->cameras->size(); ++i)
+        this->camera_blocks[i] = this->cameras->at(i).is_constant
+            ? -1 : this->num_camera_blocks++;
+
     this->lm_optimize();
     this->status.runtime_ms = timer.get_elapsed();
     return this->status;
@@ -76,6 +84,8 @@ BundleAdjustment::lm_optimize (void)
     LinearSolver::Options pcg_opts;
     pcg_opts = this->opts.linear_opts;
     pcg_opts.trust_region_radius = TRUST_REGION_RADIUS_INIT;//1000
+    /* The solver keeps the sparse Cholesky analysis between iterations. */
+    LinearSolver pcg(pcg_opts);
 
     /* Compute reprojection error for the first time. */
     DenseVectorType F, F_new;
@@ -94,31 +104,13 @@ BundleAdjustment::lm_optimize (void)
             break;
         }
 
-        /* Compute Jacobian. */ // todo 计算雅各比矩阵
-        SparseMatrixType Jc, Jp;
-        switch (this->opts.bundle_mode)
-        {
-            /*同时优化相机和三维点*/
-            case BA_CAMERAS_AND_POINTS:
-                this->analytic_jacobian(&Jc, &Jp);
-                break;
-            /*固定三维点，只优化相机参数*/
-            case BA_CAMERAS:
-                this->analytic_jacobian(&Jc, nullptr);
-                break;
-            /*固定相机优化三维点的坐标*/
-            case BA_POINTS:
-                this->analytic_jacobian(nullptr, &Jp);
-                break;
-            default:
-                throw std::runtime_error("Invalid bundle mode");
-        }
-
-        /* Perform linear step. */
+        /* Compute Jacobian and perform linear step. */ // todo 计算雅各比矩阵
         // 预置共轭梯梯度法进行求解*/
         DenseVectorType delta_x;
-        LinearSolver pcg(pcg_opts);
-        LinearSolver::Status cg_status = pcg.solve(Jc, Jp, F, &delta_x);
+        pcg.set_options(pcg_opts);
+        LinearSolver::Status cg_status = this->num_cam_params == 6
+            ? this->linear_step<6>(pcg, F, &delta_x)
+            : this->linear_step<9>(pcg, F, &delta_x);
 
         /* Update reprojection errors and MSE after linear step. */
         double new_mse, delta_mse, delta_mse_ratio = 1.0;
@@ -240,17 +232,21 @@ BundleAdjustment::compute_reprojection_errors (DenseVectorType* vector_f,
         // 如果delta_x 不为空，则先利用delta_x对相机和结构进行更新，然后再计算重投影误差
         if (delta_x != nullptr)
         {
-            std::size_t cam_id = obs.camera_id * this->num_cam_params;
+            int const cam_block = this->camera_blocks[obs.camera_id];
             std::size_t pt_id = obs.point_id * 3;
 
             if (this->opts.bundle_mode & BA_CAMERAS)
             {
-                this->update_camera(cam, delta_x->data() + cam_id, &new_camera);
-                flen = &new_camera.focal_length;
-                dist = new_camera.distortion;
-                rot = new_camera.rotation;
-                trans = new_camera.translation;
-                pt_id += this->cameras->size() * this->num_cam_params;
+                if (cam_block >= 0)
+                {
+                    this->update_camera(cam, delta_x->data()
+                        + cam_block * this->num_cam_params, &new_camera);
+                    flen = &new_camera.focal_length;
+                    dist = new_camera.distortion;
+                    rot = new_camera.rotation;
+                    trans = new_camera.translation;
+                }
+                pt_id += this->num_camera_blocks * this->num_cam_params;
             }
 
             if (this->opts.bundle_mode & BA_POINTS)
@@ -319,37 +315,80 @@ BundleAdjustment::rodrigues_to_matrix (double const* r, double* m)
     m[8] = 1.0 - (r[0] * r[0] + r[1] * r[1]) * ct;
 }
 
+template <int N>
+LinearSolver::Status
+BundleAdjustment::linear_step (LinearSolver& solver,
+    DenseVectorType const& vector_f, DenseVectorType* delta_x)
+{
+    BlockSparseMatrix<double, 2, N> Jc;
+    LinearSolver::PointJacobian Jp;
+    switch (this->opts.bundle_mode)
+    {
+        /*同时优化相机和三维点*/
+        case BA_CAMERAS_AND_POINTS:
+            this->analytic_jacobian(&Jc, &Jp);
+            break;
+        /*固定三维点，只优化相机参数*/
+        case BA_CAMERAS:
+            this->analytic_jacobian(&Jc, nullptr);
+            break;
+        /*固定相机优化三维点的坐标*/
+        case BA_POINTS:
+            this->analytic_jacobian<N>(nullptr, &Jp);
+            break;
+        default:
+            throw std::runtime_error("Invalid bundle mode");
+    }
+
+    return solver.solve(Jc, Jp, vector_f, delta_x);
+}
+
+template <int N>
 void
-BundleAdjustment::analytic_jacobian (SparseMatrixType* jac_cam,
-    SparseMatrixType* jac_points)
+BundleAdjustment::analytic_jacobian (BlockSparseMatrix<double, 2, N>* jac_cam,
+    LinearSolver::PointJacobian* jac_points)
 {
-    // 相机和三维点jacobian矩阵的行数都是n_observations*2
-    // 相机jacobian矩阵jac_cam的列数是n_cameras* n_cam_params
-    // 三维点jacobian矩阵jac_points的列数是n_points*3
-    std::size_t const camera_cols = this->cameras->size() * this->num_cam_params;
-    std::size_t const point_cols = this->points->size() * 3;
-    std::size_t const jacobi_rows = this->observations->size() * 2;
-
-    // 定义稀疏矩阵的基本元素
-    SparseMatrixType::Triplets cam_triplets, point_triplets;
-    // 对相机进行优化
+    // 相机和三维点jacobian矩阵的行数都是n_observations*2, 每个观察点对应
+    // 一个块行: jac_cam中一个2xN的相机块, jac_points中一个2x3的三维点块
+    // 相机jacobian矩阵jac_cam的块列数是非固定相机的个数, 固定相机的观察点
+    // 在jac_cam中没有块
+    // 三维点jacobian矩阵jac_points的块列数是n_points
+    std::size_t const num_observations = this->observations->size();
+    std::vector<std::size_t> row_offsets(num_observations + 1);
+    std::vector<std::size_t> cam_cols, point_cols;
+
     if (jac_cam != nullptr)
-        cam_triplets.reserve(this->observations->size() * 2 * this->num_cam_params);
-    // 对三维点进行优化
+    {
+        row_offsets[0] = 0;
+        for (std::size_t i = 0; i < num_observations; ++i)
+        {
+            int const cam_block
+                = this->camera_blocks[this->observations->at(i).camera_id];
+            if (cam_block >= 0)
+                cam_cols.push_back(cam_block);
+            row_offsets[i + 1] = cam_cols.size();
+        }
+        jac_cam->set_structure(this->num_camera_blocks, row_offsets, cam_cols);
+    }
     if (jac_points != nullptr)
-        point_triplets.reserve(this->observations->size() * 3 * 2);
-
-    /*jac_cam的尺寸大小是 n_observations  x 2*n_cam_params--每一个观察点对应一个相机
-     *jac_points的尺寸是 n_observations   x  2*3 --每一个观察点对应一个三维点
-     */
+    {
+        point_cols.resize(num_observations);
+        for (std::size_t i = 0; i <= num_observations; ++i)
+            row_offsets[i] = i;
+        for (std::size_t i = 0; i < num_observations; ++i)
+            point_cols[i] = this->observations->at(i).point_id;
+        jac_points->set_structure(this->points->size(),
+            row_offsets, point_cols);
+    }
 
+    /* Every observation writes its own blocks, no synchronization. */
 #pragma omp parallel
     {
         double cam_x_ptr[9], cam_y_ptr[9], point_x_ptr[3], point_y_ptr[3];
 #pragma omp for
 
         // 对于每一个观察到的二维点
-        for (std::size_t i = 0; i < this->observations->size(); ++i) {
+        for (std::size_t i = 0; i < num_observations; ++i) {
 
             // 获取二维点，obs.point_id 三维点的索引，obs.camera_id 相机的索引
             Observation const& obs = this->observations->at(i);
@@ -368,40 +407,18 @@ BundleAdjustment::analytic_jacobian (SparseMatrixType* jac_cam,
                 std::fill(point_y_ptr, point_y_ptr + 3, 0.0);
             }
 
-            /*观察点对应雅各比矩阵的行，第i个观察点在雅各比矩阵的位置是2*i, 2*i+1*/
-            std::size_t row_x = i * 2, row_y = row_x + 1;
-
-            /*jac_cam中相机对应的列数为camera_id* n_cam_params*/
-            std::size_t cam_col = obs.camera_id * this->num_cam_params;
-
-            /*jac_points中三维点对应的列数为point_id* 3*/
-            std::size_t point_col = obs.point_id * 3;
-
-            for (int j = 0; jac_cam != nullptr && j < this->num_cam_params; ++j) {
-                cam_triplets.push_back(SparseMatrixType::Triplet(row_x, cam_col + j, cam_x_ptr[j]));
-                cam_triplets.push_back(SparseMatrixType::Triplet(row_y, cam_col + j, cam_y_ptr[j]));
+            /*第i个观察点对应雅各比矩阵的第i个块, 块的第一行是x, 第二行是y*/
+            if (jac_cam != nullptr
+                && jac_cam->row_begin(i) != jac_cam->row_end(i)) {
+                double* block = jac_cam->block(jac_cam->row_begin(i));
+                std::copy(cam_x_ptr, cam_x_ptr + N, block);
+                std::copy(cam_y_ptr, cam_y_ptr + N, block + N);
             }
 
-            for (int j = 0; jac_points != nullptr && j < 3; ++j) {
-                point_triplets.push_back(SparseMatrixType::Triplet(row_x, point_col + j, point_x_ptr[j]));
-                point_triplets.push_back(SparseMatrixType::Triplet(row_y, point_col + j, point_y_ptr[j]));
-            }
-        }
-
-#pragma omp sections
-        {
-#pragma omp section
-            if (jac_cam != nullptr)
-            {
-                jac_cam->allocate(jacobi_rows, camera_cols);
-                jac_cam->set_from_triplets(cam_triplets);
-            }
-
-#pragma omp section
-            if (jac_points != nullptr)
-            {
-                jac_points->allocate(jacobi_rows, point_cols);
-                jac_points->set_from_triplets(point_triplets);
+            if (jac_points != nullptr) {
+                double* block = jac_points->block(i);
+                std::copy(point_x_ptr, point_x_ptr + 3, block);
+                std::copy(point_y_ptr, point_y_ptr + 3, block + 3);
             }
         }
     }
@@ -677,10 +694,11 @@ BundleAdjustment::update_parameters (DenseVectorType const& delta_x)
     if (this->opts.bundle_mode & BA_CAMERAS)
     {
         for (std::size_t i = 0; i < this->cameras->size(); ++i)
-            this->update_camera(this->cameras->at(i),
-                delta_x.data() + this->num_cam_params * i,
-                &this->cameras->at(i));
-        total_camera_params = this->cameras->size() * this->num_cam_params;
+            if (this->camera_blocks[i] >= 0)
+                this->update_camera(this->cameras->at(i), delta_x.data()
+                    + this->num_cam_params * this->camera_blocks[i],
+                    &this->cameras->at(i));
+        total_camera_params = this->num_camera_blocks * this->num_cam_params;
     }
 
     /* Update points. */
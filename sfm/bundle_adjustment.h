@@ -14,7 +14,7 @@
 
 #include "util/logging.h"
 #include "sfm/defines.h"
-#include "sfm/ba_sparse_matrix.h"
+#include "sfm/ba_block_sparse_matrix.h"
 #include "sfm/ba_dense_vector.h"
 #include "sfm/ba_linear_solver.h"
 #include "sfm/ba_types.h"
@@ -30,11 +30,8 @@
  *
  * Actual TODOs.
  *
- * - Better preconditioner for conjugate gradient, i.e., use the 9x9 diagonal
- *   blocks of S instead of B. Requires method in matrix.
  * - Properly implement and test BA_POINTS mode.
  * - More accurate implementations for the Jacobian (currently approximated).
- * - Implement block_size = 9 in linear solver, no need for CG
  */
 
 SFM_NAMESPACE_BEGIN
@@ -98,7 +95,6 @@ public:
     void print_status (bool detailed = false) const;
 
 private:
-    typedef SparseMatrix<double> SparseMatrixType;
     typedef DenseVector<double> DenseVectorType;
 
 private:
@@ -114,9 +110,15 @@ private:
     void rodrigues_to_matrix (double const* r, double* rot);
 
 
+    /* Jacobian and linear step for N camera parameters. */
+    template <int N>
+    LinearSolver::Status linear_step (LinearSolver& solver,
+        DenseVectorType const& vector_f, DenseVectorType* delta_x);
+
     /* Analytic Jacobian. */
-    void analytic_jacobian (SparseMatrixType* jac_cam,
-                            SparseMatrixType* jac_points);
+    template <int N>
+    void analytic_jacobian (BlockSparseMatrix<double, 2, N>* jac_cam,
+        LinearSolver::PointJacobian* jac_points);
     void analytic_jacobian_entries (Camera const& cam, Point3D const& point,
         double* cam_x_ptr, double* cam_y_ptr,
         double* point_x_ptr, double* point_y_ptr);
@@ -135,6 +137,9 @@ private:
     std::vector<Point3D>* points;
     std::vector<Observation>* observations;
     int const num_cam_params;
+    /* Parameter block of every camera, -1 for constant cameras. */
+    std::vector<int> camera_blocks;
+    std::size_t num_camera_blocks;
 };
 
 /* ------------------------ Implementation ------------------------ */
@@ -171,8 +176,8 @@ BundleAdjustment::BundleAdjustment (Options const& options)
     , points(nullptr)
     , observations(nullptr)
     , num_cam_params(options.fixed_intrinsics ? 6 : 9)
+    , num_camera_blocks(0)
 {
-    this->opts.linear_opts.camera_block_dim = this->num_cam_params;
 }
 
 inline void
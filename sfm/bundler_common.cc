@@ -32,22 +32,81 @@ SFM_BUNDLER_NAMESPACE_BEGIN
 /* --------------- Data Structure for Feature Tracks -------------- */
 
 void
-Track::invalidate (void)
+TrackList::clear (void)
 {
-    std::fill(this->pos.begin(), this->pos.end(),
-        std::numeric_limits<float>::quiet_NaN());
+    this->positions.clear();
+    this->colors.clear();
+    this->valid.clear();
+    this->offsets.assign(1, 0);
+    this->num_features.clear();
+    this->references.clear();
 }
 
 void
-Track::remove_view (int view_id)
+TrackList::reserve (std::size_t num_tracks, std::size_t num_references)
 {
-    for (FeatureReferenceList::iterator iter = this->features.begin();
-        iter != this->features.end();)
+    this->positions.reserve(num_tracks);
+    this->colors.reserve(num_tracks);
+    this->valid.reserve(num_tracks);
+    this->offsets.reserve(num_tracks + 1);
+    this->num_features.reserve(num_tracks);
+    this->references.reserve(num_references);
+}
+
+int
+TrackList::append (FeatureReference const* begin, FeatureReference const* end)
+{
+    int const track_id = static_cast<int>(this->positions.size());
+    this->positions.push_back(math::Vec3f(0.0f));
+    this->colors.push_back(math::Vec3uc(static_cast<unsigned char>(0)));
+    this->valid.push_back(0);
+    this->num_features.push_back(static_cast<uint32_t>(end - begin));
+    this->references.insert(this->references.end(), begin, end);
+    this->offsets.push_back(this->references.size());
+    return track_id;
+}
+
+void
+TrackList::remove_view (std::size_t track_id, int view_id)
+{
+    /* Compact the remaining references within the range of the track. */
+    FeatureReference* refs = this->references.data()
+        + this->offsets[track_id];
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < this->num_features[track_id]; ++i)
+        if (refs[i].view_id != view_id)
+            refs[num_kept++] = refs[i];
+    this->num_features[track_id] = num_kept;
+}
+
+void
+TrackList::compute_view_index (std::size_t num_views,
+    std::vector<std::size_t>* offsets,
+    std::vector<TrackObservation>* observations) const
+{
+    /* Count observations per view, then fill in order of track ID. */
+    offsets->assign(num_views + 1, 0);
+    for (std::size_t i = 0; i < this->size(); ++i)
+    {
+        Features const refs = this->features(i);
+        for (std::size_t j = 0; j < refs.size(); ++j)
+            offsets->at(refs[j].view_id + 1) += 1;
+    }
+    for (std::size_t i = 0; i < num_views; ++i)
+        offsets->at(i + 1) += offsets->at(i);
+
+    observations->resize(offsets->back());
+    std::vector<std::size_t> positions(offsets->begin(), offsets->end() - 1);
+    for (std::size_t i = 0; i < this->size(); ++i)
     {
-        if (iter->view_id == view_id)
-            iter = this->features.erase(iter);
-        else
-            iter++;
+        Features const refs = this->features(i);
+        for (std::size_t j = 0; j < refs.size(); ++j)
+        {
+            TrackObservation& obs = observations->at(
+                positions[refs[j].view_id]++);
+            obs.track_id = static_cast<int>(i);
+            obs.feature_id = refs[j].feature_id;
+        }
     }
 }
 
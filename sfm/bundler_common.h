@@ -10,6 +10,8 @@
 #ifndef SFM_BUNDLER_COMMON_HEADER
 #define SFM_BUNDLER_COMMON_HEADER
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -73,20 +75,84 @@ struct FeatureReference
 /** The list of all feature references inside a track. */
 typedef std::vector<FeatureReference> FeatureReferenceList;
 
-/** Representation of a feature track. */
-struct Track
+/** Observation of a track in a view, see TrackList::compute_view_index(). */
+struct TrackObservation
 {
-    bool is_valid (void) const;
-    void invalidate (void);
-    void remove_view (int view_id);
-
-    math::Vec3f pos;
-    math::Vec3uc color;
-    FeatureReferenceList features;
+    int track_id;
+    int feature_id;
 };
 
-/** The list of all tracks. */
-typedef std::vector<Track> TrackList;
+/**
+ * The list of all tracks in structure-of-arrays layout. Positions, colors
+ * and validity are stored in flat arrays indexed by track ID, the feature
+ * references of all tracks are stored in a single CSR buffer. Track i owns
+ * the references starting at offsets[i], of which the first num_features
+ * are in use; removing features from a track does not move other tracks.
+ * A track is valid once it has a 3D position.
+ */
+class TrackList
+{
+public:
+    /** Read-only view of the feature references of a track. */
+    class Features
+    {
+    public:
+        Features (FeatureReference const* data, std::size_t size);
+        FeatureReference const* begin (void) const;
+        FeatureReference const* end (void) const;
+        std::size_t size (void) const;
+        bool empty (void) const;
+        FeatureReference const& operator[] (std::size_t index) const;
+
+    private:
+        FeatureReference const* data;
+        std::size_t num;
+    };
+
+public:
+    TrackList (void);
+
+    std::size_t size (void) const;
+    bool empty (void) const;
+    void clear (void);
+    void reserve (std::size_t num_tracks, std::size_t num_references);
+
+    /**
+     * Appends an invalid track with the given features and black color.
+     * Returns the ID of the new track. Invalidates feature views.
+     */
+    int append (FeatureReference const* begin, FeatureReference const* end);
+
+    /** Returns the feature references of a track. */
+    Features features (std::size_t track_id) const;
+    /** Removes all features in the given view from a track. */
+    void remove_view (std::size_t track_id, int view_id);
+
+    math::Vec3f const& position (std::size_t track_id) const;
+    /** Sets the 3D position, which makes the track valid. */
+    void set_position (std::size_t track_id, math::Vec3f const& pos);
+    math::Vec3uc const& color (std::size_t track_id) const;
+    void set_color (std::size_t track_id, math::Vec3uc const& color);
+    bool is_valid (std::size_t track_id) const;
+    void invalidate (std::size_t track_id);
+
+    /**
+     * Computes the observations of all tracks per view in CSR layout. The
+     * observations of view i are [offsets[i], offsets[i + 1]), sorted by
+     * track ID.
+     */
+    void compute_view_index (std::size_t num_views,
+        std::vector<std::size_t>* offsets,
+        std::vector<TrackObservation>* observations) const;
+
+private:
+    std::vector<math::Vec3f> positions;
+    std::vector<math::Vec3uc> colors;
+    std::vector<uint8_t> valid;
+    std::vector<std::size_t> offsets;
+    std::vector<uint32_t> num_features;
+    FeatureReferenceList references;
+};
 
 /* Observation of a survey point in a specific view. */
 struct SurveyObservation
@@ -197,10 +263,104 @@ Viewport::Viewport (void)
     std::fill(this->radial_distortion, this->radial_distortion + 2, 0.0f);
 }
 
+inline
+TrackList::Features::Features (FeatureReference const* data,
+    std::size_t size)
+    : data(data)
+    , num(size)
+{
+}
+
+inline FeatureReference const*
+TrackList::Features::begin (void) const
+{
+    return this->data;
+}
+
+inline FeatureReference const*
+TrackList::Features::end (void) const
+{
+    return this->data + this->num;
+}
+
+inline std::size_t
+TrackList::Features::size (void) const
+{
+    return this->num;
+}
+
+inline bool
+TrackList::Features::empty (void) const
+{
+    return this->num == 0;
+}
+
+inline FeatureReference const&
+TrackList::Features::operator[] (std::size_t index) const
+{
+    return this->data[index];
+}
+
+inline
+TrackList::TrackList (void)
+    : offsets(1, 0)
+{
+}
+
+inline std::size_t
+TrackList::size (void) const
+{
+    return this->positions.size();
+}
+
+inline bool
+TrackList::empty (void) const
+{
+    return this->positions.empty();
+}
+
+inline TrackList::Features
+TrackList::features (std::size_t track_id) const
+{
+    return Features(this->references.data() + this->offsets[track_id],
+        this->num_features[track_id]);
+}
+
+inline math::Vec3f const&
+TrackList::position (std::size_t track_id) const
+{
+    return this->positions[track_id];
+}
+
+inline void
+TrackList::set_position (std::size_t track_id, math::Vec3f const& pos)
+{
+    this->positions[track_id] = pos;
+    this->valid[track_id] = 1;
+}
+
+inline math::Vec3uc const&
+TrackList::color (std::size_t track_id) const
+{
+    return this->colors[track_id];
+}
+
+inline void
+TrackList::set_color (std::size_t track_id, math::Vec3uc const& color)
+{
+    this->colors[track_id] = color;
+}
+
 inline bool
-Track::is_valid (void) const
+TrackList::is_valid (std::size_t track_id) const
+{
+    return this->valid[track_id] != 0;
+}
+
+inline void
+TrackList::invalidate (std::size_t track_id)
 {
-    return !std::isnan(this->pos[0]);
+    this->valid[track_id] = 0;
 }
 
 SFM_BUNDLER_NAMESPACE_END
@@ -7,6 +7,9 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <thread>
+
 #include "util/timer.h"
 #include "core/image.h"
 #include "core/image_exif.h"
@@ -37,9 +40,19 @@ Features::compute (core::Scene::Ptr scene, ViewportList* viewports)
     std::size_t num_done = 0;
     std::size_t total_features = 0;
 
-    /* Iterate the scene and compute features. */
+    /*
+     * Iterate the scene and compute features. Every thread holds at most one
+     * image at a time, thus the number of threads bounds the memory usage.
+     * Results are stored per view index, which makes the output independent
+     * of the scheduling.
+     */
+    std::size_t const num_threads = this->opts.num_threads > 0
+        ? static_cast<std::size_t>(this->opts.num_threads)
+        : std::max(1u, std::thread::hardware_concurrency());
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
     for (std::size_t i = 0; i < views.size(); ++i)
     {
+#pragma omp critical
         {
             num_done += 1;
             float percent = (num_done * 1000 / num_views) / 10.0f;
@@ -47,7 +60,6 @@ Features::compute (core::Scene::Ptr scene, ViewportList* viewports)
                 << num_views << " (" << percent << "%)..." << std::flush;
         }
 
-
         // 获取图像
         if (views[i] == nullptr)
             continue;
@@ -73,6 +85,7 @@ Features::compute (core::Scene::Ptr scene, ViewportList* viewports)
         // 对图像特征点的位置进行初始化
         viewport->features.normalize_feature_positions();
 
+#pragma omp critical
         {
             std::size_t const num_feats = viewport->features.positions.size();
             std::cout << "\rView ID "
@@ -36,6 +36,11 @@ public:
         std::string image_embedding;
         /** The maximum image size given in number of pixels. */
         int max_image_size;
+        /**
+         * The number of views processed concurrently. This also limits the
+         * number of images held in memory. Zero uses all available cores.
+         */
+        int num_threads;
         /** Feature set options. */
         FeatureSet::Options feature_options;
     };
@@ -43,7 +48,10 @@ public:
 public:
     explicit Features (Options const& options);
 
-    /** Computes features for all images in the scene. */
+    /**
+     * Computes features for all images in the scene. Views are processed
+     * in parallel, the result is identical to sequential processing.
+     */
     void compute (core::Scene::Ptr scene, ViewportList* viewports);
 
 private:
@@ -56,7 +64,10 @@ inline
 Features::Options::Options (void)
     : image_embedding("original")
     , max_image_size(std::numeric_limits<int>::max())
+    , num_threads(0)
 {
+    /* Only the matcher consumes the descriptors, keep them compact. */
+    this->feature_options.compact_descriptors = true;
 }
 
 inline
@@ -7,7 +7,9 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
 #include <limits>
+#include <thread>
 #include <iostream>
 #include <utility>
 #include <iostream>
@@ -46,10 +48,7 @@ Incremental::initialize (ViewportList* viewports, TrackList* tracks,
 
     /* Set track positions to invalid state. */
     for (std::size_t i = 0; i < tracks->size(); ++i)
-    {
-        Track& track = tracks->at(i);
-        track.invalidate();
-    }
+        tracks->invalidate(i);
 }
 
 /* ---------------------------------------------------------------- */
@@ -64,13 +63,13 @@ Incremental::find_next_views (std::vector<int>* next_views)
 
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
+        if (!this->tracks->is_valid(i))
             continue;
 
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        TrackList::Features const refs = this->tracks->features(i);
+        for (std::size_t j = 0; j < refs.size(); ++j)
         {
-            int const view_id = track.features[j].view_id;
+            int const view_id = refs[j].view_id;
             if (this->viewports->at(view_id).pose.is_valid())
                 continue;
             valid_tracks[view_id].first += 1;
@@ -93,107 +92,203 @@ Incremental::find_next_views (std::vector<int>* next_views)
 // 通过p3p重建新视角的相机姿态，并通过RANSAC去除错误的Tracks
 bool
 Incremental::reconstruct_next_view (int view_id)
+{
+    util::WallTimer timer;
+    Resection resection;
+    bool const success = this->resect_view(view_id,
+        this->opts.pose_p3p_opts, &resection);
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "Collected " << resection.num_correspondences
+            << " 2D-3D correspondences." << std::endl;
+    }
+
+    /* Cancel if inliers are below a 33% threshold. */
+    if (!success){
+        if (this->opts.verbose_output)
+            std::cout << "Only " << resection.num_inliers
+                << " 2D-3D correspondences inliers ("
+                << (100 * resection.num_inliers
+                / std::max<std::size_t>(1, resection.num_correspondences))
+                << "%). Skipping view." << std::endl;
+        return false;
+    }
+    else if (this->opts.verbose_output)
+    {
+        std::cout << "Selected " << resection.num_inliers
+            << " 2D-3D correspondences inliers ("
+            << (100 * resection.num_inliers / resection.num_correspondences)
+            << "%), took " << timer.get_elapsed() << "ms." << std::endl;
+    }
+
+    this->commit_view(view_id, resection);
+
+    if (this->survey_points != nullptr && !registered)
+        this->try_registration();
+
+    this->num_registrations += 1;
+    return true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::reconstruct_next_views (std::vector<int> const& view_ids,
+    std::vector<int>* reconstructed_ids)
+{
+    int const num_threads = this->opts.num_threads > 0
+        ? this->opts.num_threads
+        : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    /*
+     * The views are resected in parallel, every RANSAC runs single
+     * threaded. Resection only reads the tracks, which are not modified
+     * before all views are done.
+     */
+    RansacPoseP3P::Options ransac_opts = this->opts.pose_p3p_opts;
+    ransac_opts.num_threads = 1;
+    ransac_opts.verbose_output = false;
+
+    util::WallTimer timer;
+    std::vector<Resection> resections(view_ids.size());
+    std::vector<char> success(view_ids.size(), 0);
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+        success[i] = this->resect_view(view_ids[i], ransac_opts,
+            &resections[i]);
+
+    /*
+     * Commit all successful views. Every view only removes its own
+     * feature references from the tracks, so the order does not matter.
+     */
+    reconstructed_ids->clear();
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        if (this->opts.verbose_output)
+        {
+            std::cout << "View ID " << view_ids[i] << ": "
+                << resections[i].num_inliers << " of "
+                << resections[i].num_correspondences
+                << " 2D-3D correspondences inliers"
+                << (success[i] ? "." : ", skipping view.") << std::endl;
+        }
+        if (!success[i])
+            continue;
+
+        this->commit_view(view_ids[i], resections[i]);
+        reconstructed_ids->push_back(view_ids[i]);
+    }
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "Reconstructed " << reconstructed_ids->size()
+            << " of " << view_ids.size() << " views, took "
+            << timer.get_elapsed() << "ms." << std::endl;
+    }
+
+    if (this->survey_points != nullptr && !registered
+        && !reconstructed_ids->empty())
+        this->try_registration();
+
+    this->num_registrations += reconstructed_ids->size();
+}
+
+/* ---------------------------------------------------------------- */
+
+bool
+Incremental::resect_view (int view_id,
+    RansacPoseP3P::Options const& ransac_opts, Resection* resection) const
 {
     Viewport const& viewport = this->viewports->at(view_id);
     FeatureSet const& features = viewport.features;
 
     /* Collect all 2D-3D correspondences. */
     Correspondences2D3D corr;
-    std::vector<int> track_ids;
     std::vector<int> feature_ids;
     for (std::size_t i = 0; i < viewport.track_ids.size(); ++i)
     {
         int const track_id = viewport.track_ids[i];
-        if (track_id < 0 || !this->tracks->at(track_id).is_valid())
+        if (track_id < 0 || !this->tracks->is_valid(track_id))
             continue;
         math::Vec2f const& pos2d = features.positions[i];
-        math::Vec3f const& pos3d = this->tracks->at(track_id).pos;
+        math::Vec3f const& pos3d = this->tracks->position(track_id);
 
         corr.push_back(Correspondence2D3D());
         Correspondence2D3D& c = corr.back();
         std::copy(pos3d.begin(), pos3d.end(), c.p3d);
         std::copy(pos2d.begin(), pos2d.end(), c.p2d);
-        track_ids.push_back(track_id);
         feature_ids.push_back(i);
     }
-
-    if (this->opts.verbose_output){
-        std::cout << "Collected " << corr.size()
-            << " 2D-3D correspondences." << std::endl;
-    }
+    resection->num_correspondences = corr.size();
+    resection->num_inliers = 0;
+    resection->outlier_features.clear();
+    if (corr.size() < 3)
+        return false;
 
     /* Initialize a temporary camera. */
-    CameraPose temp_camera;
-    temp_camera.set_k_matrix(viewport.focal_length, 0.0, 0.0);
+    CameraPose& camera = resection->pose;
+    camera.set_k_matrix(viewport.focal_length, 0.0, 0.0);
 
-//    std::ofstream fout("./examples/task2/correspondence2D3D.txt");
-//    assert(fout.is_open());
-//    fout<<corr.size()<<std::endl;
-//    for(int kk=0; kk<corr.size(); kk++){
-//        fout<<corr[kk].p3d[0]<<" "<<corr[kk].p3d[1]<<" "<<corr[kk].p3d[2]<<" "<<corr[kk].p2d[0]<<" "<<corr[kk].p2d[1]<<std::endl;
-//    }
-
-    /* Compute pose from 2D-3D correspondences using P3P. */
-    util::WallTimer timer;
+    /*
+     * Compute pose from 2D-3D correspondences using P3P. The seed depends
+     * on the view only, so parallel resection is reproducible.
+     */
     RansacPoseP3P::Result ransac_result;
     {
-        RansacPoseP3P ransac(this->opts.pose_p3p_opts);
-        ransac.estimate(corr, temp_camera.K, &ransac_result);
+        RansacPoseP3P::Options view_opts = ransac_opts;
+        view_opts.seed = ransac_opts.seed + static_cast<unsigned int>(view_id);
+        RansacPoseP3P ransac(view_opts);
+        ransac.estimate(corr, camera.K, &ransac_result);
     }
+    resection->num_inliers = ransac_result.inliers.size();
 
     /* Cancel if inliers are below a 33% threshold. */
-    if (3 * ransac_result.inliers.size() < corr.size()){
-        if (this->opts.verbose_output)
-            std::cout << "Only " << ransac_result.inliers.size()
-                << " 2D-3D correspondences inliers ("
-                << (100 * ransac_result.inliers.size() / corr.size())
-                << "%). Skipping view." << std::endl;
+    if (3 * ransac_result.inliers.size() < corr.size())
         return false;
-    }
-    else if (this->opts.verbose_output)
+
+    camera.R = ransac_result.pose.delete_col(3);
+    camera.t = ransac_result.pose.col(3);
+
+    /* Collect the outlier features, the inliers are sorted. */
+    for (std::size_t i = 0, j = 0; i < feature_ids.size(); ++i)
     {
-        std::cout << "Selected " << ransac_result.inliers.size()
-            << " 2D-3D correspondences inliers ("
-            << (100 * ransac_result.inliers.size() / corr.size())
-            << "%), took " << timer.get_elapsed() << "ms." << std::endl;
+        if (j < ransac_result.inliers.size()
+            && ransac_result.inliers[j] == static_cast<int>(i))
+            j += 1;
+        else
+            resection->outlier_features.push_back(feature_ids[i]);
     }
 
+    return true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::commit_view (int view_id, Resection const& resection)
+{
     /*
      * Remove outliers from tracks and tracks from viewport.
      * TODO: Once single cam BA has been performed and parameters for this
      * camera are optimized, evaluate outlier tracks and try to restore them.
      */
-    for (std::size_t i = 0; i < ransac_result.inliers.size(); ++i)
-        track_ids[ransac_result.inliers[i]] = -1;
-    for (std::size_t i = 0; i < track_ids.size(); ++i)
+    Viewport& viewport = this->viewports->at(view_id);
+    for (std::size_t i = 0; i < resection.outlier_features.size(); ++i)
     {
-        if (track_ids[i] < 0)
-            continue;
-        this->tracks->at(track_ids[i]).remove_view(view_id);
-        this->viewports->at(view_id).track_ids[feature_ids[i]] = -1;
+        int const feature_id = resection.outlier_features[i];
+        this->tracks->remove_view(viewport.track_ids[feature_id], view_id);
+        viewport.track_ids[feature_id] = -1;
     }
-    track_ids.clear();
-    feature_ids.clear();
 
     /* Commit camera using known K and computed R and t. */
+    viewport.pose = resection.pose;
+    if (this->opts.verbose_output)
     {
-        CameraPose& pose = this->viewports->at(view_id).pose;
-        pose = temp_camera;
-        pose.R = ransac_result.pose.delete_col(3);
-        pose.t = ransac_result.pose.col(3);
-
-        if (this->opts.verbose_output)
-        {
-            std::cout << "Reconstructed camera "
-                << view_id << " with focal length "
-                << pose.get_focal_length() << std::endl;
-        }
+        std::cout << "Reconstructed camera "
+            << view_id << " with focal length "
+            << viewport.pose.get_focal_length() << std::endl;
     }
-
-    if (this->survey_points != nullptr && !registered)
-        this->try_registration();
-
-    return true;
 }
 
 /* ---------------------------------------------------------------- */
@@ -252,11 +347,10 @@ Incremental::try_registration () {
     /* Transform every point. */
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        Track& track = this->tracks->at(i);
-        if (!track.is_valid())
+        if (!this->tracks->is_valid(i))
             continue;
 
-        track.pos = R * s * track.pos + t;
+        this->tracks->set_position(i, R * s * this->tracks->position(i) + t);
     }
 
     this->registered = true;
@@ -279,8 +373,7 @@ Incremental::triangulate_new_tracks (int min_num_views)
     for (std::size_t i = 0; i < this->tracks->size(); ++i){
 
         /* Skip tracks that have already been triangulated. */
-        Track const& track = this->tracks->at(i);
-        if (track.is_valid())
+        if (this->tracks->is_valid(i))
             continue;
 
         /*
@@ -291,12 +384,13 @@ Incremental::triangulate_new_tracks (int min_num_views)
         std::vector<CameraPose const*> poses;
         std::vector<std::size_t> view_ids;
         std::vector<std::size_t> feature_ids;
-        for (std::size_t j = 0; j < track.features.size(); ++j){
+        TrackList::Features const refs = this->tracks->features(i);
+        for (std::size_t j = 0; j < refs.size(); ++j){
 
-            int const view_id = track.features[j].view_id;
+            int const view_id = refs[j].view_id;
             if (!this->viewports->at(view_id).pose.is_valid())
                 continue;
-            int const feature_id = track.features[j].feature_id;
+            int const feature_id = refs[j].feature_id;
             pos.push_back(this->viewports->at(view_id)
                 .features.positions[feature_id]);
             poses.push_back(&this->viewports->at(view_id).pose);
@@ -314,30 +408,30 @@ Incremental::triangulate_new_tracks (int min_num_views)
         math::Vec3d track_pos;
         if (!triangulator.triangulate(poses, pos, &track_pos, &stats, &outlier))
             continue;
-        this->tracks->at(i).pos = track_pos;
+        this->tracks->set_position(i, track_pos);
 
         /* Check if track contains outliers */
         if (outlier.size() == 0)
             continue;
 
         /* Split outliers from track and generate new track */
-        Track & inlier_track = this->tracks->at(i);
-        Track outlier_track;
-        outlier_track.invalidate();
-        outlier_track.color = inlier_track.color;
-        for (std::size_t i = 0; i < outlier.size(); ++i){
-
-            int const view_id = view_ids[outlier[i]];
-            int const feature_id = feature_ids[outlier[i]];
+        FeatureReferenceList outlier_features;
+        for (std::size_t j = 0; j < outlier.size(); ++j){
+
+            int const view_id = view_ids[outlier[j]];
+            int const feature_id = feature_ids[outlier[j]];
             /* Remove outlier from inlier track */
-            inlier_track.remove_view(view_id);
+            this->tracks->remove_view(i, view_id);
             /* Add features to new track */
-            outlier_track.features.emplace_back(view_id, feature_id);
+            outlier_features.emplace_back(view_id, feature_id);
             /* Change TrackID in viewports */
             this->viewports->at(view_id).track_ids[feature_id] =
                 this->tracks->size();
         }
-        this->tracks->push_back(outlier_track);
+        int const outlier_track_id = this->tracks->append(
+            outlier_features.data(),
+            outlier_features.data() + outlier_features.size());
+        this->tracks->set_color(outlier_track_id, this->tracks->color(i));
     }
 
     if (this->opts.verbose_output){
@@ -353,6 +447,100 @@ void
 Incremental::bundle_adjustment_full (void)
 {
     this->bundle_adjustment_intern(-1);
+
+    this->num_registrations = 0;
+    this->num_cameras_full_ba = 0;
+    for (std::size_t i = 0; i < this->viewports->size(); ++i)
+        if (this->viewports->at(i).pose.is_valid())
+            this->num_cameras_full_ba += 1;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::bundle_adjustment_local (std::vector<int> const& view_ids)
+{
+    std::vector<char> local_views(this->viewports->size(), 0);
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        int const view_id = view_ids[i];
+        if (view_id < 0 || std::size_t(view_id) >= this->viewports->size()
+            || !this->viewports->at(view_id).pose.is_valid())
+            throw std::invalid_argument("Invalid view ID");
+        local_views[view_id] = 1;
+    }
+
+    /* Count the tracks every other camera shares with the given views. */
+    std::vector<std::pair<int, int> > shared_tracks(this->viewports->size());
+    for (std::size_t i = 0; i < shared_tracks.size(); ++i)
+        shared_tracks[i] = std::make_pair(0, static_cast<int>(i));
+    std::vector<char> visited_tracks(this->tracks->size(), 0);
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        Viewport const& viewport = this->viewports->at(view_ids[i]);
+        for (std::size_t j = 0; j < viewport.track_ids.size(); ++j)
+        {
+            int const track_id = viewport.track_ids[j];
+            if (track_id < 0 || visited_tracks[track_id]
+                || !this->tracks->is_valid(track_id))
+                continue;
+            visited_tracks[track_id] = 1;
+
+            TrackList::Features const refs = this->tracks->features(track_id);
+            for (std::size_t k = 0; k < refs.size(); ++k)
+            {
+                int const view_id = refs[k].view_id;
+                if (!local_views[view_id]
+                    && this->viewports->at(view_id).pose.is_valid())
+                    shared_tracks[view_id].first += 1;
+            }
+        }
+    }
+
+    /* Add the co-visible views with most shared tracks. */
+    std::sort(shared_tracks.rbegin(), shared_tracks.rend());
+    std::size_t num_local_views = view_ids.size();
+    for (int i = 0; i < this->opts.local_ba_num_neighbors
+        && i < static_cast<int>(shared_tracks.size())
+        && shared_tracks[i].first > 0; ++i)
+    {
+        local_views[shared_tracks[i].second] = 1;
+        num_local_views += 1;
+    }
+
+    if (this->opts.verbose_output)
+        std::cout << "Running local bundle adjustment on "
+            << num_local_views << " views..." << std::endl;
+
+    this->bundle_adjustment_intern(-1, &local_views);
+}
+
+/* ---------------------------------------------------------------- */
+
+bool
+Incremental::is_full_ba_due (void) const
+{
+    if (this->num_registrations == 0)
+        return false;
+
+    int num_cameras = 0;
+    for (std::size_t i = 0; i < this->viewports->size(); ++i)
+        if (this->viewports->at(i).pose.is_valid())
+            num_cameras += 1;
+
+    /*
+     * The interval grows with the reconstruction, so large models run
+     * a logarithmic number of full bundle adjustments.
+     */
+    int const interval = std::max(this->opts.full_ba_interval,
+        num_cameras / 10 + 1);
+    if (this->num_registrations >= interval)
+        return true;
+
+    /* The growth test needs the camera count of a previous full BA. */
+    return this->num_cameras_full_ba > 0
+        && num_cameras >= this->opts.full_ba_growth_factor
+        * this->num_cameras_full_ba;
 }
 
 /* ---------------------------------------------------------------- */
@@ -376,7 +564,8 @@ Incremental::bundle_adjustment_points_only (void){
 /* ---------------------------------------------------------------- */
 
 void
-Incremental::bundle_adjustment_intern (int single_camera_ba){
+Incremental::bundle_adjustment_intern (int single_camera_ba,
+    std::vector<char> const* local_views){
     ba::BundleAdjustment::Options ba_opts;
     ba_opts.fixed_intrinsics = this->opts.ba_fixed_intrinsics;
     ba_opts.verbose_output = this->opts.verbose_ba;
@@ -389,6 +578,25 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
     else
         throw std::invalid_argument("Invalid BA mode selection");
 
+    /*
+     * Local BA only optimizes the tracks seen by the local views. The
+     * other cameras observing these tracks are added as constant cameras.
+     */
+    bool const local_ba = local_views != nullptr;
+    std::vector<char> ba_tracks(this->tracks->size(), !local_ba);
+    std::vector<char> ba_views(this->viewports->size(), !local_ba);
+    for (std::size_t i = 0; local_ba && i < this->tracks->size(); ++i)
+    {
+        if (!this->tracks->is_valid(i))
+            continue;
+
+        TrackList::Features const refs = this->tracks->features(i);
+        for (std::size_t j = 0; j < refs.size() && !ba_tracks[i]; ++j)
+            ba_tracks[i] = local_views->at(refs[j].view_id);
+        for (std::size_t j = 0; j < refs.size() && ba_tracks[i]; ++j)
+            ba_views[refs[j].view_id] = 1;
+    }
+
     /* Convert camera to BA data structures. */
     std::vector<ba::Camera> ba_cameras;
     std::vector<int> ba_cameras_mapping(this->viewports->size(), -1);
@@ -396,6 +604,8 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
     {
         if (single_camera_ba >= 0 && int(i) != single_camera_ba)
             continue;
+        if (!ba_views[i])
+            continue;
 
         Viewport const& view = this->viewports->at(i);
         CameraPose const& pose = view.pose;
@@ -408,6 +618,7 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
         std::copy(pose.R.begin(), pose.R.end(), cam.rotation);
         std::copy(view.radial_distortion,
             view.radial_distortion + 2, cam.distortion);
+        cam.is_constant = local_ba && !local_views->at(i);
         ba_cameras_mapping[i] = ba_cameras.size();
         ba_cameras.push_back(cam);
     }
@@ -418,26 +629,27 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
     std::vector<int> ba_tracks_mapping(this->tracks->size(), -1);
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
+        if (!this->tracks->is_valid(i) || !ba_tracks[i])
             continue;
 
         /* Add corresponding 3D point to BA. */
         ba::Point3D point;
-        std::copy(track.pos.begin(), track.pos.end(), point.pos);
+        math::Vec3f const& track_pos = this->tracks->position(i);
+        std::copy(track_pos.begin(), track_pos.end(), point.pos);
         ba_tracks_mapping[i] = ba_points_3d.size();
         ba_points_3d.push_back(point);
 
         /* Add all observations to BA. */
-        for (std::size_t j = 0; j < track.features.size(); ++j){
+        TrackList::Features const refs = this->tracks->features(i);
+        for (std::size_t j = 0; j < refs.size(); ++j){
 
-            int const view_id = track.features[j].view_id;
+            int const view_id = refs[j].view_id;
             if (!this->viewports->at(view_id).pose.is_valid())
                 continue;
             if (single_camera_ba >= 0 && view_id != single_camera_ba)
                 continue;
 
-            int const feature_id = track.features[j].feature_id;
+            int const feature_id = refs[j].feature_id;
             Viewport const& view = this->viewports->at(view_id);
             math::Vec2f const& f2d = view.features.positions[feature_id];
 
@@ -464,9 +676,7 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
         {
             SurveyObservation const& obs = survey_point.observations[j];
             int const view_id = obs.view_id;
-            if (!this->viewports->at(view_id).pose.is_valid())
-                continue;
-            if (single_camera_ba >= 0 && view_id != single_camera_ba)
+            if (ba_cameras_mapping[view_id] < 0)
                 continue;
 
             ba::Observation point;
@@ -486,7 +696,6 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
     ba.print_status();
 
     /* Transfer cameras back to SfM data structures. */
-    std::size_t ba_cam_counter = 0;
     for (std::size_t i = 0; i < this->viewports->size(); ++i)
     {
         if (ba_cameras_mapping[i] == -1)
@@ -494,7 +703,9 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
 
         Viewport& view = this->viewports->at(i);
         CameraPose& pose = view.pose;
-        ba::Camera const& cam = ba_cameras[ba_cam_counter];
+        ba::Camera const& cam = ba_cameras[ba_cameras_mapping[i]];
+        if (cam.is_constant)
+            continue;
 
         if (this->opts.verbose_output && !this->opts.ba_fixed_intrinsics)
         {
@@ -513,7 +724,6 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
         std::copy(cam.rotation, cam.rotation + 9, pose.R.begin());
         std::copy(cam.distortion, cam.distortion + 2, view.radial_distortion);
         pose.set_k_matrix(cam.focal_length, 0.0, 0.0);
-        ba_cam_counter += 1;
     }
 
     /* Exit if single camera BA is used. */
@@ -521,16 +731,14 @@ Incremental::bundle_adjustment_intern (int single_camera_ba){
         return;
 
     /* Transfer tracks back to SfM data structures. */
-    std::size_t ba_track_counter = 0;
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        Track& track = this->tracks->at(i);
-        if (!track.is_valid())
+        if (ba_tracks_mapping[i] == -1)
             continue;
 
-        ba::Point3D const& point = ba_points_3d[ba_track_counter];
-        std::copy(point.pos, point.pos + 3, track.pos.begin());
-        ba_track_counter += 1;
+        ba::Point3D const& point = ba_points_3d[ba_tracks_mapping[i]];
+        this->tracks->set_position(i, math::Vec3f(point.pos[0],
+            point.pos[1], point.pos[2]));
     }
 }
 
@@ -544,12 +752,12 @@ Incremental::invalidate_large_error_tracks (void)
     std::size_t num_valid_tracks = 0;
     for (std::size_t i = 0; i < this->tracks->size(); ++i){
 
-        if (!this->tracks->at(i).is_valid())
+        if (!this->tracks->is_valid(i))
             continue;
 
         num_valid_tracks += 1;
-        math::Vec3f const& pos3d = this->tracks->at(i).pos;
-        FeatureReferenceList const& ref = this->tracks->at(i).features;
+        math::Vec3f const& pos3d = this->tracks->position(i);
+        TrackList::Features const ref = this->tracks->features(i);
 
         double total_error = 0.0f;
         int num_valid = 0;
@@ -590,7 +798,7 @@ Incremental::invalidate_large_error_tracks (void)
     int num_deleted_tracks = 0;
     for (std::size_t i = nth_position; i < all_errors.size(); ++i) {
         if (all_errors[i].first > square_threshold) {
-            this->tracks->at(all_errors[i].second).invalidate();
+            this->tracks->invalidate(all_errors[i].second);
             num_deleted_tracks += 1;
         }
     }
@@ -641,10 +849,11 @@ Incremental::normalize_scene (void)
     /* Transform every point. */
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        if (!this->tracks->at(i).is_valid())
+        if (!this->tracks->is_valid(i))
             continue;
 
-        this->tracks->at(i).pos = (this->tracks->at(i).pos + trans) * scale;
+        this->tracks->set_position(i,
+            (this->tracks->position(i) + trans) * scale);
     }
 
     /* Transform every camera. */
@@ -742,25 +951,27 @@ Incremental::create_bundle (void) const
         bundle_feats.reserve(this->tracks->size());
         for (std::size_t i = 0; i < this->tracks->size(); ++i)
         {
-            Track const& track = this->tracks->at(i);
-            if (!track.is_valid())
+            if (!this->tracks->is_valid(i))
                 continue;
 
             /* Copy position and color of the track. */
+            math::Vec3f const& track_pos = this->tracks->position(i);
+            math::Vec3uc const& track_color = this->tracks->color(i);
+            TrackList::Features const refs = this->tracks->features(i);
             bundle_feats.push_back(core::Bundle::Feature3D());
             core::Bundle::Feature3D& f3d = bundle_feats.back();
-            std::copy(track.pos.begin(), track.pos.end(), f3d.pos);
-            f3d.color[0] = track.color[0] / 255.0f;
-            f3d.color[1] = track.color[1] / 255.0f;
-            f3d.color[2] = track.color[2] / 255.0f;
-            f3d.refs.reserve(track.features.size());
-            for (std::size_t j = 0; j < track.features.size(); ++j)
+            std::copy(track_pos.begin(), track_pos.end(), f3d.pos);
+            f3d.color[0] = track_color[0] / 255.0f;
+            f3d.color[1] = track_color[1] / 255.0f;
+            f3d.color[2] = track_color[2] / 255.0f;
+            f3d.refs.reserve(refs.size());
+            for (std::size_t j = 0; j < refs.size(); ++j)
             {
                 /* For each reference copy view ID, feature ID and 2D pos. */
                 f3d.refs.push_back(core::Bundle::Feature2D());
                 core::Bundle::Feature2D& f2d = f3d.refs.back();
-                f2d.view_id = track.features[j].view_id;
-                f2d.feature_id = track.features[j].feature_id;
+                f2d.view_id = refs[j].view_id;
+                f2d.feature_id = refs[j].feature_id;
 
                 FeatureSet const& features
                     = this->viewports->at(f2d.view_id).features;
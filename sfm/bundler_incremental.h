@@ -43,6 +43,17 @@ public:
         bool ba_fixed_intrinsics;
         /** Bundle Adjustment with shared intrinsics. */
         bool ba_shared_intrinsics;
+        /** Number of co-visible views optimized with new views in local BA. */
+        int local_ba_num_neighbors;
+        /**
+         * Minimum number of registrations between full BAs. The interval
+         * grows to a tenth of the cameras for large reconstructions.
+         */
+        int full_ba_interval;
+        /** Full BA if the number of cameras grew by this factor. */
+        double full_ba_growth_factor;
+        /** Number of threads for batched registration, 0 uses all cores. */
+        int num_threads;
         /** Produce status messages on the console. */
         bool verbose_output;
         /** Produce detailed BA messages on the console. */
@@ -70,12 +81,36 @@ public:
     void find_next_views (std::vector<int>* next_views);
     /** Incrementally adds the given view to the bundle. */
     bool reconstruct_next_view (int view_id);
+    /**
+     * Adds a batch of views to the bundle. All views are resected in
+     * parallel against the current tracks, then the successful poses are
+     * committed at once and their IDs are returned. New tracks are not
+     * triangulated, call triangulate_new_tracks() once after the batch.
+     */
+    void reconstruct_next_views (std::vector<int> const& view_ids,
+        std::vector<int>* reconstructed_ids);
     /** Triangulates tracks without 3D position and at least N views. */
     void triangulate_new_tracks (int min_num_views);
     /** Deletes tracks with a large reprojection error. */
     void invalidate_large_error_tracks (void);
     /** Runs bundle adjustment on both, structure and motion. */
     void bundle_adjustment_full (void);
+    /**
+     * Runs bundle adjustment on the given (newly added) views, the
+     * 'local_ba_num_neighbors' views sharing most tracks with them, and
+     * the tracks seen by these views. Other cameras observing the tracks
+     * are held constant.
+     */
+    void bundle_adjustment_local (std::vector<int> const& view_ids);
+    /**
+     * Returns true if a full bundle adjustment is due, i.e. after
+     * max('full_ba_interval', cameras / 10 + 1) registrations or if the
+     * number of cameras grew by 'full_ba_growth_factor' since the last
+     * full bundle adjustment.
+     */
+    bool is_full_ba_due (void) const;
+    /** Returns the number of registrations since the last full BA. */
+    int num_registrations_since_full_ba (void) const;
     /** Runs bundle adjustment on a single camera without structure. */
     void bundle_adjustment_single_cam (int view_id);
     /** Runs bundle adjustment on the structure (3D points) only. */
@@ -92,7 +127,22 @@ public:
     core::Bundle::Ptr create_bundle (void) const;
 
 private:
-    void bundle_adjustment_intern (int single_camera_ba);
+    /** Camera pose and 2D-3D outliers of a resected view. */
+    struct Resection
+    {
+        CameraPose pose;
+        std::size_t num_correspondences = 0;
+        std::size_t num_inliers = 0;
+        std::vector<int> outlier_features;
+    };
+
+    /** Computes the pose of the view, tracks and viewports are unchanged. */
+    bool resect_view (int view_id, RansacPoseP3P::Options const& ransac_opts,
+        Resection* resection) const;
+    /** Sets the pose and removes the outliers from tracks and viewport. */
+    void commit_view (int view_id, Resection const& resection);
+    void bundle_adjustment_intern (int single_camera_ba,
+        std::vector<char> const* local_views = nullptr);
 
 private:
     Options opts;
@@ -100,6 +150,8 @@ private:
     TrackList* tracks;
     SurveyPointList* survey_points;
     bool registered = false;
+    int num_registrations = 0;
+    int num_cameras_full_ba = 0;
 };
 
 /* ------------------------ Implementation ------------------------ */
@@ -111,6 +163,10 @@ Incremental::Options::Options (void)
     , min_triangulation_angle(MATH_DEG2RAD(1.0))
     , ba_fixed_intrinsics(false)
     , ba_shared_intrinsics(false)
+    , local_ba_num_neighbors(10)
+    , full_ba_interval(10)
+    , full_ba_growth_factor(1.2)
+    , num_threads(0)
     , verbose_output(false)
     , verbose_ba(false)
 {
@@ -131,6 +187,12 @@ Incremental::is_initialized (void) const
         && this->tracks != nullptr;
 }
 
+inline int
+Incremental::num_registrations_since_full_ba (void) const
+{
+    return this->num_registrations;
+}
+
 SFM_BUNDLER_NAMESPACE_END
 SFM_NAMESPACE_END
 
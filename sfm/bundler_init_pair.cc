@@ -188,14 +188,14 @@ InitialPair::compute_candidate_pairs (CandidatePairs* candidates)
     candidates->reserve(1000);
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        Track const& track = this->tracks->at(i);
-        for (std::size_t j = 1; j < track.features.size(); ++j)
+        TrackList::Features const features = this->tracks->features(i);
+        for (std::size_t j = 1; j < features.size(); ++j)
             for (std::size_t k = 0; k < j; ++k) {
 
-                int v1id = track.features[j].view_id;
-                int v2id = track.features[k].view_id;
-                int f1id = track.features[j].feature_id;
-                int f2id = track.features[k].feature_id;
+                int v1id = features[j].view_id;
+                int v2id = features[k].view_id;
+                int f1id = features[j].feature_id;
+                int f2id = features[k].feature_id;
                 if (v1id > v2id) {
                     std::swap(v1id, v2id);
                     std::swap(f1id, f2id);
@@ -8,6 +8,8 @@
  */
 
 #include "util/exception.h"
+#include "util/bounded_queue.h"
+#include "util/file_system.h"
 #include "util/timer.h"
 #include "features/sift.h"
 #include "sfm/ransac.h"
@@ -15,7 +17,11 @@
 #include "features/cascade_hashing.h"
 #include "features/exhaustive_matching.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <iterator>
+#include <thread>
 #include <fstream>
 #include <cstring>
 #include <cerrno>
@@ -38,6 +44,10 @@ Matching::Matching (Options const& options, Progress* progress)
         case MATCHER_CASCADE_HASHING:
             this->matcher.reset(new features::CascadeHashing());
             break;
+        case MATCHER_KD_FOREST:
+            this->matcher.reset(new features::KdForestMatching(
+                this->opts.kd_forest_opts));
+            break;
         default:
             throw std::runtime_error("Unhandled matcher type");
     }
@@ -52,6 +62,11 @@ Matching::init (ViewportList* viewports)
     this->viewports = viewports;
     this->matcher->init(viewports);
 
+    /* Select pairs before the descriptors are released. */
+    this->retrieved_pairs.clear();
+    if (this->opts.retrieval_num_neighbors > 0)
+        this->retrieve_pairs(*viewports);
+
     /* Free descriptors. */
     for (std::size_t i = 0; i < viewports->size(); i++)
         viewports->at(i).features.clear_descriptors();
@@ -65,8 +80,10 @@ Matching::compute (PairwiseMatching* pairwise_matching)
 
     // 视角的个数
     std::size_t num_viewports = this->viewports->size();
-    std::size_t num_pairs = num_viewports * (num_viewports - 1) / 2;
-    std::size_t num_done = 0;
+    bool const use_retrieval = this->opts.retrieval_num_neighbors > 0;
+    std::size_t const num_pairs = use_retrieval
+        ? this->retrieved_pairs.size()
+        : num_viewports * (num_viewports - 1) / 2;
 
     if (this->progress != nullptr)
     {
@@ -74,73 +91,122 @@ Matching::compute (PairwiseMatching* pairwise_matching)
         this->progress->num_done = 0;
     }
 
-#pragma omp parallel for schedule(dynamic)
-    for (std::size_t i = 0; i < num_pairs; ++i)
+    /*
+     * Two stage pipeline: Descriptor matching produces candidate pairs that
+     * are verified with RANSAC. The stages are connected by a bounded queue.
+     * Threads prefer verification and verify their own pair if the queue is
+     * full, which bounds the number of unverified pairs in memory. Results
+     * go to per-thread buffers, progress is reported through atomics and
+     * nothing is printed until all pairs are done.
+     */
+    std::size_t const num_threads = this->opts.num_threads > 0
+        ? static_cast<std::size_t>(this->opts.num_threads)
+        : std::max(1u, std::thread::hardware_concurrency());
+    std::size_t const queue_size = this->opts.max_pending_pairs > 0
+        ? static_cast<std::size_t>(this->opts.max_pending_pairs)
+        : 4 * num_threads;
+
+    util::WallTimer timer;
+    util::BoundedQueue<PendingPair> queue(queue_size);
+    std::vector<ThreadResult> thread_results(num_threads);
+    std::atomic<std::size_t> next_slot(0);
+    std::atomic<std::size_t> next_pair(0);
+    std::atomic<std::size_t> num_matched(0);
+
+#pragma omp parallel num_threads(num_threads)
     {
-#pragma omp critical
+        ThreadResult& result = thread_results[next_slot++];
+        PendingPair pair;
+        while (true)
         {
-            num_done += 1;
-            if (this->progress != nullptr)
-                this->progress->num_done += 1;
+            /* Stage 2: Geometric verification of queued pairs. */
+            if (queue.try_pop(&pair))
+            {
+                this->geometric_verification(pair, &result);
+                continue;
+            }
 
-            float percent = (num_done * 1000 / num_pairs) / 10.0f;
-            std::cout << "\rMatching pair " << num_done << " of "
-                << num_pairs << " (" << percent << "%)..." << std::flush;
-        }
+            /* Wait for pairs that are still matched by other threads. */
+            if (next_pair.load() >= num_pairs)
+            {
+                if (num_matched.load() == num_pairs && queue.size() == 0)
+                    break;
+                std::this_thread::yield();
+                continue;
+            }
 
-        int const view_1_id = (int)(0.5 + std::sqrt(0.25 + 2.0 * i));
-        int const view_2_id = (int)i - view_1_id * (view_1_id - 1) / 2;
-        if (this->opts.match_num_previous_frames != 0
-            && view_2_id + this->opts.match_num_previous_frames < view_1_id)
-            continue;
-
-        // 遍历两个视角
-        FeatureSet const& view_1 = this->viewports->at(view_1_id).features;
-        FeatureSet const& view_2 = this->viewports->at(view_2_id).features;
-        if (view_1.positions.empty() || view_2.positions.empty())
-            continue;
-
-       // 两个视角之间进行匹配
-        util::WallTimer timer;
-        std::stringstream message;
-        CorrespondenceIndices matches;
-        this->two_view_matching(view_1_id, view_2_id, &matches, message);
-        std::size_t matching_time = timer.get_elapsed();
-
-        if (matches.empty())
-        {
-#pragma omp critical
-            std::cout << "\rPair (" << view_1_id << ","
-                << view_2_id << ") rejected, "
-                << message.str() << std::endl;
-            continue;
-        }
+            std::size_t const i = next_pair++;
+            if (i >= num_pairs)
+                continue;
 
-        /* Successful two view matching. Add the pair. */
-        TwoViewMatching matching;
-        matching.view_1_id = view_1_id;
-        matching.view_2_id = view_2_id;
-        std::swap(matching.matches, matches);
+            if (use_retrieval)
+            {
+                pair.view_1_id = this->retrieved_pairs[i].first;
+                pair.view_2_id = this->retrieved_pairs[i].second;
+            }
+            else
+            {
+                pair.view_1_id = (int)(0.5 + std::sqrt(0.25 + 2.0 * i));
+                pair.view_2_id = (int)i - pair.view_1_id
+                    * (pair.view_1_id - 1) / 2;
+            }
 
-#pragma omp critical
-        {
-            pairwise_matching->push_back(matching);
-            std::cout << "\rPair (" << view_1_id << ","
-                << view_2_id << ") matched, " << matching.matches.size()
-                << " inliers, took " << matching_time << " ms." << std::endl;
+            /* Stage 1: Descriptor matching, queue or verify the result. */
+            if (this->descriptor_matching(&pair, &result))
+            {
+                if (!queue.try_push(std::move(pair)))
+                    this->geometric_verification(pair, &result);
+            }
+            else if (this->progress != nullptr)
+                this->progress->num_done += 1;
+            num_matched += 1;
         }
     }
 
-    std::cout << "\rFound a total of " << pairwise_matching->size()
+    /* Merge per-thread results in pair order. */
+    std::size_t const num_previous = pairwise_matching->size();
+    std::size_t num_rejected_lowres = 0;
+    std::size_t num_rejected_matches = 0;
+    std::size_t num_rejected_inliers = 0;
+    for (std::size_t i = 0; i < thread_results.size(); ++i)
+    {
+        ThreadResult& result = thread_results[i];
+        pairwise_matching->insert(pairwise_matching->end(),
+            std::make_move_iterator(result.matching.begin()),
+            std::make_move_iterator(result.matching.end()));
+        num_rejected_lowres += result.num_rejected_lowres;
+        num_rejected_matches += result.num_rejected_matches;
+        num_rejected_inliers += result.num_rejected_inliers;
+    }
+    std::sort(pairwise_matching->begin() + num_previous,
+        pairwise_matching->end());
+
+    std::cout << "Matched " << num_pairs << " pairs using " << num_threads
+        << " threads, took " << timer.get_elapsed() << " ms." << std::endl;
+    std::cout << "Rejected " << num_rejected_lowres << " pairs by low-res "
+        << "matching, " << num_rejected_matches << " by too few matches, "
+        << num_rejected_inliers << " by too few inliers." << std::endl;
+    std::cout << "Found a total of " << pairwise_matching->size()
         << " matching image pairs." << std::endl;
 }
 
-void
-Matching::two_view_matching (int view_1_id, int view_2_id,
-    CorrespondenceIndices* matches, std::stringstream& message)
+bool
+Matching::descriptor_matching (PendingPair* pair, ThreadResult* result) const
 {
+    int const view_1_id = pair->view_1_id;
+    int const view_2_id = pair->view_2_id;
+    pair->matches.clear();
+    pair->indices.clear();
+
+    if (this->opts.match_num_previous_frames != 0
+        && view_2_id + this->opts.match_num_previous_frames < view_1_id)
+        return false;
+
+    // 遍历两个视角
     FeatureSet const& view_1 = this->viewports->at(view_1_id).features;
     FeatureSet const& view_2 = this->viewports->at(view_2_id).features;
+    if (view_1.positions.empty() || view_2.positions.empty())
+        return false;
 
     /* Low-res matching if number of features is large. */
     if (this->opts.use_lowres_matching
@@ -150,10 +216,8 @@ Matching::two_view_matching (int view_1_id, int view_2_id,
             view_2_id, this->opts.num_lowres_features);
         if (num_matches < this->opts.min_lowres_matches)
         {
-            message << "only " << num_matches
-                << " of " << this->opts.min_lowres_matches
-                << " low-res matches.";
-            return;
+            result->num_rejected_lowres += 1;
+            return false;
         }
     }
 
@@ -166,58 +230,177 @@ Matching::two_view_matching (int view_1_id, int view_2_id,
     int const min_matches_thres = std::max(8, this->opts.min_feature_matches);
     if (num_matches < min_matches_thres)
     {
-        message << "matches below threshold of "
-            << min_matches_thres << ".";
-        return;
+        result->num_rejected_matches += 1;
+        return false;
     }
 
+    /* Visit matches by increasing Lowe ratio for PROSAC if available. */
+    std::vector<int> const& m12 = matching_result.matches_1_2;
+    std::vector<float> const& ratios = matching_result.ratios_1_2;
+    std::vector<int> order;
+    order.reserve(num_matches);
+    for (std::size_t i = 0; i < m12.size(); ++i)
+        if (m12[i] >= 0)
+            order.push_back(i);
+    pair->sorted = this->opts.prosac_sampling && ratios.size() == m12.size();
+    if (pair->sorted)
+        std::stable_sort(order.begin(), order.end(),
+            [&ratios] (int a, int b) { return ratios[a] < ratios[b]; });
+
     /* Build correspondences from feature matching result. */
-    sfm::Correspondences2D2D unfiltered_matches;
-    sfm::CorrespondenceIndices unfiltered_indices;
+    pair->matches.reserve(order.size());
+    pair->indices.reserve(order.size());
+    for (std::size_t j = 0; j < order.size(); ++j)
     {
-        std::vector<int> const& m12 = matching_result.matches_1_2;
-        for (std::size_t i = 0; i < m12.size(); ++i)
-        {
-            if (m12[i] < 0)
-                continue;
+        int const i = order[j];
 
-            sfm::Correspondence2D2D match;
-            match.p1[0] = view_1.positions[i][0];
-            match.p1[1] = view_1.positions[i][1];
-            match.p2[0] = view_2.positions[m12[i]][0];
-            match.p2[1] = view_2.positions[m12[i]][1];
-            unfiltered_matches.push_back(match);
-            unfiltered_indices.push_back(std::make_pair(i, m12[i]));
-        }
+        sfm::Correspondence2D2D match;
+        match.p1[0] = view_1.positions[i][0];
+        match.p1[1] = view_1.positions[i][1];
+        match.p2[0] = view_2.positions[m12[i]][0];
+        match.p2[1] = view_2.positions[m12[i]][1];
+        pair->matches.push_back(match);
+        pair->indices.push_back(std::make_pair(i, m12[i]));
     }
+    return true;
+}
 
+void
+Matching::geometric_verification (PendingPair const& pair,
+    ThreadResult* result) const
+{
     /* Compute fundamental matrix using RANSAC. */
     sfm::RansacFundamental::Result ransac_result;
     int num_inliers = 0;
     {
-        sfm::RansacFundamental ransac(this->opts.ransac_opts);
-        ransac.estimate(unfiltered_matches, &ransac_result);
+        sfm::RansacFundamental::Options ransac_opts = this->opts.ransac_opts;
+        ransac_opts.prosac_sampling = pair.sorted;
+        /* Pairs are verified concurrently, RANSAC only uses one thread. */
+        if (this->opts.num_threads != 1)
+            ransac_opts.num_threads = 1;
+        sfm::RansacFundamental ransac(ransac_opts);
+        ransac.estimate(pair.matches, &ransac_result);
         num_inliers = ransac_result.inliers.size();
     }
 
+    if (this->progress != nullptr)
+        this->progress->num_done += 1;
+
     /* Require at least 8 inlier matches. */
     int const min_inlier_thres = std::max(8, this->opts.min_matching_inliers);
     if (num_inliers < min_inlier_thres)
     {
-        message << "inliers below threshold of "
-            << min_inlier_thres << ".";
+        result->num_rejected_inliers += 1;
         return;
     }
 
     /* Create Two-View matching result. */
-    matches->clear();
-    matches->reserve(num_inliers);
+    result->matching.push_back(TwoViewMatching());
+    TwoViewMatching& matching = result->matching.back();
+    matching.view_1_id = pair.view_1_id;
+    matching.view_2_id = pair.view_2_id;
+    matching.matches.reserve(num_inliers);
     for (int i = 0; i < num_inliers; ++i)
     {
         int const inlier_id = ransac_result.inliers[i];
-        matches->push_back(unfiltered_indices[inlier_id]);
+        matching.matches.push_back(pair.indices[inlier_id]);
     }
 }
 
+void
+Matching::retrieve_pairs (ViewportList const& viewports)
+{
+    util::WallTimer timer;
+    std::size_t const num_viewports = viewports.size();
+
+    /* Quantized SIFT descriptors of every view. */
+    std::vector<features::QuantizedSiftDescriptors> descriptors(num_viewports);
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < num_viewports; ++i)
+    {
+        FeatureSet const& fs = viewports[i].features;
+        if (!fs.sift_quantized.empty())
+            descriptors[i] = fs.sift_quantized;
+        else
+            features::quantize_descriptors(fs.sift_descriptors,
+                &descriptors[i]);
+    }
+
+    /* Load the vocabulary or train it on a uniform sample. */
+    features::VocabularyTree vocabulary(this->opts.vocabulary_opts);
+    if (!this->opts.vocabulary_file.empty()
+        && util::fs::file_exists(this->opts.vocabulary_file.c_str()))
+    {
+        vocabulary.load_from_file(this->opts.vocabulary_file);
+        std::cout << "Loaded vocabulary with " << vocabulary.num_words()
+            << " words from " << this->opts.vocabulary_file << std::endl;
+    }
+    else
+    {
+        std::size_t num_descriptors = 0;
+        for (std::size_t i = 0; i < num_viewports; ++i)
+            num_descriptors += descriptors[i].size();
+        std::size_t const max_samples
+            = std::max(1, this->opts.vocabulary_num_samples);
+        std::size_t const stride = (num_descriptors + max_samples - 1)
+            / max_samples;
+
+        features::QuantizedSiftDescriptors samples;
+        samples.reserve(std::min(num_descriptors, max_samples));
+        std::size_t index = 0;
+        for (std::size_t i = 0; i < num_viewports; ++i)
+            for (std::size_t j = 0; j < descriptors[i].size(); ++j, ++index)
+                if (index % stride == 0)
+                    samples.push_back(descriptors[i][j]);
+
+        vocabulary.train(samples);
+        std::cout << "Trained vocabulary with " << vocabulary.num_words()
+            << " words from " << samples.size() << " descriptors." << std::endl;
+        if (!this->opts.vocabulary_file.empty() && vocabulary.num_words() > 0)
+            vocabulary.save_to_file(this->opts.vocabulary_file);
+    }
+
+    if (vocabulary.num_words() == 0)
+    {
+        std::cout << "Empty vocabulary, matching all pairs." << std::endl;
+        for (std::size_t i = 1; i < num_viewports; ++i)
+            for (std::size_t j = 0; j < i; ++j)
+                this->retrieved_pairs.push_back(std::make_pair(i, j));
+        return;
+    }
+
+    /* Index all views, then query the neighbors of every view. */
+    features::VocabularyIndex index(&vocabulary);
+    index.reset(num_viewports);
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < num_viewports; ++i)
+    {
+        index.set_image(i, descriptors[i]);
+        features::QuantizedSiftDescriptors().swap(descriptors[i]);
+    }
+    index.finalize();
+
+    std::vector<std::vector<int>> neighbors(num_viewports);
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < num_viewports; ++i)
+        index.query(i, this->opts.retrieval_num_neighbors, &neighbors[i]);
+
+    /* Symmetric union of the neighbor lists, larger view ID first. */
+    for (std::size_t i = 0; i < num_viewports; ++i)
+        for (std::size_t j = 0; j < neighbors[i].size(); ++j)
+        {
+            int const other = neighbors[i][j];
+            this->retrieved_pairs.push_back(std::make_pair(
+                std::max<int>(i, other), std::min<int>(i, other)));
+        }
+    std::sort(this->retrieved_pairs.begin(), this->retrieved_pairs.end());
+    this->retrieved_pairs.erase(std::unique(this->retrieved_pairs.begin(),
+        this->retrieved_pairs.end()), this->retrieved_pairs.end());
+
+    std::cout << "Retrieved " << this->retrieved_pairs.size() << " of "
+        << num_viewports * (num_viewports - 1) / 2 << " pairs, took "
+        << timer.get_elapsed() << " ms." << std::endl;
+}
+
 SFM_BUNDLER_NAMESPACE_END
 SFM_NAMESPACE_END
@@ -10,6 +10,7 @@
 #ifndef SFM_BUNDLER_MATCHING_HEADER
 #define SFM_BUNDLER_MATCHING_HEADER
 
+#include <atomic>
 #include <memory>
 #include <stdexcept>
 #include <vector>
@@ -20,6 +21,8 @@
 #include "sfm/bundler_common.h"
 #include "sfm/defines.h"
 #include "features/matching_base.h"
+#include "features/kd_forest_matching.h"
+#include "features/vocabulary_tree.h"
 
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
@@ -43,6 +46,11 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  * <view ID 3> <view ID 4> <number of matches>
  * ...
  *
+ * If 'retrieval_num_neighbors' is set, a vocabulary tree is used to retrieve
+ * the most similar views for every view, and only these pairs are matched.
+ * The vocabulary is loaded from 'vocabulary_file' if it exists. Otherwise
+ * it is trained on a sample of the descriptors and saved to the file.
+ *
  * Note:
  * - Only supports SIFT at the moment.
  */
@@ -52,7 +60,8 @@ public:
     enum MatcherType
     {
         MATCHER_EXHAUSTIVE,
-        MATCHER_CASCADE_HASHING
+        MATCHER_CASCADE_HASHING,
+        MATCHER_KD_FOREST
     };
 
     /** Options for feature matching. */
@@ -74,12 +83,32 @@ public:
         int match_num_previous_frames = 0;
         /** Matcher type. Exhaustive by default. */
         MatcherType matcher_type = MATCHER_EXHAUSTIVE;
+        /** Recall vs. speed trade-off for the KD-forest matcher. */
+        features::KdForestMatching::Options kd_forest_opts;
+        /** Match every view to its most similar views only. 0 = disabled. */
+        int retrieval_num_neighbors = 0;
+        /** Options to train the vocabulary tree for retrieval. */
+        features::VocabularyTree::Options vocabulary_opts;
+        /** Maximum number of descriptors to train the vocabulary. */
+        int vocabulary_num_samples = 200000;
+        /** Vocabulary file, loaded if it exists, otherwise written. */
+        std::string vocabulary_file;
+        /** Number of matching threads. Zero uses all available cores. */
+        int num_threads = 0;
+        /** Maximum number of pairs waiting for RANSAC. Zero = 4 per thread. */
+        int max_pending_pairs = 0;
+        /**
+         * Sort matches by their Lowe ratio and sample them PROSAC-style
+         * in RANSAC. Overrides 'ransac_opts.prosac_sampling'.
+         */
+        bool prosac_sampling = true;
     };
 
+    /** Matching progress, may be polled from other threads. */
     struct Progress
     {
-        std::size_t num_total;
-        std::size_t num_done;
+        std::atomic<std::size_t> num_total;
+        std::atomic<std::size_t> num_done;
     };
 
 public:
@@ -96,19 +125,49 @@ public:
     /**
      * Computes the pairwise matching between all pairs of views.
      * Computation requires both descriptor data and 2D feature positions
-     * in the viewports.
+     * in the viewports. Descriptor matching and RANSAC verification run as
+     * a pipeline, the result is sorted by view IDs.
      */
     void compute (PairwiseMatching* pairwise_matching); // std::vector<TwoViewMatching>
 
 private:
-    void two_view_matching (int view_1_id, int view_2_id,
-        CorrespondenceIndices* matches, std::stringstream& message);
+    /** A descriptor matched pair waiting for geometric verification. */
+    struct PendingPair
+    {
+        int view_1_id;
+        int view_2_id;
+        Correspondences2D2D matches;
+        CorrespondenceIndices indices;
+        /* Matches are sorted by decreasing quality. */
+        bool sorted;
+    };
+
+    /** Per-thread matching result and statistics. */
+    struct ThreadResult
+    {
+        PairwiseMatching matching;
+        std::size_t num_rejected_lowres = 0;
+        std::size_t num_rejected_matches = 0;
+        std::size_t num_rejected_inliers = 0;
+    };
+
+    /** Matches descriptors, returns false if the pair is rejected. */
+    bool descriptor_matching (PendingPair* pair, ThreadResult* result) const;
+
+    /** Verifies the matches with RANSAC and stores accepted pairs. */
+    void geometric_verification (PendingPair const& pair,
+        ThreadResult* result) const;
+
+    /** Selects the view pairs to match using image retrieval. */
+    void retrieve_pairs (ViewportList const& viewports);
 
 private:
     Options opts;
     Progress* progress;
     std::unique_ptr<MatchingBase> matcher;
     ViewportList const* viewports;
+    /** Retrieved pairs with the larger view ID first. */
+    std::vector<std::pair<int, int>> retrieved_pairs;
 };
 
 SFM_BUNDLER_NAMESPACE_END
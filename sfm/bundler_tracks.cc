@@ -7,8 +7,11 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <set>
+#include <memory>
+#include <thread>
 
 #include "core/image_tools.h"
 #include "core/image_drawing.h"
@@ -17,31 +20,73 @@
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
-/*
- * Merges tracks and updates viewports accordingly.
- */
-void
-unify_tracks(int view1_tid, int view2_tid,
-    TrackList* tracks, ViewportList* viewports)
+namespace
 {
-    /* Unify in larger track. */
-    if (tracks->at(view1_tid).features.size()
-        < tracks->at(view2_tid).features.size())
-        std::swap(view1_tid, view2_tid);
+    /*
+     * Lock-free disjoint-set forest. Roots are always linked below the
+     * smaller root, so parents only decrease and the root of every set is
+     * its smallest element, independent of the order of the unions.
+     */
+    class ConcurrentUnionFind
+    {
+    public:
+        explicit ConcurrentUnionFind (std::size_t size);
+
+        /** Returns the root of the set, halves the path on the way. */
+        int find (int id);
+
+        /** Merges the sets of both elements. Thread-safe. */
+        void unite (int id1, int id2);
 
-    Track& track1 = tracks->at(view1_tid);
-    Track& track2 = tracks->at(view2_tid);
+    private:
+        std::unique_ptr<std::atomic<int>[]> parents;
+    };
 
-    for (std::size_t k = 0; k < track2.features.size(); ++k)
+    ConcurrentUnionFind::ConcurrentUnionFind (std::size_t size)
+        : parents(new std::atomic<int>[size])
     {
-        int const view_id = track2.features[k].view_id;
-        int const feat_id = track2.features[k].feature_id;
-        viewports->at(view_id).track_ids[feat_id] = view1_tid;
+        for (std::size_t i = 0; i < size; ++i)
+            this->parents[i].store(static_cast<int>(i),
+                std::memory_order_relaxed);
+    }
+
+    int
+    ConcurrentUnionFind::find (int id)
+    {
+        while (true)
+        {
+            int parent = this->parents[id].load(std::memory_order_relaxed);
+            if (parent == id)
+                return id;
+            int const grandparent
+                = this->parents[parent].load(std::memory_order_relaxed);
+            if (grandparent == parent)
+                return parent;
+            /* Failure is harmless, another thread shortened the path. */
+            this->parents[id].compare_exchange_weak(parent, grandparent,
+                std::memory_order_relaxed);
+            id = grandparent;
+        }
+    }
+
+    void
+    ConcurrentUnionFind::unite (int id1, int id2)
+    {
+        while (true)
+        {
+            id1 = this->find(id1);
+            id2 = this->find(id2);
+            if (id1 == id2)
+                return;
+            if (id1 > id2)
+                std::swap(id1, id2);
+            /* Link the larger root if it is still a root. */
+            int expected = id2;
+            if (this->parents[id2].compare_exchange_weak(expected, id1,
+                std::memory_order_relaxed))
+                return;
+        }
     }
-    track1.features.insert(track1.features.end(),
-        track2.features.begin(), track2.features.end());
-    /* Free old track's memory. clear() does not work. */
-    track2.features = FeatureReferenceList();
 }
 
 /* ---------------------------------------------------------------- */
@@ -50,157 +95,148 @@ void
 Tracks::compute (PairwiseMatching const& matching,
     ViewportList* viewports, TrackList* tracks)
 {
-    /* Initialize per-viewport track IDs. */
+    int const num_threads = this->opts.num_threads > 0
+        ? this->opts.num_threads
+        : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    /* Initialize per-viewport track IDs and global feature IDs. */
+    std::vector<int> view_offsets(viewports->size() + 1, 0);
     for (std::size_t i = 0; i < viewports->size(); ++i)
     {
         Viewport& viewport = viewports->at(i);
-        viewport.track_ids.resize(viewport.features.positions.size(), -1);
+        viewport.track_ids.assign(viewport.features.positions.size(), -1);
+        view_offsets[i + 1] = view_offsets[i]
+            + static_cast<int>(viewport.features.positions.size());
     }
+    std::size_t const num_features = view_offsets.back();
 
-    /* Propagate track IDs. */
+    /* Merge all pairwise matches into feature sets. */
     if (this->opts.verbose_output)
-        std::cout << "Propagating track IDs..." << std::endl;
+        std::cout << "Merging matches of " << matching.size()
+            << " pairs..." << std::endl;
 
-    /* Iterate over all pairwise matchings and create tracks. */
-    tracks->clear();
+    ConcurrentUnionFind union_find(num_features);
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
     for (std::size_t i = 0; i < matching.size(); ++i)
     {
         TwoViewMatching const& tvm = matching[i];
-        Viewport& viewport1 = viewports->at(tvm.view_1_id);
-        Viewport& viewport2 = viewports->at(tvm.view_2_id);
-
-        /* Iterate over matches for a pair. */
+        int const offset1 = view_offsets[tvm.view_1_id];
+        int const offset2 = view_offsets[tvm.view_2_id];
         for (std::size_t j = 0; j < tvm.matches.size(); ++j)
         {
-            CorrespondenceIndex idx = tvm.matches[j];
-            int const view1_tid = viewport1.track_ids[idx.first];
-            int const view2_tid = viewport2.track_ids[idx.second];
-            if (view1_tid == -1 && view2_tid == -1)
-            {
-                /* No track ID associated with the match. Create track. */
-                viewport1.track_ids[idx.first] = tracks->size();
-                viewport2.track_ids[idx.second] = tracks->size();
-                tracks->push_back(Track());
-                tracks->back().features.push_back(
-                    FeatureReference(tvm.view_1_id, idx.first));
-                tracks->back().features.push_back(
-                    FeatureReference(tvm.view_2_id, idx.second));
-            }
-            else if (view1_tid == -1 && view2_tid != -1)
-            {
-                /* Propagate track ID from first to second view. */
-                viewport1.track_ids[idx.first] = view2_tid;
-                tracks->at(view2_tid).features.push_back(
-                    FeatureReference(tvm.view_1_id, idx.first));
-            }
-            else if (view1_tid != -1 && view2_tid == -1)
-            {
-                /* Propagate track ID from second to first view. */
-                viewport2.track_ids[idx.second] = view1_tid;
-                tracks->at(view1_tid).features.push_back(
-                    FeatureReference(tvm.view_2_id, idx.second));
-            }
-            else if (view1_tid == view2_tid)
-            {
-                /* Track ID already propagated. */
-            }
-            else
-            {
-                /* 如果匹配的两个特征点对应的track id不一样，则将track进行融合
-                 * A track ID is already associated with both ends of a match,
-                 * however, is not consistent. Unify tracks.
-                 */
-                unify_tracks(view1_tid, view2_tid, tracks, viewports);
-            }
+            CorrespondenceIndex const& idx = tvm.matches[j];
+            union_find.unite(offset1 + idx.first, offset2 + idx.second);
         }
     }
 
-    /* Find and remove invalid tracks or tracks with conflicts. */
-    if (this->opts.verbose_output)
-        std::cout << "Removing tracks with conflicts..." << std::flush;
+    /* Resolve the root of every feature and count the set sizes. */
+    std::vector<int> roots(num_features);
+    std::vector<int> set_sizes(num_features, 0);
+#pragma omp parallel for num_threads(num_threads)
+    for (std::size_t i = 0; i < num_features; ++i)
+        roots[i] = union_find.find(i);
+    for (std::size_t i = 0; i < num_features; ++i)
+        set_sizes[roots[i]] += 1;
 
-    // 删除不合理的track(同一个track,包含同一副图像中的多个特征点）
-    std::size_t const num_invalid_tracks = this->remove_invalid_tracks(viewports, tracks);
-    if (this->opts.verbose_output)
-        std::cout << " deleted " << num_invalid_tracks << " tracks." << std::endl;
+    /*
+     * Compaction: Every set with at least two features is a track. The
+     * features are stored in CSR layout, track i owns the references in
+     * [track_offsets[i], track_offsets[i + 1]). Since the root of a set is
+     * its smallest feature, tracks are numbered in order of first feature.
+     */
+    std::vector<int> root_tracks(num_features, -1);
+    std::vector<int> track_offsets(1, 0);
+    for (std::size_t i = 0; i < num_features; ++i)
+    {
+        if (roots[i] != static_cast<int>(i) || set_sizes[i] < 2)
+            continue;
+        root_tracks[i] = track_offsets.size() - 1;
+        track_offsets.push_back(track_offsets.back() + set_sizes[i]);
+    }
+    std::size_t const num_candidates = track_offsets.size() - 1;
 
-    /* Compute color for every track. */
-    if (this->opts.verbose_output)
-        std::cout << "Colorizing tracks..." << std::endl;
-    for (std::size_t i = 0; i < tracks->size(); ++i)
+    FeatureReferenceList references(track_offsets.back(),
+        FeatureReference(-1, -1));
+    std::vector<int> fill_positions(track_offsets.begin(),
+        track_offsets.end() - 1);
+    for (std::size_t view_id = 0; view_id < viewports->size(); ++view_id)
     {
-        Track& track = tracks->at(i);
-        math::Vec4f color(0.0f, 0.0f, 0.0f, 0.0f);
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        int const num_view_features = view_offsets[view_id + 1]
+            - view_offsets[view_id];
+        for (int feature_id = 0; feature_id < num_view_features; ++feature_id)
         {
-            FeatureReference const& ref = track.features[j];
-            FeatureSet const& features = viewports->at(ref.view_id).features;
-            math::Vec3f const feature_color(features.colors[ref.feature_id]);
-            color += math::Vec4f(feature_color, 1.0f);
+            int const track_id
+                = root_tracks[roots[view_offsets[view_id] + feature_id]];
+            if (track_id < 0)
+                continue;
+            references[fill_positions[track_id]++]
+                = FeatureReference(view_id, feature_id);
         }
-        track.color[0] = static_cast<uint8_t>(color[0] / color[3] + 0.5f);
-        track.color[1] = static_cast<uint8_t>(color[1] / color[3] + 0.5f);
-        track.color[2] = static_cast<uint8_t>(color[2] / color[3] + 0.5f);
     }
-}
+    std::vector<int>().swap(roots);
+    std::vector<int>().swap(set_sizes);
+    std::vector<int>().swap(root_tracks);
 
-/* ---------------------------------------------------------------- */
-
-int
-Tracks::remove_invalid_tracks (ViewportList* viewports, TrackList* tracks)
-{
     /*
-     * Detect invalid tracks where a track contains no features, or
-     * multiple features from a single view.
+     * 删除不合理的track(同一个track,包含同一副图像中的多个特征点）
+     * Remove tracks with multiple features from a single view. The
+     * references are sorted by view, conflicts are adjacent.
      */
-    // 删除tracks没有特征点，或者是包含同一幅图像中的多个特征点
-    std::vector<bool> delete_tracks(tracks->size());
-    int num_invalid_tracks = 0;
-    for (std::size_t i = 0; i < tracks->size(); ++i)
-    {
-        if (tracks->at(i).features.empty()) {
-            delete_tracks[i] = true;
-            continue;
-        }
+    if (this->opts.verbose_output)
+        std::cout << "Removing tracks with conflicts..." << std::flush;
 
-        std::set<int> view_ids;
-        for (std::size_t j = 0; j < tracks->at(i).features.size(); ++j)
-        {
-            FeatureReference const& ref = tracks->at(i).features[j];
-            if (view_ids.insert(ref.view_id).second == false) {
-                num_invalid_tracks += 1;
-                delete_tracks[i] = true;
+    std::vector<char> valid_tracks(num_candidates, 1);
+#pragma omp parallel for num_threads(num_threads)
+    for (std::size_t i = 0; i < num_candidates; ++i)
+        for (int j = track_offsets[i] + 1; j < track_offsets[i + 1]; ++j)
+            if (references[j].view_id == references[j - 1].view_id)
+            {
+                valid_tracks[i] = 0;
                 break;
             }
-        }
-    }
 
-    /* Create a mapping from old to new track IDs. */
-    std::vector<int> id_mapping(delete_tracks.size(), -1);
-    int valid_track_counter = 0;
-    for (std::size_t i = 0; i < delete_tracks.size(); ++i)
-    {
-        if (delete_tracks[i])
-            continue;
-        id_mapping[i] = valid_track_counter;
-        valid_track_counter += 1;
-    }
+    std::vector<int> track_ids(num_candidates, -1);
+    int num_tracks = 0;
+    for (std::size_t i = 0; i < num_candidates; ++i)
+        if (valid_tracks[i])
+            track_ids[i] = num_tracks++;
 
-    /* Fix track IDs stored in the viewports. */
-    for (std::size_t i = 0; i < viewports->size(); ++i)
-    {
-        std::vector<int>& track_ids = viewports->at(i).track_ids;
-        for (std::size_t j = 0; j < track_ids.size(); ++j)
-            if (track_ids[j] >= 0)
-                track_ids[j] = id_mapping[track_ids[j]];
-    }
+    if (this->opts.verbose_output)
+        std::cout << " deleted " << (num_candidates - num_tracks)
+            << " tracks." << std::endl;
 
-    /* Clean the tracks from the vector. */
-    math::algo::vector_clean(delete_tracks, tracks);
+    /* Copy the valid tracks to the track list. */
+    tracks->clear();
+    tracks->reserve(num_tracks, references.size());
+    for (std::size_t i = 0; i < num_candidates; ++i)
+        if (track_ids[i] >= 0)
+            tracks->append(references.data() + track_offsets[i],
+                references.data() + track_offsets[i + 1]);
 
-    return num_invalid_tracks;
+    /* Set per-feature track IDs and compute color for every track. */
+    if (this->opts.verbose_output)
+        std::cout << "Colorizing tracks..." << std::endl;
+#pragma omp parallel for schedule(dynamic, 64) num_threads(num_threads)
+    for (std::size_t i = 0; i < tracks->size(); ++i)
+    {
+        TrackList::Features const refs = tracks->features(i);
+        math::Vec4f color(0.0f, 0.0f, 0.0f, 0.0f);
+        for (std::size_t j = 0; j < refs.size(); ++j)
+        {
+            FeatureReference const& ref = refs[j];
+            Viewport& viewport = viewports->at(ref.view_id);
+            viewport.track_ids[ref.feature_id] = i;
+            math::Vec3f const feature_color(
+                viewport.features.colors[ref.feature_id]);
+            color += math::Vec4f(feature_color, 1.0f);
+        }
+        math::Vec3uc track_color;
+        track_color[0] = static_cast<uint8_t>(color[0] / color[3] + 0.5f);
+        track_color[1] = static_cast<uint8_t>(color[1] / color[3] + 0.5f);
+        track_color[2] = static_cast<uint8_t>(color[2] / color[3] + 0.5f);
+        tracks->set_color(i, track_color);
+    }
 }
 
-
 SFM_BUNDLER_NAMESPACE_END
 SFM_NAMESPACE_END
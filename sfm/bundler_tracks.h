@@ -30,6 +30,9 @@ public:
     {
         Options (void);
 
+        /** Number of threads for track construction, 0 uses all cores. */
+        int num_threads;
+
         /** Produce status messages on the console. */
         bool verbose_output;
     };
@@ -37,19 +40,21 @@ public:
 public:
     explicit Tracks (Options const& options);
 
-    // todo calculate tracks
     /**
      * Computes viewport connectivity information by propagating track IDs.
      * Computation requires feature positions and colors in the viewports.
      * A color for each track is computed as the average color from features.
      * Per-feature track IDs are added to the viewports.
+     *
+     * Tracks are the connected components of the matches. The matches are
+     * merged in parallel into a disjoint-set forest over global feature
+     * IDs, the tracks are then built in a single compaction pass. Tracks
+     * with multiple features in one view are removed. Tracks are ordered
+     * by their first feature, features in a track by view and feature ID.
      */
     void compute (PairwiseMatching const& matching,
         ViewportList* viewports, TrackList* tracks);
 
-private:
-    int remove_invalid_tracks (ViewportList* viewports, TrackList* tracks);
-
 private:
     Options opts;
 };
@@ -58,7 +63,8 @@ private:
 
 inline
 Tracks::Options::Options (void)
-    : verbose_output(false)
+    : num_threads(0)
+    , verbose_output(false)
 {
 }
 
@@ -10,9 +10,11 @@
 #ifndef SFM_CORRESPONDENCE_HEADER
 #define SFM_CORRESPONDENCE_HEADER
 
+#include <cstddef>
 #include <vector>
 
 #include "math/matrix.h"
+#include "util/aligned_memory.h"
 #include "sfm/defines.h"
 
 SFM_NAMESPACE_BEGIN
@@ -49,6 +51,88 @@ struct Correspondence2D3D
     double p2d[2];
 };
 
+/**
+ * Structure-of-arrays copy of 2D-2D correspondences for the vectorized
+ * RANSAC kernels. The correspondences are stored in the given order, 'ids'
+ * maps positions in the buffer to indices in the original list.
+ */
+struct CorrespondenceBuffer2D2D
+{
+    void assign (Correspondences2D2D const& matches,
+        std::vector<int> const& order);
+    std::size_t size (void) const;
+
+    util::AlignedMemory<double, 32> x1, y1, x2, y2;
+    std::vector<int> ids;
+};
+
+/** Structure-of-arrays copy of 2D-3D correspondences, see above. */
+struct CorrespondenceBuffer2D3D
+{
+    void assign (Correspondences2D3D const& corresp,
+        std::vector<int> const& order);
+    std::size_t size (void) const;
+
+    util::AlignedMemory<double, 32> x, y, z, u, v;
+    std::vector<int> ids;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline void
+CorrespondenceBuffer2D2D::assign (Correspondences2D2D const& matches,
+    std::vector<int> const& order)
+{
+    std::size_t const num = order.size();
+    this->x1.resize(num);
+    this->y1.resize(num);
+    this->x2.resize(num);
+    this->y2.resize(num);
+    this->ids = order;
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        Correspondence2D2D const& match = matches[order[i]];
+        this->x1[i] = match.p1[0];
+        this->y1[i] = match.p1[1];
+        this->x2[i] = match.p2[0];
+        this->y2[i] = match.p2[1];
+    }
+}
+
+inline std::size_t
+CorrespondenceBuffer2D2D::size (void) const
+{
+    return this->ids.size();
+}
+
+inline void
+CorrespondenceBuffer2D3D::assign (Correspondences2D3D const& corresp,
+    std::vector<int> const& order)
+{
+    std::size_t const num = order.size();
+    this->x.resize(num);
+    this->y.resize(num);
+    this->z.resize(num);
+    this->u.resize(num);
+    this->v.resize(num);
+    this->ids = order;
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        Correspondence2D3D const& c = corresp[order[i]];
+        this->x[i] = c.p3d[0];
+        this->y[i] = c.p3d[1];
+        this->z[i] = c.p3d[2];
+        this->u[i] = c.p2d[0];
+        this->v[i] = c.p2d[1];
+    }
+}
+
+inline std::size_t
+CorrespondenceBuffer2D3D::size (void) const
+{
+    return this->ids.size();
+}
+
 SFM_NAMESPACE_END
 
 #endif  // SFM_CORRESPONDENCE_HEADER
@@ -82,7 +82,10 @@ FeatureSet::compute_sift (core::ByteImage::ConstPtr image)
     }
 
     /* Keep SIFT descriptors. */
-    std::swap(descr, this->sift_descriptors);
+    if (this->opts.compact_descriptors)
+        quantize_descriptors(descr, &this->sift_quantized);
+    else
+        std::swap(descr, this->sift_descriptors);
 }
 
 void
@@ -113,7 +116,10 @@ FeatureSet::compute_surf (core::ByteImage::ConstPtr image)
     }
 
     /* Keep SURF descriptors. */
-    std::swap(descr, this->surf_descriptors);
+    if (this->opts.compact_descriptors)
+        quantize_descriptors(descr, &this->surf_quantized);
+    else
+        std::swap(descr, this->surf_descriptors);
 }
 
 void
@@ -123,6 +129,10 @@ FeatureSet::clear_descriptors (void)
     this->sift_descriptors.shrink_to_fit();
     this->surf_descriptors.clear();
     this->surf_descriptors.shrink_to_fit();
+    this->sift_quantized.clear();
+    this->sift_quantized.shrink_to_fit();
+    this->surf_quantized.clear();
+    this->surf_quantized.shrink_to_fit();
 }
 
 SFM_NAMESPACE_END
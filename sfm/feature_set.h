@@ -16,6 +16,7 @@
 #include "util/aligned_memory.h"
 #include "features/sift.h"
 #include "features/surf.h"
+#include "features/descriptor_quantization.h"
 #include "sfm/defines.h"
 #include "features/defines.h"
 
@@ -43,6 +44,12 @@ public:
         Options (void);
 
         FeatureTypes feature_types;
+        /**
+         * Stores the descriptors quantized right after extraction (8 bit
+         * SIFT, 16 bit SURF) and drops the float descriptors. This reduces
+         * SIFT descriptor memory by a factor of four.
+         */
+        bool compact_descriptors;
         Sift::Options sift_opts;
         Surf::Options surf_opts;
     };
@@ -74,6 +81,10 @@ public:
     Sift::Descriptors sift_descriptors;
     /** The SURF descriptors. */
     Surf::Descriptors surf_descriptors;
+    /** The quantized SIFT descriptors if compact descriptors are enabled. */
+    QuantizedSiftDescriptors sift_quantized;
+    /** The quantized SURF descriptors if compact descriptors are enabled. */
+    QuantizedSurfDescriptors surf_quantized;
 
 private:
     void compute_sift (core::ByteImage::ConstPtr image);
@@ -88,6 +99,7 @@ private:
 inline
 FeatureSet::Options::Options (void)
     : feature_types(FEATURE_SIFT)
+    , compact_descriptors(false)
 {
 }
 
@@ -8,6 +8,7 @@
  */
 
 #include <cmath>
+#include <limits>
 
 #include "math/functions.h"
 #include "sfm/ransac.h"
@@ -20,9 +21,34 @@ compute_ransac_iterations (double inlier_ratio,
     double desired_success_rate)
 {
     double prob_all_good = math::fastpow(inlier_ratio, num_samples);
+    if (prob_all_good <= 0.0)
+        return std::numeric_limits<int>::max();
+    if (prob_all_good >= 1.0)
+        return 1;
+
+    /* log1p() keeps the precision for very small probabilities. */
     double num_iterations = std::log(1.0 - desired_success_rate)
-        / std::log(1.0 - prob_all_good);
+        / std::log1p(-prob_all_good);
+    if (!(num_iterations < static_cast<double>(
+        std::numeric_limits<int>::max())))
+        return std::numeric_limits<int>::max();
     return static_cast<int>(math::round(num_iterations));
 }
 
+double
+compute_sprt_threshold (double epsilon, double delta,
+    double model_cost, double models_per_sample)
+{
+    /* Expected information gain of one consistent/inconsistent point. */
+    double const c = (1.0 - delta) * std::log((1.0 - delta) / (1.0 - epsilon))
+        + delta * std::log(delta / epsilon);
+
+    /* Fixed point iteration A = K + log(A), see Matas and Chum. */
+    double const k = model_cost * c / models_per_sample + 1.0;
+    double a = k;
+    for (int i = 0; i < 10; ++i)
+        a = k + std::log(a);
+    return a;
+}
+
 SFM_NAMESPACE_END
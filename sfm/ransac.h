@@ -10,7 +10,17 @@
 #ifndef SFM_RANSAC_HEADER
 #define SFM_RANSAC_HEADER
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
 #include "sfm/defines.h"
+#include "sfm/ransac_kernels.h"
 
 SFM_NAMESPACE_BEGIN
 
@@ -27,12 +37,527 @@ SFM_NAMESPACE_BEGIN
  *
  * Example: For w = 50%, p = 99%, n = 8: k = log(0.001) / log(0.99609) = 1176.
  * Thus, it requires 1176 iterations for RANSAC to succeed with a 99% chance.
+ * For w = 0 the function returns the largest representable int.
  */
 int
 compute_ransac_iterations (double inlier_ratio,
     int num_samples,
     double desired_success_rate = 0.99);
 
+/**
+ * Returns the decision threshold A of the sequential probability ratio test
+ * (SPRT) for model verification, see Matas and Chum, "Randomized RANSAC
+ * with Sequential Probability Ratio Test", ICCV 2005. Epsilon is the
+ * probability that a point is consistent with a good model, delta the
+ * probability for a bad model. The model cost is the time to compute a
+ * model hypothesis in units of one residual evaluation.
+ */
+double
+compute_sprt_threshold (double epsilon, double delta,
+    double model_cost, double models_per_sample);
+
+/* ---------------------------------------------------------------- */
+
+/** Parameters of the adaptive RANSAC core, see ransac_estimate(). */
+struct RansacParameters
+{
+    RansacParameters (void);
+
+    /** Upper bound for the number of iterations. */
+    int max_iterations;
+
+    /** Inlier threshold on the squared residuals of the estimator. */
+    double square_threshold;
+
+    /**
+     * Desired probability of drawing at least one all-inlier sample. The
+     * number of iterations is reduced whenever a better model is found.
+     * Set to 1 to always run 'max_iterations'.
+     */
+    double success_rate;
+
+    /**
+     * PROSAC sampling: The data is sorted by decreasing quality. Samples
+     * are drawn from a growing set of the best points first, which
+     * converges to uniform sampling after 'max_iterations'.
+     */
+    bool prosac_sampling;
+
+    /**
+     * Verify models with the sequential probability ratio test. Evaluation
+     * of a model stops as soon as it is likely to be a bad model.
+     */
+    bool sprt_scoring;
+
+    /** SPRT: Cost of one model hypothesis in residual evaluations. */
+    double sprt_model_cost;
+
+    /** SPRT: Initial probability of a point consistent with a bad model. */
+    double sprt_initial_delta;
+
+    /** SPRT: Initial probability of a point consistent with a good model. */
+    double sprt_initial_epsilon;
+
+    /**
+     * Number of threads, or 0 for all cores. The iterations are split into
+     * rounds, every thread draws a fixed share of the samples of a round
+     * from its own random stream. The result only depends on the seed and
+     * the number of threads, not on the scheduling.
+     */
+    int num_threads;
+
+    /** Seed for the random streams of the threads. */
+    unsigned int seed;
+};
+
+/** Summary of a RANSAC run. */
+struct RansacSummary
+{
+    /** Number of samples drawn. */
+    int num_iterations;
+    /** Number of model hypotheses computed from the samples. */
+    int num_models;
+    /** Number of models rejected early by the SPRT. */
+    int num_rejected_models;
+    /** Residual evaluations over all models. */
+    std::size_t num_evaluations;
+};
+
+/**
+ * Adaptive RANSAC core shared by the F, H and P3P estimators.
+ *
+ * Draws minimal samples, computes model hypotheses with the estimator and
+ * keeps the model with the most inliers. The iteration bound is updated
+ * from the best inlier ratio, samples are drawn PROSAC-style if the data
+ * is sorted by quality, and models are scored with the SPRT.
+ *
+ * Models are scored in batches with the vectorized kernels: The estimator
+ * keeps a structure-of-arrays copy of the data in a random evaluation
+ * order, so the SPRT is unbiased on sorted data, and tests up to
+ * RANSAC_MAX_BATCH_MODELS models per call on a range of buffer positions.
+ * With the SPRT, models are tested in blocks of 64 points and the decision
+ * is made once per block. The returned inliers are sorted by index.
+ *
+ * Iterations run in rounds of RANSAC_ROUND_ITERATIONS samples per thread.
+ * Threads share the best model, the SPRT state and the iteration bound at
+ * the end of each round, the best model of the round is the first one
+ * with the most inliers in thread order.
+ *
+ * The estimator must provide:
+ *
+ *   typedef ... Model;
+ *   static int const SAMPLE_SIZE;
+ *   void set_evaluation_order (std::vector<int> const& order);
+ *   void compute_models (int const* sample, std::vector<Model>* models) const;
+ *   void find_inliers (Model const* models, int num_models,
+ *       std::size_t begin, std::size_t end, double square_threshold,
+ *       uint64_t* const* masks, std::size_t* counts) const;
+ *
+ * where 'sample' contains indices into the data, 'order' maps buffer
+ * positions to indices, and 'find_inliers' behaves like the kernels in
+ * sfm/ransac_kernels.h on buffer positions. The const functions are called
+ * concurrently.
+ */
+template <typename Estimator>
+RansacSummary
+ransac_estimate (Estimator* estimator, std::size_t num_data,
+    RansacParameters const& params,
+    typename Estimator::Model* best_model, std::vector<int>* best_inliers);
+
+/** Number of samples per thread and round in ransac_estimate(). */
+int const RANSAC_ROUND_ITERATIONS = 16;
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+RansacParameters::RansacParameters (void)
+    : max_iterations(1000)
+    , square_threshold(0.0)
+    , success_rate(0.999)
+    , prosac_sampling(false)
+    , sprt_scoring(true)
+    , sprt_model_cost(200.0)
+    , sprt_initial_delta(0.05)
+    , sprt_initial_epsilon(0.2)
+    , num_threads(1)
+    , seed(0)
+{
+}
+
+/** State shared by all threads of ransac_estimate() in a round. */
+struct RansacSharedState
+{
+    double epsilon;
+    double delta;
+    double sum_delta;
+    double threshold_a;
+    int num_iterations;
+    int num_models;
+    int num_rejected_models;
+    int max_iterations;
+    std::size_t best_count;
+};
+
+/** Per-thread buffers and results of ransac_estimate(). */
+template <typename Model>
+struct RansacThreadState
+{
+    std::mt19937 rng;
+    std::vector<int> sample;
+    std::vector<Model> models;
+    std::vector<uint64_t> masks;
+    std::vector<uint64_t> best_mask;
+    Model best_model;
+    std::size_t best_count;
+    bool has_best;
+    RansacSummary summary;
+    double sum_delta;
+};
+
+/** Runs the iterations [first, last) of a round in one thread. */
+template <typename Estimator>
+void
+ransac_thread_iterations (Estimator const& estimator, std::size_t num_data,
+    RansacParameters const& params, RansacSharedState const& shared,
+    std::size_t const* prosac_n, int first, int last,
+    RansacThreadState<typename Estimator::Model>* state)
+{
+    typedef typename Estimator::Model Model;
+    int const m = Estimator::SAMPLE_SIZE;
+    int const max_batch = RANSAC_MAX_BATCH_MODELS;
+    std::size_t const num_words = inlier_mask_words(num_data);
+
+    state->summary.num_iterations = 0;
+    state->summary.num_models = 0;
+    state->summary.num_rejected_models = 0;
+    state->summary.num_evaluations = 0;
+    state->sum_delta = 0.0;
+    state->best_count = shared.best_count;
+    state->has_best = false;
+
+    /* Thread-local copies of the SPRT state and the iteration bound. */
+    double epsilon = shared.epsilon;
+    double delta = shared.delta;
+    double threshold_a = shared.threshold_a;
+    int max_iterations = shared.max_iterations;
+
+    for (int iter = first; iter < last && iter <= max_iterations; ++iter)
+    {
+        state->summary.num_iterations += 1;
+        int const num_iterations = shared.num_iterations
+            + state->summary.num_iterations;
+
+        /*
+         * Draw a sample without duplicates. PROSAC samples always contain
+         * the newest point of the sampling set.
+         */
+        std::size_t const sampling_n = prosac_n[iter - first];
+        int num_drawn = 0;
+        std::size_t range = sampling_n;
+        if (sampling_n < num_data)
+        {
+            state->sample[num_drawn++] = sampling_n - 1;
+            range = sampling_n - 1;
+        }
+        std::uniform_int_distribution<int> dist(0, range - 1);
+        while (num_drawn < m)
+        {
+            int const id = dist(state->rng);
+            if (std::find(state->sample.begin(),
+                state->sample.begin() + num_drawn, id)
+                == state->sample.begin() + num_drawn)
+                state->sample[num_drawn++] = id;
+        }
+
+        state->models.clear();
+        estimator.compute_models(state->sample.data(), &state->models);
+        state->summary.num_models += state->models.size();
+        double const models_per_sample = static_cast<double>(
+            shared.num_models + state->summary.num_models) / num_iterations;
+
+        std::vector<Model> const& models = state->models;
+        for (std::size_t first_model = 0; first_model < models.size();
+            first_model += max_batch)
+        {
+            int const batch_size = static_cast<int>(std::min<std::size_t>(
+                max_batch, models.size() - first_model));
+
+            /* Per-model state of the batch. */
+            uint64_t* masks[RANSAC_MAX_BATCH_MODELS];
+            std::size_t counts[RANSAC_MAX_BATCH_MODELS];
+            std::size_t num_tested[RANSAC_MAX_BATCH_MODELS];
+            double log_lambda[RANSAC_MAX_BATCH_MODELS];
+            bool rejected[RANSAC_MAX_BATCH_MODELS];
+            for (int k = 0; k < batch_size; ++k)
+            {
+                masks[k] = &state->masks[k * num_words];
+                counts[k] = 0;
+                num_tested[k] = 0;
+                log_lambda[k] = 0.0;
+                rejected[k] = false;
+            }
+
+            if (!params.sprt_scoring)
+            {
+                estimator.find_inliers(&models[first_model], batch_size, 0,
+                    num_data, params.square_threshold, masks, counts);
+                for (int k = 0; k < batch_size; ++k)
+                    num_tested[k] = num_data;
+            }
+            else
+            {
+                /* Evaluate blocks of 64 points, the SPRT stops bad models. */
+                double const log_consistent = std::log(delta / epsilon);
+                double const log_inconsistent
+                    = std::log((1.0 - delta) / (1.0 - epsilon));
+                double const log_threshold_a = std::log(threshold_a);
+                for (std::size_t begin = 0; begin < num_data; begin += 64)
+                {
+                    std::size_t const end = std::min(begin + 64, num_data);
+
+                    /* Compact the models which are still active. */
+                    Model active[RANSAC_MAX_BATCH_MODELS];
+                    uint64_t* active_masks[RANSAC_MAX_BATCH_MODELS];
+                    std::size_t block_counts[RANSAC_MAX_BATCH_MODELS];
+                    int active_ids[RANSAC_MAX_BATCH_MODELS];
+                    int num_active = 0;
+                    for (int k = 0; k < batch_size; ++k)
+                    {
+                        if (rejected[k])
+                            continue;
+                        active[num_active] = models[first_model + k];
+                        active_masks[num_active] = masks[k];
+                        active_ids[num_active] = k;
+                        num_active += 1;
+                    }
+                    if (num_active == 0)
+                        break;
+
+                    estimator.find_inliers(active, num_active, begin, end,
+                        params.square_threshold, active_masks, block_counts);
+                    for (int a = 0; a < num_active; ++a)
+                    {
+                        int const k = active_ids[a];
+                        double const num_consistent = block_counts[a];
+                        counts[k] += block_counts[a];
+                        num_tested[k] = end;
+                        log_lambda[k] += num_consistent * log_consistent
+                            + (end - begin - num_consistent)
+                            * log_inconsistent;
+                        if (log_lambda[k] > log_threshold_a)
+                            rejected[k] = true;
+                    }
+                }
+            }
+
+            for (int k = 0; k < batch_size; ++k)
+            {
+                state->summary.num_evaluations += num_tested[k];
+                if (rejected[k])
+                {
+                    /* Update the estimate of delta from rejected models. */
+                    state->summary.num_rejected_models += 1;
+                    state->sum_delta += static_cast<double>(counts[k])
+                        / static_cast<double>(num_tested[k]);
+                    double const new_delta = std::max(1e-4, std::min(
+                        (shared.sum_delta + state->sum_delta)
+                        / (shared.num_rejected_models
+                        + state->summary.num_rejected_models),
+                        0.5 * epsilon));
+                    if (std::abs(new_delta - delta) > 0.05 * delta)
+                    {
+                        delta = new_delta;
+                        threshold_a = compute_sprt_threshold(epsilon, delta,
+                            params.sprt_model_cost, models_per_sample);
+                    }
+                    continue;
+                }
+
+                if (counts[k] <= state->best_count)
+                    continue;
+
+                /* New best model, update epsilon and the iteration bound. */
+                state->best_model = models[first_model + k];
+                std::copy(masks[k], masks[k] + num_words,
+                    state->best_mask.begin());
+                state->best_count = counts[k];
+                state->has_best = true;
+
+                double const inlier_ratio = static_cast<double>(
+                    state->best_count) / static_cast<double>(num_data);
+                if (inlier_ratio > epsilon)
+                {
+                    epsilon = std::min(inlier_ratio, 0.99);
+                    delta = std::min(delta, 0.5 * epsilon);
+                    threshold_a = compute_sprt_threshold(epsilon, delta,
+                        params.sprt_model_cost, models_per_sample);
+                }
+                if (params.success_rate < 1.0)
+                    max_iterations = std::min(max_iterations,
+                        std::max(iter, compute_ransac_iterations(inlier_ratio,
+                        m, params.success_rate)));
+            }
+        }
+    }
+}
+
+template <typename Estimator>
+RansacSummary
+ransac_estimate (Estimator* estimator, std::size_t num_data,
+    RansacParameters const& params,
+    typename Estimator::Model* best_model, std::vector<int>* best_inliers)
+{
+    typedef typename Estimator::Model Model;
+    int const m = Estimator::SAMPLE_SIZE;
+
+    RansacSummary summary;
+    summary.num_iterations = 0;
+    summary.num_models = 0;
+    summary.num_rejected_models = 0;
+    summary.num_evaluations = 0;
+    best_inliers->clear();
+    if (num_data < std::size_t(m))
+        return summary;
+
+    int const num_threads = params.num_threads > 0 ? params.num_threads
+        : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int const round_size = num_threads * RANSAC_ROUND_ITERATIONS;
+
+    /* Random evaluation order for an unbiased SPRT. */
+    std::vector<int> order(num_data);
+    std::iota(order.begin(), order.end(), 0);
+    {
+        std::seed_seq seq = { params.seed, 0u };
+        std::mt19937 rng(seq);
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+    estimator->set_evaluation_order(order);
+
+    /* Buffers and random streams of the threads, allocated once. */
+    std::size_t const num_words = inlier_mask_words(num_data);
+    std::vector<RansacThreadState<Model> > states(num_threads);
+    for (int i = 0; i < num_threads; ++i)
+    {
+        std::seed_seq seq = { params.seed, static_cast<unsigned int>(i + 1) };
+        states[i].rng.seed(seq);
+        states[i].sample.resize(m);
+        states[i].models.reserve(RANSAC_MAX_BATCH_MODELS);
+        states[i].masks.resize(RANSAC_MAX_BATCH_MODELS * num_words);
+        states[i].best_mask.resize(num_words);
+    }
+
+    /* PROSAC state: Sampling set size and growth schedule. */
+    std::size_t prosac_n = params.prosac_sampling ? m : num_data;
+    double prosac_tn = params.max_iterations;
+    for (int i = 0; i < m; ++i)
+        prosac_tn *= static_cast<double>(m - i)
+            / static_cast<double>(num_data - i);
+    double prosac_tn_prime = 1.0;
+    std::vector<std::size_t> round_prosac_n(round_size);
+
+    RansacSharedState shared;
+    shared.epsilon = params.sprt_initial_epsilon;
+    shared.delta = params.sprt_initial_delta;
+    shared.sum_delta = 0.0;
+    shared.threshold_a = compute_sprt_threshold(shared.epsilon, shared.delta,
+        params.sprt_model_cost, 1.0);
+    shared.num_iterations = 0;
+    shared.num_models = 0;
+    shared.num_rejected_models = 0;
+    shared.max_iterations = params.max_iterations;
+    shared.best_count = 0;
+
+    std::vector<uint64_t> best_mask(num_words, 0);
+    for (int round_first = 1; round_first <= shared.max_iterations;
+        round_first += round_size)
+    {
+        int const round_last = std::min(round_first + round_size,
+            shared.max_iterations + 1);
+
+        /* Grow the PROSAC sampling set according to the schedule. */
+        for (int iter = round_first; iter < round_last; ++iter)
+        {
+            if (prosac_n < num_data && iter > prosac_tn_prime)
+            {
+                prosac_n += 1;
+                double const tn_next = prosac_tn
+                    * static_cast<double>(prosac_n)
+                    / static_cast<double>(prosac_n - m);
+                prosac_tn_prime += std::ceil(tn_next - prosac_tn);
+                prosac_tn = tn_next;
+            }
+            round_prosac_n[iter - round_first] = prosac_n;
+        }
+
+        /* Every thread runs a fixed share of the round. */
+#pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+        for (int i = 0; i < num_threads; ++i)
+        {
+            int const first = std::min(round_last,
+                round_first + i * RANSAC_ROUND_ITERATIONS);
+            int const last = std::min(round_last,
+                first + RANSAC_ROUND_ITERATIONS);
+            ransac_thread_iterations(*estimator, num_data, params, shared,
+                &round_prosac_n[first - round_first], first, last,
+                &states[i]);
+        }
+
+        /* Reduce the results in thread order. */
+        int last_iteration = round_first;
+        for (int i = 0; i < num_threads; ++i)
+        {
+            RansacThreadState<Model> const& state = states[i];
+            shared.num_iterations += state.summary.num_iterations;
+            shared.num_models += state.summary.num_models;
+            shared.num_rejected_models += state.summary.num_rejected_models;
+            shared.sum_delta += state.sum_delta;
+            summary.num_evaluations += state.summary.num_evaluations;
+            if (state.summary.num_iterations > 0)
+                last_iteration = std::min(round_last, round_first
+                    + i * RANSAC_ROUND_ITERATIONS
+                    + state.summary.num_iterations) - 1;
+            if (!state.has_best || state.best_count <= shared.best_count)
+                continue;
+            *best_model = state.best_model;
+            best_mask = state.best_mask;
+            shared.best_count = state.best_count;
+        }
+
+        /* Update the SPRT state and the iteration bound for the next round. */
+        double const models_per_sample = shared.num_iterations > 0
+            ? static_cast<double>(shared.num_models) / shared.num_iterations
+            : 1.0;
+        if (shared.num_rejected_models > 0)
+            shared.delta = std::max(1e-4, std::min(shared.sum_delta
+                / shared.num_rejected_models, 0.5 * shared.epsilon));
+        double const inlier_ratio = static_cast<double>(shared.best_count)
+            / static_cast<double>(num_data);
+        if (inlier_ratio > shared.epsilon)
+        {
+            shared.epsilon = std::min(inlier_ratio, 0.99);
+            shared.delta = std::min(shared.delta, 0.5 * shared.epsilon);
+        }
+        shared.threshold_a = compute_sprt_threshold(shared.epsilon,
+            shared.delta, params.sprt_model_cost, models_per_sample);
+        if (params.success_rate < 1.0 && shared.best_count > 0)
+            shared.max_iterations = std::min(shared.max_iterations,
+                std::max(last_iteration, compute_ransac_iterations(
+                inlier_ratio, m, params.success_rate)));
+    }
+
+    summary.num_iterations = shared.num_iterations;
+    summary.num_models = shared.num_models;
+    summary.num_rejected_models = shared.num_rejected_models;
+
+    /* Convert the best inlier mask to sorted indices. */
+    best_inliers->reserve(shared.best_count);
+    for (std::size_t i = 0; i < num_data; ++i)
+        if (best_mask[i / 64] & (uint64_t(1) << (i % 64)))
+            best_inliers->push_back(order[i]);
+    std::sort(best_inliers->begin(), best_inliers->end());
+    return summary;
+}
+
 SFM_NAMESPACE_END
 
 #endif /* SFM_RANSAC_HEADER */
@@ -7,102 +7,102 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
-#include <algorithm>
 #include <iostream>
-#include <set>
 #include <stdexcept>
 
-#include "util/system.h"
-#include "math/algo.h"
+#include "sfm/ransac.h"
+#include "sfm/ransac_kernels.h"
 #include "sfm/ransac_fundamental.h"
 
 SFM_NAMESPACE_BEGIN
 
-RansacFundamental::RansacFundamental (Options const& options)
-    : opts(options)
-{
-}
-
-void
-RansacFundamental::estimate (Correspondences2D2D const& matches, Result* result)
+namespace
 {
-    if (this->opts.verbose_output)
+    /* Normalized 8-point estimator for ransac_estimate(). */
+    struct FundamentalEstimator
     {
-        std::cout << "RANSAC-F: Running for " << this->opts.max_iterations
-            << " iterations, threshold " << this->opts.threshold
-            << "..." << std::endl;
-    }
+        typedef FundamentalMatrix Model;
+        static int const SAMPLE_SIZE = 8;
 
-    std::vector<int> inliers;
-    inliers.reserve(matches.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
-    {
-        FundamentalMatrix fundamental;
-        this->estimate_8_point(matches, &fundamental);
+        Correspondences2D2D const* matches;
+        CorrespondenceBuffer2D2D buffer;
 
-        this->find_inliers(matches, fundamental, &inliers);
-        if (inliers.size() > result->inliers.size())
+        void set_evaluation_order (std::vector<int> const& order)
         {
-            if (this->opts.verbose_output)
+            this->buffer.assign(*this->matches, order);
+        }
+
+        void compute_models (int const* sample,
+            std::vector<Model>* models) const
+        {
+            math::Matrix<double, 3, 8> pset1, pset2;
+            for (int i = 0; i < 8; ++i)
             {
-                std::cout << "RANSAC-F: Iteration " << iteration
-                    << ", inliers " << inliers.size() << " ("
-                    << (100.0 * inliers.size() / matches.size())
-                    << "%)" << std::endl;
+                Correspondence2D2D const& match = (*this->matches)[sample[i]];
+                pset1(0, i) = match.p1[0];
+                pset1(1, i) = match.p1[1];
+                pset1(2, i) = 1.0;
+                pset2(0, i) = match.p2[0];
+                pset2(1, i) = match.p2[1];
+                pset2(2, i) = 1.0;
             }
 
-            result->fundamental = fundamental;
+            /* Compute fundamental matrix using normalized 8-point. */
+            FundamentalMatrix fundamental;
+            sfm::fundamental_8_point(pset1, pset2, &fundamental);
+            sfm::enforce_fundamental_constraints(&fundamental);
+            models->push_back(fundamental);
+        }
 
-            std::swap(result->inliers, inliers);
-            inliers.reserve(matches.size());
+        void find_inliers (Model const* models, int num_models,
+            std::size_t begin, std::size_t end, double square_threshold,
+            uint64_t* const* masks, std::size_t* counts) const
+        {
+            sampson_inliers(models, num_models, this->buffer, begin, end,
+                square_threshold, masks, counts);
         }
-    }
+    };
+}
+
+RansacFundamental::RansacFundamental (Options const& options)
+    : opts(options)
+{
 }
 
 void
-RansacFundamental::estimate_8_point (Correspondences2D2D const& matches,
-    FundamentalMatrix* fundamental)
+RansacFundamental::estimate (Correspondences2D2D const& matches, Result* result)
 {
     if (matches.size() < 8)
         throw std::invalid_argument("At least 8 matches required");
 
-    /*
-     * Draw 8 random numbers in the interval [0, matches.size() - 1]
-     * without duplicates. This is done by keeping a set with drawn numbers.
-     */
-    std::set<int> result;
-    while (result.size() < 8)
-        result.insert(util::system::rand_int() % matches.size());
-
-    math::Matrix<double, 3, 8> pset1, pset2;
-    std::set<int>::const_iterator iter = result.begin();
-    for (int i = 0; i < 8; ++i, ++iter)
+    if (this->opts.verbose_output)
     {
-        Correspondence2D2D const& match = matches[*iter];
-        pset1(0, i) = match.p1[0];
-        pset1(1, i) = match.p1[1];
-        pset1(2, i) = 1.0;
-        pset2(0, i) = match.p2[0];
-        pset2(1, i) = match.p2[1];
-        pset2(2, i) = 1.0;
+        std::cout << "RANSAC-F: Running for up to "
+            << this->opts.max_iterations << " iterations, threshold "
+            << this->opts.threshold << "..." << std::endl;
     }
-    /* Compute fundamental matrix using normalized 8-point. */
-    sfm::fundamental_8_point(pset1, pset2, fundamental);
 
-    sfm::enforce_fundamental_constraints(fundamental);
-}
+    RansacParameters params;
+    params.max_iterations = this->opts.max_iterations;
+    params.square_threshold = MATH_POW2(this->opts.threshold);
+    params.success_rate = this->opts.success_rate;
+    params.prosac_sampling = this->opts.prosac_sampling;
+    params.sprt_scoring = this->opts.sprt_scoring;
+    params.num_threads = this->opts.num_threads;
+    params.seed = this->opts.seed;
 
-void
-RansacFundamental::find_inliers (Correspondences2D2D const& matches,
-    FundamentalMatrix const& fundamental, std::vector<int>* result)
-{
-    result->resize(0);
-    double const squared_thres = this->opts.threshold * this->opts.threshold;
-    for (std::size_t i = 0; i < matches.size(); ++i)
+    FundamentalEstimator estimator;
+    estimator.matches = &matches;
+    RansacSummary summary = ransac_estimate(&estimator, matches.size(),
+        params, &result->fundamental, &result->inliers);
+
+    if (this->opts.verbose_output)
     {
-        double error = sampson_distance(fundamental, matches[i]);
-        if (error < squared_thres)
-            result->push_back(i);
+        std::cout << "RANSAC-F: " << summary.num_iterations
+            << " iterations, " << summary.num_rejected_models
+            << " models rejected early, inliers " << result->inliers.size()
+            << " (" << (100.0 * result->inliers.size() / matches.size())
+            << "%)" << std::endl;
     }
 }
 
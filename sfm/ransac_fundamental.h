@@ -25,7 +25,8 @@ SFM_NAMESPACE_BEGIN
  * randomly selects N image correspondences (where N depends on the pose
  * algorithm) to estimate a fundamental matrix. Running for a number of
  * iterations, the fundamental matrix supporting the most matches is
- * returned as result.
+ * returned as result. The iterations are handled by ransac_estimate(),
+ * which terminates early once the inlier ratio is known well enough.
  */
 class RansacFundamental
 {
@@ -35,7 +36,7 @@ public:
         Options (void);
 
         /**
-         * The number of RANSAC iterations. Defaults to 1000.
+         * The maximum number of RANSAC iterations. Defaults to 1000.
          * Function compute_ransac_iterations() can be used to estimate the
          * required number of iterations for a certain RANSAC success rate.
          */
@@ -47,6 +48,37 @@ public:
          */
         double threshold;
 
+        /**
+         * Desired RANSAC success rate. The number of iterations is reduced
+         * to compute_ransac_iterations() of the best inlier ratio found so
+         * far. Set to 1 to always run 'max_iterations'. Defaults to 0.999.
+         */
+        double success_rate;
+
+        /**
+         * The matches are sorted by decreasing quality (e.g. by the Lowe
+         * ratio) and sampled PROSAC-style. Defaults to false.
+         */
+        bool prosac_sampling;
+
+        /**
+         * Reject bad models early with the sequential probability ratio
+         * test instead of scoring all matches. Defaults to true.
+         */
+        bool sprt_scoring;
+
+        /**
+         * Number of threads for the RANSAC iterations, 0 uses all cores.
+         * Defaults to 0.
+         */
+        int num_threads;
+
+        /**
+         * Seed for the per-thread random streams. The result is
+         * reproducible for a fixed seed and number of threads. Defaults to 0.
+         */
+        unsigned int seed;
+
         /**
          * Produce status messages on the console.
          */
@@ -72,12 +104,6 @@ public:
     explicit RansacFundamental (Options const& options);
     void estimate (Correspondences2D2D const& matches, Result* result);
 
-private:
-    void estimate_8_point (Correspondences2D2D const& matches,
-        FundamentalMatrix* fundamental);
-    void find_inliers (Correspondences2D2D const& matches,
-        FundamentalMatrix const& fundamental, std::vector<int>* result);
-
 private:
     Options opts;
 };
@@ -88,6 +114,11 @@ inline
 RansacFundamental::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.0015)
+    , success_rate(0.999)
+    , prosac_sampling(false)
+    , sprt_scoring(true)
+    , num_threads(0)
+    , seed(0)
     , verbose_output(false)
 {
 }
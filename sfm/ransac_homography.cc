@@ -7,18 +7,56 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
-#include <algorithm>
 #include <iostream>
-#include <set>
 #include <stdexcept>
 
 #include "util/system.h"
-#include "math/algo.h"
 #include "math/matrix_tools.h"
+#include "sfm/ransac.h"
+#include "sfm/ransac_kernels.h"
 #include "sfm/ransac_homography.h"
 
 SFM_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Four point DLT estimator for ransac_estimate(). */
+    struct HomographyEstimator
+    {
+        typedef HomographyMatrix Model;
+        static int const SAMPLE_SIZE = 4;
+
+        Correspondences2D2D const* matches;
+        CorrespondenceBuffer2D2D buffer;
+
+        void set_evaluation_order (std::vector<int> const& order)
+        {
+            this->buffer.assign(*this->matches, order);
+        }
+
+        void compute_models (int const* sample,
+            std::vector<Model>* models) const
+        {
+            Correspondences2D2D four_correspondeces(4);
+            for (std::size_t i = 0; i < 4; ++i)
+                four_correspondeces[i] = (*this->matches)[sample[i]];
+
+            HomographyMatrix homography;
+            sfm::homography_dlt(four_correspondeces, &homography);
+            homography /= homography[8];
+            models->push_back(homography);
+        }
+
+        void find_inliers (Model const* models, int num_models,
+            std::size_t begin, std::size_t end, double square_threshold,
+            uint64_t* const* masks, std::size_t* counts) const
+        {
+            transfer_inliers(models, num_models, this->buffer, begin, end,
+                square_threshold, masks, counts);
+        }
+    };
+}
+
 RansacHomography::RansacHomography (Options const& options)
     : opts(options)
 {
@@ -27,73 +65,36 @@ RansacHomography::RansacHomography (Options const& options)
 void
 RansacHomography::estimate (Correspondences2D2D const& matches, Result* result)
 {
-    if (this->opts.verbose_output)
-    {
-        std::cout << "RANSAC-H: Running for " << this->opts.max_iterations
-            << " iterations, threshold " << this->opts.threshold
-            << "..." << std::endl;
-    }
+    if (matches.size() < 4)
+        throw std::invalid_argument("At least 4 matches required");
 
-    std::vector<int> inliers;
-    inliers.reserve(matches.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
+    if (this->opts.verbose_output)
     {
-        HomographyMatrix homography;
-        this->compute_homography(matches, &homography);
-        this->evaluate_homography(matches, homography, &inliers);
-        if (inliers.size() > result->inliers.size())
-        {
-            if (this->opts.verbose_output)
-            {
-                std::cout << "RANSAC-H: Iteration " << iteration
-                    << ", inliers " << inliers.size() << " ("
-                    << (100.0 * inliers.size() / matches.size())
-                    << "%)" << std::endl;
-            }
-
-            result->homography = homography;
-            std::swap(result->inliers, inliers);
-            inliers.reserve(matches.size());
-        }
+        std::cout << "RANSAC-H: Running for up to "
+            << this->opts.max_iterations << " iterations, threshold "
+            << this->opts.threshold << "..." << std::endl;
     }
-}
 
-void
-RansacHomography::compute_homography (Correspondences2D2D const& matches,
-    HomographyMatrix* homography)
-{
-    if (matches.size() < 4)
-        throw std::invalid_argument("At least 4 matches required");
+    RansacParameters params;
+    params.max_iterations = this->opts.max_iterations;
+    params.square_threshold = MATH_POW2(this->opts.threshold);
+    params.success_rate = this->opts.success_rate;
+    params.prosac_sampling = this->opts.prosac_sampling;
+    params.sprt_scoring = this->opts.sprt_scoring;
+    params.seed = util::system::rand_int();
 
-    /*
-     * Draw 4 random numbers in the interval [0, matches.size() - 1]
-     * without duplicates. This is done by keeping a set with drawn numbers.
-     */
-    std::set<int> result;
-    while (result.size() < 4)
-        result.insert(util::system::rand_int() % matches.size());
-
-    Correspondences2D2D four_correspondeces(4);
-    std::set<int>::const_iterator iter = result.begin();
-    for (std::size_t i = 0; i < 4; ++i, ++iter)
-        four_correspondeces[i] = matches[*iter];
-
-    sfm::homography_dlt(four_correspondeces, homography);
-    *homography /= (*homography)[8];
-}
+    HomographyEstimator estimator;
+    estimator.matches = &matches;
+    RansacSummary summary = ransac_estimate(&estimator, matches.size(),
+        params, &result->homography, &result->inliers);
 
-void
-RansacHomography::evaluate_homography (Correspondences2D2D const& matches,
-    HomographyMatrix const& homography, std::vector<int>* inliers)
-{
-    double const square_threshold = MATH_POW2(this->opts.threshold);
-    inliers->resize(0);
-    for (std::size_t i = 0; i < matches.size(); ++i)
+    if (this->opts.verbose_output)
     {
-        Correspondence2D2D const& match = matches[i];
-        double error = sfm::symmetric_transfer_error(homography, match);
-        if (error < square_threshold)
-            inliers->push_back(i);
+        std::cout << "RANSAC-H: " << summary.num_iterations
+            << " iterations, " << summary.num_rejected_models
+            << " models rejected early, inliers " << result->inliers.size()
+            << " (" << (100.0 * result->inliers.size() / matches.size())
+            << "%)" << std::endl;
     }
 }
 
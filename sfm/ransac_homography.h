@@ -23,6 +23,7 @@ SFM_NAMESPACE_BEGIN
  * correspondences contaminated with outliers. The algorithm randomly selects 4
  * image correspondences to estimate a homography matrix. Running for a number
  * of iterations, the homography matrix supporting the most matches returned.
+ * The iterations are handled by ransac_estimate().
  */
 class RansacHomography
 {
@@ -32,7 +33,7 @@ public:
         Options (void);
 
         /**
-         * The number of RANSAC iterations. Defaults to 1000.
+         * The maximum number of RANSAC iterations. Defaults to 1000.
          * Function compute_ransac_iterations() can be used to estimate the
          * required number of iterations for a certain RANSAC success rate.
          */
@@ -44,6 +45,25 @@ public:
          */
         double threshold;
 
+        /**
+         * Desired RANSAC success rate. The number of iterations is reduced
+         * to compute_ransac_iterations() of the best inlier ratio found so
+         * far. Set to 1 to always run 'max_iterations'. Defaults to 0.999.
+         */
+        double success_rate;
+
+        /**
+         * The matches are sorted by decreasing quality (e.g. by the Lowe
+         * ratio) and sampled PROSAC-style. Defaults to false.
+         */
+        bool prosac_sampling;
+
+        /**
+         * Reject bad models early with the sequential probability ratio
+         * test instead of scoring all matches. Defaults to true.
+         */
+        bool sprt_scoring;
+
         /**
          * Produce status messages on the console.
          */
@@ -69,12 +89,6 @@ public:
     explicit RansacHomography (Options const& options);
     void estimate (Correspondences2D2D const& matches, Result* result);
 
-private:
-    void compute_homography (Correspondences2D2D const& matches,
-        HomographyMatrix* homography);
-    void evaluate_homography (Correspondences2D2D const& matches,
-        HomographyMatrix const& homography, std::vector<int>* inliers);
-
 private:
     Options opts;
 };
@@ -85,6 +99,9 @@ inline
 RansacHomography::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.005)
+    , success_rate(0.999)
+    , prosac_sampling(false)
+    , sprt_scoring(true)
     , verbose_output(false)
 {
 }
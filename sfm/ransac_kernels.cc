@@ -0,0 +1,377 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <algorithm>
+#include <bitset>
+#include <stdexcept>
+
+/*
+ * The AVX2 kernels are compiled with function level target attributes and
+ * selected at runtime, independent of the compiler flags. FMA is not
+ * enabled, which keeps the results identical to the scalar kernels.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define RANSAC_AVX2_KERNELS 1
+#   define RANSAC_TARGET(isa) __attribute__((target(isa)))
+#   include <immintrin.h>
+#else
+#   define RANSAC_AVX2_KERNELS 0
+#endif
+
+#include "util/system.h"
+#include "math/matrix_tools.h"
+#include "sfm/ransac_kernels.h"
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Sampson distance, same operations as sampson_distance(). */
+    struct SampsonKernel
+    {
+        typedef FundamentalMatrix Model;
+        typedef CorrespondenceBuffer2D2D Buffer;
+
+        double f[9];
+
+        void init (Model const& model)
+        {
+            std::copy(model.begin(), model.end(), this->f);
+        }
+
+        double error (Buffer const& b, std::size_t i) const
+        {
+            double const fx0 = b.x1[i] * f[0] + b.y1[i] * f[1] + f[2];
+            double const fx1 = b.x1[i] * f[3] + b.y1[i] * f[4] + f[5];
+            double const fx2 = b.x1[i] * f[6] + b.y1[i] * f[7] + f[8];
+            double const ftx0 = b.x2[i] * f[0] + b.y2[i] * f[3] + f[6];
+            double const ftx1 = b.x2[i] * f[1] + b.y2[i] * f[4] + f[7];
+            double const e = b.x2[i] * fx0 + b.y2[i] * fx1 + fx2;
+            return (e * e) / (fx0 * fx0 + fx1 * fx1
+                + ftx0 * ftx0 + ftx1 * ftx1);
+        }
+
+#if RANSAC_AVX2_KERNELS
+        struct Points
+        {
+            __m256d x1, y1, x2, y2;
+        };
+
+        RANSAC_TARGET("avx2")
+        static void load (Buffer const& b, std::size_t i, Points* p)
+        {
+            p->x1 = _mm256_load_pd(&b.x1[i]);
+            p->y1 = _mm256_load_pd(&b.y1[i]);
+            p->x2 = _mm256_load_pd(&b.x2[i]);
+            p->y2 = _mm256_load_pd(&b.y2[i]);
+        }
+
+        RANSAC_TARGET("avx2")
+        __m256d error (Points const& p) const
+        {
+            __m256d const fx0 = affine(p.x1, p.y1, f[0], f[1], f[2]);
+            __m256d const fx1 = affine(p.x1, p.y1, f[3], f[4], f[5]);
+            __m256d const fx2 = affine(p.x1, p.y1, f[6], f[7], f[8]);
+            __m256d const ftx0 = affine(p.x2, p.y2, f[0], f[3], f[6]);
+            __m256d const ftx1 = affine(p.x2, p.y2, f[1], f[4], f[7]);
+            __m256d const e = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(p.x2, fx0), _mm256_mul_pd(p.y2, fx1)), fx2);
+            __m256d den = _mm256_mul_pd(fx0, fx0);
+            den = _mm256_add_pd(den, _mm256_mul_pd(fx1, fx1));
+            den = _mm256_add_pd(den, _mm256_mul_pd(ftx0, ftx0));
+            den = _mm256_add_pd(den, _mm256_mul_pd(ftx1, ftx1));
+            return _mm256_div_pd(_mm256_mul_pd(e, e), den);
+        }
+
+        /* Computes x * a + y * b + c. */
+        RANSAC_TARGET("avx2")
+        static __m256d affine (__m256d x, __m256d y,
+            double a, double b, double c)
+        {
+            return _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(x, _mm256_set1_pd(a)),
+                _mm256_mul_pd(y, _mm256_set1_pd(b))), _mm256_set1_pd(c));
+        }
+#endif
+    };
+
+    /* Symmetric transfer error, see symmetric_transfer_error(). */
+    struct TransferKernel
+    {
+        typedef HomographyMatrix Model;
+        typedef CorrespondenceBuffer2D2D Buffer;
+
+        double h[9];
+        double hi[9];
+
+        void init (Model const& model)
+        {
+            HomographyMatrix const inv = math::matrix_inverse(model);
+            std::copy(model.begin(), model.end(), this->h);
+            std::copy(inv.begin(), inv.end(), this->hi);
+        }
+
+        double error (Buffer const& b, std::size_t i) const
+        {
+            double const wi = b.x2[i] * hi[6] + b.y2[i] * hi[7] + hi[8];
+            double const bx = (b.x2[i] * hi[0] + b.y2[i] * hi[1] + hi[2]) / wi
+                - b.x1[i];
+            double const by = (b.x2[i] * hi[3] + b.y2[i] * hi[4] + hi[5]) / wi
+                - b.y1[i];
+            double const w = b.x1[i] * h[6] + b.y1[i] * h[7] + h[8];
+            double const fx = (b.x1[i] * h[0] + b.y1[i] * h[1] + h[2]) / w
+                - b.x2[i];
+            double const fy = (b.x1[i] * h[3] + b.y1[i] * h[4] + h[5]) / w
+                - b.y2[i];
+            return 0.5 * ((bx * bx + by * by) + (fx * fx + fy * fy));
+        }
+
+#if RANSAC_AVX2_KERNELS
+        typedef SampsonKernel::Points Points;
+
+        RANSAC_TARGET("avx2")
+        static void load (Buffer const& b, std::size_t i, Points* p)
+        {
+            SampsonKernel::load(b, i, p);
+        }
+
+        RANSAC_TARGET("avx2")
+        __m256d error (Points const& p) const
+        {
+            __m256d const wi = SampsonKernel::affine(p.x2, p.y2,
+                hi[6], hi[7], hi[8]);
+            __m256d const bx = _mm256_sub_pd(_mm256_div_pd(
+                SampsonKernel::affine(p.x2, p.y2, hi[0], hi[1], hi[2]), wi),
+                p.x1);
+            __m256d const by = _mm256_sub_pd(_mm256_div_pd(
+                SampsonKernel::affine(p.x2, p.y2, hi[3], hi[4], hi[5]), wi),
+                p.y1);
+            __m256d const w = SampsonKernel::affine(p.x1, p.y1,
+                h[6], h[7], h[8]);
+            __m256d const fx = _mm256_sub_pd(_mm256_div_pd(
+                SampsonKernel::affine(p.x1, p.y1, h[0], h[1], h[2]), w),
+                p.x2);
+            __m256d const fy = _mm256_sub_pd(_mm256_div_pd(
+                SampsonKernel::affine(p.x1, p.y1, h[3], h[4], h[5]), w),
+                p.y2);
+            __m256d const eb = _mm256_add_pd(_mm256_mul_pd(bx, bx),
+                _mm256_mul_pd(by, by));
+            __m256d const ef = _mm256_add_pd(_mm256_mul_pd(fx, fx),
+                _mm256_mul_pd(fy, fy));
+            return _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_add_pd(eb, ef));
+        }
+#endif
+    };
+
+    /* Squared reprojection error of a 3x4 projection matrix. */
+    struct ReprojectionKernel
+    {
+        typedef math::Matrix<double, 3, 4> Model;
+        typedef CorrespondenceBuffer2D3D Buffer;
+
+        double p[12];
+
+        void init (Model const& model)
+        {
+            std::copy(model.begin(), model.end(), this->p);
+        }
+
+        double error (Buffer const& b, std::size_t i) const
+        {
+            double const px = b.x[i] * p[0] + b.y[i] * p[1]
+                + b.z[i] * p[2] + p[3];
+            double const py = b.x[i] * p[4] + b.y[i] * p[5]
+                + b.z[i] * p[6] + p[7];
+            double const pz = b.x[i] * p[8] + b.y[i] * p[9]
+                + b.z[i] * p[10] + p[11];
+            double const ex = px / pz - b.u[i];
+            double const ey = py / pz - b.v[i];
+            return ex * ex + ey * ey;
+        }
+
+#if RANSAC_AVX2_KERNELS
+        struct Points
+        {
+            __m256d x, y, z, u, v;
+        };
+
+        RANSAC_TARGET("avx2")
+        static void load (Buffer const& b, std::size_t i, Points* pts)
+        {
+            pts->x = _mm256_load_pd(&b.x[i]);
+            pts->y = _mm256_load_pd(&b.y[i]);
+            pts->z = _mm256_load_pd(&b.z[i]);
+            pts->u = _mm256_load_pd(&b.u[i]);
+            pts->v = _mm256_load_pd(&b.v[i]);
+        }
+
+        RANSAC_TARGET("avx2")
+        __m256d error (Points const& pts) const
+        {
+            __m256d const px = row(pts, p + 0);
+            __m256d const py = row(pts, p + 4);
+            __m256d const pz = row(pts, p + 8);
+            __m256d const ex = _mm256_sub_pd(_mm256_div_pd(px, pz), pts.u);
+            __m256d const ey = _mm256_sub_pd(_mm256_div_pd(py, pz), pts.v);
+            return _mm256_add_pd(_mm256_mul_pd(ex, ex),
+                _mm256_mul_pd(ey, ey));
+        }
+
+        RANSAC_TARGET("avx2")
+        static __m256d row (Points const& pts, double const* r)
+        {
+            __m256d result = _mm256_mul_pd(pts.x, _mm256_set1_pd(r[0]));
+            result = _mm256_add_pd(result,
+                _mm256_mul_pd(pts.y, _mm256_set1_pd(r[1])));
+            result = _mm256_add_pd(result,
+                _mm256_mul_pd(pts.z, _mm256_set1_pd(r[2])));
+            return _mm256_add_pd(result, _mm256_set1_pd(r[3]));
+        }
+#endif
+    };
+
+    /* Scalar inlier test of a range, one mask word at a time. */
+    template <typename Kernel>
+    void
+    score_scalar (Kernel const* kernels, int num_models,
+        typename Kernel::Buffer const& buffer, std::size_t begin,
+        std::size_t end, double square_threshold,
+        uint64_t* const* masks, std::size_t* counts)
+    {
+        for (std::size_t base = begin; base < end; base += 64)
+        {
+            std::size_t const word_end = std::min(base + 64, end);
+            uint64_t words[RANSAC_MAX_BATCH_MODELS] = { 0, 0, 0, 0 };
+            for (std::size_t i = base; i < word_end; ++i)
+                for (int k = 0; k < num_models; ++k)
+                    if (kernels[k].error(buffer, i) < square_threshold)
+                        words[k] |= uint64_t(1) << (i - base);
+
+            for (int k = 0; k < num_models; ++k)
+            {
+                masks[k][base / 64] = words[k];
+                counts[k] += std::bitset<64>(words[k]).count();
+            }
+        }
+    }
+
+#if RANSAC_AVX2_KERNELS
+    /* AVX2 inlier test, four correspondences shared by all models. */
+    template <typename Kernel>
+    RANSAC_TARGET("avx2")
+    void
+    score_avx2 (Kernel const* kernels, int num_models,
+        typename Kernel::Buffer const& buffer, std::size_t begin,
+        std::size_t end, double square_threshold,
+        uint64_t* const* masks, std::size_t* counts)
+    {
+        __m256d const threshold = _mm256_set1_pd(square_threshold);
+        for (std::size_t base = begin; base < end; base += 64)
+        {
+            std::size_t const word_end = std::min(base + 64, end);
+            uint64_t words[RANSAC_MAX_BATCH_MODELS] = { 0, 0, 0, 0 };
+            std::size_t i = base;
+            for (; i + 4 <= word_end; i += 4)
+            {
+                typename Kernel::Points points;
+                Kernel::load(buffer, i, &points);
+                for (int k = 0; k < num_models; ++k)
+                {
+                    __m256d const inlier = _mm256_cmp_pd(
+                        kernels[k].error(points), threshold, _CMP_LT_OQ);
+                    words[k] |= uint64_t(_mm256_movemask_pd(inlier))
+                        << (i - base);
+                }
+            }
+            for (; i < word_end; ++i)
+                for (int k = 0; k < num_models; ++k)
+                    if (kernels[k].error(buffer, i) < square_threshold)
+                        words[k] |= uint64_t(1) << (i - base);
+
+            for (int k = 0; k < num_models; ++k)
+            {
+                masks[k][base / 64] = words[k];
+                counts[k] += std::bitset<64>(words[k]).count();
+            }
+        }
+    }
+#endif
+
+    template <typename Kernel>
+    void
+    score (typename Kernel::Model const* models, int num_models,
+        typename Kernel::Buffer const& buffer, std::size_t begin,
+        std::size_t end, double square_threshold,
+        uint64_t* const* masks, std::size_t* counts)
+    {
+        if (num_models < 0 || num_models > RANSAC_MAX_BATCH_MODELS)
+            throw std::invalid_argument("Invalid number of models");
+        if (begin % 64 != 0 || end > buffer.size())
+            throw std::invalid_argument("Invalid correspondence range");
+
+        Kernel kernels[RANSAC_MAX_BATCH_MODELS];
+        for (int k = 0; k < num_models; ++k)
+        {
+            kernels[k].init(models[k]);
+            counts[k] = 0;
+        }
+
+#if RANSAC_AVX2_KERNELS
+        if (ransac_kernels_use_avx2())
+        {
+            score_avx2(kernels, num_models, buffer, begin, end,
+                square_threshold, masks, counts);
+            return;
+        }
+#endif
+        score_scalar(kernels, num_models, buffer, begin, end,
+            square_threshold, masks, counts);
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+sampson_inliers (FundamentalMatrix const* models, int num_models,
+    CorrespondenceBuffer2D2D const& buffer, std::size_t begin,
+    std::size_t end, double square_threshold,
+    uint64_t* const* masks, std::size_t* counts)
+{
+    score<SampsonKernel>(models, num_models, buffer, begin, end,
+        square_threshold, masks, counts);
+}
+
+void
+transfer_inliers (HomographyMatrix const* models, int num_models,
+    CorrespondenceBuffer2D2D const& buffer, std::size_t begin,
+    std::size_t end, double square_threshold,
+    uint64_t* const* masks, std::size_t* counts)
+{
+    score<TransferKernel>(models, num_models, buffer, begin, end,
+        square_threshold, masks, counts);
+}
+
+void
+reprojection_inliers (math::Matrix<double, 3, 4> const* projections,
+    int num_models, CorrespondenceBuffer2D3D const& buffer,
+    std::size_t begin, std::size_t end, double square_threshold,
+    uint64_t* const* masks, std::size_t* counts)
+{
+    score<ReprojectionKernel>(projections, num_models, buffer, begin, end,
+        square_threshold, masks, counts);
+}
+
+bool
+ransac_kernels_use_avx2 (void)
+{
+#if RANSAC_AVX2_KERNELS
+    static bool const has_avx2 = util::system::cpu_has_avx2();
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+SFM_NAMESPACE_END
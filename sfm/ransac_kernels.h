@@ -0,0 +1,74 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SFM_RANSAC_KERNELS_HEADER
+#define SFM_RANSAC_KERNELS_HEADER
+
+#include <cstddef>
+#include <cstdint>
+
+#include "math/matrix.h"
+#include "sfm/correspondence.h"
+#include "sfm/defines.h"
+#include "sfm/fundamental.h"
+#include "sfm/homography.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Batch inlier tests for RANSAC on structure-of-arrays correspondences.
+ *
+ * Every kernel scores up to RANSAC_MAX_BATCH_MODELS hypotheses against the
+ * correspondences in [begin, end) of a buffer, loading each correspondence
+ * once for all hypotheses. The result is an inlier bitmask per hypothesis,
+ * bit i of word i / 64 is set if correspondence i is an inlier, and the
+ * number of inliers in the range. 'begin' must be a multiple of 64, only
+ * the mask words covering the range are written.
+ *
+ * The kernels use AVX2 if supported by the CPU (selected at runtime) and
+ * give the same results as the scalar code.
+ */
+int const RANSAC_MAX_BATCH_MODELS = 4;
+
+/** Returns the number of 64 bit words for an inlier mask. */
+std::size_t
+inlier_mask_words (std::size_t num_correspondences);
+
+/** Inlier test on the Sampson distance, see sampson_distance(). */
+void
+sampson_inliers (FundamentalMatrix const* models, int num_models,
+    CorrespondenceBuffer2D2D const& buffer, std::size_t begin,
+    std::size_t end, double square_threshold,
+    uint64_t* const* masks, std::size_t* counts);
+
+/** Inlier test on the symmetric transfer error of a homography. */
+void
+transfer_inliers (HomographyMatrix const* models, int num_models,
+    CorrespondenceBuffer2D2D const& buffer, std::size_t begin,
+    std::size_t end, double square_threshold,
+    uint64_t* const* masks, std::size_t* counts);
+
+/** Inlier test on the squared reprojection error of P = K [R|t]. */
+void
+reprojection_inliers (math::Matrix<double, 3, 4> const* projections,
+    int num_models, CorrespondenceBuffer2D3D const& buffer,
+    std::size_t begin, std::size_t end, double square_threshold,
+    uint64_t* const* masks, std::size_t* counts);
+
+/** Returns true if the kernels run with AVX2. */
+bool
+ransac_kernels_use_avx2 (void);
+
+/* ------------------------ Implementation ------------------------ */
+
+inline std::size_t
+inlier_mask_words (std::size_t num_correspondences)
+{
+    return (num_correspondences + 63) / 64;
+}
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_RANSAC_KERNELS_HEADER */
@@ -26,7 +26,8 @@ SFM_NAMESPACE_BEGIN
  * The rotation and translation of a camera is determined from a set of
  * 2D image to 3D point correspondences contaminated with outliers. The
  * algorithm iteratively selects 3 random correspondences and returns the
- * result which led to the most inliers.
+ * result which led to the most inliers. The iterations are handled by
+ * ransac_estimate().
  *
  * The input 2D image coordinates, the input K-matrix and the threshold
  * in the options must be consistent. For example, if the 2D image coordinates
@@ -42,7 +43,7 @@ public:
         Options (void);
 
         /**
-         * The number of RANSAC iterations. Defaults to 1000.
+         * The maximum number of RANSAC iterations. Defaults to 1000.
          * Function compute_ransac_iterations() can be used to estimate the
          * required number of iterations for a certain RANSAC success rate.
          */
@@ -54,6 +55,37 @@ public:
          */
         double threshold;
 
+        /**
+         * Desired RANSAC success rate. The number of iterations is reduced
+         * to compute_ransac_iterations() of the best inlier ratio found so
+         * far. Set to 1 to always run 'max_iterations'. Defaults to 0.999.
+         */
+        double success_rate;
+
+        /**
+         * The matches are sorted by decreasing quality (e.g. by the Lowe
+         * ratio) and sampled PROSAC-style. Defaults to false.
+         */
+        bool prosac_sampling;
+
+        /**
+         * Reject bad models early with the sequential probability ratio
+         * test instead of scoring all matches. Defaults to true.
+         */
+        bool sprt_scoring;
+
+        /**
+         * Number of threads for the RANSAC iterations, 0 uses all cores.
+         * Defaults to 0.
+         */
+        int num_threads;
+
+        /**
+         * Seed for the per-thread random streams. The result is
+         * reproducible for a fixed seed and number of threads. Defaults to 0.
+         */
+        unsigned int seed;
+
         /**
          * Produce status messages on the console.
          */
@@ -76,19 +108,6 @@ public:
         math::Matrix<double, 3, 3> const& k_matrix,
         Result* result) const;
 
-private:
-    typedef math::Matrix<double, 3, 4> Pose;
-    typedef std::vector<Pose> PutativePoses;
-
-private:
-    void compute_p3p (Correspondences2D3D const& corresp,
-        math::Matrix<double, 3, 3> const& inv_k_matrix,
-        PutativePoses* poses) const;
-
-    void find_inliers (Correspondences2D3D const& corresp,
-        math::Matrix<double, 3, 3> const& k_matrix,
-        Pose const& pose, std::vector<int>* inliers) const;
-
 private:
     Options opts;
 };
@@ -99,6 +118,11 @@ inline
 RansacPoseP3P::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.005)
+    , success_rate(0.999)
+    , prosac_sampling(false)
+    , sprt_scoring(true)
+    , num_threads(0)
+    , seed(0)
     , verbose_output(false)
 {
 }
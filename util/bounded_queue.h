@@ -0,0 +1,97 @@
+/*
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_BOUNDED_QUEUE_HEADER
+#define UTIL_BOUNDED_QUEUE_HEADER
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "util/defines.h"
+
+UTIL_NAMESPACE_BEGIN
+
+/**
+ * Thread-safe FIFO queue with a fixed capacity to connect pipeline stages.
+ * The operations never block: a producer that finds the queue full is
+ * expected to consume an item itself, which applies back pressure without
+ * the risk of deadlocks if all threads are producers and consumers.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue (std::size_t capacity);
+
+    /** Appends the item unless the queue is full. Returns success. */
+    bool try_push (T&& item);
+
+    /** Removes the oldest item unless the queue is empty. Returns success. */
+    bool try_pop (T* item);
+
+    /** Returns the number of queued items. */
+    std::size_t size (void) const;
+
+    /** Returns the capacity of the queue. */
+    std::size_t capacity (void) const;
+
+private:
+    std::size_t max_size;
+    std::deque<T> items;
+    mutable std::mutex mutex;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+template <typename T>
+inline
+BoundedQueue<T>::BoundedQueue (std::size_t capacity)
+    : max_size(capacity)
+{
+}
+
+template <typename T>
+inline bool
+BoundedQueue<T>::try_push (T&& item)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->items.size() >= this->max_size)
+        return false;
+    this->items.push_back(std::move(item));
+    return true;
+}
+
+template <typename T>
+inline bool
+BoundedQueue<T>::try_pop (T* item)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->items.empty())
+        return false;
+    *item = std::move(this->items.front());
+    this->items.pop_front();
+    return true;
+}
+
+template <typename T>
+inline std::size_t
+BoundedQueue<T>::size (void) const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->items.size();
+}
+
+template <typename T>
+inline std::size_t
+BoundedQueue<T>::capacity (void) const
+{
+    return this->max_size;
+}
+
+UTIL_NAMESPACE_END
+
+#endif /* UTIL_BOUNDED_QUEUE_HEADER */
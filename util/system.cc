@@ -69,5 +69,53 @@ print_stack_trace (void)
     ::exit(1);
 }
 
+/* ---------------------------------------------------------------- */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define UTIL_X86_CPU_DETECTION 1
+#else
+#   define UTIL_X86_CPU_DETECTION 0
+#endif
+
+bool
+cpu_has_sse3 (void)
+{
+#if UTIL_X86_CPU_DETECTION
+    static bool const result = __builtin_cpu_supports("sse3");
+    return result;
+#else
+    return false;
+#endif
+}
+
+/* ---------------------------------------------------------------- */
+
+bool
+cpu_has_avx2 (void)
+{
+#if UTIL_X86_CPU_DETECTION
+    /* Also checks that the OS saves the YMM registers. */
+    static bool const result = __builtin_cpu_supports("avx2");
+    return result;
+#else
+    return false;
+#endif
+}
+
+/* ---------------------------------------------------------------- */
+
+bool
+cpu_has_avx512_vnni (void)
+{
+#if UTIL_X86_CPU_DETECTION
+    static bool const result = __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512vnni");
+    return result;
+#else
+    return false;
+#endif
+}
+
 UTIL_SYSTEM_NAMESPACE_END
 UTIL_NAMESPACE_END
@@ -64,6 +64,20 @@ void signal_segfault_handler (int code);
 /** Prints a stack trace. */
 void print_stack_trace (void);
 
+/*
+ * ------------------------- CPU capabilities ------------------------
+ */
+
+/**
+ * Runtime checks for instruction set extensions of the host CPU. These
+ * allow selecting vectorized code paths independent of the compiler flags.
+ * All checks return false on non-x86 platforms.
+ */
+bool cpu_has_sse3 (void);
+bool cpu_has_avx2 (void);
+/** AVX-512 foundation, byte/word instructions and VNNI dot products. */
+bool cpu_has_avx512_vnni (void);
+
 /*
  * ----------------------- Endian conversions ------------------------
  */